@@ -0,0 +1,296 @@
+/*
+ * align_bench.cc
+ *
+ *  Microbenchmark of the alignment kernels behind AlignmentFunctionType (Myers/edlib, SeqAn and Opal wrappers).
+ *  Every kernel is run over a grid of query lengths, target lengths, error rates and band widths, on pairs simulated
+ *  from a fixed seed. The throughput is reported in DP cells per second, and the edit distance of every alignment is
+ *  checked against the exact one computed by the Myers kernel of the same alignment mode.
+ *
+ *  Build and run with: make bench-align BENCH_ALIGN_ARGS="--query-lens 1000,5000 --errors 0.05,0.15 --json align.json"
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <omp.h>
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "read_simulator.h"
+#include "alignment/alignment_wrappers.h"
+#include "alignment/cigargen.h"
+#include "log_system/log_system.h"
+#include "program_parameters.h"
+#include "argparser.h"
+
+struct AlignBenchParameters {
+  int64_t seed = 12345;
+  std::string query_lengths = "200,1000,5000";
+  std::string target_ratios = "1.0,1.1";       // Target length relative to the query length.
+  std::string error_rates = "0.01,0.05,0.15";
+  std::string band_widths = "-1,100,500";      // -1 is unbanded.
+  std::string kernels = "all";
+  std::string scoring = "edit";
+  int64_t num_pairs = 5;
+  double min_time = 0.2;
+  std::string json_path = "";
+};
+
+struct AlignmentKernel {
+  const char *name;
+  int mode;                         // ALIGNMENT_TYPE_*.
+  AlignmentFunctionType function;
+  bool uses_band;                   // Kernels which ignore the band width are run only once per grid cell.
+  bool is_reference;                // Gives the exact edit distance of its mode.
+};
+
+// Myers kernels compute the exact edit distance, so they are the reference of their mode and are listed first.
+static const AlignmentKernel kAlignmentKernels[] = {
+  {"myers_hw", ALIGNMENT_TYPE_HW, MyersSemiglobalWrapper, false, true},
+  {"seqan_hw", ALIGNMENT_TYPE_HW, SeqAnSemiglobalWrapper, true, false},
+  {"seqan_myers_hw", ALIGNMENT_TYPE_HW, SeqAnSemiglobalWrapperWithMyersLocalization, true, false},
+  {"myers_nw", ALIGNMENT_TYPE_NW, MyersNWWrapper, false, true},
+  {"seqan_nw", ALIGNMENT_TYPE_NW, SeqAnNWWrapper, true, false},
+#ifndef RELEASE_VERSION
+  {"opal_nw", ALIGNMENT_TYPE_NW, OpalNWWrapper, false, false},
+#endif
+  {"myers_shw", ALIGNMENT_TYPE_SHW, MyersSHWWrapper, false, true},
+  {"seqan_shw", ALIGNMENT_TYPE_SHW, SeqAnSHWWrapper, true, false},
+#ifndef RELEASE_VERSION
+  {"opal_shw", ALIGNMENT_TYPE_SHW, OpalSHWWrapper, false, false},
+#endif
+};
+static const int64_t kNumAlignmentKernels = sizeof(kAlignmentKernels) / sizeof(kAlignmentKernels[0]);
+
+struct KernelResult {
+  std::string kernel;
+  std::string mode;
+  int64_t query_length = 0;
+  int64_t target_length = 0;
+  double error_rate = 0.0;
+  int64_t band_width = -1;
+  int64_t num_alignments = 0;
+  int64_t num_failed = 0;           // Return code other than ALIGNMENT_GOOD, or an alignment inconsistent with the sequences.
+  int64_t num_agree = 0;            // Edit distance equal to the reference kernel's.
+  int64_t num_checked = 0;
+  double cells = 0.0;
+  double time = 0.0;
+};
+
+static const char* AlignmentModeName(int mode) {
+  if (mode == ALIGNMENT_TYPE_HW) return "hw";
+  if (mode == ALIGNMENT_TYPE_NW) return "nw";
+  return "shw";
+}
+
+template <typename T>
+int ParseList(std::string list, std::vector<T> &ret) {
+  ret.clear();
+  std::replace(list.begin(), list.end(), ',', ' ');
+  std::istringstream ss(list);
+  T value;
+  while (ss >> value) { ret.push_back(value); }
+  return (ret.size() > 0) ? 0 : 1;
+}
+
+// Counts the edits of the alignment by walking it over the sequences, since the kernels do not all report the same
+// score (Opal returns the alignment score). Returns -1 if the alignment does not consume the query exactly, or if it
+// goes out of the target.
+int64_t AlignmentEditDistance(const std::string &query, const std::string &target, int64_t target_start, const std::vector<unsigned char> &alignment) {
+  int64_t query_pos = 0, target_pos = target_start, edit_distance = 0;
+  if (target_start < 0) {
+    return -1;
+  }
+  for (int64_t i = 0; i < alignment.size(); i++) {
+    unsigned char op = alignment[i];
+    if (op == EDLIB_M || op == EDLIB_X) {
+      if (query_pos >= query.size() || target_pos >= target.size()) { return -1; }
+      edit_distance += (query[query_pos] != target[target_pos]) ? 1 : 0;
+      query_pos += 1;
+      target_pos += 1;
+    } else if (op == EDLIB_I || op == EDLIB_S) {
+      edit_distance += 1;
+      query_pos += 1;
+    } else if (op == EDLIB_D) {
+      edit_distance += 1;
+      target_pos += 1;
+    }
+  }
+  if (query_pos != query.size() || target_pos > target.size()) {
+    return -1;
+  }
+  return edit_distance;
+}
+
+void RunKernel(const AlignmentKernel &kernel, const std::vector<std::string> &queries, const std::vector<std::string> &targets, int64_t band_width,
+               const AlignBenchParameters &bench, const std::vector<int64_t> &scores, const std::vector<int64_t> *reference_distances,
+               std::vector<int64_t> *ret_distances, KernelResult *result) {
+  result->kernel = kernel.name;
+  result->mode = AlignmentModeName(kernel.mode);
+  result->band_width = (kernel.uses_band == true) ? band_width : -1;
+  ret_distances->assign(queries.size(), -1);
+
+  // The first round is checked, and the rounds are repeated until the minimum time is reached.
+  std::vector<unsigned char> alignment;
+  double time_start = omp_get_wtime();
+  for (int64_t round = 0; round == 0 || (omp_get_wtime() - time_start) < bench.min_time; round++) {
+    for (int64_t i = 0; i < queries.size(); i++) {
+      int64_t start = 0, end = 0, score = 0;
+      alignment.clear();
+      int ret = kernel.function((const int8_t *) queries[i].c_str(), queries[i].size(), (const int8_t *) targets[i].c_str(), targets[i].size(),
+                                band_width, scores[0], scores[1], scores[2], scores[3], scores[4], &start, &end, &score, alignment);
+      result->num_alignments += 1;
+      result->cells += ((double) queries[i].size()) * targets[i].size();
+      if (round > 0) {
+        continue;
+      }
+      int64_t edit_distance = (ret == ALIGNMENT_GOOD) ? AlignmentEditDistance(queries[i], targets[i], start, alignment) : -1;
+      (*ret_distances)[i] = edit_distance;
+      if (edit_distance < 0) {
+        result->num_failed += 1;
+      } else if (reference_distances != NULL && (*reference_distances)[i] >= 0) {
+        result->num_checked += 1;
+        result->num_agree += (edit_distance == (*reference_distances)[i]) ? 1 : 0;
+      }
+    }
+  }
+  result->time = omp_get_wtime() - time_start;
+}
+
+void WriteAlignBenchJSON(FILE *fp, const AlignBenchParameters &bench, const std::vector<KernelResult> &results) {
+  fprintf (fp, "{\n");
+  fprintf (fp, "  \"config\": {\"seed\": %ld, \"num_pairs\": %ld, \"min_time_s\": %.3f, \"scoring\": \"%s\"},\n", bench.seed, bench.num_pairs, bench.min_time, bench.scoring.c_str());
+  fprintf (fp, "  \"results\": [\n");
+  for (int64_t i = 0; i < results.size(); i++) {
+    const KernelResult &r = results[i];
+    fprintf (fp, "    {\"kernel\": \"%s\", \"mode\": \"%s\", \"query_length\": %ld, \"target_length\": %ld, \"error_rate\": %.4f, \"band_width\": %ld, "
+                 "\"num_alignments\": %ld, \"time_s\": %.6f, \"us_per_alignment\": %.3f, \"cells_per_s\": %.1f, \"num_failed\": %ld, \"num_checked\": %ld, \"num_agree\": %ld}%s\n",
+             r.kernel.c_str(), r.mode.c_str(), r.query_length, r.target_length, r.error_rate, r.band_width,
+             r.num_alignments, r.time, (r.num_alignments > 0) ? (r.time * 1e6 / r.num_alignments) : 0.0, (r.time > 0.0) ? (r.cells / r.time) : 0.0,
+             r.num_failed, r.num_checked, r.num_agree, ((i + 1) < results.size()) ? "," : "");
+  }
+  fprintf (fp, "  ]\n");
+  fprintf (fp, "}\n");
+}
+
+int ProcessArgsAlignBench(int argc, char **argv, AlignBenchParameters *bench) {
+  ArgumentParser argparser;
+  argparser.AddArgument(&bench->seed, VALUE_TYPE_INT64, "", "seed", "12345", "Seed of the simulated sequence pairs.", 0, "Grid options");
+  argparser.AddArgument(&bench->query_lengths, VALUE_TYPE_STRING, "", "query-lens", "200,1000,5000", "Comma separated query lengths.", 0, "Grid options");
+  argparser.AddArgument(&bench->target_ratios, VALUE_TYPE_STRING, "", "target-ratios", "1.0,1.1", "Comma separated target lengths, relative to the query length. The query is simulated from the beginning of the target.", 0, "Grid options");
+  argparser.AddArgument(&bench->error_rates, VALUE_TYPE_STRING, "", "errors", "0.01,0.05,0.15", "Comma separated error rates, split equally between mismatches, insertions and deletions.", 0, "Grid options");
+  argparser.AddArgument(&bench->band_widths, VALUE_TYPE_STRING, "", "bands", "-1,100,500", "Comma separated band widths. -1 is unbanded. Kernels which do not use a band are run only once per cell.", 0, "Grid options");
+  argparser.AddArgument(&bench->num_pairs, VALUE_TYPE_INT64, "", "pairs", "5", "Number of sequence pairs per grid cell.", 0, "Grid options");
+  argparser.AddArgument(&bench->kernels, VALUE_TYPE_STRING, "", "kernels", "all", "Comma separated kernels to run, or 'all'. The Myers kernel of a mode is always run, as the reference.", 0, "Run options");
+  argparser.AddArgument(&bench->scoring, VALUE_TYPE_STRING, "", "scoring", "edit", "Scores passed to the kernels:\n edit     - unit edit distance, all kernels must agree with Myers.\n graphmap - the defaults of GraphMap, the edit distances of the other kernels can be larger.", 0, "Run options");
+  argparser.AddArgument(&bench->min_time, VALUE_TYPE_DOUBLE, "", "min-time", "0.2", "Minimum time in seconds to run each kernel on a grid cell.", 0, "Run options");
+  argparser.AddArgument(&bench->json_path, VALUE_TYPE_STRING, "", "json", "", "Path of the JSON report. If not specified, it is written to stdout.", 0, "Run options");
+  argparser.set_program_name(std::string(argv[0]));
+
+  argparser.ProcessArguments(argc, argv);
+
+  std::vector<double> dummy;
+  if (ParseList(bench->query_lengths, dummy) || ParseList(bench->target_ratios, dummy) || ParseList(bench->error_rates, dummy) || ParseList(bench->band_widths, dummy)) {
+    fprintf (stderr, "The grid lists need to be comma separated numbers.\n\n");
+    fprintf (stderr, "%s", argparser.VerboseUsage().c_str());
+    return 1;
+  }
+  if (bench->scoring != "edit" && bench->scoring != "graphmap") {
+    fprintf (stderr, "Unknown scoring '%s'.\n\n", bench->scoring.c_str());
+    fprintf (stderr, "%s", argparser.VerboseUsage().c_str());
+    return 1;
+  }
+  if (bench->num_pairs <= 0) {
+    fprintf (stderr, "The number of pairs needs to be > 0.\n\n");
+    fprintf (stderr, "%s", argparser.VerboseUsage().c_str());
+    return 1;
+  }
+
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  AlignBenchParameters bench;
+  if (ProcessArgsAlignBench(argc, argv, &bench)) {
+    return 1;
+  }
+  LogSystem::GetInstance().SetProgramVerboseLevelFromInt(0);
+
+  std::vector<int64_t> query_lengths, band_widths;
+  std::vector<double> target_ratios, error_rates;
+  ParseList(bench.query_lengths, query_lengths);
+  ParseList(bench.target_ratios, target_ratios);
+  ParseList(bench.error_rates, error_rates);
+  ParseList(bench.band_widths, band_widths);
+
+  std::vector<std::string> selected;
+  ParseList(bench.kernels, selected);
+  bool run_all = (bench.kernels == "all");
+
+  // Scores in the order of the kernel arguments: match, mex, mismatch, gap open, gap extend. Penalties are passed as
+  // negative values, the same as in the alignment module.
+  ProgramParameters defaults;
+  std::vector<int64_t> scores = {0, 0, -1, 0, -1};
+  if (bench.scoring == "graphmap") {
+    scores = {defaults.match_score, defaults.mex_score, -defaults.mismatch_penalty, -defaults.gap_open_penalty, -defaults.gap_extend_penalty};
+  }
+
+  ReadSimulator simulator((uint64_t) bench.seed);
+  std::vector<KernelResult> results;
+
+  for (int64_t qi = 0; qi < query_lengths.size(); qi++) {
+    for (int64_t ti = 0; ti < target_ratios.size(); ti++) {
+      for (int64_t ei = 0; ei < error_rates.size(); ei++) {
+        int64_t target_length = std::max((int64_t) 1, (int64_t) (query_lengths[qi] * target_ratios[ti]));
+        ErrorProfile profile = UniformErrorProfile(error_rates[ei]);
+        std::vector<std::string> queries, targets;
+        for (int64_t i = 0; i < bench.num_pairs; i++) {
+          targets.push_back(simulator.GenerateSequence(target_length));
+          queries.push_back(simulator.ApplyErrors(targets.back().substr(0, query_lengths[qi]), profile));
+        }
+
+        // Edit distances of the reference kernel of each mode, from the unbanded run.
+        std::vector<std::vector<int64_t> > reference_distances(3);
+        std::vector<int64_t> distances;
+
+        for (int64_t bi = 0; bi < band_widths.size(); bi++) {
+          for (int64_t k = 0; k < kNumAlignmentKernels; k++) {
+            const AlignmentKernel &kernel = kAlignmentKernels[k];
+            if (kernel.uses_band == false && bi > 0) { continue; }
+            if (kernel.is_reference == false && run_all == false && std::find(selected.begin(), selected.end(), std::string(kernel.name)) == selected.end()) { continue; }
+
+            KernelResult result;
+            result.query_length = query_lengths[qi];
+            result.target_length = target_length;
+            result.error_rate = error_rates[ei];
+            const std::vector<int64_t> *reference = (kernel.is_reference == true || reference_distances[kernel.mode].size() == 0) ? NULL : &reference_distances[kernel.mode];
+            RunKernel(kernel, queries, targets, band_widths[bi], bench, scores, reference, &distances, &result);
+            if (kernel.is_reference == true) {
+              reference_distances[kernel.mode] = distances;
+            }
+            results.push_back(result);
+
+            fprintf (stderr, "%-15s %-4s q=%-7ld t=%-7ld err=%.3f band=%-5ld %10.1f us/aln %10.2f Mcells/s  agree %ld/%ld  failed %ld\n",
+                     result.kernel.c_str(), result.mode.c_str(), result.query_length, result.target_length, result.error_rate, result.band_width,
+                     result.time * 1e6 / result.num_alignments, result.cells / result.time / 1e6, result.num_agree, result.num_checked, result.num_failed);
+          }
+        }
+      }
+    }
+  }
+
+  FILE *fp_json = stdout;
+  if (bench.json_path.size() > 0) {
+    fp_json = fopen(bench.json_path.c_str(), "w");
+    if (fp_json == NULL) {
+      fprintf (stderr, "Could not open '%s' for writing.\n", bench.json_path.c_str());
+      return 1;
+    }
+  }
+  WriteAlignBenchJSON(fp_json, bench, results);
+  if (fp_json != stdout) {
+    fclose(fp_json);
+  }
+
+  return 0;
+}
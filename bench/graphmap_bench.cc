@@ -0,0 +1,265 @@
+/*
+ * graphmap_bench.cc
+ *
+ *  Reproducible end-to-end benchmark of the mapping pipeline. A reference and long reads with a known origin are
+ *  simulated from a fixed seed, GraphMap is run on them through its API, and the throughput, the per-stage latencies,
+ *  the peak memory and the mapping accuracy are written as JSON, so that runs can be compared between commits.
+ *
+ *  Build and run with: make bench BENCH_ARGS="--profile ont --num-reads 2000 --json bench.json"
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <omp.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "read_simulator.h"
+#include "graphmap/graphmap.h"
+#include "graphmap/mapping_stats.h"
+#include "log_system/log_system.h"
+#include "program_parameters.h"
+#include "utility/utility_general.h"
+#include "argparser.h"
+
+struct BenchParameters {
+  std::string out_dir = "bench_data";
+  int64_t seed = 12345;
+  int64_t genome_length = 5000000;
+  int64_t num_ref_seqs = 1;
+  double repeat_fraction = 0.05;
+  int64_t num_reads = 2000;
+  int64_t read_length = 8000;
+  int64_t read_length_sd = 6000;
+  std::string length_distribution = "lognormal";
+  std::string profile = "ont";
+  int64_t num_threads = 1;
+  int64_t num_iterations = 3;
+  std::string json_path = "";
+  std::string graphmap_args = "";
+};
+
+// Result of one mapping run.
+struct BenchIteration {
+  double wall_time = 0.0;
+  MappingStats::Counters totals;
+};
+
+// Compares the primary alignments in the SAM file with the true origins of the reads. A read is correctly mapped if
+// it is on the right sequence and strand, and its start is within max(50, 10% of the read length) of the true start.
+int EvaluateSAM(std::string sam_path, const std::vector<SimulatedRead> &reads, int64_t *ret_num_mapped, int64_t *ret_num_correct) {
+  *ret_num_mapped = 0;
+  *ret_num_correct = 0;
+
+  FILE *fp = fopen(sam_path.c_str(), "r");
+  if (fp == NULL) {
+    return 1;
+  }
+
+  std::vector<bool> evaluated(reads.size(), false);
+  char line[65536];
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    if (line[0] == '@') {
+      continue;
+    }
+    std::istringstream ss(line);
+    std::string qname, rname;
+    int64_t flag = 0, pos = 0;
+    if (!(ss >> qname >> flag >> rname >> pos)) {
+      continue;
+    }
+    if ((flag & 4) || (flag & 256) || (flag & 2048)) {
+      continue;
+    }
+
+    int64_t read_id = -1, ref_id = -1;
+    if (sscanf(qname.c_str(), "sim_read_%ld", &read_id) != 1 || read_id < 0 || read_id >= reads.size() || evaluated[read_id] == true) {
+      continue;
+    }
+    evaluated[read_id] = true;
+    *ret_num_mapped += 1;
+
+    const SimulatedRead &read = reads[read_id];
+    sscanf(rname.c_str(), "sim_ref_%ld", &ref_id);
+    int64_t tolerance = std::max((int64_t) 50, (read.ref_end - read.ref_start) / 10);
+    bool is_reverse = (flag & 16) != 0;
+    if (ref_id == read.ref_id && is_reverse == read.is_reverse && std::abs((pos - 1) - read.ref_start) <= tolerance) {
+      *ret_num_correct += 1;
+    }
+  }
+  fclose(fp);
+
+  return 0;
+}
+
+void WriteBenchJSON(FILE *fp, const BenchParameters &bench, const ProgramParameters &parameters, double simulation_time, double index_time,
+                    const std::vector<BenchIteration> &iterations, int64_t num_mapped, int64_t num_correct, int64_t num_reads, int64_t peak_rss) {
+  // The reported run is the one with the median wall time. The stage latencies are taken from it.
+  std::vector<int64_t> order;
+  for (int64_t i = 0; i < iterations.size(); i++) { order.push_back(i); }
+  std::sort(order.begin(), order.end(), [&](int64_t a, int64_t b) { return iterations[a].wall_time < iterations[b].wall_time; });
+  const BenchIteration &median = iterations[order[order.size() / 2]];
+  const MappingStats::Counters &totals = median.totals;
+  double wall_time = median.wall_time;
+
+  fprintf (fp, "{\n");
+  fprintf (fp, "  \"config\": {\"seed\": %ld, \"genome_length\": %ld, \"num_ref_seqs\": %ld, \"repeat_fraction\": %.3f, \"num_reads\": %ld, \"read_length\": %ld, \"read_length_sd\": %ld, \"length_distribution\": \"%s\", \"profile\": \"%s\", \"num_threads\": %ld, \"num_iterations\": %ld, \"graphmap_args\": \"%s\"},\n",
+           bench.seed, bench.genome_length, bench.num_ref_seqs, bench.repeat_fraction, bench.num_reads, bench.read_length, bench.read_length_sd,
+           bench.length_distribution.c_str(), bench.profile.c_str(), parameters.num_threads, bench.num_iterations, bench.graphmap_args.c_str());
+  fprintf (fp, "  \"version\": \"%s\",\n", std::string(GRAPHMAP_CURRENT_VERSION).c_str());
+  fprintf (fp, "  \"simulation_time_s\": %.6f,\n", simulation_time);
+  fprintf (fp, "  \"index_time_s\": %.6f,\n", index_time);
+  fprintf (fp, "  \"mapping_time_s\": %.6f,\n", wall_time);
+  fprintf (fp, "  \"mapping_time_min_s\": %.6f,\n", iterations[order.front()].wall_time);
+  fprintf (fp, "  \"mapping_time_max_s\": %.6f,\n", iterations[order.back()].wall_time);
+  fprintf (fp, "  \"num_bases\": %ld,\n", totals.num_bases);
+  fprintf (fp, "  \"reads_per_s\": %.3f,\n", (wall_time > 0.0) ? (totals.num_reads / wall_time) : 0.0);
+  fprintf (fp, "  \"bases_per_s\": %.3f,\n", (wall_time > 0.0) ? (totals.num_bases / wall_time) : 0.0);
+  fprintf (fp, "  \"mapped_fraction\": %.6f,\n", (num_reads > 0) ? (((double) num_mapped) / num_reads) : 0.0);
+  fprintf (fp, "  \"accuracy\": %.6f,\n", (num_reads > 0) ? (((double) num_correct) / num_reads) : 0.0);
+  fprintf (fp, "  \"precision\": %.6f,\n", (num_mapped > 0) ? (((double) num_correct) / num_mapped) : 0.0);
+  fprintf (fp, "  \"peak_rss_bytes\": %ld,\n", peak_rss);
+  fprintf (fp, "  \"stages\": {\n");
+  for (int stage = 0; stage < NUM_STAGES; stage++) {
+    const LatencyHistogram &histogram = totals.stages[stage];
+    fprintf (fp, "    \"%s\": {\"ns_per_base\": %.3f, \"total_ns\": %ld, \"p50_ns\": %ld, \"p99_ns\": %ld, \"max_ns\": %ld}%s\n",
+             StageName(stage), (totals.num_bases > 0) ? (((double) histogram.get_sum()) / totals.num_bases) : 0.0, histogram.get_sum(),
+             histogram.GetPercentile(50.0), histogram.GetPercentile(99.0), histogram.get_max(), ((stage + 1) < NUM_STAGES) ? "," : "");
+  }
+  fprintf (fp, "  }\n");
+  fprintf (fp, "}\n");
+}
+
+int ProcessArgsBench(int argc, char **argv, BenchParameters *bench) {
+  ArgumentParser argparser;
+  argparser.AddArgument(&bench->out_dir, VALUE_TYPE_STRING, "", "out-dir", "bench_data", "Folder for the simulated data, the index and the SAM output.", 0, "Data options");
+  argparser.AddArgument(&bench->seed, VALUE_TYPE_INT64, "", "seed", "12345", "Seed of the simulator. The same seed gives the same data on every platform.", 0, "Data options");
+  argparser.AddArgument(&bench->genome_length, VALUE_TYPE_INT64, "", "genome-len", "5000000", "Total length of the simulated reference.", 0, "Data options");
+  argparser.AddArgument(&bench->num_ref_seqs, VALUE_TYPE_INT64, "", "num-seqs", "1", "Number of sequences in the simulated reference.", 0, "Data options");
+  argparser.AddArgument(&bench->repeat_fraction, VALUE_TYPE_DOUBLE, "", "repeat-frac", "0.05", "Fraction of the reference made of diverged copies of other segments.", 0, "Data options");
+  argparser.AddArgument(&bench->num_reads, VALUE_TYPE_INT64, "", "num-reads", "2000", "Number of simulated reads.", 0, "Data options");
+  argparser.AddArgument(&bench->read_length, VALUE_TYPE_INT64, "", "read-len", "8000", "Mean length of the reads.", 0, "Data options");
+  argparser.AddArgument(&bench->read_length_sd, VALUE_TYPE_INT64, "", "read-len-sd", "6000", "Standard deviation of the read lengths, for the lognormal distribution.", 0, "Data options");
+  argparser.AddArgument(&bench->length_distribution, VALUE_TYPE_STRING, "", "len-dist", "lognormal", "Distribution of the read lengths: lognormal or fixed.", 0, "Data options");
+  argparser.AddArgument(&bench->profile, VALUE_TYPE_STRING, "", "profile", "ont", "Error profile of the reads: ont, pacbio, hifi or perfect.", 0, "Data options");
+  argparser.AddArgument(&bench->num_threads, VALUE_TYPE_INT64, "t", "threads", "1", "Number of mapping threads.", 0, "Run options");
+  argparser.AddArgument(&bench->num_iterations, VALUE_TYPE_INT64, "", "iterations", "3", "Number of mapping runs over the same reads. The run with the median wall time is reported.", 0, "Run options");
+  argparser.AddArgument(&bench->json_path, VALUE_TYPE_STRING, "", "json", "", "Path of the JSON report. If not specified, it is written to stdout.", 0, "Run options");
+  argparser.AddArgument(&bench->graphmap_args, VALUE_TYPE_STRING, "", "graphmap-args", "", "Additional GraphMap options, separated by spaces (e.g. \"-x sensitive\").", 0, "Run options");
+  argparser.set_program_name(std::string(argv[0]));
+
+  argparser.ProcessArguments(argc, argv);
+
+  ErrorProfile profile;
+  if (GetErrorProfile(bench->profile, &profile)) {
+    fprintf (stderr, "Unknown error profile '%s'.\n\n", bench->profile.c_str());
+    fprintf (stderr, "%s", argparser.VerboseUsage().c_str());
+    return 1;
+  }
+  if (bench->length_distribution != "lognormal" && bench->length_distribution != "fixed") {
+    fprintf (stderr, "Unknown read length distribution '%s'.\n\n", bench->length_distribution.c_str());
+    fprintf (stderr, "%s", argparser.VerboseUsage().c_str());
+    return 1;
+  }
+  if (bench->genome_length <= 0 || bench->num_reads <= 0 || bench->read_length <= 0 || bench->num_iterations <= 0 || bench->num_threads == 0) {
+    fprintf (stderr, "The genome length, the number of reads, the read length, the number of iterations and the number of threads need to be > 0.\n\n");
+    fprintf (stderr, "%s", argparser.VerboseUsage().c_str());
+    return 1;
+  }
+
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  BenchParameters bench;
+  if (ProcessArgsBench(argc, argv, &bench)) {
+    return 1;
+  }
+
+  mkdir(bench.out_dir.c_str(), 0755);
+  std::string ref_path = bench.out_dir + "/ref.fa";
+  std::string reads_path = bench.out_dir + "/reads.fa";
+  std::string sam_path = bench.out_dir + "/out.sam";
+
+  // Simulate the data. The index is rebuilt on every run, since the reference may have changed with the options.
+  double time_start = omp_get_wtime();
+  ErrorProfile profile;
+  GetErrorProfile(bench.profile, &profile);
+  ReadLengthParams lengths;
+  lengths.distribution = bench.length_distribution;
+  lengths.mean = bench.read_length;
+  lengths.sd = bench.read_length_sd;
+
+  ReadSimulator simulator((uint64_t) bench.seed);
+  std::vector<std::string> ref_headers, ref_seqs;
+  std::vector<SimulatedRead> reads;
+  simulator.GenerateReference(bench.genome_length, bench.num_ref_seqs, bench.repeat_fraction, ref_headers, ref_seqs);
+  simulator.SimulateReads(ref_seqs, bench.num_reads, lengths, profile, reads);
+
+  std::vector<std::string> read_headers, read_seqs;
+  for (int64_t i = 0; i < reads.size(); i++) {
+    read_headers.push_back(reads[i].header);
+    read_seqs.push_back(reads[i].seq);
+  }
+  if (WriteFasta(ref_path, ref_headers, ref_seqs) || WriteFasta(reads_path, read_headers, read_seqs)) {
+    fprintf (stderr, "Could not write the simulated data to '%s'.\n", bench.out_dir.c_str());
+    return 1;
+  }
+  double simulation_time = omp_get_wtime() - time_start;
+
+  // The GraphMap parameters are parsed from a command line, so that all the defaults are the same as in a normal run.
+  std::vector<std::string> args = {"graphmap", "-r", ref_path, "-d", reads_path, "-o", sam_path, "-t", FormatString("%ld", bench.num_threads), "-v", "0", "--rebuild-index"};
+  std::istringstream extra_args(bench.graphmap_args);
+  std::string arg;
+  while (extra_args >> arg) { args.push_back(arg); }
+  std::vector<char *> args_ptrs;
+  for (int64_t i = 0; i < args.size(); i++) { args_ptrs.push_back((char *) args[i].c_str()); }
+
+  ProgramParameters parameters;
+  parameters.subprogram = "align";
+  if (ProcessArgsGraphMap(args_ptrs.size(), &args_ptrs[0], &parameters)) {
+    return 1;
+  }
+  LogSystem::GetInstance().SetProgramVerboseLevelFromInt(parameters.verbose_level);
+
+  GraphMap graphmap;
+  time_start = omp_get_wtime();
+  graphmap.Initialize(parameters, clock());
+  double index_time = omp_get_wtime() - time_start;
+
+  std::vector<BenchIteration> iterations;
+  for (int64_t i = 0; i < bench.num_iterations; i++) {
+    BenchIteration iteration;
+    time_start = omp_get_wtime();
+    graphmap.RunOnFile(parameters, reads_path, sam_path, clock());
+    iteration.wall_time = omp_get_wtime() - time_start;
+    iteration.totals = graphmap.get_mapping_stats().GetTotals();
+    iterations.push_back(iteration);
+    fprintf (stderr, "[bench] Iteration %ld: %.3f sec, %.2f reads/s.\n", i, iteration.wall_time, (iteration.wall_time > 0.0) ? (iteration.totals.num_reads / iteration.wall_time) : 0.0);
+  }
+
+  // The output of all iterations is the same, so only the last SAM is evaluated.
+  int64_t num_mapped = 0, num_correct = 0;
+  if (EvaluateSAM(sam_path, reads, &num_mapped, &num_correct)) {
+    fprintf (stderr, "Could not open the SAM output '%s'.\n", sam_path.c_str());
+    return 1;
+  }
+
+  FILE *fp_json = stdout;
+  if (bench.json_path.size() > 0) {
+    fp_json = fopen(bench.json_path.c_str(), "w");
+    if (fp_json == NULL) {
+      fprintf (stderr, "Could not open '%s' for writing.\n", bench.json_path.c_str());
+      return 1;
+    }
+  }
+  WriteBenchJSON(fp_json, bench, parameters, simulation_time, index_time, iterations, num_mapped, num_correct, (int64_t) reads.size(), (int64_t) getPeakRSS());
+  if (fp_json != stdout) {
+    fclose(fp_json);
+  }
+
+  return 0;
+}
@@ -0,0 +1,217 @@
+/*
+ * read_simulator.cc
+ *
+ *  Deterministic simulator of a reference and of long reads sampled from it, for the benchmark.
+ */
+
+#include "read_simulator.h"
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+
+static const char kSimBases[] = "ACGT";
+
+static char ComplementBase(char base) {
+  switch (base) {
+    case 'A': return 'T';
+    case 'C': return 'G';
+    case 'G': return 'C';
+    case 'T': return 'A';
+    default: break;
+  }
+  return 'N';
+}
+
+int GetErrorProfile(std::string name, ErrorProfile *profile) {
+  profile->name = name;
+  if (name == "ont") {
+    profile->mismatch_rate = 0.04;
+    profile->insertion_rate = 0.03;
+    profile->deletion_rate = 0.05;
+    profile->homopolymer_factor = 3.0;
+  } else if (name == "pacbio") {
+    profile->mismatch_rate = 0.01;
+    profile->insertion_rate = 0.09;
+    profile->deletion_rate = 0.04;
+    profile->homopolymer_factor = 1.0;
+  } else if (name == "hifi") {
+    profile->mismatch_rate = 0.002;
+    profile->insertion_rate = 0.001;
+    profile->deletion_rate = 0.002;
+    profile->homopolymer_factor = 2.0;
+  } else if (name == "perfect") {
+    profile->mismatch_rate = 0.0;
+    profile->insertion_rate = 0.0;
+    profile->deletion_rate = 0.0;
+    profile->homopolymer_factor = 1.0;
+  } else {
+    return 1;
+  }
+  return 0;
+}
+
+ErrorProfile UniformErrorProfile(double error_rate) {
+  ErrorProfile profile;
+  profile.name = "uniform";
+  profile.mismatch_rate = error_rate / 3.0;
+  profile.insertion_rate = error_rate / 3.0;
+  profile.deletion_rate = error_rate / 3.0;
+  profile.homopolymer_factor = 1.0;
+  return profile;
+}
+
+ReadSimulator::ReadSimulator(uint64_t seed) : generator_(seed) {
+}
+
+ReadSimulator::~ReadSimulator() {
+}
+
+double ReadSimulator::Uniform_() {
+  // The top 53 bits fill the mantissa of the double.
+  return (generator_() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+double ReadSimulator::Normal_() {
+  double u1 = 1.0 - Uniform_();   // (0, 1], to keep the log finite.
+  double u2 = Uniform_();
+  return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+int64_t ReadSimulator::UniformInt_(int64_t n) {
+  if (n <= 0) { return 0; }
+  return (int64_t) (generator_() % ((uint64_t) n));
+}
+
+char ReadSimulator::RandomBase_() {
+  return kSimBases[UniformInt_(4)];
+}
+
+char ReadSimulator::RandomOtherBase_(char base) {
+  char other = base;
+  while (other == base) { other = RandomBase_(); }
+  return other;
+}
+
+int64_t ReadSimulator::SampleLength_(const ReadLengthParams &lengths) {
+  if (lengths.distribution != "lognormal" || lengths.sd <= 0) {
+    return std::max(lengths.min, lengths.mean);
+  }
+  // Parameters of the underlying normal distribution, from the mean and the standard deviation of the lengths.
+  double mean = (double) lengths.mean, sd = (double) lengths.sd;
+  double sigma2 = log(1.0 + (sd * sd) / (mean * mean));
+  double mu = log(mean) - sigma2 / 2.0;
+  int64_t length = (int64_t) exp(mu + sqrt(sigma2) * Normal_());
+  return std::max(lengths.min, length);
+}
+
+void ReadSimulator::GenerateReference(int64_t length, int64_t num_sequences, double repeat_fraction, std::vector<std::string> &headers, std::vector<std::string> &seqs) {
+  headers.clear();
+  seqs.clear();
+  num_sequences = std::max((int64_t) 1, num_sequences);
+
+  for (int64_t seq_id = 0; seq_id < num_sequences; seq_id++) {
+    int64_t seq_length = length / num_sequences + ((seq_id < (length % num_sequences)) ? 1 : 0);
+    std::string seq = GenerateSequence(seq_length);
+
+    // Overwrite random places with diverged copies of earlier segments, until the repeat fraction is covered.
+    int64_t repeat_bases = (int64_t) (repeat_fraction * seq_length);
+    while (repeat_bases > 0 && seq_length > 20000) {
+      int64_t repeat_length = std::min(repeat_bases, 2000 + UniformInt_(8000));
+      int64_t source = UniformInt_(seq_length / 2 - repeat_length);
+      int64_t dest = seq_length / 2 + UniformInt_(seq_length / 2 - repeat_length);
+      for (int64_t i = 0; i < repeat_length; i++) {
+        seq[dest + i] = (Uniform_() < 0.01) ? RandomOtherBase_(seq[source + i]) : seq[source + i];
+      }
+      repeat_bases -= repeat_length;
+    }
+
+    char header[64];
+    snprintf (header, sizeof(header), "sim_ref_%ld", seq_id);
+    headers.push_back(std::string(header));
+    seqs.push_back(seq);
+  }
+}
+
+void ReadSimulator::SimulateReads(const std::vector<std::string> &ref_seqs, int64_t num_reads, const ReadLengthParams &lengths, const ErrorProfile &profile, std::vector<SimulatedRead> &reads) {
+  reads.clear();
+  reads.reserve(num_reads);
+
+  int64_t total_length = 0;
+  for (int64_t i = 0; i < ref_seqs.size(); i++) { total_length += ref_seqs[i].size(); }
+
+  for (int64_t read_id = 0; read_id < num_reads; read_id++) {
+    SimulatedRead read;
+
+    // Pick the reference sequence proportionally to its length.
+    int64_t position = UniformInt_(total_length);
+    read.ref_id = 0;
+    while (read.ref_id < (ref_seqs.size() - 1) && position >= ref_seqs[read.ref_id].size()) {
+      position -= ref_seqs[read.ref_id].size();
+      read.ref_id += 1;
+    }
+    const std::string &ref = ref_seqs[read.ref_id];
+
+    int64_t read_length = std::min(SampleLength_(lengths), (int64_t) ref.size());
+    read.ref_start = UniformInt_(ref.size() - read_length + 1);
+    read.ref_end = read.ref_start + read_length;
+    read.is_reverse = (Uniform_() < 0.5);
+
+    std::string seq = ApplyErrors(ref.substr(read.ref_start, read_length), profile);
+    if (read.is_reverse == true) {
+      std::reverse(seq.begin(), seq.end());
+      for (int64_t i = 0; i < seq.size(); i++) { seq[i] = ComplementBase(seq[i]); }
+    }
+    read.seq = seq;
+
+    char header[256];
+    snprintf (header, sizeof(header), "sim_read_%ld ref=%ld start=%ld end=%ld strand=%c", read_id, read.ref_id, read.ref_start, read.ref_end, (read.is_reverse == true) ? '-' : '+');
+    read.header = std::string(header);
+
+    reads.push_back(read);
+  }
+}
+
+std::string ReadSimulator::GenerateSequence(int64_t length) {
+  std::string seq(std::max((int64_t) 0, length), 'A');
+  for (int64_t i = 0; i < seq.size(); i++) {
+    seq[i] = RandomBase_();
+  }
+  return seq;
+}
+
+std::string ReadSimulator::ApplyErrors(const std::string &seq, const ErrorProfile &profile) {
+  std::string ret;
+  ret.reserve(seq.size() + seq.size() / 4);
+  for (int64_t i = 0; i < seq.size(); i++) {
+    char base = seq[i];
+    bool in_homopolymer = (i >= 2 && seq[i - 1] == base && seq[i - 2] == base);
+    double indel_factor = (in_homopolymer == true) ? profile.homopolymer_factor : 1.0;
+    double r = Uniform_();
+    if (r < profile.deletion_rate * indel_factor) {
+      continue;
+    }
+    r = Uniform_();
+    if (r < profile.insertion_rate * indel_factor) {
+      // Insertions in homopolymers extend the run, others are random.
+      ret.push_back((in_homopolymer == true) ? base : RandomBase_());
+    }
+    r = Uniform_();
+    ret.push_back((r < profile.mismatch_rate) ? RandomOtherBase_(base) : base);
+  }
+  return ret;
+}
+
+int WriteFasta(std::string path, const std::vector<std::string> &headers, const std::vector<std::string> &seqs) {
+  FILE *fp = fopen(path.c_str(), "w");
+  if (fp == NULL) {
+    return 1;
+  }
+  for (int64_t i = 0; i < seqs.size(); i++) {
+    fprintf (fp, ">%s\n", headers[i].c_str());
+    for (int64_t j = 0; j < seqs[i].size(); j += 100) {
+      fprintf (fp, "%s\n", seqs[i].substr(j, 100).c_str());
+    }
+  }
+  fclose(fp);
+  return 0;
+}
@@ -0,0 +1,83 @@
+/*
+ * read_simulator.h
+ *
+ *  Deterministic simulator of a reference and of long reads sampled from it, for the benchmark. The same seed
+ *  gives the same data on every platform and compiler: the random numbers are drawn from std::mt19937_64 (whose
+ *  output is fixed by the standard), and all distributions are implemented here instead of using <random>'s.
+ */
+
+#ifndef BENCH_READ_SIMULATOR_H_
+#define BENCH_READ_SIMULATOR_H_
+
+#include <stdint.h>
+#include <random>
+#include <string>
+#include <vector>
+
+// Error rates of the simulated reads, per base of the reference.
+struct ErrorProfile {
+  std::string name;
+  double mismatch_rate = 0.0;
+  double insertion_rate = 0.0;
+  double deletion_rate = 0.0;
+  double homopolymer_factor = 1.0;   // Indel rates are multiplied by this within homopolymer runs (longer than 2 bases).
+};
+
+// Lengths of the simulated reads.
+struct ReadLengthParams {
+  std::string distribution = "lognormal";   // "lognormal" or "fixed".
+  int64_t mean = 8000;
+  int64_t sd = 6000;                        // Only for the lognormal distribution.
+  int64_t min = 200;
+};
+
+struct SimulatedRead {
+  std::string header;
+  std::string seq;
+  int64_t ref_id = 0;
+  int64_t ref_start = 0;      // Interval on the forward strand of the reference, [ref_start, ref_end).
+  int64_t ref_end = 0;
+  bool is_reverse = false;
+};
+
+// Fills the error profile with the given name: "ont" (R9-like, ~12% errors, deletion-heavy with homopolymer errors),
+// "pacbio" (CLR-like, ~14% errors, insertion-heavy), "hifi" (~0.5% errors) or "perfect". Returns 0 if OK.
+int GetErrorProfile(std::string name, ErrorProfile *profile);
+
+// Profile with the given total error rate, split equally between mismatches, insertions and deletions.
+ErrorProfile UniformErrorProfile(double error_rate);
+
+class ReadSimulator {
+ public:
+  ReadSimulator(uint64_t seed);
+  ~ReadSimulator();
+
+  // Generates num_sequences random sequences of the total given length. A repeat_fraction of each sequence is
+  // made of copies of its earlier segments, with 1% of mismatches, so that the reads also hit repeats.
+  void GenerateReference(int64_t length, int64_t num_sequences, double repeat_fraction, std::vector<std::string> &headers, std::vector<std::string> &seqs);
+
+  // Samples reads uniformly from both strands of the reference, and applies the errors of the profile.
+  // The true origin of each read is stored in it, and encoded in the header comment.
+  void SimulateReads(const std::vector<std::string> &ref_seqs, int64_t num_reads, const ReadLengthParams &lengths, const ErrorProfile &profile, std::vector<SimulatedRead> &reads);
+
+  // Random sequence of uniformly distributed bases.
+  std::string GenerateSequence(int64_t length);
+
+  // Copy of the forward strand sequence with the errors of the profile applied.
+  std::string ApplyErrors(const std::string &seq, const ErrorProfile &profile);
+
+ private:
+  std::mt19937_64 generator_;
+
+  double Uniform_();                  // [0, 1)
+  double Normal_();                   // Standard normal, Box-Muller.
+  int64_t UniformInt_(int64_t n);     // [0, n)
+  char RandomBase_();
+  char RandomOtherBase_(char base);
+  int64_t SampleLength_(const ReadLengthParams &lengths);
+};
+
+// Writes the sequences as FASTA, with 100 bases per line. Returns 0 if OK.
+int WriteFasta(std::string path, const std::vector<std::string> &headers, const std::vector<std::string> &seqs);
+
+#endif /* BENCH_READ_SIMULATOR_H_ */
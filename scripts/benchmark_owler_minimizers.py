@@ -0,0 +1,101 @@
+#! /usr/bin/python
+
+# Compares Owler in the dense mode (all seeds) to the minimizer-sampled mode (-w) on the same data.
+# For every window length the script reports the index size, wall time, peak memory, number of
+# reported overlaps, and sensitivity/precision measured against the overlaps of the dense mode.
+#
+# Usage:
+#	scripts/benchmark_owler_minimizers.py <graphmap_bin> <reads.fa> <out_folder> [window1 window2 ...]
+
+import os;
+import sys;
+import time;
+import subprocess;
+import shlex;
+
+DEFAULT_WINDOWS = [0, 5, 10, 15];
+
+# Runs the command and waits for it with wait4, to obtain the peak memory of that particular run. Returns (wall_time_sec, peak_rss_mb).
+def execute_command(command):
+	sys.stderr.write('Executing command: %s\n' % (command));
+	start = time.time();
+	process = subprocess.Popen(shlex.split(command));
+	(pid, status, rusage) = os.wait4(process.pid, 0);
+	wall_time = time.time() - start;
+	if (status != 0):
+		sys.stderr.write('Command exited with status %d: %s\n' % (status, command));
+	# ru_maxrss is in kilobytes on Linux.
+	peak_rss_mb = rusage.ru_maxrss / 1024.0;
+	return (wall_time, peak_rss_mb);
+
+def index_path_for_window(reads_path, window):
+	if (window > 1):
+		return '%s.gmidxowlw%d' % (reads_path, window);
+	return '%s.gmidxowl' % (reads_path);
+
+def load_overlap_pairs(overlaps_path):
+	pairs = set();
+	try:
+		fp = open(overlaps_path, 'r');
+	except Exception:
+		return pairs;
+	for line in fp:
+		line = line.strip();
+		if (len(line) == 0):
+			continue;
+		split_line = line.split('\t') if ('\t' in line) else line.split();
+		# Works for both MHAP (ids in the first two columns) and PAF (names in columns 1 and 6).
+		if (len(split_line) >= 12):
+			(a, b) = (split_line[0], split_line[5]);
+		else:
+			(a, b) = (split_line[0], split_line[1]);
+		if (a == b):
+			continue;
+		pairs.add((min(a, b), max(a, b)));
+	fp.close();
+	return pairs;
+
+def run_one(graphmap_bin, reads_path, out_folder, window):
+	out_path = os.path.join(out_folder, 'overlaps-w%d.paf' % (window));
+	index_path = index_path_for_window(reads_path, window);
+	if (os.path.exists(index_path)):
+		os.remove(index_path);
+
+	(index_time, index_rss) = execute_command('%s owler -r %s -d %s -w %d -I' % (graphmap_bin, reads_path, reads_path, window));
+	(overlap_time, overlap_rss) = execute_command('%s owler -r %s -d %s -w %d -L paf -o %s' % (graphmap_bin, reads_path, reads_path, window, out_path));
+
+	index_size = os.path.getsize(index_path) if (os.path.exists(index_path)) else 0;
+	return {'window': window, 'index_time': index_time, 'overlap_time': overlap_time,
+			'index_size_mb': (index_size / (1024.0 * 1024.0)), 'peak_rss_mb': max(index_rss, overlap_rss),
+			'pairs': load_overlap_pairs(out_path)};
+
+def main():
+	if (len(sys.argv) < 4):
+		sys.stderr.write('Usage:\n');
+		sys.stderr.write('\t%s <graphmap_bin> <reads.fa> <out_folder> [window1 window2 ...]\n' % (sys.argv[0]));
+		sys.stderr.write('\tWindow 0 is the dense mode and is always used as the baseline. Default windows: %s\n' % (str(DEFAULT_WINDOWS)));
+		exit(1);
+
+	graphmap_bin = sys.argv[1];
+	reads_path = sys.argv[2];
+	out_folder = sys.argv[3];
+	windows = [int(val) for val in sys.argv[4:]] if (len(sys.argv) > 4) else DEFAULT_WINDOWS;
+	if ((0 in windows) == False):
+		windows = [0] + windows;
+
+	if (not os.path.exists(out_folder)):
+		os.makedirs(out_folder);
+
+	results = [run_one(graphmap_bin, reads_path, out_folder, window) for window in windows];
+	baseline = [result for result in results if result['window'] == 0][0];
+
+	sys.stdout.write('window\tindex_mb\tindex_s\toverlap_s\tpeak_rss_mb\tnum_overlaps\tsensitivity\tprecision\tspeedup\n');
+	for result in results:
+		num_common = len(result['pairs'] & baseline['pairs']);
+		sensitivity = (float(num_common) / len(baseline['pairs'])) if (len(baseline['pairs']) > 0) else 0.0;
+		precision = (float(num_common) / len(result['pairs'])) if (len(result['pairs']) > 0) else 0.0;
+		speedup = (baseline['overlap_time'] / result['overlap_time']) if (result['overlap_time'] > 0) else 0.0;
+		sys.stdout.write('%d\t%.2f\t%.2f\t%.2f\t%.2f\t%d\t%.4f\t%.4f\t%.2f\n' % (result['window'], result['index_size_mb'], result['index_time'], result['overlap_time'], result['peak_rss_mb'], len(result['pairs']), sensitivity, precision, speedup));
+
+if __name__ == "__main__":
+	main();
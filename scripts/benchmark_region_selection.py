@@ -0,0 +1,121 @@
+#! /usr/bin/python
+
+# Compares the dense (--region-engine dense) and the sort-based (--region-engine sort) region selection on synthetic
+# data, for a grid of reference lengths and read lengths. Every reference is random, and the reads are sampled from
+# it with ~10% of errors. For every combination the script reports the wall time of mapping with both engines, the
+# number of bins per seed of a read (which the automatic choice is based on, see REGION_SELECTION_AUTO_BINS_PER_SEED
+# in src/graphmap/graphmap.h), and checks that both engines produced the same alignments.
+#
+# Usage:
+#	scripts/benchmark_region_selection.py <graphmap_bin> <out_folder> [num_reads]
+
+import os;
+import sys;
+import time;
+import random;
+import subprocess;
+
+GENOME_LENGTHS = [10000, 100000, 1000000, 5000000, 20000000];
+READ_LENGTHS = [150, 1000, 10000];
+DEFAULT_NUM_READS = 2000;
+THREADS = 1;
+
+def execute_command(command):
+	sys.stderr.write('Executing command: %s\n' % (command));
+	start = time.time();
+	subprocess.call(command, shell=True);
+	return (time.time() - start);
+
+def write_fasta(path, headers, seqs):
+	fp = open(path, 'w');
+	for (header, seq) in zip(headers, seqs):
+		fp.write('>%s\n' % (header));
+		for i in xrange(0, len(seq), 100):
+			fp.write('%s\n' % (seq[i:(i + 100)]));
+	fp.close();
+
+def reverse_complement(seq):
+	complement = {'A': 'T', 'C': 'G', 'G': 'C', 'T': 'A'};
+	return ''.join([complement[base] for base in reversed(seq)]);
+
+def simulate_read(genome, read_length, error_rate):
+	start = random.randint(0, len(genome) - read_length);
+	read = [];
+	for base in genome[start:(start + read_length)]:
+		r = random.random();
+		if (r < (error_rate * 0.5)):
+			read.append(random.choice('ACGT'));		# Mismatch.
+		elif (r < (error_rate * 0.75)):
+			continue;								# Deletion.
+		elif (r < error_rate):
+			read.append(base + random.choice('ACGT'));	# Insertion.
+		else:
+			read.append(base);
+	read = ''.join(read);
+	return (reverse_complement(read) if (random.random() < 0.5) else read);
+
+def load_sam_alignments(sam_path):
+	alignments = [];
+	try:
+		fp = open(sam_path, 'r');
+	except Exception:
+		return alignments;
+	for line in fp:
+		if (len(line) == 0 or line[0] == '@'):
+			continue;
+		split_line = line.strip().split('\t');
+		alignments.append('\t'.join(split_line[0:6]));
+	fp.close();
+	return sorted(alignments);
+
+def run_one(graphmap_bin, out_folder, genome_length, read_length, num_reads):
+	prefix = os.path.join(out_folder, 'g%d-r%d' % (genome_length, read_length));
+	ref_path = '%s-ref.fa' % (prefix);
+	reads_path = '%s-reads.fa' % (prefix);
+
+	if (not os.path.exists(ref_path)):
+		random.seed(genome_length);
+		genome = ''.join([random.choice('ACGT') for i in xrange(genome_length)]);
+		write_fasta(ref_path, ['ref'], [genome]);
+		write_fasta(reads_path, ['read%d' % (i) for i in xrange(num_reads)], [simulate_read(genome, min(read_length, genome_length), 0.10) for i in xrange(num_reads)]);
+		execute_command('%s align -r %s -I' % (graphmap_bin, ref_path));
+
+	times = {};
+	alignments = {};
+	for engine in ['dense', 'sort']:
+		sam_path = '%s-%s.sam' % (prefix, engine);
+		times[engine] = execute_command('%s align -r %s -d %s -o %s -t %d --region-engine %s -v 0' % (graphmap_bin, ref_path, reads_path, sam_path, THREADS, engine));
+		alignments[engine] = load_sam_alignments(sam_path);
+
+	# Same estimate as in GraphMap::UseSortedRegionSelection_, with the default bin size of read_length / 3.
+	num_bins = 2 * (genome_length / (read_length / 3) + 1);
+	bins_per_seed = float(num_bins) / read_length;
+
+	return {'genome_length': genome_length, 'read_length': read_length, 'bins_per_seed': bins_per_seed,
+			'dense_s': times['dense'], 'sort_s': times['sort'],
+			'same': (alignments['dense'] == alignments['sort'])};
+
+def main():
+	if (len(sys.argv) < 3):
+		sys.stderr.write('Usage:\n');
+		sys.stderr.write('\t%s <graphmap_bin> <out_folder> [num_reads]\n' % (sys.argv[0]));
+		sys.stderr.write('\tDefault num_reads: %d\n' % (DEFAULT_NUM_READS));
+		exit(1);
+
+	graphmap_bin = sys.argv[1];
+	out_folder = sys.argv[2];
+	num_reads = int(sys.argv[3]) if (len(sys.argv) > 3) else DEFAULT_NUM_READS;
+
+	if (not os.path.exists(out_folder)):
+		os.makedirs(out_folder);
+
+	results = [run_one(graphmap_bin, out_folder, genome_length, read_length, num_reads) for genome_length in GENOME_LENGTHS for read_length in READ_LENGTHS];
+
+	sys.stdout.write('genome_len\tread_len\tbins_per_seed\tdense_s\tsort_s\tspeedup\tfaster\tsame_alignments\n');
+	for result in results:
+		speedup = (result['dense_s'] / result['sort_s']) if (result['sort_s'] > 0) else 0.0;
+		faster = 'sort' if (result['sort_s'] < result['dense_s']) else 'dense';
+		sys.stdout.write('%d\t%d\t%.1f\t%.2f\t%.2f\t%.2f\t%s\t%s\n' % (result['genome_length'], result['read_length'], result['bins_per_seed'], result['dense_s'], result['sort_s'], speedup, faster, str(result['same'])));
+
+if __name__ == "__main__":
+	main();
@@ -7,8 +7,10 @@
 
 #include "alignment/alignment.h"
 #include "libs/opal.h"
+#include "graphmap/pipeline_trace.h"
 
 int AlignRegion(const SingleSequence *read, const Index *index, const ProgramParameters *parameters, const EValueParams *evalue_params, bool extend_to_end, PathGraphEntry *region_results) {
+  TraceSpan trace_align("AlignRegion", read->get_sequence_id(), read->get_sequence_length());
 //  bool align_end_to_end = true;
 //  bool spliced_alignment = true;
 //  bool spliced_alignment = false;
@@ -66,8 +68,9 @@ void VerboseAlignment(const SingleSequence *read, const Index *index, const Prog
   if (parameters->verbose_level > 5 && read->get_sequence_id() == parameters->debug_read) {
     std::string alignment_as_string = "";
 
+    DataWindow ref_window;
     alignment_as_string = PrintAlignmentToString((const unsigned char *) read->get_data(), read->get_sequence_length(),
-       (const unsigned char *) (index->get_data() + aln->raw_pos_start), (aln->raw_pos_end - aln->raw_pos_start + 1),
+       (const unsigned char *) index->GetDataWindow(aln->raw_pos_start, aln->raw_pos_end, &ref_window), (aln->raw_pos_end - aln->raw_pos_start + 1),
        (unsigned char *) &(aln->raw_alignment[0]), aln->raw_alignment.size(),
        aln->raw_pos_end - aln->raw_pos_start, aln->aln_mode_code);
 //       (aln->raw_pos_end - aln->aln_window_start), aln->aln_mode_code);
@@ -252,6 +255,18 @@ int SplitCircularAlignment(const AlignmentResults *aln, int64_t pos_of_ref_end,
   return 0;
 }
 
+void SetAlignmentEncoding(const AlignmentEncoding &encoding, AlignmentResults *aln) {
+  aln->cigar = encoding.cigar;
+  aln->md = encoding.md;
+  aln->num_eq_ops = encoding.num_eq_ops;
+  aln->num_x_ops = encoding.num_x_ops;
+  aln->num_i_ops = encoding.num_i_ops;
+  aln->num_d_ops = encoding.num_d_ops;
+  aln->alignment_score = encoding.alignment_score;
+  aln->edit_distance = encoding.edit_distance;
+  aln->nonclipped_length = encoding.nonclipped_length;
+}
+
 // Checks if there is a strange (large) number of insertions and deletions, or consecutive insertion/deletion operations.
 // SeqAn likes to make such alignments.
 // Returns 0 if everything went ok.
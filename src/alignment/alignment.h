@@ -63,6 +63,8 @@ int FindCircularEnd(const std::vector<uint8_t> &alignment, int64_t pos_of_ref_en
 
 int SplitCircularAlignment(const AlignmentResults *aln, int64_t pos_of_ref_end, int64_t ref_start, int64_t ref_len, AlignmentResults *aln_l, AlignmentResults *aln_r);
 
+/// Copies the CIGAR, MD, operation counts and scores of an encoded alignment into the alignment results.
+void SetAlignmentEncoding(const AlignmentEncoding &encoding, AlignmentResults *aln);
 
 int CheckAlignmentSane(std::vector<unsigned char> &alignment, const SingleSequence* read=NULL, const Index* index=NULL, int64_t reference_hit_id=-1, int64_t reference_hit_pos=-1);
 
@@ -18,7 +18,7 @@ enum ClusterAlnType {
 int AlignFront(AlignmentFunctionType AlignmentFunctionSHW,
                 const SingleSequence *read, const Index *index, const ProgramParameters *parameters,
                 const PathGraphEntry *region_results, int64_t ref_index_start, int64_t region_ref_start,
-                const int8_t *ref_data, int64_t ref_len, int64_t clip_count_front,
+                const int8_t *ref_data, int64_t ref_data_offset, int64_t ref_len, int64_t clip_count_front,
                 int64_t alignment_position_start, bool align_end_to_end, AlignmentResults &aln) {
   aln.aln_mode_code = EDLIB_MODE_SHW;
   aln.query_start = 0;
@@ -55,10 +55,10 @@ int AlignFront(AlignmentFunctionType AlignmentFunctionSHW,
     int8_t *reversed_ref_front = NULL;
     int64_t reversed_ref_len = 0;
     if (clip_count_front*2  > (alignment_position_start - reference_start)) {
-      reversed_ref_front = reverse_data(ref_data + 0, (alignment_position_start - reference_start));
+      reversed_ref_front = reverse_data(ref_data + (ref_index_start - ref_data_offset), (alignment_position_start - reference_start));
       reversed_ref_len = alignment_position_start - reference_start;
     } else {
-      reversed_ref_front = reverse_data(ref_data + (alignment_position_start - 1) - (clip_count_front*2 - 1), clip_count_front*2);
+      reversed_ref_front = reverse_data(ref_data + ((alignment_position_start - 1) - (clip_count_front*2 - 1) - ref_data_offset), clip_count_front*2);
       reversed_ref_len = clip_count_front*2;
     }
 
@@ -143,7 +143,7 @@ int AlignFront(AlignmentFunctionType AlignmentFunctionSHW,
 int AlignAnchor(AlignmentFunctionType AlignmentFunctionNW,
                 const SingleSequence *read, const Index *index, const ProgramParameters *parameters,
                 const PathGraphEntry *region_results, int64_t ref_index_start, int64_t region_ref_start,
-                const int8_t *ref_data, int64_t ref_len, int64_t cluster_id, AlignmentResults &aln) {
+                const int8_t *ref_data, int64_t ref_data_offset, int64_t ref_len, int64_t cluster_id, AlignmentResults &aln) {
 
   int64_t cluster_query_start = region_results->get_mapping_data().clusters[cluster_id].query.start;
   int64_t cluster_query_end = region_results->get_mapping_data().clusters[cluster_id].query.end;
@@ -171,7 +171,7 @@ int AlignAnchor(AlignmentFunctionType AlignmentFunctionNW,
   int64_t anchor_alignment_position_start = 0, anchor_alignment_position_end = 0, anchor_edit_distance = 0;
   std::vector<unsigned char> anchor_alignment;
   int ret_code1 = AlignmentFunctionNW(read->get_data() + cluster_query_start, (query_alignment_length),
-                                      (int8_t *) (ref_data + cluster_ref_start), (ref_alignment_length),
+                                      (int8_t *) (ref_data + (cluster_ref_start - ref_data_offset)), (ref_alignment_length),
                                    bandwidth, parameters->match_score, parameters->mex_score, -parameters->mismatch_penalty, -parameters->gap_open_penalty, -parameters->gap_extend_penalty,
                                    &anchor_alignment_position_start, &anchor_alignment_position_end,
                                    &anchor_edit_distance, anchor_alignment);
@@ -183,7 +183,7 @@ int AlignAnchor(AlignmentFunctionType AlignmentFunctionNW,
   if (parameters->verbose_level > 5 && ((int64_t) read->get_sequence_id()) == parameters->debug_read) {
     std::string alignment_as_string = "";
     alignment_as_string = PrintAlignmentToString((const unsigned char *) (read->get_data() + cluster_query_start), query_alignment_length,
-                                                 (const unsigned char *) (ref_data + cluster_ref_start), (ref_alignment_length),
+                                                 (const unsigned char *) (ref_data + (cluster_ref_start - ref_data_offset)), (ref_alignment_length),
                                                  (unsigned char *) &(anchor_alignment[0]), anchor_alignment.size(),
                                                  (0), EDLIB_MODE_NW);
     LOG_DEBUG_SPEC("Aligned anchor %d:\n%s\n", cluster_id, alignment_as_string.c_str());
@@ -205,7 +205,7 @@ int AlignAnchor(AlignmentFunctionType AlignmentFunctionNW,
 int AlignInBetweenAnchors(AlignmentFunctionType AlignmentFunctionNW,
                           const SingleSequence *read, const Index *index, const ProgramParameters *parameters,
                           const PathGraphEntry *region_results, int64_t ref_index_start, int64_t region_ref_start,
-                          const int8_t *ref_data, int64_t ref_len, int64_t cluster_id, AlignmentResults &aln) {
+                          const int8_t *ref_data, int64_t ref_data_offset, int64_t ref_len, int64_t cluster_id, AlignmentResults &aln) {
 
   int64_t cluster_query_start = region_results->get_mapping_data().clusters[cluster_id].query.start;
   int64_t cluster_query_end = region_results->get_mapping_data().clusters[cluster_id].query.end;
@@ -268,7 +268,7 @@ int AlignInBetweenAnchors(AlignmentFunctionType AlignmentFunctionNW,
       int64_t between_alignment_position_start = 0, between_alignment_position_end = 0, between_anchor_edit_distance = 0;
       std::vector<unsigned char> between_anchor_alignment;
       int ret_code2 = AlignmentFunctionNW(read->get_data() + (cluster_query_end) + 1, inbetween_query_length,
-                                          (int8_t *) (ref_data + cluster_ref_end) + 1, inbetween_ref_length,
+                                          (int8_t *) (ref_data + (cluster_ref_end - ref_data_offset)) + 1, inbetween_ref_length,
                                        bandwidth, parameters->match_score, parameters->mex_score, -parameters->mismatch_penalty, -parameters->gap_open_penalty, -parameters->gap_extend_penalty,
                                        &between_alignment_position_start, &between_alignment_position_end,
                                        &between_anchor_edit_distance, between_anchor_alignment);
@@ -286,7 +286,7 @@ int AlignInBetweenAnchors(AlignmentFunctionType AlignmentFunctionNW,
       if (parameters->verbose_level > 5 && ((int64_t) read->get_sequence_id()) == parameters->debug_read) {
         std::string alignment_as_string = "";
         alignment_as_string = PrintAlignmentToString((const unsigned char *) read->get_data() + (cluster_query_end) + 1, inbetween_query_length,
-                                                     (const unsigned char *) (ref_data + cluster_ref_end) + 1, inbetween_ref_length,
+                                                     (const unsigned char *) (ref_data + (cluster_ref_end - ref_data_offset)) + 1, inbetween_ref_length,
                                                      (unsigned char *) &(between_anchor_alignment[0]), between_anchor_alignment.size(),
                                                      (0), EDLIB_MODE_NW);
         LOG_DEBUG_SPEC("Aligning in between anchors %d and %d:\n%s\n", cluster_id, (cluster_id+1), alignment_as_string.c_str());
@@ -305,7 +305,7 @@ int AlignInBetweenAnchors(AlignmentFunctionType AlignmentFunctionNW,
 int AlignBack(AlignmentFunctionType AlignmentFunctionSHW,
               const SingleSequence *read, const Index *index, const ProgramParameters *parameters,
               const PathGraphEntry *region_results, int64_t ref_index_start, int64_t region_ref_start,
-              const int8_t *ref_data, int64_t ref_len, int64_t clip_count_back, int64_t ref_start,
+              const int8_t *ref_data, int64_t ref_data_offset, int64_t ref_len, int64_t clip_count_back, int64_t ref_start,
               int64_t alignment_position_end, bool align_end_to_end, AlignmentResults &aln) {
   aln.aln_mode_code = EDLIB_MODE_SHW;
   aln.query_start = read->get_sequence_length() - clip_count_back;
@@ -354,7 +354,7 @@ int AlignBack(AlignmentFunctionType AlignmentFunctionSHW,
 
     std::vector<unsigned char> leftover_right_alignment;
     int ret_code_right = AlignmentFunctionSHW(read->get_data() + query_end + 1, (clip_count_back),
-                                     (int8_t *) (ref_data + alignment_position_end + 1), ref_len_for_aln,
+                                     (int8_t *) (ref_data + (alignment_position_end - ref_data_offset) + 1), ref_len_for_aln,
                                      bandwidth, parameters->match_score, parameters->mex_score, -parameters->mismatch_penalty, -parameters->gap_open_penalty, -parameters->gap_extend_penalty,
                                      &leftover_right_start, &leftover_right_end,
                                      &leftover_right_edit_distance, leftover_right_alignment);
@@ -363,7 +363,7 @@ int AlignBack(AlignmentFunctionType AlignmentFunctionSHW,
       if (parameters->verbose_level > 5 && ((int64_t) read->get_sequence_id()) == parameters->debug_read) {
         std::string alignment_as_string = "";
         alignment_as_string = PrintAlignmentToString((const unsigned char *) read->get_data() + query_end + 1, clip_count_back,
-                                                     (const unsigned char *) (ref_data + alignment_position_end + 1), std::min(clip_count_back*2, (reference_start + reference_length - alignment_position_end - 1)),
+                                                     (const unsigned char *) (ref_data + (alignment_position_end - ref_data_offset) + 1), std::min(clip_count_back*2, (reference_start + reference_length - alignment_position_end - 1)),
                                                      (unsigned char *) &(leftover_right_alignment[0]), leftover_right_alignment.size(),
                                                      (0), EDLIB_MODE_SHW);
         LOG_DEBUG_SPEC("Aligning the end of the read:\n%s\n", alignment_as_string.c_str());
@@ -433,7 +433,7 @@ int AlignBack(AlignmentFunctionType AlignmentFunctionSHW,
   return 0;
 }
 
-int JoinAlignmentResults(std::vector<AlignmentResults> &alns, const SingleSequence *read, const int8_t *ref_data) {
+int JoinAlignmentResults(std::vector<AlignmentResults> &alns, const SingleSequence *read, const int8_t *ref_data, int64_t ref_data_offset) {
   if (alns.size() == 0) { return 1; }
 
   int32_t first = 0, last = alns.size() - 1;
@@ -480,7 +480,7 @@ int JoinAlignmentResults(std::vector<AlignmentResults> &alns, const SingleSequen
       int64_t min_count = std::min(num_trailing_indels, num_leading_indels);
       for (current_op1 = 0; current_op1 < min_count; current_op1++) {
 //        if ((ref_data + alignment_position_end + 1 + leftover_right_start - current_op1 - 1) == (read->get_data() + (query_end + 1) - current_op1))
-        if ((ref_data + alns[i].raw_pos_end - current_op1 - 1) == (read->get_data() + (alns[i].query_end + 1) - current_op1))
+        if ((ref_data + ((alns[i].raw_pos_end - ref_data_offset) - current_op1 - 1)) == (read->get_data() + (alns[i].query_end + 1) - current_op1))
           final_aln.raw_alignment[final_aln.raw_alignment.size() - current_op1 - 1] = EDLIB_EQUAL;
         else
           final_aln.raw_alignment[final_aln.raw_alignment.size() - current_op1 - 1] = EDLIB_X;
@@ -542,19 +542,31 @@ int AnchoredAlignmentNew(AlignmentFunctionType AlignmentFunctionNW, AlignmentFun
   int64_t reference_length = index->get_reference_lengths()[abs_ref_id];
   int64_t region_length_joined = 0, start_offset = 0, position_of_ref_end = 0;
 
+  DataWindow ref_window;                              // Holds the data of the region if it is linear.
   int8_t *ref_data  = (int8_t *) index->get_data();       // The data of the region.
+  int64_t ref_data_offset = 0;                        // Position of ref_data[0] on the original Index data. Positions on ref_data are relative to it.
   int64_t region_ref_start = region.start;            // Position of the start of the region on the original Index data. E.g. reg_data[0] is the same base as index->get_data()[index_pos].
   int64_t pos_of_ref_end = 0; // If the region was circular, it crosses the boundary between the end and the start of the data. ref_data[index_pos_of_ref_end] is the last base of the reference before the split part is concatenated.
   bool is_cleanup_required = NULL;  // If true, the region_data will have to be freed manually.
 
-  if (region.is_split == true) {
+  if (region.is_split == false && index->get_data() == NULL) {
+    // Unpack only the part of the reference which can be reached by the alignment: the anchors, plus the overhangs
+    // on both ends (which are aligned to at most twice their length). ref_data then starts at window_start.
+    int64_t clip_front = region_results->get_mapping_data().clusters.front().query.start;
+    int64_t clip_back = read->get_sequence_length() - region_results->get_mapping_data().clusters.back().query.end - 1;
+    int64_t window_start = std::max(ref_data_start, region_results->get_mapping_data().clusters.front().ref.start - 2 * clip_front - 1);
+    int64_t window_end = std::min(ref_data_start + ref_data_len, region_results->get_mapping_data().clusters.back().ref.end + 2 * clip_back + 1);
+    ref_data = (int8_t *) index->GetDataWindow(window_start, window_end, &ref_window);
+    ref_data_offset = window_start;
+
+  } else if (region.is_split == true) {
     LOG_DEBUG_SPEC("Concatenating regions for circular alignment.\n");
 //    ConcatenateSplitRegion(index, (Region *) &(region), &reg_data, &region_length_joined, &start_offset, &position_of_ref_end);
 //    ref_len = region_length_joined;
 
     // Here, a pointer to the beginning of the region is obtained. If the region was linear, reg_data just points to a location in the Index.
     // If the region was circular, reg_data points to a newly allocated memory for the concatenated region, and needs to be cleared.
-    int retval_region = GetRegionData(index, &region, &ref_data, &ref_data_len, &region_ref_start, &pos_of_ref_end, &is_cleanup_required);
+    int retval_region = GetRegionData(index, &region, &ref_window, &ref_data, &ref_data_len, &region_ref_start, &pos_of_ref_end, &is_cleanup_required);
     ref_data_start = 0;
 
 //    LOG_DEBUG_HIGH("\nConcatenating regions for circular alignment.\n");
@@ -616,7 +628,7 @@ int AnchoredAlignmentNew(AlignmentFunctionType AlignmentFunctionNW, AlignmentFun
 
   /// Aligning the begining of the read (in front of the first anchor).
   if (clip_count_front > 0) {
-    int ret_code_front = AlignFront(AlignmentFunctionSHW, read, index, parameters, region_results, ref_data_start, region_ref_start, ref_data, ref_data_len, clip_count_front, alignment_position_start, align_end_to_end, alns[num_alns]);
+    int ret_code_front = AlignFront(AlignmentFunctionSHW, read, index, parameters, region_results, ref_data_start, region_ref_start, ref_data, ref_data_offset, ref_data_len, clip_count_front, alignment_position_start, align_end_to_end, alns[num_alns]);
     alns_anchor_type[num_alns] = kAlnBeginning;
     num_alns += 1;
     if (ret_code_front) { return ret_code_front; }
@@ -630,7 +642,7 @@ int AnchoredAlignmentNew(AlignmentFunctionType AlignmentFunctionNW, AlignmentFun
 
     ///////////////////////////
     /// Align the anchor.
-    int ret_code_anchor = AlignAnchor(AlignmentFunctionNW, read, index, parameters, region_results, ref_data_start, region_ref_start, ref_data, ref_data_len, i, alns[num_alns]);
+    int ret_code_anchor = AlignAnchor(AlignmentFunctionNW, read, index, parameters, region_results, ref_data_start, region_ref_start, ref_data, ref_data_offset, ref_data_len, i, alns[num_alns]);
     alns_anchor_type[num_alns] = kAlnCluster;
     num_alns += 1;
     if (ret_code_anchor) { return ret_code_anchor; }
@@ -639,7 +651,7 @@ int AnchoredAlignmentNew(AlignmentFunctionType AlignmentFunctionNW, AlignmentFun
     ///////////////////////////
     /// Align in between the anchors.
     if ((i + 1) < region_results->get_mapping_data().clusters.size()) {
-      int ret_code_inbetween = AlignInBetweenAnchors(AlignmentFunctionNW, read, index, parameters, region_results, ref_data_start, region_ref_start, ref_data, ref_data_len, i, alns[num_alns]);
+      int ret_code_inbetween = AlignInBetweenAnchors(AlignmentFunctionNW, read, index, parameters, region_results, ref_data_start, region_ref_start, ref_data, ref_data_offset, ref_data_len, i, alns[num_alns]);
       alns_anchor_type[num_alns] = kAlnInBetween;
       num_alns += 1;
       if (ret_code_inbetween) { return ret_code_inbetween; }
@@ -649,7 +661,7 @@ int AnchoredAlignmentNew(AlignmentFunctionType AlignmentFunctionNW, AlignmentFun
   /// Aligning the end of the read.
   if (clip_count_back > 0) {
     LOG_DEBUG_SPEC("Trying to align the end of the read. clip_count_back = %ld\n", clip_count_back);
-    int ret_code_back = AlignBack(AlignmentFunctionSHW, read, index, parameters, region_results, ref_data_start, region_ref_start, ref_data, ref_data_len, clip_count_back, ref_data_start, alignment_position_end, align_end_to_end, alns[num_alns]);
+    int ret_code_back = AlignBack(AlignmentFunctionSHW, read, index, parameters, region_results, ref_data_start, region_ref_start, ref_data, ref_data_offset, ref_data_len, clip_count_back, ref_data_start, alignment_position_end, align_end_to_end, alns[num_alns]);
 //    if (!ret_code_back) {
       alns_anchor_type[num_alns] = kAlnEnding;
       num_alns += 1;
@@ -674,7 +686,7 @@ int AnchoredAlignmentNew(AlignmentFunctionType AlignmentFunctionNW, AlignmentFun
 //    }
 //    LOG_DEBUG_SPEC("alns.size() = %ld, num_alns = %ld\n", alns.size(), num_alns);
 
-    JoinAlignmentResults(alns, read, ref_data);
+    JoinAlignmentResults(alns, read, ref_data, ref_data_offset);
 
 //    LOG_DEBUG_SPEC("aln.query_start = %ld\n", alns[0].query_start);
 //    LOG_DEBUG_SPEC("aln.query_end = %ld\n", alns[0].query_end);
@@ -711,25 +723,26 @@ int AnchoredAlignmentNew(AlignmentFunctionType AlignmentFunctionNW, AlignmentFun
 //    LOG_DEBUG_SPEC_NEWLINE;
 //  }
 
+  /// The E-value is calculated on the entire alignment. If it is linear, the operations are counted by EncodeAlignment below,
+  /// otherwise they need to be counted before the alignment is split.
+  bool is_circular_split = (region.is_split == true && parameters->is_reference_circular == true);
+
   for (int32_t i=0; i<alns.size(); i++) {
     AlignmentResults &aln = alns[i];
     aln.alignment = aln.raw_alignment;
 
   //  VerboseAlignment(read, index, parameters, &aln);
-    CountAlignmentOperations((std::vector<unsigned char> &) aln.raw_alignment, read->get_data(), ref_data, abs_ref_id, aln.raw_pos_start, orientation,
-                             parameters->evalue_match, parameters->evalue_mismatch, parameters->evalue_gap_open, parameters->evalue_gap_extend, true,
-                             &aln.num_eq_ops, &aln.num_x_ops, &aln.num_i_ops, &aln.num_d_ops, &aln.alignment_score, &aln.edit_distance, &aln.nonclipped_length);
-
-    LOG_DEBUG_SPEC("Calculating the E-value.\n");
-    CalculateEValueDNA(aln.alignment_score, aln.nonclipped_length, index->get_data_length_forward(), evalue_params, &aln.evalue);
-    LOG_DEBUG_SPEC("AS = %ld\n", aln.alignment_score);
-    LOG_DEBUG_SPEC("aln.num_eq_ops = %ld\n", aln.num_eq_ops);
-    LOG_DEBUG_SPEC("aln.num_x_ops = %ld\n", aln.num_x_ops);
-    LOG_DEBUG_SPEC("aln.num_i_ops = %ld\n", aln.num_i_ops);
-    LOG_DEBUG_SPEC("aln.num_d_ops = %ld\n", aln.num_d_ops);
+    if (is_circular_split == true) {
+      CountAlignmentOperations((std::vector<unsigned char> &) aln.raw_alignment, read->get_data(), ref_data, abs_ref_id, aln.raw_pos_start - ref_data_offset, orientation,
+                               parameters->evalue_match, parameters->evalue_mismatch, parameters->evalue_gap_open, parameters->evalue_gap_extend, true,
+                               &aln.num_eq_ops, &aln.num_x_ops, &aln.num_i_ops, &aln.num_d_ops, &aln.alignment_score, &aln.edit_distance, &aln.nonclipped_length);
+
+      LOG_DEBUG_SPEC("Calculating the E-value.\n");
+      CalculateEValueDNA(aln.alignment_score, aln.nonclipped_length, index->get_data_length_forward(), evalue_params, &aln.evalue);
+    }
 
     /// If alignment is linear, just add it. Otherwise, it needs to be split first.
-    if (region.is_split == false || parameters->is_reference_circular == false) {
+    if (is_circular_split == false) {
       LOG_DEBUG_SPEC("Alignment is linear.\n");
       if (orientation == kReverse) ReverseArray(aln.alignment);
       region_results->AddAlignmentData(aln);
@@ -798,6 +811,8 @@ int AnchoredAlignmentNew(AlignmentFunctionType AlignmentFunctionNW, AlignmentFun
   }
 
   /// Fill out statistics for each alignment (E-value calculation, couting of CIGAR operations, etc.) and check if the alignments are sane.
+  DataWindow aln_window;      // Reference of an alignment, in the raw orientation.
+  DataWindow md_window;       // Reference at the final position of an alignment, for the MD string.
   for (int32_t i=0; i<region_results->get_alignments().size(); i++) {
     AlignmentResults *curr_aln = &region_results->get_alignments()[i];
 
@@ -807,10 +822,6 @@ int AnchoredAlignmentNew(AlignmentFunctionType AlignmentFunctionNW, AlignmentFun
     LOG_DEBUG_SPEC("Alignment part %d / %d:\n", (i + 1), region_results->get_alignments().size());
 
     ConvertInsertionsToClipping((unsigned char *) &(curr_aln->raw_alignment[0]), curr_aln->raw_alignment.size());
-    int64_t num_clipped_front = 0, num_clipped_back = 0;
-    CountClippedBases((unsigned char *) &(curr_aln->raw_alignment[0]), curr_aln->raw_alignment.size(), &num_clipped_front, &num_clipped_back);
-    curr_aln->query_start = (curr_aln->orientation == kForward) ? num_clipped_front : num_clipped_back;
-    curr_aln->query_end = read->get_sequence_length() - ((curr_aln->orientation == kForward) ? num_clipped_back : num_clipped_front) - 1;
 
     /// This part converts the global alignment coordinates to local. 'Global' meaning the coordinates on the entire data array from the index.
     /// 'Local' meaning the coordinates on the reference that was hit (in range [0, ref_len>).
@@ -821,18 +832,18 @@ int AnchoredAlignmentNew(AlignmentFunctionType AlignmentFunctionNW, AlignmentFun
     curr_aln->ref_start = final_aln_pos_start; // % ref_len;
     curr_aln->ref_end = final_aln_pos_end; // % ref_data_len;
 
-    LOG_DEBUG_SPEC("Converting alignment to CIGAR string.\n");
-    curr_aln->cigar = AlignmentToCigar((unsigned char *) &(curr_aln->alignment[0]), curr_aln->alignment.size(), parameters->use_extended_cigar);
-
-    LOG_DEBUG_SPEC("Converting alignment to MD string.\n");
-    curr_aln->md = AlignmentToMD((std::vector<unsigned char> &) curr_aln->alignment, read->get_data(), index->get_data(), abs_ref_id, final_aln_pos_start);
-
-    LOG_DEBUG_SPEC("Counting alignment operations.\n");
-    CountAlignmentOperations((std::vector<unsigned char> &) curr_aln->raw_alignment, read->get_data(), index->get_data(), abs_ref_id, curr_aln->raw_pos_start, orientation,
-                             parameters->evalue_match, parameters->evalue_mismatch, parameters->evalue_gap_open, parameters->evalue_gap_extend, true,
-                             &curr_aln->num_eq_ops, &curr_aln->num_x_ops, &curr_aln->num_i_ops, &curr_aln->num_d_ops, &curr_aln->alignment_score, &curr_aln->edit_distance, &curr_aln->nonclipped_length);
-//    LOG_DEBUG_SPEC("Calculating the E-value.\n");
-//    CalculateEValueDNA(curr_aln->alignment_score, curr_aln->nonclipped_length, index->get_data_length_forward(), evalue_params, &curr_aln->evalue);
+    LOG_DEBUG_SPEC("Encoding the alignment (CIGAR, MD and operation counts).\n");
+    AlignmentEncoding encoding;
+    EncodeAlignment(curr_aln->raw_alignment, curr_aln->orientation, read->get_data(), index->GetDataWindow(curr_aln->raw_pos_start, curr_aln->raw_pos_start + curr_aln->raw_alignment.size(), &aln_window), 0,
+                    index->GetDataWindow(final_aln_pos_start, final_aln_pos_start + curr_aln->raw_alignment.size(), &md_window), 0, parameters->use_extended_cigar,
+                    parameters->evalue_match, parameters->evalue_mismatch, parameters->evalue_gap_open, parameters->evalue_gap_extend, &encoding);
+    SetAlignmentEncoding(encoding, curr_aln);
+    curr_aln->query_start = (curr_aln->orientation == kForward) ? encoding.num_clipped_front : encoding.num_clipped_back;
+    curr_aln->query_end = read->get_sequence_length() - ((curr_aln->orientation == kForward) ? encoding.num_clipped_back : encoding.num_clipped_front) - 1;
+    if (is_circular_split == false) {
+      LOG_DEBUG_SPEC("Calculating the E-value.\n");
+      CalculateEValueDNA(curr_aln->alignment_score, curr_aln->nonclipped_length, index->get_data_length_forward(), evalue_params, &curr_aln->evalue);
+    }
 
     LOG_DEBUG_SPEC("Checking if the alignment is sane.\n");
     if (CheckAlignmentSane((std::vector<unsigned char> &) curr_aln->raw_alignment, read, index, curr_aln->ref_id, curr_aln->ref_start) != 0) {
@@ -876,6 +887,7 @@ int AnchoredAlignmentNew(AlignmentFunctionType AlignmentFunctionNW, AlignmentFun
   int64_t ref_start = index->get_reference_starting_pos()[region.reference_id];
   int64_t ref_len = index->get_reference_lengths()[region.reference_id];
 
+  DataWindow reg_window;            // Holds the data of a linear region.
   int8_t *reg_data = NULL;       // The data of the region.
   int64_t reg_data_len = 0;         // Length of the region_data.
   int64_t index_pos = 0;            // Position of the start of the region on the original Index data. E.g. reg_data[0] is the same base as index->get_data()[index_pos].
@@ -886,7 +898,7 @@ int AnchoredAlignmentNew(AlignmentFunctionType AlignmentFunctionNW, AlignmentFun
 
   // Here, a pointer to the beginning of the region is obtained. If the region was linear, reg_data just points to a location in the Index.
   // If the region was circular, reg_data points to a newly allocated memory for the concatenated region, and needs to be cleared.
-  int retval_region = GetRegionData(index, &region, &reg_data, &reg_data_len, &index_pos, &pos_of_ref_end, &is_cleanup_required);
+  int retval_region = GetRegionData(index, &region, &reg_window, &reg_data, &reg_data_len, &index_pos, &pos_of_ref_end, &is_cleanup_required);
 
   AlignmentResults aln;
 
@@ -980,6 +992,8 @@ int AnchoredAlignmentNew(AlignmentFunctionType AlignmentFunctionNW, AlignmentFun
   }
 
   /// Fill out statistics for each alignment (E-value calculation, couting of CIGAR operations, etc.) and check if the alignments are sane.
+  DataWindow aln_window;      // Reference of an alignment, in the raw orientation.
+  DataWindow md_window;       // Reference at the final position of an alignment, for the MD string.
   for (int32_t i=0; i<region_results->get_alignments().size(); i++) {
     AlignmentResults *curr_aln = &region_results->get_alignments()[i];
 
@@ -1005,7 +1019,8 @@ int AnchoredAlignmentNew(AlignmentFunctionType AlignmentFunctionNW, AlignmentFun
     curr_aln->cigar = AlignmentToCigar((unsigned char *) &(curr_aln->alignment[0]), curr_aln->alignment.size(), parameters->use_extended_cigar);
 
     LOG_DEBUG_SPEC("Converting alignment to MD string.\n");
-    curr_aln->md = AlignmentToMD((std::vector<unsigned char> &) curr_aln->alignment, read->get_data(), index->get_data(), ref_id, curr_aln->ref_start + ref_start + index->get_reference_starting_pos()[ref_id]);
+    int64_t md_pos = curr_aln->ref_start + ref_start + index->get_reference_starting_pos()[ref_id];
+    curr_aln->md = AlignmentToMD((std::vector<unsigned char> &) curr_aln->alignment, read->get_data(), index->GetDataWindow(md_pos, md_pos + curr_aln->alignment.size(), &md_window), ref_id, 0);
 
     LOG_DEBUG_SPEC("Counting alignment operations.\n");
     CountAlignmentOperations((std::vector<unsigned char> &) curr_aln->raw_alignment, read->get_data(), reg_data, ref_id, curr_aln->reg_pos_start, orientation,
@@ -602,7 +602,7 @@ std::string AlignmentToMD(std::vector<unsigned char>& alignment, const int8_t *r
     if (cigar_array[i].op != '=' && cigar_array[i].op != 'X' && cigar_array[i].op != 'M' && cigar_array[i].op != 'D') {
       offset += 1;
       continue;
-    } else if (i > 0 && cigar_array[i].op == cigar_array[i-offset-1].op) {
+    } else if ((i - offset) > 0 && cigar_array[i].op == cigar_array[i-offset-1].op) {
       cigar_array[i-offset-1].count += cigar_array[i].count;
       offset += 1;
       continue;
@@ -686,3 +686,205 @@ int GetAlignmentPatterns(const unsigned char* query, const int64_t queryLength,
 
   return 0;
 }
+
+// A run of the same operation in the alignment array.
+struct AlignmentRun {
+  unsigned char op;
+  int64_t count;
+};
+
+static inline void AppendCount(std::string &s, int64_t count) {
+  char buffer[24];
+  int num_digits = 0;
+  do {
+    buffer[num_digits++] = '0' + (count % 10);
+    count /= 10;
+  } while (count > 0);
+  while (num_digits > 0) {
+    s.push_back(buffer[--num_digits]);
+  }
+}
+
+// Appends an operation of the CIGAR string, merging it with the previous one if it is the same. The last operation is
+// written when called with op == EDLIB_NOP. Returns 1 if the operation cannot be represented in the CIGAR string.
+static inline int AppendCigarOp(std::string &cigar, bool extended_format, unsigned char op, int64_t count, unsigned char *pending_op, int64_t *pending_count) {
+  if (extended_format == false && op == EDLIB_X) { op = EDLIB_M; }
+  if (op == *pending_op) {
+    *pending_count += count;
+    return 0;
+  }
+  if (*pending_count > 0) {
+    char op_char = (extended_format == true) ? EdlibOpToCharExtended(*pending_op) : EdlibOpToChar(*pending_op);
+    if (op_char == 0 || *pending_op == EDLIB_H) { return 1; }
+    AppendCount(cigar, *pending_count);
+    cigar.push_back(op_char);
+  }
+  *pending_op = op;
+  *pending_count = count;
+  return 0;
+}
+
+// Appends a merged run of '=', 'X' or 'D' operations to the MD string. Runs with the same operation separated only by
+// insertions or clipping are merged by the caller, so a mismatch/deletion run covers consecutive reference bases.
+static inline void AppendMDRun(std::string &md, unsigned char op, int64_t count, int64_t ref_position, const int8_t *ref_data, bool has_next, unsigned char next_op) {
+  if (op == EDLIB_EQUAL) {
+    AppendCount(md, count);
+  } else if (op == EDLIB_X) {
+    for (int64_t j = 0; j < count; j++) {
+      md.push_back((char) ref_data[ref_position + j]);
+      if ((j + 1) < count) { md.push_back('0'); }
+    }
+  } else if (op == EDLIB_D) {
+    md.push_back('^');
+    for (int64_t j = 0; j < count; j++) {
+      md.push_back((char) ref_data[ref_position + j]);
+    }
+  }
+  if (has_next == true && op != EDLIB_EQUAL && next_op != EDLIB_EQUAL) {
+    md.push_back('0');
+  }
+}
+
+int EncodeAlignment(const std::vector<unsigned char> &raw_alignment, SeqOrientation orientation,
+                    const int8_t *read_data, const int8_t *ref_data, int64_t alignment_position_start,
+                    const int8_t *md_ref_data, int64_t md_position_start, bool extended_format,
+                    int64_t match, int64_t mismatch, int64_t gap_open, int64_t gap_extend,
+                    AlignmentEncoding *ret) {
+  *ret = AlignmentEncoding();
+  if (raw_alignment.size() == 0) {
+    ret->cigar = "*-";
+    return 0;
+  }
+
+  const unsigned char *alignment = &raw_alignment[0];
+  int64_t alignment_length = raw_alignment.size();
+
+  // The only pass over the alignment: collects the runs of operations, counts the operations within the non-clipped
+  // part (same as CountAlignmentOperations), and counts the clipped bases on both ends (same as CountClippedBases).
+  std::vector<AlignmentRun> runs;
+  runs.reserve(64);
+
+  int64_t read_position = 0, ref_position = 0;
+  int64_t num_eq = 0, num_x = 0, num_i = 0, num_d = 0, alignment_score = 0, nonclipped_length = 0;
+  int64_t num_clipped_front = 0, num_clipped_back = 0;
+  bool in_body = false;                   // After the leading insertions/clipping.
+  int64_t pending_i = 0, pending_i_score = 0;   // Insertions are counted only if they are not trailing.
+
+  for (int64_t i = 0; i < alignment_length; i++) {
+    unsigned char op = alignment[i];
+    bool is_new_run = (i == 0 || op != alignment[i - 1]);
+
+    if (is_new_run == true) {
+      AlignmentRun run = { op, 1 };
+      runs.push_back(run);
+    } else {
+      runs.back().count += 1;
+    }
+
+    if (op == EDLIB_S || op == EDLIB_I) {
+      if (in_body == false) { num_clipped_front += 1; }
+      num_clipped_back += 1;
+    } else {
+      num_clipped_back = 0;
+    }
+
+    if (in_body == false && op != EDLIB_S && op != EDLIB_I) {
+      in_body = true;
+    }
+
+    if (in_body == true) {
+      if (op != EDLIB_I && pending_i > 0) {
+        num_i += pending_i;
+        nonclipped_length += pending_i;
+        alignment_score -= pending_i_score;
+        pending_i = 0;
+        pending_i_score = 0;
+      }
+
+      if (op == EDLIB_M || op == EDLIB_EQUAL || op == EDLIB_X) {
+        if (read_data[read_position] == ref_data[alignment_position_start + ref_position]) {
+          num_eq += 1;
+          alignment_score += match;
+        } else {
+          num_x += 1;
+          alignment_score -= mismatch;
+        }
+        nonclipped_length += 1;
+
+      } else if (op == EDLIB_I) {
+        pending_i += 1;
+        pending_i_score += (is_new_run == true) ? gap_open : gap_extend;
+
+      } else if (op == EDLIB_D) {
+        num_d += 1;
+        alignment_score -= (is_new_run == true) ? gap_open : gap_extend;
+      }
+    }
+
+    if (op == EDLIB_M || op == EDLIB_EQUAL || op == EDLIB_X || op == EDLIB_I || op == EDLIB_S)
+      read_position += 1;
+    if (op == EDLIB_M || op == EDLIB_EQUAL || op == EDLIB_X || op == EDLIB_D)
+      ref_position += 1;
+  }
+
+  ret->num_eq_ops = num_eq;
+  ret->num_x_ops = num_x;
+  ret->num_i_ops = num_i;
+  ret->num_d_ops = num_d;
+  ret->alignment_score = alignment_score;
+  ret->edit_distance = num_x + num_i + num_d;
+  ret->nonclipped_length = nonclipped_length;
+  ret->num_clipped_front = num_clipped_front;
+  ret->num_clipped_back = num_clipped_back;
+
+  // Leading and trailing insertions are reported as clipping (as in AlignmentToBasicCigar).
+  if (runs.front().op == EDLIB_I) { runs.front().op = EDLIB_S; }
+  if (runs.back().op == EDLIB_I) { runs.back().op = EDLIB_S; }
+
+  // The CIGAR and MD strings are generated from the runs, in the orientation of the reported alignment (reverse
+  // complemented read for kReverse), so the alignment array does not need to be reversed for them.
+  int64_t num_runs = runs.size();
+  bool is_reverse = (orientation == kReverse);
+  ret->cigar.reserve(num_runs * 4);
+
+  unsigned char cigar_pending_op = EDLIB_NOP;
+  int64_t cigar_pending_count = 0;
+  int cigar_error = 0;
+
+  unsigned char md_pending_op = EDLIB_NOP;
+  int64_t md_pending_count = 0, md_pending_ref_position = 0;
+  int64_t md_ref_position = 0;
+
+  for (int64_t k = 0; k < num_runs; k++) {
+    const AlignmentRun &run = runs[(is_reverse == false) ? k : (num_runs - k - 1)];
+
+    cigar_error |= AppendCigarOp(ret->cigar, extended_format, run.op, run.count, &cigar_pending_op, &cigar_pending_count);
+
+    // Only the reference-consuming operations are reported in MD. Runs of the same operation separated by insertions
+    // or clipping are merged (as in AlignmentToMD).
+    if (run.op == EDLIB_EQUAL || run.op == EDLIB_X || run.op == EDLIB_D) {
+      if (run.op == md_pending_op) {
+        md_pending_count += run.count;
+      } else {
+        if (md_pending_count > 0) {
+          AppendMDRun(ret->md, md_pending_op, md_pending_count, md_position_start + md_pending_ref_position, md_ref_data, true, run.op);
+        }
+        md_pending_op = run.op;
+        md_pending_count = run.count;
+        md_pending_ref_position = md_ref_position;
+      }
+      md_ref_position += run.count;
+    }
+  }
+  cigar_error |= AppendCigarOp(ret->cigar, extended_format, EDLIB_NOP, 0, &cigar_pending_op, &cigar_pending_count);
+  if (md_pending_count > 0) {
+    AppendMDRun(ret->md, md_pending_op, md_pending_count, md_position_start + md_pending_ref_position, md_ref_data, false, EDLIB_NOP);
+  }
+
+  if (cigar_error) {
+    ret->cigar = "";
+    return EDLIB_STATUS_ERROR;
+  }
+
+  return 0;
+}
@@ -66,6 +66,31 @@ int CountAlignmentOperations(std::vector<unsigned char> &alignment, const int8_t
                              int64_t match, int64_t mismatch, int64_t gap_open, int64_t gap_extend,
                              bool skip_leading_and_trailing_insertions,
                              int64_t *ret_eq, int64_t *ret_x, int64_t *ret_i, int64_t *ret_d, int64_t *ret_alignment_score, int64_t *ret_edit_dist, int64_t *ret_nonclipped_length);
+/// Everything reported for an alignment which is derived from its operations. Filled out by EncodeAlignment.
+struct AlignmentEncoding {
+  std::string cigar = "";
+  std::string md = "";
+  int64_t num_eq_ops = 0;
+  int64_t num_x_ops = 0;
+  int64_t num_i_ops = 0;
+  int64_t num_d_ops = 0;
+  int64_t alignment_score = 0;
+  int64_t edit_distance = 0;
+  int64_t nonclipped_length = 0;
+  int64_t num_clipped_front = 0;      // Leading clipped bases (or insertions) of the raw alignment, as CountClippedBases.
+  int64_t num_clipped_back = 0;       // Trailing clipped bases (or insertions) of the raw alignment.
+};
+/// Generates the CIGAR and MD strings, counts the operations and the clipped bases of an alignment in a single pass over
+/// raw_alignment. The results are the same as AlignmentToCigar and AlignmentToMD on the reported (for kReverse reversed)
+/// alignment, and CountAlignmentOperations (skipping the leading and trailing insertions) and CountClippedBases on the raw
+/// alignment, but the reversed copy of the alignment is not needed.
+/// read_data/ref_data and alignment_position_start are the sequences in the raw orientation, as for CountAlignmentOperations,
+/// and md_ref_data/md_position_start the forward reference at the start of the reported alignment, as for AlignmentToMD.
+int EncodeAlignment(const std::vector<unsigned char> &raw_alignment, SeqOrientation orientation,
+                    const int8_t *read_data, const int8_t *ref_data, int64_t alignment_position_start,
+                    const int8_t *md_ref_data, int64_t md_position_start, bool extended_format,
+                    int64_t match, int64_t mismatch, int64_t gap_open, int64_t gap_extend,
+                    AlignmentEncoding *ret);
 /// Reverses the operations in a CIGAR string.
 std::string ReverseCigarString(std::string &cigar);
 
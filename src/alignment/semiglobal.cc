@@ -20,6 +20,8 @@ int SemiglobalAlignment(AlignmentFunctionType AlignmentFunction,
   int64_t ref_len = index->get_reference_lengths()[region.reference_id];
   int64_t reference_length = index->get_reference_lengths()[abs_ref_id];
 
+  DataWindow reg_window;            // Holds the data of a linear region.
+  DataWindow md_window;             // Reference at the final position of an alignment, for the MD string.
   int8_t *reg_data = NULL;       // The data of the region.
   int64_t reg_data_len = 0;         // Length of the region_data.
   int64_t index_pos = 0;            // Position of the start of the region on the original Index data. E.g. reg_data[0] is the same base as index->get_data()[index_pos].
@@ -32,7 +34,7 @@ int SemiglobalAlignment(AlignmentFunctionType AlignmentFunction,
 
   // Here, a pointer to the beginning of the region is obtained. If the region was linear, reg_data just points to a location in the Index.
   // If the region was circular, reg_data points to a newly allocated memory for the concatenated region, and needs to be cleared.
-  int retval_region = GetRegionData(index, &region, &reg_data, &reg_data_len, &index_pos, &pos_of_ref_end, &is_cleanup_required);
+  int retval_region = GetRegionData(index, &region, &reg_window, &reg_data, &reg_data_len, &index_pos, &pos_of_ref_end, &is_cleanup_required);
   GetL1PosInRegion(read, index, parameters, region_results, &l1_start, &l1_end);
 
   if (retval_region) {
@@ -91,15 +93,20 @@ int SemiglobalAlignment(AlignmentFunctionType AlignmentFunction,
   aln.aln_mode_code = EDLIB_MODE_HW;
   aln.alignment = aln.raw_alignment;
 
+  /// The E-value is calculated on the entire alignment. If it is linear, the operations are counted by EncodeAlignment below,
+  /// otherwise they need to be counted before the alignment is split.
+  bool is_circular_split = (region.is_split == true && parameters->is_reference_circular == true);
 //  VerboseAlignment(read, index, parameters, &aln);
-  CountAlignmentOperations((std::vector<unsigned char> &) aln.raw_alignment, read->get_data(), reg_data, ref_id, aln.reg_pos_start, orientation,
-                           parameters->evalue_match, parameters->evalue_mismatch, parameters->evalue_gap_open, parameters->evalue_gap_extend, true,
-                           &aln.num_eq_ops, &aln.num_x_ops, &aln.num_i_ops, &aln.num_d_ops, &aln.alignment_score, &aln.edit_distance, &aln.nonclipped_length);
-  LOG_DEBUG_SPEC("Calculating the E-value.\n");
-  CalculateEValueDNA(aln.alignment_score, aln.nonclipped_length, index->get_data_length_forward(), evalue_params, &aln.evalue);
+  if (is_circular_split == true) {
+    CountAlignmentOperations((std::vector<unsigned char> &) aln.raw_alignment, read->get_data(), reg_data, ref_id, aln.reg_pos_start, orientation,
+                             parameters->evalue_match, parameters->evalue_mismatch, parameters->evalue_gap_open, parameters->evalue_gap_extend, true,
+                             &aln.num_eq_ops, &aln.num_x_ops, &aln.num_i_ops, &aln.num_d_ops, &aln.alignment_score, &aln.edit_distance, &aln.nonclipped_length);
+    LOG_DEBUG_SPEC("Calculating the E-value.\n");
+    CalculateEValueDNA(aln.alignment_score, aln.nonclipped_length, index->get_data_length_forward(), evalue_params, &aln.evalue);
+  }
 
   /// If alignment is linear, just add it. Otherwise, it needs to be split first.
-  if (region.is_split == false || parameters->is_reference_circular == false) {
+  if (is_circular_split == false) {
     LOG_DEBUG_SPEC("Alignment is linear.\n");
     if (orientation == kReverse) ReverseArray(aln.alignment);
     region_results->AddAlignmentData(aln);
@@ -124,10 +131,6 @@ int SemiglobalAlignment(AlignmentFunctionType AlignmentFunction,
     LOG_DEBUG_SPEC("Alignment part %d / %d:\n", i, region_results->get_alignments().size());
 
     ConvertInsertionsToClipping((unsigned char *) &(curr_aln->raw_alignment[0]), curr_aln->raw_alignment.size());
-    int64_t num_clipped_front = 0, num_clipped_back = 0;
-    CountClippedBases((unsigned char *) &(curr_aln->raw_alignment[0]), curr_aln->raw_alignment.size(), &num_clipped_front, &num_clipped_back);
-    curr_aln->query_start = (curr_aln->orientation == kForward) ? num_clipped_front : num_clipped_back;
-    curr_aln->query_end = read->get_sequence_length() - ((curr_aln->orientation == kForward) ? num_clipped_back : num_clipped_front) - 1;
 
     /// This part converts the global alignment coordinates to local. 'Global' meaning the coordinates on the entire data array from the index.
     /// 'Local' meaning the coordinates on the reference that was hit (in range [0, ref_len>).
@@ -138,18 +141,19 @@ int SemiglobalAlignment(AlignmentFunctionType AlignmentFunction,
     curr_aln->ref_start = final_aln_pos_start; // % ref_len;
     curr_aln->ref_end = final_aln_pos_end; // % ref_len;
 
-    LOG_DEBUG_SPEC("Converting alignment to CIGAR string.\n");
-    curr_aln->cigar = AlignmentToCigar((unsigned char *) &(curr_aln->alignment[0]), curr_aln->alignment.size(), parameters->use_extended_cigar);
-
-    LOG_DEBUG_SPEC("Converting alignment to MD string.\n");
-    curr_aln->md = AlignmentToMD((std::vector<unsigned char> &) curr_aln->alignment, read->get_data(), index->get_data(), ref_id, curr_aln->ref_start + ref_start + index->get_reference_starting_pos()[ref_id]);
-
-    LOG_DEBUG_SPEC("Counting alignment operations.\n");
-    CountAlignmentOperations((std::vector<unsigned char> &) curr_aln->raw_alignment, read->get_data(), reg_data, ref_id, curr_aln->reg_pos_start, orientation,
-                             parameters->evalue_match, parameters->evalue_mismatch, parameters->evalue_gap_open, parameters->evalue_gap_extend, true,
-                             &curr_aln->num_eq_ops, &curr_aln->num_x_ops, &curr_aln->num_i_ops, &curr_aln->num_d_ops, &curr_aln->alignment_score, &curr_aln->edit_distance, &curr_aln->nonclipped_length);
-//    LOG_DEBUG_SPEC("Calculating the E-value.\n");
-//    CalculateEValueDNA(curr_aln->alignment_score, curr_aln->nonclipped_length, index->get_data_length_forward(), evalue_params, &curr_aln->evalue);
+    LOG_DEBUG_SPEC("Encoding the alignment (CIGAR, MD and operation counts).\n");
+    int64_t md_pos = curr_aln->ref_start + ref_start + index->get_reference_starting_pos()[ref_id];
+    AlignmentEncoding encoding;
+    EncodeAlignment(curr_aln->raw_alignment, curr_aln->orientation, read->get_data(), reg_data, curr_aln->reg_pos_start,
+                    index->GetDataWindow(md_pos, md_pos + curr_aln->raw_alignment.size(), &md_window), 0, parameters->use_extended_cigar,
+                    parameters->evalue_match, parameters->evalue_mismatch, parameters->evalue_gap_open, parameters->evalue_gap_extend, &encoding);
+    SetAlignmentEncoding(encoding, curr_aln);
+    curr_aln->query_start = (curr_aln->orientation == kForward) ? encoding.num_clipped_front : encoding.num_clipped_back;
+    curr_aln->query_end = read->get_sequence_length() - ((curr_aln->orientation == kForward) ? encoding.num_clipped_back : encoding.num_clipped_front) - 1;
+    if (is_circular_split == false) {
+      LOG_DEBUG_SPEC("Calculating the E-value.\n");
+      CalculateEValueDNA(curr_aln->alignment_score, curr_aln->nonclipped_length, index->get_data_length_forward(), evalue_params, &curr_aln->evalue);
+    }
 
 //    CountAlignmentOperations((std::vector<unsigned char> &) curr_aln->alignment,
 //                             read->get_data(), index->get_data() + curr_aln->ref_start + index->get_reference_starting_pos()[ref_id],
@@ -17,6 +17,10 @@ MappingData::MappingData() {
   num_seeds_over_limit = 0;
   num_seeds_with_no_hits = 0;
   num_seeds_errors = 0;
+  num_seeds_looked_up = 0;
+  num_seed_hits = 0;
+  num_regions_processed = 0;
+  num_anchors = 0;
 
   num_similar_mappings = 0;
   num_same_mappings = 0;
@@ -40,6 +44,10 @@ MappingData::MappingData() {
   time_region_conversion = 0.0;
   time_region_alloc = 0.0;
   time_region_counting = 0.0;
+  time_graph = 0.0;
+  time_lcsk = 0.0;
+  time_filtering = 0.0;
+  scratch_bytes = 0;
 }
 
 MappingData::~MappingData() {
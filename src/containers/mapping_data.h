@@ -59,6 +59,10 @@ class MappingData {
   int64_t num_seeds_over_limit;
   int64_t num_seeds_with_no_hits;
   int64_t num_seeds_errors;
+  int64_t num_seeds_looked_up;                   // Number of seed positions of the read looked up in region selection.
+  int64_t num_seed_hits;                         // Total number of seed hits on the reference in region selection.
+  int64_t num_regions_processed;                 // Number of regions which went through the graph stage.
+  int64_t num_anchors;                           // Total number of graph anchors, over all processed regions.
   int64_t iteration;
 
   int64_t num_similar_mappings;                  // Number of found mapping positions with very similar (estimated) scores. E.g. to within some difference from the top mapping.
@@ -81,6 +85,11 @@ class MappingData {
   double time_region_conversion;
   double time_region_alloc;
   double time_region_counting;
+  double time_graph;        // Graph mapping of all regions. Part of time_mapping, same as time_lcsk and time_filtering.
+  double time_lcsk;
+  double time_filtering;    // Post-processing of the regions, without the LCSk.
+
+  int64_t scratch_bytes;    // Peak working memory of the read (vertices, bins, score registry and LCSk buffers of a region), in bytes.
 
   bool IsMapped();
   bool IsAligned();
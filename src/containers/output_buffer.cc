@@ -0,0 +1,200 @@
+/*
+ * output_buffer.cc
+ *
+ *  Appendable character buffer with in-place number formatting, for the output records.
+ */
+
+#include "containers/output_buffer.h"
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+
+#define OUTPUT_BUFFER_MIN_CAPACITY      4096
+#define OUTPUT_FLOAT_PRECISION          6           // Significant digits of AppendFloat, the default of std::ostream.
+#define OUTPUT_FIXED_MAX_DECIMALS       9
+#define OUTPUT_FIXED_MAX_VALUE          1e15        // Larger values (rare in the output) are formatted with snprintf.
+
+static const uint64_t kPowersOfTen[] = { 1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+                                         100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL,
+                                         1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+                                         1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+                                         1000000000000000000ULL };
+
+// Writes the decimal digits of value to the end of buffer (backwards), and returns the pointer to the first digit.
+// At least min_digits are written, padded with zeros.
+static inline char* FormatDigitsBackwards(uint64_t value, int min_digits, char *buffer_end) {
+  char *p = buffer_end;
+  int num_digits = 0;
+  do {
+    *(--p) = '0' + (value % 10);
+    value /= 10;
+    num_digits += 1;
+  } while (value > 0);
+  while (num_digits < min_digits) {
+    *(--p) = '0';
+    num_digits += 1;
+  }
+  return p;
+}
+
+// Rounds value * 10^power to the nearest integer (ties to even, as printf). Negative powers divide by the exact
+// 10^-power, so that the ties stay exact.
+static inline uint64_t RoundScaled(double value, int power) {
+  if (power >= 0) {
+    return (uint64_t) nearbyintl(((long double) value) * powl(10.0L, power));
+  }
+  return (uint64_t) nearbyintl(((long double) value) / powl(10.0L, -power));
+}
+
+// Complement of the IUPAC nucleotide codes (both cases). Other characters are their own complement.
+static const char* GetComplementTable() {
+  static char table[256];
+  static bool initialized = false;
+  if (initialized == false) {
+    for (int i = 0; i < 256; i++) { table[i] = (char) i; }
+    const char *bases = "ACGTRYKMBVDHacgtrykmbvdh";
+    const char *complements = "TGCAYRMKVBHDtgcayrmkvbhd";
+    for (int i = 0; bases[i] != '\0'; i++) {
+      table[(unsigned char) bases[i]] = complements[i];
+    }
+    initialized = true;
+  }
+  return table;
+}
+static const char *kComplementTable = GetComplementTable();
+
+OutputBuffer::OutputBuffer() : size_(0) {
+}
+
+OutputBuffer::~OutputBuffer() {
+}
+
+void OutputBuffer::Grow_(int64_t min_capacity) {
+  int64_t capacity = std::max((int64_t) OUTPUT_BUFFER_MIN_CAPACITY, (int64_t) data_.size());
+  while (capacity < min_capacity) {
+    capacity *= 2;
+  }
+  data_.resize(capacity);
+}
+
+std::string OutputBuffer::str() const {
+  return std::string(data(), size_);
+}
+
+void OutputBuffer::AppendToFirstSpace(const char *s) {
+  const char *space = strchr(s, ' ');
+  Append(s, (space != NULL) ? (space - s) : strlen(s));
+}
+
+void OutputBuffer::AppendReverse(const char *data, int64_t length) {
+  if (length <= 0) { return; }
+  Reserve_(length);
+  char *dest = &data_[size_];
+  for (int64_t i = 0; i < length; i++) {
+    dest[i] = data[length - i - 1];
+  }
+  size_ += length;
+}
+
+void OutputBuffer::AppendReverseComplement(const char *seq, int64_t length) {
+  if (length <= 0) { return; }
+  Reserve_(length);
+  char *dest = &data_[size_];
+  for (int64_t i = 0; i < length; i++) {
+    dest[i] = kComplementTable[(unsigned char) seq[length - i - 1]];
+  }
+  size_ += length;
+}
+
+void OutputBuffer::AppendInt(int64_t value) {
+  char buffer[24];
+  char *end = buffer + sizeof(buffer);
+  // The magnitude is taken as unsigned, so that the smallest int64_t does not overflow.
+  uint64_t magnitude = (value < 0) ? (0 - ((uint64_t) value)) : ((uint64_t) value);
+  char *start = FormatDigitsBackwards(magnitude, 1, end);
+  if (value < 0) { *(--start) = '-'; }
+  Append(start, end - start);
+}
+
+void OutputBuffer::AppendFloat(double value) {
+  if (isnan(value)) { AppendCString((signbit(value)) ? "-nan" : "nan"); return; }
+  if (isinf(value)) { AppendCString((signbit(value)) ? "-inf" : "inf"); return; }
+  if (signbit(value)) { Append('-'); value = -value; }
+  if (value == 0.0) { Append('0'); return; }
+
+  // Round to OUTPUT_FLOAT_PRECISION significant digits: digits is in [10^(P-1), 10^P), and value ~= digits * 10^(exponent - P + 1).
+  const uint64_t min_digits = kPowersOfTen[OUTPUT_FLOAT_PRECISION - 1], max_digits = kPowersOfTen[OUTPUT_FLOAT_PRECISION];
+  int exponent = (int) floor(log10(value));
+  uint64_t digits = RoundScaled(value, OUTPUT_FLOAT_PRECISION - 1 - exponent);
+  if (digits >= max_digits) {
+    exponent += 1;
+    digits = RoundScaled(value, OUTPUT_FLOAT_PRECISION - 1 - exponent);
+  } else if (digits < min_digits) {
+    exponent -= 1;
+    digits = RoundScaled(value, OUTPUT_FLOAT_PRECISION - 1 - exponent);
+  }
+  if (digits >= max_digits) {   // Rounded up to the next power of ten.
+    digits /= 10;
+    exponent += 1;
+  }
+
+  char mantissa[OUTPUT_FLOAT_PRECISION];
+  FormatDigitsBackwards(digits, OUTPUT_FLOAT_PRECISION, mantissa + OUTPUT_FLOAT_PRECISION);
+  int num_significant = OUTPUT_FLOAT_PRECISION;     // Trailing zeros are not printed.
+  while (num_significant > 1 && mantissa[num_significant - 1] == '0') {
+    num_significant -= 1;
+  }
+
+  if (exponent < -4 || exponent >= OUTPUT_FLOAT_PRECISION) {
+    // Scientific notation, with at least two digits of the exponent.
+    Append(mantissa[0]);
+    if (num_significant > 1) {
+      Append('.');
+      Append(&mantissa[1], num_significant - 1);
+    }
+    char buffer[8];
+    char *end = buffer + sizeof(buffer);
+    char *start = FormatDigitsBackwards((exponent < 0) ? (-exponent) : exponent, 2, end);
+    *(--start) = (exponent < 0) ? '-' : '+';
+    *(--start) = 'e';
+    Append(start, end - start);
+
+  } else if (exponent < 0) {
+    Append("0.", 2);
+    for (int i = 0; i < (-exponent - 1); i++) { Append('0'); }
+    Append(mantissa, num_significant);
+
+  } else {
+    int num_integer = exponent + 1;
+    Append(mantissa, num_integer);
+    if (num_significant > num_integer) {
+      Append('.');
+      Append(&mantissa[num_integer], num_significant - num_integer);
+    }
+  }
+}
+
+void OutputBuffer::AppendFixed(double value, int decimals) {
+  if (isnan(value)) { AppendCString((signbit(value)) ? "-nan" : "nan"); return; }
+  if (isinf(value)) { AppendCString((signbit(value)) ? "-inf" : "inf"); return; }
+  if (decimals < 0 || decimals > OUTPUT_FIXED_MAX_DECIMALS || fabs(value) >= OUTPUT_FIXED_MAX_VALUE) {
+    char buffer[512];
+    int length = snprintf(buffer, sizeof(buffer), "%.*f", std::max(0, decimals), value);
+    Append(buffer, std::min((int64_t) length, (int64_t) sizeof(buffer) - 1));
+    return;
+  }
+
+  // Like printf, the sign is kept also when the value rounds to zero.
+  if (signbit(value)) { Append('-'); value = -value; }
+  uint64_t scaled = (uint64_t) nearbyintl(((long double) value) * kPowersOfTen[decimals]);
+
+  char buffer[48];
+  char *end = buffer + sizeof(buffer);
+  char *start = end;
+  if (decimals > 0) {
+    start = FormatDigitsBackwards(scaled % kPowersOfTen[decimals], decimals, end);
+    *(--start) = '.';
+  }
+  start = FormatDigitsBackwards(scaled / kPowersOfTen[decimals], 1, start);
+  Append(start, end - start);
+}
@@ -0,0 +1,84 @@
+/*
+ * output_buffer.h
+ *
+ *  Appendable character buffer for formatting the output records. The memory is kept between records (Clear only
+ *  resets the size), and numbers are formatted in place, so appending a record does not allocate once the buffer has
+ *  grown to the size of the largest chunk.
+ */
+
+#ifndef SRC_CONTAINERS_OUTPUT_BUFFER_H_
+#define SRC_CONTAINERS_OUTPUT_BUFFER_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+class OutputBuffer {
+ public:
+  OutputBuffer();
+  ~OutputBuffer();
+
+  inline void Append(char c) {
+    Reserve_(1);
+    data_[size_++] = c;
+  }
+  inline void Append(const char *data, int64_t length) {
+    if (length <= 0) { return; }
+    Reserve_(length);
+    memcpy(&data_[size_], data, length);
+    size_ += length;
+  }
+  inline void Append(const std::string &s) {
+    Append(s.c_str(), s.size());
+  }
+  // Null-terminated string.
+  inline void AppendCString(const char *s) {
+    Append(s, strlen(s));
+  }
+  // Null-terminated string up to its first space, same as TrimToFirstSpace.
+  void AppendToFirstSpace(const char *s);
+  // Reversed copy of the data, e.g. for the qualities of a reverse complemented read.
+  void AppendReverse(const char *data, int64_t length);
+  // Reverse complement of a nucleotide sequence. IUPAC codes are complemented as well, other characters are copied.
+  void AppendReverseComplement(const char *seq, int64_t length);
+
+  void AppendInt(int64_t value);
+  // Same as the default formatting of std::ostream (and printf "%g"), six significant digits.
+  void AppendFloat(double value);
+  // Same as printf "%.<decimals>f".
+  void AppendFixed(double value, int decimals);
+
+  // Truncates the buffer to the given size (drops everything appended after it). Capacity is kept.
+  inline void Resize(int64_t size) {
+    if (size < size_) { size_ = size; }
+  }
+  inline void Clear() {
+    size_ = 0;
+  }
+
+  inline int64_t size() const {
+    return size_;
+  }
+  inline const char* data() const {
+    return &data_[0];
+  }
+  // Allocated bytes, for the memory accounting.
+  inline int64_t capacity() const {
+    return data_.size();
+  }
+  std::string str() const;
+
+ private:
+  std::vector<char> data_;      // Only the first size_ characters are valid. Never shrinks.
+  int64_t size_;
+
+  inline void Reserve_(int64_t length) {
+    if ((size_ + length) > ((int64_t) data_.size())) {
+      Grow_(size_ + length);
+    }
+  }
+  void Grow_(int64_t min_capacity);
+};
+
+#endif /* SRC_CONTAINERS_OUTPUT_BUFFER_H_ */
@@ -284,102 +284,99 @@ void PathGraphEntry::AddAlignmentData(AlignmentResults alignment_info) {
   alignments_.push_back(alignment_info);
 }
 
-std::string PathGraphEntry::GenerateSAMFromInfoAlignment_(const AlignmentResults &alignment_info, const MappingMetadata &mapping_metadata, bool is_primary, int64_t verbose_sam_output) const {
-  std::stringstream ss;
-
-  std::string qname = ((std::string) (read_->get_header()));
-  std::string qname_for_out = (verbose_sam_output < 4) ? (TrimToFirstSpace(qname)) : (qname);
-  std::string rname = region_info_.rname;
-  std::string rname_for_out = (verbose_sam_output < 4) ? (TrimToFirstSpace(rname)) : (rname);
-
+void PathGraphEntry::AppendSAMFromInfoAlignment_(OutputBuffer &out, const AlignmentResults &alignment_info, const MappingMetadata &mapping_metadata, bool is_primary, int64_t verbose_sam_output) const {
   uint32_t reverse = (alignment_info.is_reverse == false) ? 0 : SAM_THIS_SEG_REVERSED;
   uint32_t mapped = (alignment_info.is_aligned) ? 0 : SAM_THIS_SEG_UNMAPPED;  // This means that the segment is mapped.
   uint32_t secondary_alignment = ((is_primary == true) ? (0) : (SAM_SECONDARY_ALIGNMENT));
   uint32_t flag = reverse | mapped | secondary_alignment;
 
-  std::string rnext = "*";
-  int64_t pnext = 0;
-  int64_t tlen = 0;
-
-  ss << qname_for_out << "\t";
-  ss << flag << "\t";
-  ss << rname_for_out << "\t";
-  ss << alignment_info.ref_start + 1 << "\t";
-  ss << ((int64_t) alignment_info.mapping_quality) << "\t";      // To avoid confusion with the definition of mapping quality, we will use the value of 255, and report the actual quality as AS optional parameter.
-  ss << alignment_info.cigar << "\t";
-  ss << rnext << "\t";
-  ss << pnext << "\t";
-  ss << tlen << "\t";
-
+  // The names are trimmed to the first space (same as TrimToFirstSpace) unless the verbose output is requested.
+  if (verbose_sam_output < 4) { out.AppendToFirstSpace(read_->get_header()); } else { out.AppendCString(read_->get_header()); }
+  out.Append('\t');
+  out.AppendInt(flag);
+  out.Append('\t');
+  if (verbose_sam_output < 4) { out.AppendToFirstSpace(region_info_.rname.c_str()); } else { out.Append(region_info_.rname); }
+  out.Append('\t');
+  out.AppendInt(alignment_info.ref_start + 1);
+  out.Append('\t');
+  out.AppendInt(alignment_info.mapping_quality);      // To avoid confusion with the definition of mapping quality, we will use the value of 255, and report the actual quality as AS optional parameter.
+  out.Append('\t');
+  out.Append(alignment_info.cigar);
+  out.Append("\t*\t0\t0\t", 7);                       // RNEXT, PNEXT and TLEN.
+
+  bool output_quality = (verbose_sam_output < 5 && read_->get_quality_length() > 0 && read_->get_quality() != NULL);
   if (alignment_info.is_reverse == false) {
-    ss << read_->get_data() << "\t";
-
-    if (verbose_sam_output < 5 && read_->get_quality_length() > 0 && read_->get_quality() != NULL) {
-      ss << read_->get_quality() << "\t";
-    } else {
-      ss << "*" << "\t";
-    }
-
+    out.AppendCString((const char *) read_->get_data());
+    out.Append('\t');
+    if (output_quality) { out.AppendCString((const char *) read_->get_quality()); } else { out.Append('*'); }
   } else {
-    ss << read_->GetReverseComplementAsString() << "\t";
-
-    if (verbose_sam_output < 5 && read_->get_quality_length() > 0 && read_->get_quality() != NULL) {
-      ss << read_->GetReverseQualityAsString() << "\t";
-    } else {
-      ss << "*" << "\t";
-    }
+    out.AppendReverseComplement((const char *) read_->get_data(), read_->get_data_length());
+    out.Append('\t');
+    if (output_quality) { out.AppendReverse((const char *) read_->get_quality(), read_->get_quality_length()); } else { out.Append('*'); }
   }
+  out.Append('\t');
 
-  std::stringstream ss_optional1;
-  if (alignment_info.md != "") ss_optional1 << "MD:Z:" << alignment_info.md << "\t";
-  ss_optional1 << "NM:i:" << alignment_info.edit_distance << "\t"; // Specified by SAM format.
-  ss_optional1 << "AS:i:" << alignment_info.alignment_score << "\t";
-  ss_optional1 << "H0:i:" << alignment_info.num_secondary_alns << "\t"; // Specified by SAM format.
-  ss_optional1 << "ZE:f:" << alignment_info.evalue << "\t";
-  ss_optional1 << "ZF:f:" << fpfilter_ << "\t";
-  ss_optional1 << "ZQ:i:" << read_->get_sequence_length() << "\t";
-  ss_optional1 << "ZR:i:" << index_->get_reference_lengths()[region_info_.reference_id];
-
-  ss << ss_optional1.str();
-
+  if (alignment_info.md != "") {
+    out.Append("MD:Z:", 5);
+    out.Append(alignment_info.md);
+    out.Append('\t');
+  }
+  out.Append("NM:i:", 5);     // Specified by SAM format.
+  out.AppendInt(alignment_info.edit_distance);
+  out.Append("\tAS:i:", 6);
+  out.AppendInt(alignment_info.alignment_score);
+  out.Append("\tH0:i:", 6);   // Specified by SAM format.
+  out.AppendInt(alignment_info.num_secondary_alns);
+  out.Append("\tZE:f:", 6);
+  out.AppendFloat(alignment_info.evalue);
+  out.Append("\tZF:f:", 6);
+  out.AppendFloat(fpfilter_);
+  out.Append("\tZQ:i:", 6);
+  out.AppendInt(read_->get_sequence_length());
+  out.Append("\tZR:i:", 6);
+  out.AppendInt(index_->get_reference_lengths()[region_info_.reference_id]);
+
+  // Debug output, formatted only on request.
   if (verbose_sam_output >= 3) {
     float mismatch_rate = (((float) (alignment_info.num_x_ops + alignment_info.num_i_ops + alignment_info.num_d_ops)) / ((float) (alignment_info.num_eq_ops + alignment_info.num_x_ops + alignment_info.num_d_ops + alignment_info.num_i_ops)));
     float match_rate = (((float) alignment_info.num_eq_ops) / ((float) alignment_info.nonclipped_length)); // ((float) read_->get_sequence_length()));
 
-    std::stringstream X3_ss;
-    X3_ss << VerboseToString("_");
-    X3_ss << "__region_votes=" << get_region_data().region_votes; // << "__max_region_votes=" << get_region_data()..bin_value << "__num_region_iterations=" << num_region_iterations_;
-    X3_ss << "__num_eq_ops=" << alignment_info.num_eq_ops << "__num_x_ops=" << alignment_info.num_x_ops << "__num_i_ops=" << alignment_info.num_i_ops << "__num_d_ops=" << alignment_info.num_d_ops << "__nonclippedlen=" << alignment_info.nonclipped_length << "__match_rate=" << FormatString("%.2f", match_rate) << "__error_rate=" << FormatString("%.2f", mismatch_rate);
-
-    ss << "\tX3:Z:" << X3_ss.str();
-
-    std::stringstream X4_ss;
-    X4_ss << "Timings(sec)__regionselection=" << mapping_metadata.time_region_selection <<
-             "_(lookup=" << mapping_metadata.time_region_seed_lookup <<
-             "_sort=" << mapping_metadata.time_region_hitsort <<
-             "_conv=" << mapping_metadata.time_region_conversion <<
-             "_alloc=" << mapping_metadata.time_region_alloc <<
-             "_count=" << mapping_metadata.time_region_counting <<
-             ")" <<
-             "__mapping=" << mapping_metadata.time_mapping <<
-             "__alignment=" << mapping_metadata.time_alignment;
-    ss << "\tX4:Z:" << X4_ss.str();
+    out.Append("\tX3:Z:", 6);
+    out.Append(VerboseToString("_"));
+    out.AppendCString("__region_votes="); out.AppendInt(get_region_data().region_votes);
+    out.AppendCString("__num_eq_ops="); out.AppendInt(alignment_info.num_eq_ops);
+    out.AppendCString("__num_x_ops="); out.AppendInt(alignment_info.num_x_ops);
+    out.AppendCString("__num_i_ops="); out.AppendInt(alignment_info.num_i_ops);
+    out.AppendCString("__num_d_ops="); out.AppendInt(alignment_info.num_d_ops);
+    out.AppendCString("__nonclippedlen="); out.AppendInt(alignment_info.nonclipped_length);
+    out.AppendCString("__match_rate="); out.AppendFixed(match_rate, 2);
+    out.AppendCString("__error_rate="); out.AppendFixed(mismatch_rate, 2);
+
+    out.Append("\tX4:Z:", 6);
+    out.AppendCString("Timings(sec)__regionselection="); out.AppendFloat(mapping_metadata.time_region_selection);
+    out.AppendCString("_(lookup="); out.AppendFloat(mapping_metadata.time_region_seed_lookup);
+    out.AppendCString("_sort="); out.AppendFloat(mapping_metadata.time_region_hitsort);
+    out.AppendCString("_conv="); out.AppendFloat(mapping_metadata.time_region_conversion);
+    out.AppendCString("_alloc="); out.AppendFloat(mapping_metadata.time_region_alloc);
+    out.AppendCString("_count="); out.AppendFloat(mapping_metadata.time_region_counting);
+    out.AppendCString(")__mapping="); out.AppendFloat(mapping_metadata.time_mapping);
+    out.AppendCString("__alignment="); out.AppendFloat(mapping_metadata.time_alignment);
   }
-
-  return ss.str();
 }
 
 std::string PathGraphEntry::GenerateSAM(bool is_primary, int64_t verbose_sam_output) const {
-  std::stringstream ss;
+  OutputBuffer out;
+  AppendSAM(out, is_primary, verbose_sam_output);
+  return out.str();
+}
 
+void PathGraphEntry::AppendSAM(OutputBuffer &out, bool is_primary, int64_t verbose_sam_output) const {
   for (int64_t i=0; i<alignments_.size(); i++) {
     if (alignments_[i].is_aligned == true) {
-      if (i > 0) { ss << "\n"; }
-      ss << GenerateSAMFromInfoAlignment_(alignments_[i], mapping_metadata_, (i == 0), verbose_sam_output);
+      if (i > 0) { out.Append('\n'); }
+      AppendSAMFromInfoAlignment_(out, alignments_[i], mapping_metadata_, (i == 0), verbose_sam_output);
     }
   }
-
-  return ss.str();
 }
 
 std::string PathGraphEntry::GenerateAFGFromInfoMappping(const MappingResults &mapping_info) const {
@@ -415,21 +412,21 @@ std::string PathGraphEntry::GenerateAFGFromInfoMappping(const MappingResults &ma
 }
 
 std::string PathGraphEntry::GenerateAFG() const {
-  std::stringstream ss;
+  OutputBuffer out;
+  AppendAFG(out);
+  return out.str();
+}
 
+void PathGraphEntry::AppendAFG(OutputBuffer &out) const {
   for (int64_t i=0; i<alignments_.size(); i++) {
     if (alignments_[i].is_aligned == true) {
-      if (i > 0) { ss << "\n"; }
-      ss << GenerateAFGFromInfoAlignment_(alignments_[i]);
+      if (i > 0) { out.Append('\n'); }
+      AppendAFGFromInfoAlignment_(out, alignments_[i]);
     }
   }
-
-  return ss.str();
 }
 
-std::string PathGraphEntry::GenerateAFGFromInfoAlignment_(const AlignmentResults &alignment_info) const {
-  std::stringstream ss;
-
+void PathGraphEntry::AppendAFGFromInfoAlignment_(OutputBuffer &out, const AlignmentResults &alignment_info) const {
 //  int64_t l = l1_info_.l1_l - ((int64_t) index_->get_reference_starting_pos()[region_info_.reference_id]);
 //  int64_t alignment_end = l1_info_.l1_k * ((float) read_->get_sequence_length()) + l;
 
@@ -439,10 +436,9 @@ std::string PathGraphEntry::GenerateAFGFromInfoAlignment_(const AlignmentResults
   char clip_op_front=0, clip_op_back=0;
   int64_t clip_count_front=0, clip_count_back=0;
   if (GetClippingOpsFromCigar(alignment_info.cigar, &clip_op_front, &clip_count_front, &clip_op_back, &clip_count_back)) {
-    return std::string("");
+    return;
   }
 
-  std::string adj = (alignment_info.is_reverse == false) ? OVERLAP_NORMAL : OVERLAP_INNIE;
   int64_t read1_id = read_->get_sequence_id() + 1;
   int64_t read2_id = (region_info_.reference_id % index_->get_num_sequences_forward()) + 1;
   int64_t score = alignment_info.alignment_score;
@@ -460,79 +456,81 @@ std::string PathGraphEntry::GenerateAFGFromInfoAlignment_(const AlignmentResults
   int64_t ahang = - (alignment_start - clip_count_front);
   int64_t bhang = index_->get_reference_lengths()[region_info_.reference_id] - (alignment_end + clip_count_back);
 
-  ss << "{OVL" << "\n";
-  ss << "adj:" << adj << "\n";
-  ss << "rds:" << read1_id << "," << read2_id << "\n";
-  ss << "scr:" << score << "\n";
-  ss << "ahg:" << ahang << "\n";
-  ss << "bhg:" << bhang << "\n";
-  ss << "}";
-
-  return ss.str();
+  out.AppendCString("{OVL\nadj:");
+  out.AppendCString((alignment_info.is_reverse == false) ? OVERLAP_NORMAL : OVERLAP_INNIE);
+  out.AppendCString("\nrds:");
+  out.AppendInt(read1_id);
+  out.Append(',');
+  out.AppendInt(read2_id);
+  out.AppendCString("\nscr:");
+  out.AppendInt(score);
+  out.AppendCString("\nahg:");
+  out.AppendInt(ahang);
+  out.AppendCString("\nbhg:");
+  out.AppendInt(bhang);
+  out.AppendCString("\n}");
 }
 
 std::string PathGraphEntry::GenerateM5(bool is_primary, int64_t verbose_sam_output) const {
-  std::stringstream ss;
+  OutputBuffer out;
+  AppendM5(out, is_primary, verbose_sam_output);
+  return out.str();
+}
 
+void PathGraphEntry::AppendM5(OutputBuffer &out, bool is_primary, int64_t verbose_sam_output) const {
   for (int64_t i=0; i<alignments_.size(); i++) {
     if (alignments_[i].is_aligned == true) {
-      if (i > 0) { ss << "\n"; }
-      ss << GenerateM5FromInfoAlignment_(alignments_[i], mapping_metadata_, (i == 0), verbose_sam_output);
+      if (i > 0) { out.Append('\n'); }
+      AppendM5FromInfoAlignment_(out, alignments_[i], mapping_metadata_, (i == 0), verbose_sam_output);
     }
   }
-
-  return ss.str();
 }
 
-std::string PathGraphEntry::GenerateM5FromInfoAlignment_(const AlignmentResults &alignment_info, const MappingMetadata &mapping_metadata, bool is_primary, int64_t verbose_sam_output) const {
-  std::stringstream ss;
-
-  std::string qname = ((std::string) (read_->get_header()));
-  std::string qname_for_out = (verbose_sam_output < 4) ? (TrimToFirstSpace(qname)) : (qname);
-  std::string rname = region_info_.rname;
-  std::string rname_for_out = (verbose_sam_output < 4) ? (TrimToFirstSpace(rname)) : (rname);
-
+void PathGraphEntry::AppendM5FromInfoAlignment_(OutputBuffer &out, const AlignmentResults &alignment_info, const MappingMetadata &mapping_metadata, bool is_primary, int64_t verbose_sam_output) const {
   int64_t qlen = read_->get_sequence_length();
   int64_t rlen = index_->get_reference_lengths()[region_info_.reference_id];
 
-  /// TODO: The aligned sequences and the match_pattern need to be calculated!
+  // The aligned sequences and the match pattern are built per alignment, they are as long as the alignment itself.
   std::string aligned_q = "", match_pattern = "", aligned_t = "";
+  int64_t aligned_ref_start = index_->get_reference_starting_pos()[alignment_info.ref_id] + alignment_info.ref_start;
+  DataWindow ref_window;
+  const int8_t *ref_data = index_->GetDataWindow(aligned_ref_start, aligned_ref_start + (alignment_info.ref_end - alignment_info.ref_start), &ref_window);
   if (alignment_info.is_reverse == false) {
     GetAlignmentPatterns((unsigned char *) read_->get_data(), read_->get_sequence_length(),
-                         (unsigned char *) &(index_->get_data()[index_->get_reference_starting_pos()[alignment_info.ref_id] + alignment_info.ref_start]), (alignment_info.ref_end - alignment_info.ref_start + 1),
+                         (unsigned char *) ref_data, (alignment_info.ref_end - alignment_info.ref_start + 1),
                          (unsigned char *) &alignment_info.alignment[0], alignment_info.alignment.size(),
                          aligned_q, aligned_t, match_pattern);
   } else {
     std::string rev = read_->GetReverseComplementAsString();
     GetAlignmentPatterns((unsigned char *) &(rev[0]), rev.size(),
-                         (unsigned char *) &(index_->get_data()[index_->get_reference_starting_pos()[alignment_info.ref_id] + alignment_info.ref_start]), (alignment_info.ref_end - alignment_info.ref_start + 1),
+                         (unsigned char *) ref_data, (alignment_info.ref_end - alignment_info.ref_start + 1),
                          (unsigned char *) &alignment_info.alignment[0], alignment_info.alignment.size(),
                          aligned_q, aligned_t, match_pattern);
   }
 
-  ss << qname_for_out << " ";
-  ss << qlen << " ";
-  ss << alignment_info.query_start << " ";
-  ss << alignment_info.query_end << " ";
-  ss << ((alignment_info.orientation == kForward) ? "+" : "-") << " ";
-
-  ss << rname_for_out << " ";
-  ss << rlen << " ";
-  ss << alignment_info.ref_start << " ";
-  ss << alignment_info.ref_end << " ";
-  ss << "+" << " ";
-
-  ss << alignment_info.alignment_score << " ";
-  ss << alignment_info.num_eq_ops << " ";
-  ss << alignment_info.num_x_ops << " ";
-  ss << alignment_info.num_i_ops << " ";
-  ss << alignment_info.num_d_ops << " ";
-  ss << alignment_info.mapping_quality << " ";
-  ss << aligned_q << " ";
-  ss << match_pattern << " ";
-  ss << aligned_t;
-
-  return ss.str();
+  if (verbose_sam_output < 4) { out.AppendToFirstSpace(read_->get_header()); } else { out.AppendCString(read_->get_header()); }
+  out.Append(' ');
+  out.AppendInt(qlen); out.Append(' ');
+  out.AppendInt(alignment_info.query_start); out.Append(' ');
+  out.AppendInt(alignment_info.query_end); out.Append(' ');
+  out.Append((alignment_info.orientation == kForward) ? '+' : '-'); out.Append(' ');
+
+  if (verbose_sam_output < 4) { out.AppendToFirstSpace(region_info_.rname.c_str()); } else { out.Append(region_info_.rname); }
+  out.Append(' ');
+  out.AppendInt(rlen); out.Append(' ');
+  out.AppendInt(alignment_info.ref_start); out.Append(' ');
+  out.AppendInt(alignment_info.ref_end); out.Append(' ');
+  out.Append("+ ", 2);
+
+  out.AppendInt(alignment_info.alignment_score); out.Append(' ');
+  out.AppendInt(alignment_info.num_eq_ops); out.Append(' ');
+  out.AppendInt(alignment_info.num_x_ops); out.Append(' ');
+  out.AppendInt(alignment_info.num_i_ops); out.Append(' ');
+  out.AppendInt(alignment_info.num_d_ops); out.Append(' ');
+  out.AppendInt(alignment_info.mapping_quality); out.Append(' ');
+  out.Append(aligned_q); out.Append(' ');
+  out.Append(match_pattern); out.Append(' ');
+  out.Append(aligned_t);
 }
 
 float PathGraphEntry::get_fpfilter_cov_bases() {
@@ -19,6 +19,7 @@
 //#include "sam/sam_entry.h"
 #include "containers/vertices.h"
 #include "containers/results.h"
+#include "containers/output_buffer.h"
 
 // N(ormal) would indicate both sequences are in the same orientation.
 #define OVERLAP_NORMAL          "N"
@@ -41,6 +42,10 @@ class PathGraphEntry {
   std::string GenerateSAM(bool is_primary, int64_t verbose_sam_output) const;
   std::string GenerateAFG() const;
   std::string GenerateM5(bool is_primary, int64_t verbose_sam_output) const;
+  // Same as the Generate functions above, but the lines are appended to out, without allocating per line.
+  void AppendSAM(OutputBuffer &out, bool is_primary, int64_t verbose_sam_output) const;
+  void AppendAFG(OutputBuffer &out) const;
+  void AppendM5(OutputBuffer &out, bool is_primary, int64_t verbose_sam_output) const;
 
   float CalcDistanceRatio() const;
   float CalcDistanceRatioSuppress() const;
@@ -106,10 +111,10 @@ class PathGraphEntry {
   float fpfilter_std_;
   float fpfilter_read_len_;
 
-  std::string GenerateSAMFromInfoAlignment_(const AlignmentResults &alignment_info, const MappingMetadata &mapping_metadata, bool is_primary, int64_t verbose_sam_output) const;
-  std::string GenerateAFGFromInfoAlignment_(const AlignmentResults &alignment_info) const;
+  void AppendSAMFromInfoAlignment_(OutputBuffer &out, const AlignmentResults &alignment_info, const MappingMetadata &mapping_metadata, bool is_primary, int64_t verbose_sam_output) const;
+  void AppendAFGFromInfoAlignment_(OutputBuffer &out, const AlignmentResults &alignment_info) const;
   std::string GenerateAFGFromInfoMappping(const MappingResults &mapping_info) const;
-  std::string GenerateM5FromInfoAlignment_(const AlignmentResults &alignment_info, const MappingMetadata &mapping_metadata, bool is_primary, int64_t verbose_sam_output) const;
+  void AppendM5FromInfoAlignment_(OutputBuffer &out, const AlignmentResults &alignment_info, const MappingMetadata &mapping_metadata, bool is_primary, int64_t verbose_sam_output) const;
 
 // private:
   static float CalcFPFactorReadLength_(int64_t read_length, int64_t db_size);
@@ -16,7 +16,7 @@ int CopyLinearRegion(const Index *index_reference, const Region *region, int8_t
     return 3;
   }
 
-  memmove((data_copy), &(index_reference->get_data()[region->start]), (region->end - region->start + 1));
+  index_reference->CopyData(region->start, (region->end - region->start + 1), data_copy);
 
   data_copy[(region->end - region->start + 1)] = '\0';
 
@@ -48,16 +48,16 @@ int ConcatenateSplitRegion(const Index *index_reference, const Region *region, i
   // If the main region is at the beginning of the reference. The region is then expanded towards left and right, but on the left it zips back
   // to the end of the circular reference.
   if (region->start < region->split_start) {
-    memmove(data_copy, &(index_reference->get_data()[region->split_start]), region_length_second);
-    memmove((data_copy + region_length_second), &(index_reference->get_data()[region->start]), region_length_first);
+    index_reference->CopyData(region->split_start, region_length_second, data_copy);
+    index_reference->CopyData(region->start, region_length_first, (data_copy + region_length_second));
     position_of_ref_end = region->split_end - region->split_start; // + 1;
     start_offset = region->split_start;
 
     // If the main region is at the end of the reference. The region is then expanded towards left and right, but on the right it zips back
     // to the beginning of the circular reference.
   } else {
-    memmove((data_copy), &(index_reference->get_data()[region->start]), region_length_first);
-    memmove((data_copy + region_length_first), &(index_reference->get_data()[region->split_start]), region_length_second);
+    index_reference->CopyData(region->start, region_length_first, data_copy);
+    index_reference->CopyData(region->split_start, region_length_second, (data_copy + region_length_first));
     position_of_ref_end = region->end - region->start;
     start_offset = region->start;
 
@@ -73,11 +73,12 @@ int ConcatenateSplitRegion(const Index *index_reference, const Region *region, i
   return 0;
 }
 
-int GetRegionData(const Index *index, const Region *region,
+int GetRegionData(const Index *index, const Region *region, DataWindow *window,
                   int8_t **region_data, int64_t *data_len, int64_t *index_reg_start, int64_t *pos_of_ref_end, bool *is_cleanup_required) {
 
   if (region->is_split == false) {
-    *region_data = (int8_t *) index->get_data() + region->start;
+    // For packed reference data only the region is unpacked, into the buffer of the window (no cleanup needed).
+    *region_data = (int8_t *) index->GetDataWindow(region->start, region->end, window);
     *data_len = (region->end - region->start);
     *index_reg_start = region->start;
     *pos_of_ref_end = -1;
@@ -32,10 +32,12 @@ int CopyLinearRegion(const Index *index_reference, const Region *region, int8_t
 // It is users responsibility to free the allocated space using delete[].
 int ConcatenateSplitRegion(const Index *index_reference, const Region *region, int8_t **ret_concatenated_data, int64_t *ret_data_length, int64_t *ret_start_offset, int64_t *ret_position_of_ref_end);
 
-// Checks if the region is linear or split. If the region is linear, it returns the pointer to the existing part of the Index data and is_cleanup_required is set to false.
+// Checks if the region is linear or split. If the region is linear, the region is fetched into the given window (pointing
+// to the existing part of the Index data, or to a copy in the window's buffer if the data is packed), region_data points
+// to its start and is_cleanup_required is set to false. The window needs to outlive the use of region_data.
 // Otherwise, a new data array is allocated and the data copied from the split parts of the Index.
 // If the is_cleanup_required parameter is true, region_data needs to be freed by the user using free().
-int GetRegionData(const Index *index, const Region *region,
+int GetRegionData(const Index *index, const Region *region, DataWindow *window,
                   int8_t **region_data, int64_t *data_len, int64_t *index_pos, int64_t *index_pos_of_ref_end, bool *is_cleanup_required);
 
 // Checks if the region is linear or split. It copies the data to a new array, and returns the pointer to the region data.
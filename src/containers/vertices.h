@@ -90,6 +90,10 @@ class Vertices {
 
   void Reserve(int64_t size);
   void Resize(int64_t size);
+  // Number of bytes allocated for the 9 arrays above.
+  inline int64_t CalcMemoryBytes() const {
+    return container_capacity * 9 * sizeof(int64_t);
+  }
 
   inline int CopyValuesWithin(int64_t source_idx, int64_t dest_idx) {
     if (source_idx >= num_vertices || dest_idx >= num_vertices || source_idx < 0 || dest_idx < 0) {
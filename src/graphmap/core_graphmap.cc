@@ -9,8 +9,9 @@
 
 
 
-int GraphMap::GraphMap_(ScoreRegistry* local_score, Index *index_read, MappingData* mapping_data, const std::vector<Index *> indexes, const SingleSequence* read, const ProgramParameters* parameters) {
+int GraphMap::GraphMap_(ScoreRegistry* local_score, ReadKmerIndex *index_read, MappingData* mapping_data, const std::vector<Index *> indexes, const SingleSequence* read, const ProgramParameters* parameters) {
   LOG_DEBUG_SPEC("Entered function. [time: %.2f sec, RSS: %ld MB, peakRSS: %ld MB]\n", (((float) (clock())) / CLOCKS_PER_SEC), getCurrentRSS() / (1024 * 1024), getPeakRSS() / (1024 * 1024));
+  TraceSpan trace_graph("GraphMap_", read->get_sequence_id(), read->get_sequence_length());
 
   uint64_t readlength = read->get_sequence_length();
 
@@ -24,8 +25,10 @@ int GraphMap::GraphMap_(ScoreRegistry* local_score, Index *index_read, MappingDa
     LogSystem::GetInstance().Log(VERBOSE_LEVEL_HIGH_DEBUG, read->get_sequence_id() == parameters->debug_read, FormatString("split_start = %ld, split_end = %ld\n", local_score->get_region().split_start, local_score->get_region().split_end), "[]");
   }
 
+  DataWindow data_window;
   const int8_t *data_ptr = NULL;
   int8_t *data_copy = NULL;
+  int64_t data_offset = 0;      // Position of data_ptr[0] on the index data.
   int64_t data_start = 0;
   int64_t data_end = 0;
 
@@ -33,9 +36,10 @@ int GraphMap::GraphMap_(ScoreRegistry* local_score, Index *index_read, MappingDa
   // This part takes care of the split regions.
   if (local_score->get_region().is_split == false) {
     local_score->Reserve((local_score->get_region().end - local_score->get_region().start) * 2);
-    data_ptr = indexes[0]->get_data();
     data_start = local_score->get_region().start;
     data_end = local_score->get_region().end - parameters->k_graph + 1;
+    data_ptr = indexes[0]->GetDataWindow(data_start, local_score->get_region().end, &data_window);
+    data_offset = data_start;
 
   } else {
     int64_t region_length_joined = 0, start_offset = 0, position_of_ref_end = 0;
@@ -47,10 +51,12 @@ int GraphMap::GraphMap_(ScoreRegistry* local_score, Index *index_read, MappingDa
   }
 
   // Go through all kmers from the reference (bounded by region coordinates).
+  TraceSpan trace_kmers("graph_kmers", read->get_sequence_id(), read->get_sequence_length());
   for (uint64_t i = data_start; i <= data_end; i++) {  // i+=parameters->kmer_step) {
-    ProcessKmerCacheFriendly_((int8_t *) &(data_ptr[i]), i, local_score, mapping_data, index_read, read, parameters);
+    ProcessKmerCacheFriendly_((int8_t *) &(data_ptr[i - data_offset]), i, local_score, mapping_data, index_read, read, parameters);
     mapping_data->iteration += 1;
   }
+  trace_kmers.End();
 
   // Ensures that the previous information stored in the vertices will not influence the current bin.
   mapping_data->iteration += parameters->num_links * 2;
@@ -70,7 +76,7 @@ int GraphMap::GraphMap_(ScoreRegistry* local_score, Index *index_read, MappingDa
   return 0;
 }
 
-int GraphMap::ProcessKmerCacheFriendly_(int8_t *kmer, int64_t kmer_start_position, ScoreRegistry *local_score, MappingData* mapping_data, Index *index_read, const SingleSequence* read, const ProgramParameters* parameters) {
+int GraphMap::ProcessKmerCacheFriendly_(int8_t *kmer, int64_t kmer_start_position, ScoreRegistry *local_score, MappingData* mapping_data, ReadKmerIndex *index_read, const SingleSequence* read, const ProgramParameters* parameters) {
 
   int64_t k = parameters->k_graph;
   int64_t num_links = parameters->num_links;
@@ -79,7 +85,7 @@ int GraphMap::ProcessKmerCacheFriendly_(int8_t *kmer, int64_t kmer_start_positio
   uint64_t num_hits = 0;
   int64_t *hits = NULL;
 
-  int ret_search = ((IndexHash *) index_read)->FindAllRawPositionsOfIncrementalSeed(kmer, (uint64_t) k, (uint64_t) parameters->max_num_hits, &hits, &hits_start, &num_hits);
+  int ret_search = index_read->FindAllRawPositionsOfIncrementalSeed(kmer, (uint64_t) k, (uint64_t) parameters->max_num_hits, &hits, &hits_start, &num_hits);
 
   if (ret_search == 1) {      // There are no hits for the current kmer.
     return 1;
@@ -7,6 +7,7 @@
 
 #include <omp.h>
 #include <algorithm>
+#include <functional>
 #include "libs/libdivsufsort-2.0.1-64bit/divsufsort64.h"
 #include "graphmap/graphmap.h"
 #include "index/index_hash.h"
@@ -15,11 +16,24 @@
 
 
 
-GraphMap::GraphMap() {
+GraphMap::GraphMap() : prefetched_reads_(NULL), prefetched_reads_ret_(1), slow_reads_fp_(NULL), num_slow_reads_(0) {
   indexes_.clear();
 }
 
 GraphMap::~GraphMap() {
+  if (prefetch_thread_.joinable()) {
+    prefetch_thread_.join();
+  }
+  if (prefetched_reads_) {
+    prefetched_reads_->CloseFileAfterBatchLoading();
+    delete prefetched_reads_;
+    prefetched_reads_ = NULL;
+  }
+  if (slow_reads_fp_) {
+    fclose(slow_reads_fp_);
+    slow_reads_fp_ = NULL;
+  }
+  ClearIndexReplicas_();
   for (int32_t i=0; i<indexes_.size(); i++) {
     if (indexes_[i]) { delete indexes_[i]; }
     indexes_[i] = NULL;
@@ -64,6 +78,10 @@ void GraphMap::Initialize(ProgramParameters& parameters, const clock_t &time_sta
 //    return;
 //  }
 
+  ResolveAutomaticParameters(parameters);
+}
+
+void GraphMap::ResolveAutomaticParameters(ProgramParameters &parameters) const {
   // Dynamic calculation of the number of allowed regions. This should be relative to the genome size.
   // The following formula has been chosen arbitrarily.
   // The dynamic calculation can be overridden by explicitly stating the max_num_regions in the arguments passed to the binary.
@@ -93,9 +111,9 @@ void GraphMap::Initialize(ProgramParameters& parameters, const clock_t &time_sta
   // we employ this simple heuristic.
   // The dynamic calculation can be overridden by explicitly stating the max_num_hits in the arguments passed to the binary.
   if (parameters.max_num_hits < 0) {
+    // The percentile is precomputed when the index is built and stored in the index file, so this is only a lookup.
     int64_t max_seed_count = 0;
-//    ((IndexSpacedHashFast *) this->indexes_[0])->CalcPercentileHits(0.9999, &parameters.max_num_hits, &max_seed_count);
-    ((IndexSpacedHashFast *) this->indexes_[0])->CalcPercentileHits(0.9999, &parameters.max_num_hits, &max_seed_count);
+    ((IndexSpacedHashFast *) this->indexes_[0])->CalcPercentileHits(REPETITIVE_KEY_PERCENTILE, &parameters.max_num_hits, &max_seed_count);
     LOG_ALL("Automatically setting the maximum number of seed hits to: %ld. Maximum seed occurrence in index: %ld.\n", parameters.max_num_hits, max_seed_count);
   } else if (parameters.max_num_hits == 0) {
     LOG_ALL("No limit to the maximum number of seed hits will be set in region selection.\n");
@@ -111,9 +129,11 @@ void GraphMap::RunOnFile(const ProgramParameters &parameters, std::string reads_
   FILE *fp_out = OpenOutSAMFile_(parameters_local.out_sam_path); // Checks if the output SAM file is specified. If it is not, then output to STDOUT.
 
   // Do the actual work.
+  StartMappingStats_(parameters_local);
   ProcessReadsFromSingleFile(parameters_local, fp_out);
   LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("\n"), "[]");
   LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("All reads processed in %.2f sec (or %.2f CPU min).\n", (((float) (clock() - last_time))/CLOCKS_PER_SEC), ((((float) (clock() - last_time))/CLOCKS_PER_SEC) / 60.0f)), "ProcessReads");
+  ReportMappingStats_(parameters_local);
 
   if (fp_out != stdout)
     fclose(fp_out);
@@ -126,6 +146,18 @@ void GraphMap::Run(ProgramParameters& parameters) {
   // Set the verbose level for the execution of this program.
   LogSystem::GetInstance().SetProgramVerboseLevelFromInt(parameters.verbose_level);
 
+  // Startup is overlapped: the first batch of reads is parsed in the background while the index is loaded,
+  // and the OpenMP thread pool used for mapping is spawned up front instead of on the first batch.
+  if (parameters.calc_only_index == false && parameters.process_reads_from_folder == false && parameters.reads_path.size() > 0) {
+    // With a memory budget, the batch size depends on the size of the loaded index, so the first batch is not prefetched.
+    if (parameters.max_memory <= 0) {
+      StartReadPrefetch_(parameters);
+    }
+    int64_t num_threads = std::max((int64_t) 1, GetNumMappingThreads_(parameters));
+    #pragma omp parallel num_threads(num_threads)
+    { }
+  }
+
   // Check if the index exists, and build it if it doesn't.
   BuildIndex(parameters);
   LogSystem::GetInstance().Log(VERBOSE_LEVEL_HIGH | VERBOSE_LEVEL_MED, true, FormatString("Memory consumption: %s\n\n", FormatMemoryConsumptionAsString().c_str()), "Index");
@@ -136,50 +168,7 @@ void GraphMap::Run(ProgramParameters& parameters) {
     return;
   }
 
-  // Dynamic calculation of the number of allowed regions. This should be relative to the genome size.
-  // The following formula has been chosen arbitrarily.
-  // The dynamic calculation can be overridden by explicitly stating the max_num_regions in the arguments passed to the binary.
-  if (parameters.max_num_regions == 0) {
-    if (this->indexes_[0]->get_data_length_forward() < 5000000){
-      parameters.max_num_regions = 500;          // Limit the number of allowed regions, because log10 will drop rapidly after this point.
-    } else {
-      float M10 = 1000;                          // Baseline number of allowed regions. M10 is the number of allowed regions for 10Mbp reference size.
-      float factor = log10(((float) this->indexes_[0]->get_data_length()) / 1000000.0f);     // How many powers of 10 above 1 million?
-      parameters.max_num_regions = (int64_t) (M10 * factor);
-    }
-    LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Automatically setting the maximum allowed number of regions: max. %ld, attempt to reduce after %ld\n", parameters.max_num_regions, parameters.max_num_regions_cutoff), "Run");
-
-  } else if (parameters.max_num_regions < 0) {
-    LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("No limit to the maximum allowed number of regions will be set.\n"), "Run");
-  }
-
-  // The dynamic calculation can be overridden by explicitly stating the max_num_regions_cutoff in the arguments passed to the binary.
-  if (parameters.max_num_regions_cutoff == 0) {
-    parameters.max_num_regions_cutoff = (parameters.max_num_regions < 0) ? (parameters.max_num_regions) : (parameters.max_num_regions / 5);
-  }
-
-  // Dynamic calculation of the number of allowed kmer hits for region selection.
-  // The following formula has been chosen arbitrarily.
-  // The correct value would be the one that calculates the mean (or median) of the kspectra and its standard deviation
-  // to detect outliers, but calculating the kspectra could be time and memory consuming for larger genomes. That is why
-  // we employ this simple heuristic.
-  // The dynamic calculation can be overridden by explicitly stating the max_num_hits in the arguments passed to the binary.
-  if (parameters.max_num_hits < 0) {
-    // This is how it was done previously.
-//    int64_t num_kmers = (1 << (parameters.k_region * 2));
-//    int64_t num_kmers_in_genome = (this->indexes_[0]->get_data_length_forward() * 2) - parameters.k_region + 1;
-//    double average_num_kmers = ((double) num_kmers_in_genome) / ((double) num_kmers);
-//    parameters.max_num_hits = (int64_t) ceil(average_num_kmers) * 500;
-    int64_t max_seed_count = 0;
-//    ((IndexSpacedHashFast *) this->indexes_[0])->CalcPercentileHits(0.9999, &parameters.max_num_hits, &max_seed_count);
-    ((IndexSpacedHashFast *) this->indexes_[0])->CalcPercentileHits(0.9999, &parameters.max_num_hits, &max_seed_count);
-    LOG_ALL("Automatically setting the maximum number of seed hits to: %ld. Maximum seed occurrence in index: %ld.\n", parameters.max_num_hits, max_seed_count);
-
-//    LogSystem::GetInstance().VerboseLog(VERBOSE_LEVEL_ALL, true, FormatString("Automatically setting the maximum number of kmer hits: %ld\n", parameters.max_num_hits), "Run");
-//    ErrorReporting::GetInstance().VerboseLog(VERBOSE_LEVEL_ALL, true, FormatString("\tmax_num_hits = %ld\n", parameters.max_num_hits), "Run");
-  } else if (parameters.max_num_hits == 0) {
-    LOG_ALL("No limit to the maximum number of seed hits will be set in region selection.\n");
-  }
+  ResolveAutomaticParameters(parameters);
 
   if (parameters.is_reference_circular == false)
     LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Reference genome is assumed to be linear.\n"), "Run");
@@ -206,9 +195,11 @@ void GraphMap::Run(ProgramParameters& parameters) {
     FILE *fp_out = OpenOutSAMFile_(parameters.out_sam_path); // Checks if the output SAM file is specified. If it is not, then output to STDOUT.
 
     // Do the actual work.
+    StartMappingStats_(parameters);
     ProcessReadsFromSingleFile(parameters, fp_out);
     LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("\n"), "[]");
     LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("All reads processed in %.2f sec (or %.2f CPU min).\n", (((float) (clock() - last_time))/CLOCKS_PER_SEC), ((((float) (clock() - last_time))/CLOCKS_PER_SEC) / 60.0f)), "ProcessReads");
+    ReportMappingStats_(parameters);
 
     if (fp_out != stdout)
       fclose(fp_out);
@@ -225,6 +216,7 @@ void GraphMap::Run(ProgramParameters& parameters) {
         LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Loading reads from input folder. In total, %ld files need to be processed.\n", read_files.size()), "Run");
 
         clock_t all_reads_time = clock();
+        StartMappingStats_(parameters);
 
         for (int64_t i=0; i<((int64_t) read_files.size()); i++) {
           last_time = clock();
@@ -243,6 +235,7 @@ void GraphMap::Run(ProgramParameters& parameters) {
 
         LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("\n"), "[]");
         LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("All reads processed in %.2f sec (or %.2f CPU min). =====\n", (((float) (clock() - all_reads_time))/CLOCKS_PER_SEC), ((((float) (clock() - all_reads_time))/CLOCKS_PER_SEC) / 60.0f)), "ProcessReads");
+        ReportMappingStats_(parameters);
       }
     }
 
@@ -250,10 +243,99 @@ void GraphMap::Run(ProgramParameters& parameters) {
       LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("No read files found in path '%s'. Exiting.\n\n", parameters.reads_folder.c_str()), "Run");
     }
   }
+
+  // Index segments are merged only if requested, and only after all reads were mapped, so that the rebuild does not
+  // take cores or memory from the mapping.
+  if (parameters.compact_index == true || parameters.append_reference_path.size() > 0) {
+    CompactIndex_(parameters);
+  }
+}
+
+const MappingStats& GraphMap::get_mapping_stats() const {
+  return mapping_stats_;
+}
+
+const std::vector<Index *>& GraphMap::get_indexes() const {
+  return indexes_;
+}
+
+void GraphMap::StartMappingStats_(const ProgramParameters &parameters) {
+  mapping_stats_.Start();
+  MemoryAccounting::GetInstance().ResetMapping();
+  MemoryAccounting::GetInstance().SetIndexSections(CalcIndexMemorySections_());
+  if (parameters.trace_path.size() > 0) {
+    PipelineTrace::GetInstance().Start(parameters.trace_buffer_size);
+  }
+  if (parameters.perf_counters == true) {
+    PerfCounters::GetInstance().Start();
+  }
+  num_slow_reads_ = 0;
+  if (parameters.slow_read_log_path.size() > 0 && slow_reads_fp_ == NULL) {
+    slow_reads_fp_ = fopen(parameters.slow_read_log_path.c_str(), "w");
+    if (slow_reads_fp_ == NULL) {
+      LogSystem::GetInstance().Error(SEVERITY_INT_WARNING, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_OPENING_FILE, "Could not open '%s' for writing the slow reads. They will not be logged.", parameters.slow_read_log_path.c_str()));
+    }
+  }
+}
+
+void GraphMap::ReportMappingStats_(const ProgramParameters &parameters) {
+  LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, mapping_stats_.FormatSummary(), "Stats");
+  if (parameters.stats_path.size() > 0) {
+    if (mapping_stats_.WriteJSON(parameters.stats_path) == 0) {
+      LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Mapping statistics written to '%s'.\n", parameters.stats_path.c_str()), "Stats");
+    }
+  }
+  if (slow_reads_fp_) {
+    fclose(slow_reads_fp_);
+    slow_reads_fp_ = NULL;
+    LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("%ld reads took longer than %.2f ms, written to '%s'.\n", num_slow_reads_, parameters.slow_read_threshold, parameters.slow_read_log_path.c_str()), "Stats");
+  }
+  LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, MemoryAccounting::GetInstance().FormatSummary(), "Stats");
+  if (PerfCounters::IsEnabled()) {
+    LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, PerfCounters::GetInstance().FormatSummary(), "Stats");
+    PerfCounters::GetInstance().Stop();
+  }
+  if (PipelineTrace::IsEnabled()) {
+    PipelineTrace::GetInstance().Stop();
+    if (PipelineTrace::GetInstance().WriteChromeTrace(parameters.trace_path) == 0) {
+      LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Trace written to '%s' (%ld spans were lost, increase --trace-buffer to keep them).\n", parameters.trace_path.c_str(), PipelineTrace::GetInstance().get_num_lost()), "Stats");
+    }
+  }
+}
+
+void GraphMap::LogSlowRead_(const SingleSequence *read, const MappingData *mapping_data, const ReadStageTimes &stage_times, int mapped_state) {
+  // The original header is cut at the first whitespace, and the statistics are appended as its comment.
+  std::string qname = std::string(read->get_header());
+  std::string::size_type qname_end = qname.find_first_of(" \t");
+  if (qname_end != std::string::npos) { qname = qname.substr(0, qname_end); }
+
+  std::string header = FormatString("%s read_id=%ld length=%ld mapped_state=%d total_ms=%.3f", qname.c_str(), read->get_sequence_id(), read->get_sequence_length(),
+                                    mapped_state, stage_times.time[STAGE_TOTAL] * 1000.0);
+  for (int stage = 0; stage < STAGE_TOTAL; stage++) {
+    header += FormatString(" %s_ms=%.3f", StageName(stage), stage_times.time[stage] * 1000.0);
+  }
+  header += FormatString(" seeds=%ld seed_hits=%ld seeds_over_limit=%ld bins=%ld regions=%ld region_iterations=%ld anchors=%ld",
+                         mapping_data->num_seeds_looked_up, mapping_data->num_seed_hits, mapping_data->num_seeds_over_limit, (int64_t) mapping_data->bins.size(),
+                         mapping_data->num_regions_processed, mapping_data->num_region_iterations, mapping_data->num_anchors);
+
+  std::string sequence((const char *) read->get_data(), read->get_sequence_length());
+  bool has_quality = (read->get_quality() != NULL && read->get_quality_length() == read->get_sequence_length());
+
+  #pragma omp critical(slow_read_log)
+  {
+    if (has_quality == true) {
+      fprintf (slow_reads_fp_, "@%s\n%s\n+\n%.*s\n", header.c_str(), sequence.c_str(), (int) read->get_quality_length(), (const char *) read->get_quality());
+    } else {
+      fprintf (slow_reads_fp_, ">%s\n%s\n", header.c_str(), sequence.c_str());
+    }
+    fflush(slow_reads_fp_);
+    num_slow_reads_ += 1;
+  }
 }
 
 int GraphMap::BuildIndex(ProgramParameters &parameters) {
   // Run away, you are free now!
+  ClearIndexReplicas_();
   for (int32_t i=0; i<indexes_.size(); i++) {
     if (indexes_[i]) { delete indexes_[i]; }
     indexes_[i] = NULL;
@@ -267,12 +349,33 @@ int GraphMap::BuildIndex(ProgramParameters &parameters) {
   if (parameters.sensitive_mode == false) {
     LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Running in normal (parsimonious) mode. Only one index will be used.\n"), "Index");
   } else {
-    LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Running in sensitive mode. Two indexes will be used (double memory consumption).\n"), "Index");
+    LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Running in sensitive mode. Two seed shapes will be used over the same reference data.\n"), "Index");
     index_sec = new IndexSpacedHashFast(SHAPE_TYPE_66);
     indexes_.push_back(index_sec);
   }
 
+  // Placement of the large index arrays on NUMA nodes, and their huge page backing. With the replicate policy,
+  // the loaded index is the copy for node 0, and the copies for the other nodes are loaded after it.
+  IndexMemory::GetInstance().SetPolicy(parameters.numa_policy, parameters.huge_pages);
+  LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("%s.\n", IndexMemory::GetInstance().FormatPolicy().c_str()), "Index");
+  if (IndexMemory::GetInstance().get_policy() == INDEX_MEMORY_POLICY_REPLICATE) {
+    index_prim->set_memory_node(0);
+    if (index_sec) { index_sec->set_memory_node(0); }
+  }
+
+  // The secondary index shares the reference data with the primary one, so only the primary needs to pack it.
+  index_prim->set_pack_data(parameters.pack_reference);
+  index_prim->set_max_shard_length((parameters.index_shard_size > 0) ? (parameters.index_shard_size * 1000000) : parameters.index_shard_size);
+  // If the index would not fit into the build memory limit, it is built on disk and needs to be loaded after it is stored.
+  if (parameters.index_build_memory > 0) {
+    index_prim->set_max_build_memory(parameters.index_build_memory * 1024 * 1024, parameters.index_file);
+    if (index_sec) { index_sec->set_max_build_memory(parameters.index_build_memory * 1024 * 1024, parameters.index_file + std::string("sec")); }
+  }
+
   clock_t last_time = clock();
+  double last_wall_time = omp_get_wtime();
+
+  if (AppendToIndex_(parameters)) { return 1; }
 
   if (parameters.calc_only_index == false) {
     // Check if index already exists, if not generate it.
@@ -292,6 +395,11 @@ int GraphMap::BuildIndex(ProgramParameters &parameters) {
       int prim_index_generated = index_prim->GenerateFromFile(parameters.reference_path);
       int prim_index_stored = index_prim->StoreToFile(parameters.index_file);
       if (prim_index_generated || prim_index_stored) { return 1; }
+      if (parameters.pack_reference == true && index_prim->PackData()) { return 1; }
+    }
+    if (index_prim->is_built_on_disk()) {
+      if (index_prim->LoadFromFile(parameters.index_file)) { return 1; }
+      if (parameters.pack_reference == true && index_prim->PackData()) { return 1; }
     }
 
     if (parameters.sensitive_mode == true ) {
@@ -303,19 +411,38 @@ int GraphMap::BuildIndex(ProgramParameters &parameters) {
         fclose (fp);
       }
 
+      // The secondary index file holds only the bucket tables of the second shape. The reference data, headers
+      // and lengths are taken from the primary index.
       if (parameters.rebuild_index == false) {
-        int sec_index_loaded = index_sec->LoadOrGenerate(parameters.reference_path, parameters.index_file + std::string("sec"), (parameters.verbose_level > 0));
+        int sec_index_loaded = index_sec->LoadOrGenerateShared(index_prim, parameters.index_file + std::string("sec"), (parameters.verbose_level > 0));
         if (sec_index_loaded) { return 1; }
       } else {
-        int sec_index_generated = index_sec->GenerateFromFile(parameters.reference_path);
-        int sec_index_stored = index_sec->StoreToFile(parameters.index_file + std::string("sec"));
+        int sec_index_generated = index_sec->GenerateFromSharedReference(index_prim);
+        int sec_index_stored = index_sec->StoreSharedToFile(parameters.index_file + std::string("sec"));
         if (sec_index_generated || sec_index_stored) { return 1; }
       }
+      if (index_sec->is_built_on_disk() && index_sec->LoadSharedFromFile(index_prim, parameters.index_file + std::string("sec"))) { return 1; }
     }
 
-    LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Index loaded in %.2f sec.\n", (((float) (clock() - last_time))/CLOCKS_PER_SEC)), "Index");
+    // Read throughput of the index files, if the index was loaded and not generated.
+    int64_t loaded_bytes = index_prim->get_loaded_bytes() + ((index_sec != NULL) ? index_sec->get_loaded_bytes() : 0);
+    double wall_time = omp_get_wtime() - last_wall_time;
+    if (loaded_bytes > 0 && wall_time > 0.0) {
+      LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Index loaded in %.2f sec (%.2f GB at %.2f GB/s).\n", wall_time, ((double) loaded_bytes) / 1e9, ((double) loaded_bytes) / 1e9 / wall_time), "Index");
+    } else {
+      LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Index loaded in %.2f sec.\n", (((float) (clock() - last_time))/CLOCKS_PER_SEC)), "Index");
+    }
+
+    if (IndexMemory::GetInstance().get_policy() == INDEX_MEMORY_POLICY_REPLICATE && CreateIndexReplicas_(parameters)) { return 1; }
+    LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Index memory placement: %s.\n", IndexMemory::GetInstance().FormatPlacement().c_str()), "Index");
+
     return 0;
 
+  } else if (parameters.append_reference_path.size() > 0) {
+    // Only the new sequences were indexed. The secondary index is regenerated the next time it is loaded.
+    LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Index updated in %.2f sec.\n", (((float) (clock() - last_time))/CLOCKS_PER_SEC)), "Index");
+    if (CompactIndex_(parameters)) { return 1; }
+
   } else {
     LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Generating index.\n"), "Index");
 
@@ -324,8 +451,8 @@ int GraphMap::BuildIndex(ProgramParameters &parameters) {
 
     if (parameters.sensitive_mode == true) {
       LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Generating secondary index.\n"), "Index");
-      index_sec->GenerateFromFile(parameters.reference_path);
-      index_sec->StoreToFile(parameters.index_file + std::string("sec"));
+      index_sec->GenerateFromSharedReference(index_prim);
+      index_sec->StoreSharedToFile(parameters.index_file + std::string("sec"));
     }
     LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Index generated in %.2f sec.\n", (((float) (clock() - last_time))/CLOCKS_PER_SEC)), "Index");
   }
@@ -333,6 +460,101 @@ int GraphMap::BuildIndex(ProgramParameters &parameters) {
   return 0;
 }
 
+int GraphMap::CreateIndexReplicas_(const ProgramParameters &parameters) {
+  ClearIndexReplicas_();
+
+  int num_nodes = IndexMemory::GetInstance().get_num_nodes();
+  if (num_nodes <= 1) {
+    return 0;
+  }
+
+  double start_wall_time = omp_get_wtime();
+  int64_t num_replicas = 0;
+  node_indexes_.resize(num_nodes);
+  node_indexes_[0] = indexes_;
+  for (int node = 1; node < num_nodes; node++) {
+    if (IndexMemory::GetInstance().get_num_node_cpus(node) == 0) {
+      continue;
+    }
+
+    IndexSpacedHashFast *replica_prim = new IndexSpacedHashFast(SHAPE_TYPE_444);
+    replica_prim->set_pack_data(parameters.pack_reference);
+    replica_prim->set_memory_node(node);
+    node_indexes_[node].push_back(replica_prim);
+    if (replica_prim->LoadFromFile(parameters.index_file)) {
+      LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_FILE_READ_DATA, "Could not load the copy of the index for NUMA node %d.", node));
+      return 1;
+    }
+
+    if (indexes_.size() > 1) {
+      IndexSpacedHashFast *replica_sec = new IndexSpacedHashFast(SHAPE_TYPE_66);
+      replica_sec->set_memory_node(node);
+      node_indexes_[node].push_back(replica_sec);
+      if (replica_sec->LoadSharedFromFile(replica_prim, parameters.index_file + std::string("sec"))) {
+        LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_FILE_READ_DATA, "Could not load the copy of the secondary index for NUMA node %d.", node));
+        return 1;
+      }
+    }
+    num_replicas += 1;
+  }
+
+  LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Loaded %ld additional copies of the index in %.2f sec, one per NUMA node.\n", num_replicas, omp_get_wtime() - start_wall_time), "Index");
+
+  return 0;
+}
+
+void GraphMap::ClearIndexReplicas_() {
+  // The copies for node 0 are the indexes_ themselves, and are released with them.
+  for (int64_t node = 1; node < node_indexes_.size(); node++) {
+    for (int64_t i = ((int64_t) node_indexes_[node].size()) - 1; i >= 0; i--) {
+      if (node_indexes_[node][i]) { delete node_indexes_[node][i]; }
+    }
+  }
+  node_indexes_.clear();
+}
+
+int GraphMap::AppendToIndex_(const ProgramParameters &parameters) {
+  if (parameters.append_reference_path.size() == 0) {
+    return 0;
+  }
+
+  FILE *fp = fopen(parameters.index_file.c_str(), "r");
+  if (fp == NULL) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_OPENING_FILE, "Index '%s' does not exist, so the sequences cannot be appended to it. Generate the index first.", parameters.index_file.c_str()));
+    return 1;
+  }
+  fclose(fp);
+
+  IndexSpacedHashFast index(SHAPE_TYPE_444);
+  index.set_max_shard_length((parameters.index_shard_size > 0) ? (parameters.index_shard_size * 1000000) : parameters.index_shard_size);
+  if (parameters.index_build_memory > 0) {
+    index.set_max_build_memory(parameters.index_build_memory * 1024 * 1024, parameters.index_file);
+  }
+
+  return index.AppendToFile(parameters.index_file, parameters.append_reference_path);
+}
+
+int GraphMap::CompactIndex_(const ProgramParameters &parameters) {
+  if (parameters.index_max_segments <= 0) {
+    return 0;
+  }
+
+  // The merged segments are built next to the loaded index, so with a memory budget they get only what is left of it.
+  int64_t max_build_memory = (parameters.index_build_memory > 0) ? (parameters.index_build_memory * 1024 * 1024) : 0;
+  if (parameters.max_memory > 0) {
+    int64_t available = parameters.max_memory * 1024 * 1024 - MemoryAccounting::GetInstance().get_current(MEMORY_INDEX) - MEMORY_UNTRACKED_OVERHEAD;
+    if (available <= 0) {
+      LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("No memory left within --max-memory %ld MB for compacting the index segments, skipping.\n", parameters.max_memory), "Index");
+      return 0;
+    }
+    max_build_memory = (max_build_memory > 0) ? std::min(max_build_memory, available) : available;
+  }
+
+  IndexSpacedHashFast index(SHAPE_TYPE_444);
+  index.set_max_build_memory(max_build_memory, parameters.index_file);
+  return index.CompactFile(parameters.index_file, parameters.index_max_segments);
+}
+
 void GraphMap::ProcessReadsFromSingleFile(const ProgramParameters &parameters, FILE *fp_out) {
   // Write out the SAM header in fp_out.
   if (parameters.outfmt == "sam") {
@@ -341,25 +563,42 @@ void GraphMap::ProcessReadsFromSingleFile(const ProgramParameters &parameters, F
       fprintf (fp_out, "%s\n", sam_header.c_str());
   }
 
+  // With a memory budget, the batch size and the number of threads are chosen again for every batch.
+  ProgramParameters parameters_batch = parameters;
+  if (parameters.max_memory > 0) {
+    parameters_batch.batch_size_in_mb = GovernBatchSize_(parameters);
+  }
+
   // Check whether to load in batches or to load all the data at once.
-  if (parameters.batch_size_in_mb <= 0) {
+  if (parameters_batch.batch_size_in_mb <= 0) {
     LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("All reads will be loaded in memory.\n"), "ProcessReads");
   } else {
-    LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Reads will be loaded in batches of up to %ld MB in size.\n", parameters.batch_size_in_mb), "ProcessReads");
+    LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Reads will be loaded in batches of up to %ld MB in size.\n", parameters_batch.batch_size_in_mb), "ProcessReads");
   }
 
-  SequenceFile reads;
-  reads.OpenFileForBatchLoading(parameters.reads_path);
-
   clock_t absolute_time = clock();
   clock_t last_batch_loading_time = clock();
 
+  // If the first batch was already parsed during startup, continue from there.
+  int load_ret = 1;
+  SequenceFile *reads_ptr = TakePrefetchedReads_(parameters, &load_ret);
+  if (reads_ptr != NULL) {
+    LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("First batch of reads was loaded while the index was being prepared.\n"), "ProcessReads");
+  } else {
+    reads_ptr = new SequenceFile;
+    reads_ptr->OpenFileForBatchLoading(parameters.reads_path);
+    load_ret = LoadNextReadBatch_(parameters_batch, reads_ptr);
+  }
+  SequenceFile &reads = *reads_ptr;
+
   int64_t num_mapped = 0;
   int64_t num_unmapped = 0;
 
   // Load sequences in batch (if requested), or all at once.
-  while ((parameters.batch_size_in_mb <= 0 && !reads.LoadAllAsBatch(SeqFmtToString(parameters.infmt), false)) || (parameters.batch_size_in_mb > 0 && !reads.LoadNextBatchInMegabytes(SeqFmtToString(parameters.infmt), parameters.batch_size_in_mb, false))) {
-    if (parameters.batch_size_in_mb <= 0) {
+  while (load_ret == 0) {
+    MemoryAccounting::GetInstance().Set(MEMORY_READS, CalcReadBatchBytes_(reads));
+
+    if (parameters_batch.batch_size_in_mb <= 0) {
       LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("All reads loaded in %.2f sec (size around %ld MB). (%ld bases)\n", (((float) (clock() - last_batch_loading_time))/CLOCKS_PER_SEC), reads.CalculateTotalSize(MEMORY_UNIT_MEGABYTE), reads.GetNumberOfBases()), "ProcessReads");
       LogSystem::GetInstance().Log(VERBOSE_LEVEL_HIGH | VERBOSE_LEVEL_MED, true, FormatString("Memory consumption: %s\n", FormatMemoryConsumptionAsString().c_str()), "ProcessReads");
     }
@@ -368,36 +607,194 @@ void GraphMap::ProcessReadsFromSingleFile(const ProgramParameters &parameters, F
       LogSystem::GetInstance().Log(VERBOSE_LEVEL_HIGH | VERBOSE_LEVEL_MED, true, FormatString("Memory consumption: %s\n", FormatMemoryConsumptionAsString().c_str()), "ProcessReads");
     }
 
+    if (parameters.max_memory > 0) {
+      parameters_batch.num_threads = GovernNumThreads_(parameters, reads);
+    }
+
     // This line actually does all the work.
-    ProcessSequenceFileInParallel(&parameters, &reads, &absolute_time, fp_out, &num_mapped, &num_unmapped);
+    ProcessSequenceFileInParallel(&parameters_batch, &reads, &absolute_time, fp_out, &num_mapped, &num_unmapped);
 
-    if (parameters.batch_size_in_mb > 0) {
+    if (parameters_batch.batch_size_in_mb > 0) {
       LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("\n"), "[]");
     }
 
+    if (parameters.max_memory > 0) {
+      parameters_batch.batch_size_in_mb = GovernBatchSize_(parameters);
+    }
+
     last_batch_loading_time = clock();
+    load_ret = LoadNextReadBatch_(parameters_batch, reads_ptr);
   }
+  MemoryAccounting::GetInstance().Set(MEMORY_READS, 0);
 
   LogSystem::GetInstance().Log(VERBOSE_LEVEL_HIGH | VERBOSE_LEVEL_MED, true, FormatString("Memory consumption: %s\n", FormatMemoryConsumptionAsString().c_str()), "ProcessReads");
 
   reads.CloseFileAfterBatchLoading();
+  delete reads_ptr;
 }
 
-int GraphMap::ProcessSequenceFileInParallel(const ProgramParameters *parameters, SequenceFile *reads, clock_t *last_time, FILE *fp_out, int64_t *ret_num_mapped, int64_t *ret_num_unmapped) {
-  ProgramParameters parameters_local = *parameters;
+void GraphMap::StartReadPrefetch_(const ProgramParameters &parameters) {
+  if (prefetch_thread_.joinable()) {
+    prefetch_thread_.join();
+  }
+  if (prefetched_reads_) {
+    prefetched_reads_->CloseFileAfterBatchLoading();
+    delete prefetched_reads_;
+  }
 
-  int64_t num_reads = reads->get_sequences().size();
-  std::vector<std::string> sam_lines;
+  prefetched_reads_ = new SequenceFile;
+  prefetched_reads_path_ = parameters.reads_path;
+  prefetched_reads_ret_ = 1;
 
-  if (parameters_local.output_in_original_order == true) {
-    sam_lines.resize(num_reads, std::string(""));
+  // Only the members set above are touched by the thread, and they are not read until the thread is joined.
+  ProgramParameters parameters_local = parameters;
+  prefetch_thread_ = std::thread([this, parameters_local]() {
+    prefetched_reads_->OpenFileForBatchLoading(parameters_local.reads_path);
+    prefetched_reads_ret_ = LoadNextReadBatch_(parameters_local, prefetched_reads_);
+  });
+}
+
+SequenceFile* GraphMap::TakePrefetchedReads_(const ProgramParameters &parameters, int *ret_load) {
+  if (prefetch_thread_.joinable()) {
+    prefetch_thread_.join();
+  }
+  if (prefetched_reads_ == NULL) {
+    return NULL;
+  }
+  if (prefetched_reads_path_ != parameters.reads_path) {
+    prefetched_reads_->CloseFileAfterBatchLoading();
+    delete prefetched_reads_;
+    prefetched_reads_ = NULL;
+    return NULL;
+  }
+
+  SequenceFile *reads = prefetched_reads_;
+  *ret_load = prefetched_reads_ret_;
+  prefetched_reads_ = NULL;
+  return reads;
+}
+
+int GraphMap::LoadNextReadBatch_(const ProgramParameters &parameters, SequenceFile *reads) const {
+  if (parameters.batch_size_in_mb <= 0) {
+    return reads->LoadAllAsBatch(SeqFmtToString(parameters.infmt), false);
   }
+  return reads->LoadNextBatchInMegabytes(SeqFmtToString(parameters.infmt), parameters.batch_size_in_mb, false);
+}
 
+int64_t GraphMap::GetNumMappingThreads_(const ProgramParameters &parameters) const {
   // Division by to to avoid hyperthreading cores, and limit on 24 to avoid clogging a shared SMP.
   int64_t num_threads = std::min(24, ((int) omp_get_num_procs()) / 2);
+  if (parameters.num_threads > 0)
+    num_threads = (int64_t) parameters.num_threads;
+  return num_threads;
+}
+
+std::vector<std::pair<std::string, int64_t> > GraphMap::CalcIndexMemorySections_() const {
+  std::vector<std::pair<std::string, int64_t> > sections;
+  for (int64_t i = 0; i < indexes_.size(); i++) {
+    if (indexes_[i]) { indexes_[i]->CalcMemorySections(sections); }
+  }
+  // node_indexes_[0] holds the same pointers as indexes_.
+  for (int64_t node = 1; node < node_indexes_.size(); node++) {
+    for (int64_t i = 0; i < node_indexes_[node].size(); i++) {
+      if (node_indexes_[node][i]) { node_indexes_[node][i]->CalcMemorySections(sections); }
+    }
+  }
+  return sections;
+}
+
+int64_t GraphMap::CalcReadBatchBytes_(const SequenceFile &reads) const {
+  int64_t bytes = 0;
+  for (int64_t i = 0; i < reads.get_sequences().size(); i++) {
+    const SingleSequence *read = reads.get_sequences()[i];
+    bytes += sizeof(SingleSequence) + read->get_data_length() + read->get_header_length() + ((read->get_quality() != NULL) ? read->get_quality_length() : 0);
+  }
+  return bytes;
+}
+
+double GraphMap::EstimateOutputPerReadByte_(const ProgramParameters &parameters) const {
+  if (parameters.output_in_original_order == false) {
+    return 0.0;
+  }
+  const MemoryAccounting &accounting = MemoryAccounting::GetInstance();
+  if (accounting.get_peak(MEMORY_READS) > 0 && accounting.get_peak(MEMORY_OUTPUT) > 0) {
+    return ((double) accounting.get_peak(MEMORY_OUTPUT)) / ((double) accounting.get_peak(MEMORY_READS));
+  }
+  return MEMORY_DEFAULT_OUTPUT_PER_READ_BYTE;
+}
+
+int64_t GraphMap::GovernBatchSize_(const ProgramParameters &parameters) const {
+  const MemoryAccounting &accounting = MemoryAccounting::GetInstance();
+  int64_t budget = parameters.max_memory * 1024 * 1024;
+  int64_t num_threads = std::max((int64_t) 1, GetNumMappingThreads_(parameters));
+
+  // Working memory is reserved for every thread, as large as for the largest read mapped so far.
+  int64_t scratch_bytes = num_threads * std::max(MEMORY_SCRATCH_MIN_PER_THREAD, accounting.GetMaxReadScratch());
+  int64_t available = budget - accounting.get_current(MEMORY_INDEX) - MEMORY_UNTRACKED_OVERHEAD - scratch_bytes;
+
+  // Every MB of the batch takes more than that in memory (headers, qualities, object overhead), and the output lines
+  // of the batch can be kept until its end.
+  double bytes_per_batch_byte = MEMORY_READS_PER_BATCH_BYTE * (1.0 + EstimateOutputPerReadByte_(parameters));
+  int64_t batch_size_in_mb = (int64_t) (((double) available) / bytes_per_batch_byte / (1024.0 * 1024.0));
+
+  if (batch_size_in_mb < 1) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_WARNING, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_MEMORY, "The memory budget of %ld MB is too small for the index (%ld MB) and the working memory of %ld threads (%ld MB). Reads will be loaded in batches of 1 MB, and the budget may be exceeded.",
+                                                                                                                     parameters.max_memory, accounting.get_current(MEMORY_INDEX) / (1024 * 1024), num_threads, scratch_bytes / (1024 * 1024)));
+    batch_size_in_mb = 1;
+  }
+  if (parameters.batch_size_in_mb > 0) {
+    batch_size_in_mb = std::min(batch_size_in_mb, parameters.batch_size_in_mb);
+  }
+
+  LogSystem::GetInstance().Log(VERBOSE_LEVEL_HIGH | VERBOSE_LEVEL_MED, true, FormatString("Memory budget of %ld MB: index %ld MB, working memory %ld MB for %ld threads. Batch size set to %ld MB.\n",
+                                                                                         parameters.max_memory, accounting.get_current(MEMORY_INDEX) / (1024 * 1024), scratch_bytes / (1024 * 1024), num_threads, batch_size_in_mb), "MemoryGovernor");
+  return batch_size_in_mb;
+}
+
+int64_t GraphMap::GovernNumThreads_(const ProgramParameters &parameters, const SequenceFile &reads) const {
+  const MemoryAccounting &accounting = MemoryAccounting::GetInstance();
+  int64_t budget = parameters.max_memory * 1024 * 1024;
+  int64_t max_threads = std::max((int64_t) 1, GetNumMappingThreads_(parameters));
+
+  int64_t reads_bytes = accounting.get_current(MEMORY_READS);
+  int64_t output_bytes = (int64_t) (reads_bytes * EstimateOutputPerReadByte_(parameters));
+  int64_t available = budget - accounting.get_current(MEMORY_INDEX) - MEMORY_UNTRACKED_OVERHEAD - reads_bytes - output_bytes;
+
+  // In the worst case, the longest reads of the batch are mapped at the same time, one per thread.
+  int64_t num_longest = std::min(max_threads, (int64_t) reads.get_sequences().size());
+  std::vector<int64_t> read_lengths(reads.get_sequences().size(), 0);
+  for (int64_t i = 0; i < read_lengths.size(); i++) {
+    read_lengths[i] = reads.get_sequences()[i]->get_sequence_length();
+  }
+  std::partial_sort(read_lengths.begin(), read_lengths.begin() + num_longest, read_lengths.end(), std::greater<int64_t>());
+
+  int64_t num_threads = 0;
+  int64_t scratch_bytes = 0;
+  while (num_threads < max_threads) {
+    int64_t read_scratch_bytes = accounting.EstimateReadScratch((num_threads < num_longest) ? read_lengths[num_threads] : 0);
+    if ((scratch_bytes + read_scratch_bytes) > available) { break; }
+    scratch_bytes += read_scratch_bytes;
+    num_threads += 1;
+  }
+
+  if (num_threads == 0) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_WARNING, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_MEMORY, "The memory budget of %ld MB is too small to map the longest read of the batch (%ld bp). Using 1 thread, and the budget may be exceeded.",
+                                                                                                                     parameters.max_memory, (num_longest > 0) ? read_lengths[0] : 0));
+    num_threads = 1;
+  } else if (num_threads < max_threads) {
+    LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Memory budget of %ld MB: using %ld instead of %ld threads for this batch (longest read %ld bp).\n",
+                                                                     parameters.max_memory, num_threads, max_threads, (num_longest > 0) ? read_lengths[0] : 0), "MemoryGovernor");
+  }
+
+  return num_threads;
+}
 
-  if (parameters_local.num_threads > 0)
-    num_threads = (int64_t) parameters_local.num_threads;
+int GraphMap::ProcessSequenceFileInParallel(const ProgramParameters *parameters, SequenceFile *reads, clock_t *last_time, FILE *fp_out, int64_t *ret_num_mapped, int64_t *ret_num_unmapped) {
+  ProgramParameters parameters_local = *parameters;
+
+  int64_t num_reads = reads->get_sequences().size();
+
+  int64_t num_threads = GetNumMappingThreads_(parameters_local);
   LogSystem::GetInstance().Log(VERBOSE_LEVEL_HIGH | VERBOSE_LEVEL_MED, true, FormatString("Using %ld threads.\n", num_threads), "ProcessReads");
 
   // Set up the starting and ending read index.
@@ -427,8 +824,44 @@ int GraphMap::ProcessSequenceFileInParallel(const ProgramParameters *parameters,
   EValueParams *evalue_params;
   SetupScorer((char *) "EDNA_FULL_5_4", indexes_[0]->get_data_length_forward(), -parameters_local.evalue_gap_open, -parameters_local.evalue_gap_extend, &evalue_params);
 
+  // With the replicate NUMA policy, threads are spread over the nodes, bound to them, and use the local copy of the index.
+  // OpenMP keeps the same pool of threads for the parallel regions below, so the binding holds for the whole batch.
+  std::vector<int> thread_nodes(num_threads, 0);
+  if (node_indexes_.size() > 1) {
+    std::vector<int> nodes;
+    for (int node = 0; node < node_indexes_.size(); node++) {
+      if (node_indexes_[node].size() > 0) { nodes.push_back(node); }
+    }
+    #pragma omp parallel num_threads(num_threads)
+    {
+      int64_t thread_id = omp_get_thread_num();
+      int node = nodes[(thread_id * nodes.size()) / omp_get_num_threads()];
+      if (IndexMemory::GetInstance().BindCurrentThreadToNode(node) == 0) {
+        thread_nodes[thread_id] = node;
+      }
+    }
+  }
+
+  // Per-thread slots of the mapping stats, the trace, the perf counters and the memory accounting.
+  ThreadSlotsBase::ReserveAll(num_threads);
+
+  // Every thread formats its records into its own output chunk. Unordered output is written whenever a chunk fills up,
+  // while for the original order the chunks keep the whole batch and only the position of each record is stored.
+  // The chunks are kept between batches, so they are only cleared here and keep their capacity.
+  if ((int64_t) thread_output_.size() < num_threads) {
+    thread_output_.resize(num_threads);
+  }
+  for (size_t thread_id = 0; thread_id < thread_output_.size(); thread_id++) {
+    thread_output_[thread_id].Clear();
+  }
+  std::vector<OutputBuffer> &thread_output = thread_output_;
+  std::vector<OutputRecordPosition> record_positions;
+  if (parameters_local.output_in_original_order == true) {
+    record_positions.resize(num_reads);
+  }
+
   // Process all reads in parallel.
-  #pragma omp parallel for num_threads(num_threads) firstprivate(num_reads_processed_in_thread_0, evalue_params) shared(reads, parameters, last_time, sam_lines, num_mapped, num_unmapped, num_ambiguous, num_errors, fp_out) schedule(dynamic, 1)
+  #pragma omp parallel for num_threads(num_threads) firstprivate(num_reads_processed_in_thread_0, evalue_params) shared(reads, parameters, last_time, thread_output, record_positions, num_mapped, num_unmapped, num_ambiguous, num_errors, fp_out) schedule(dynamic, 1)
   for (int64_t i=start_i; i<max_i; i++) {
     uint32_t thread_id = omp_get_thread_num();
 
@@ -462,13 +895,43 @@ int GraphMap::ProcessSequenceFileInParallel(const ProgramParameters *parameters,
     }
 
     // The actual interesting part.
-    std::string sam_line = "";
+    double read_start_time = omp_get_wtime();
+    TraceSpan trace_read("read", reads->get_sequences()[i]->get_sequence_id(), reads->get_sequences()[i]->get_sequence_length());
+    PerfStageScope perf_read(STAGE_TOTAL);
     MappingData mapping_data;
-    ProcessRead(&mapping_data, indexes_, reads->get_sequences()[i], &parameters_local, evalue_params);
+    const std::vector<Index *> &thread_indexes = (node_indexes_.size() > 1) ? node_indexes_[thread_nodes[thread_id]] : indexes_;
+    ProcessRead(&mapping_data, thread_indexes, reads->get_sequences()[i], &parameters_local, evalue_params);
 
     // Generate the output.
+    double formatting_start_time = omp_get_wtime();
+    TraceSpan trace_formatting("formatting", reads->get_sequences()[i]->get_sequence_id(), reads->get_sequences()[i]->get_sequence_length());
+    PerfStageScope perf_formatting(STAGE_FORMATTING);
+    OutputBuffer &output = thread_output[thread_id];
+    int64_t record_start = output.size();
     int mapped_state = STATE_UNMAPPED;
-    mapped_state = CollectAlignments(reads->get_sequences()[i], &parameters_local, &mapping_data, sam_line);
+    mapped_state = CollectAlignments(reads->get_sequences()[i], &parameters_local, &mapping_data, output);
+    if (output.size() > record_start) {
+      output.Append('\n');
+    }
+    int64_t record_length = output.size() - record_start;
+    perf_formatting.End();
+    trace_formatting.End();
+
+    // Record the stage times of the read.
+    ReadStageTimes stage_times;
+    stage_times.time[STAGE_SEED_LOOKUP] = mapping_data.time_region_seed_lookup;
+    stage_times.time[STAGE_BIN_COUNTING] = std::max(0.0, mapping_data.time_region_selection - mapping_data.time_region_seed_lookup);
+    stage_times.time[STAGE_GRAPH] = mapping_data.time_graph;
+    stage_times.time[STAGE_LCSK] = mapping_data.time_lcsk;
+    stage_times.time[STAGE_FILTERING] = mapping_data.time_filtering;
+    stage_times.time[STAGE_ALIGNMENT] = mapping_data.time_alignment;
+    stage_times.time[STAGE_FORMATTING] = omp_get_wtime() - formatting_start_time;
+    stage_times.time[STAGE_TOTAL] = omp_get_wtime() - read_start_time;
+    mapping_stats_.RecordRead(thread_id, stage_times, reads->get_sequences()[i]->get_sequence_length(), mapped_state == STATE_MAPPED);
+    MemoryAccounting::GetInstance().RecordReadScratch(thread_id, mapping_data.scratch_bytes, reads->get_sequences()[i]->get_sequence_length());
+    if (slow_reads_fp_ != NULL && (stage_times.time[STAGE_TOTAL] * 1000.0) > parameters_local.slow_read_threshold) {
+      LogSlowRead_(reads->get_sequences()[i], &mapping_data, stage_times, mapped_state);
+    }
 
     // Keep the counts.
     if (mapped_state == STATE_MAPPED) {
@@ -488,16 +951,20 @@ int GraphMap::ProcessSequenceFileInParallel(const ProgramParameters *parameters,
       num_errors += 1;
     }
 
-    // If the order of the reads should be kept, store them in a vector, otherwise output the alignment to file.
+    // If the order of the reads should be kept, remember where the record is, otherwise output the chunk when it is full.
+    MemoryAccounting::GetInstance().Add(MEMORY_OUTPUT, record_length);
     if (parameters_local.output_in_original_order == false) {
-      if (sam_line.size() > 0) {
+      if (output.size() >= OUTPUT_CHUNK_FLUSH_BYTES) {
         #pragma omp critical
-        fprintf (fp_out, "%s\n", sam_line.c_str());
+        fwrite(output.data(), sizeof(char), output.size(), fp_out);
+        MemoryAccounting::GetInstance().Add(MEMORY_OUTPUT, -output.size());
+        output.Clear();
       }
     }
     else {
-      #pragma omp critical
-      sam_lines[i] = sam_line;
+      record_positions[i].thread_id = thread_id;
+      record_positions[i].start = record_start;
+      record_positions[i].length = record_length;
     }
   }
 
@@ -520,11 +987,18 @@ int GraphMap::ProcessSequenceFileInParallel(const ProgramParameters *parameters,
   // Output the results to the SAM file in the exact ordering of the input file (if it was requested by the specified parameter).
   if (parameters_local.output_in_original_order == true) {
     for (int64_t i=0; i<num_reads; i++) {
-      if (sam_lines[i].size() > 0) {
-        fprintf (fp_out, "%s\n", sam_lines[i].c_str());
+      if (record_positions[i].length > 0) {
+        fwrite(thread_output[record_positions[i].thread_id].data() + record_positions[i].start, sizeof(char), record_positions[i].length, fp_out);
+      }
+    }
+  } else {
+    for (int64_t thread_id = 0; thread_id < num_threads; thread_id++) {
+      if (thread_output[thread_id].size() > 0) {
+        fwrite(thread_output[thread_id].data(), sizeof(char), thread_output[thread_id].size(), fp_out);
       }
     }
   }
+  MemoryAccounting::GetInstance().Set(MEMORY_OUTPUT, 0);
 
   return 0;
 }
@@ -15,12 +15,14 @@
 #include <sstream>
 #include <vector>
 #include <algorithm>
+#include <thread>
 
 #include "index/index.h"
 #include "index/index_sa.h"
 #include "index/index_hash.h"
 #include "index/index_spaced_hash.h"
 #include "index/index_spaced_hash_fast.h"
+#include "index/read_kmer_index.h"
 #include "sequences/single_sequence.h"
 #include "sequences/sequence_file.h"
 #include "containers/score_registry.h"
@@ -29,8 +31,39 @@
 #include "alignment/cigargen.h"
 #include "containers/region.h"
 #include "containers/mapping_data.h"
+#include "containers/output_buffer.h"
 #include "utility/evalue.h"
 #include "containers/vertices.h"
+#include "graphmap/mapping_stats.h"
+#include "graphmap/pipeline_trace.h"
+#include "graphmap/perf_counters.h"
+#include "graphmap/memory_accounting.h"
+
+// Automatic choice of the region selection engine (parameters->region_engine == "auto"). The dense engine allocates,
+// clears and scans one bin per (bin_size) bases of the reference, the sort-based engine sorts one key per seed hit,
+// which is estimated to cost a few tens of bins. The sort-based engine is used when there are more than
+// REGION_SELECTION_AUTO_BINS_PER_SEED bins per seed of the read, and only for references of up to
+// REGION_SELECTION_AUTO_MAX_GENOME_LENGTH bases (100 Mbp), because of the many repetitive hits in larger ones.
+// The thresholds are estimates and should be checked with scripts/benchmark_region_selection.py before relying
+// on "auto", which is why "dense" stays the default.
+#define REGION_SELECTION_AUTO_BINS_PER_SEED     128
+#define REGION_SELECTION_AUTO_MAX_GENOME_LENGTH ((int64_t) 100000000)
+
+// Adaptive seeding in region selection (parameters->adaptive_seeds). The top bin needs at least this many seeds before
+// the remaining seeds can be skipped.
+#define ADAPTIVE_SEEDS_MIN_TOP_COUNT  8
+#define ADAPTIVE_SEEDS_NUM_TOP_BINS   4
+
+// Unordered output is written when the output chunk of a thread grows beyond this size, under a single lock per chunk
+// instead of one per read.
+#define OUTPUT_CHUNK_FLUSH_BYTES      ((int64_t) 1024 * 1024)
+
+// Location of the output record of a read in the output chunks, for writing the records in the original order.
+struct OutputRecordPosition {
+  int64_t thread_id = 0;
+  int64_t start = 0;
+  int64_t length = 0;
+};
 
 class GraphMap {
  public:
@@ -45,6 +78,10 @@ class GraphMap {
   // Sets up the index and everything for mapping, but does not run the mapping process.
   void Initialize(ProgramParameters &parameters, const clock_t &time_start);
 
+  // Sets the parameters which are calculated from the size of the loaded index (max_num_regions, max_num_regions_cutoff
+  // and max_num_hits), unless they were specified explicitly. Called by Run and Initialize after the index is loaded.
+  void ResolveAutomaticParameters(ProgramParameters &parameters) const;
+
   void RunOnFile(const ProgramParameters &parameters, std::string reads_file, std::string out_sam_path, const clock_t &time_start);
 
   // Generates or loads the index of the reference genome.
@@ -61,6 +98,12 @@ class GraphMap {
 
   // Collects alignments from the given mapping_data and converts them into an appropriate output format (string).
   int CollectAlignments(const SingleSequence *read, const ProgramParameters *parameters, MappingData *mapping_data, std::string &ret_aln_lines);
+  // Same as above, but appends the lines to out (e.g. the output chunk of the thread), without allocating per read.
+  // Lines of multiple alignments are separated by '\n', and there is no '\n' after the last one.
+  int CollectAlignments(const SingleSequence *read, const ProgramParameters *parameters, MappingData *mapping_data, OutputBuffer &out);
+  // Same as CollectAlignments, but copies the alignments into ret_alignments instead of formatting them. The primary
+  // alignment comes first. Returns STATE_MAPPED, or STATE_UNMAPPED with ret_alignments empty.
+  int CollectAlignmentResults(const MappingData *mapping_data, std::vector<AlignmentResults> &ret_alignments) const;
 
   // Allows the usage of GraphMap as an API.
   int Align(const SequenceFile *ref, const SequenceFile *reads, const ProgramParameters &parameters);
@@ -69,10 +112,64 @@ class GraphMap {
   // after which the above function is called. Headers for sequences are automatically generated: ref_%d and query_%d for ref_seqs and read_seqs, respectivelly.
   int Align(std::vector<std::string> ref_seqs, std::vector<std::string> read_seqs, const ProgramParameters &parameters);
 
+  // Statistics of the last run (Run or RunOnFile).
+  const MappingStats& get_mapping_stats() const;
+  // Loaded indexes, as passed to ProcessRead. Empty until BuildIndex is called.
+  const std::vector<Index *>& get_indexes() const;
+
 
 
  private:
   std::vector<Index *> indexes_;
+  std::vector<std::vector<Index *> > node_indexes_;   // With the replicate NUMA policy, a copy of indexes_ per node. node_indexes_[0] holds the pointers of indexes_.
+  std::thread prefetch_thread_;     // Parses the first batch of reads while the index is being loaded.
+  SequenceFile *prefetched_reads_;  // Opened reads file with the first batch loaded by prefetch_thread_.
+  std::string prefetched_reads_path_;
+  int prefetched_reads_ret_;        // Return value of loading the first batch (0 if a batch was loaded).
+  MappingStats mapping_stats_;      // Per-stage latencies and throughput of the current run.
+  FILE *slow_reads_fp_;             // Reads slower than parameters.slow_read_threshold are written here, if specified.
+  int64_t num_slow_reads_;
+  std::vector<OutputBuffer> thread_output_;   // Per-thread output chunks, kept between batches of reads.
+
+  // Opens the reads file and parses the first batch in a separate thread, so that it overlaps with BuildIndex.
+  void StartReadPrefetch_(const ProgramParameters &parameters);
+  // Joins the prefetch thread and hands over the reads file if it was opened for parameters.reads_path.
+  // Returns NULL if nothing was prefetched for that path.
+  SequenceFile* TakePrefetchedReads_(const ProgramParameters &parameters, int *ret_load);
+  // Loads the next batch of reads (or all reads if batching is turned off). Returns 0 if a batch was loaded.
+  int LoadNextReadBatch_(const ProgramParameters &parameters, SequenceFile *reads) const;
+  // Returns the number of threads which will be used for mapping.
+  int64_t GetNumMappingThreads_(const ProgramParameters &parameters) const;
+  // Sizes of the sections of all loaded indexes, including the NUMA replicas.
+  std::vector<std::pair<std::string, int64_t> > CalcIndexMemorySections_() const;
+  // Number of bytes held by a loaded batch of reads (bases, qualities and headers).
+  int64_t CalcReadBatchBytes_(const SequenceFile &reads) const;
+  // Bytes of output kept in memory per byte of the loaded reads, until the batch is written out. Non-zero only if the
+  // original order of the reads is kept. Measured on the previous batches, if there were any.
+  double EstimateOutputPerReadByte_(const ProgramParameters &parameters) const;
+  // Memory governor, used if parameters.max_memory > 0. Returns the batch size in MB which fits into the budget next to
+  // the index and the working memory of the threads. Never more than parameters.batch_size_in_mb, if that is > 0.
+  int64_t GovernBatchSize_(const ProgramParameters &parameters) const;
+  // Memory governor. Returns the largest number of threads (up to GetNumMappingThreads_, and at least 1) which can map
+  // the longest reads of the loaded batch at the same time within the budget.
+  int64_t GovernNumThreads_(const ProgramParameters &parameters, const SequenceFile &reads) const;
+
+  // Starts the run-level statistics, and the tracing if parameters.trace_path is specified.
+  void StartMappingStats_(const ProgramParameters &parameters);
+  // Prints the summary of mapping_stats_, and writes it to parameters.stats_path if specified. Dumps the trace.
+  void ReportMappingStats_(const ProgramParameters &parameters);
+  // Writes the read to slow_reads_fp_ as FASTQ (or FASTA, if it has no qualities), with its stage times and the
+  // sizes of the intermediate results in the header comment. The file can be used directly as input to replay the reads.
+  void LogSlowRead_(const SingleSequence *read, const MappingData *mapping_data, const ReadStageTimes &stage_times, int mapped_state);
+
+  // Loads a copy of the index for every other NUMA node which has CPUs, with the arrays bound to that node. Returns 0 if OK.
+  int CreateIndexReplicas_(const ProgramParameters &parameters);
+  void ClearIndexReplicas_();
+  // Appends new sequences to the index on disk, if specified in the parameters. Returns 0 if OK.
+  int AppendToIndex_(const ProgramParameters &parameters);
+  // Merges the index segments on disk if there are more than parameters.index_max_segments. Called only when no reads
+  // are being mapped, and only with --append-ref or --compact-index. Returns 0 if OK.
+  int CompactIndex_(const ProgramParameters &parameters);
 
   // Opens the output SAM file for writing if the path is specified. If the path is empty, then output is set to STDOUT.
   FILE* OpenOutSAMFile_(std::string out_sam_path="");
@@ -80,18 +177,30 @@ class GraphMap {
   std::string GenerateSAMHeader_(const ProgramParameters &parameters, Index *index);
   // Generates a default SAM line for unmapped reads.
   std::string GenerateUnmappedSamLine_(MappingData *mapping_data, int64_t verbose_sam_output, const SingleSequence *read) const;
+  void AppendUnmappedSamLine_(OutputBuffer &out, MappingData *mapping_data, int64_t verbose_sam_output, const SingleSequence *read) const;
 
   // Calculates the LCSk of the anchors using the Fenwick tree.
   void CalcLCSFromLocalScoresCacheFriendly_(const Vertices *vertices, bool use_l1_filtering, int64_t l, int64_t allowed_dist, int* ret_lcskpp_length, std::vector<int> *ret_lcskpp_indices);
 
   // Count gapped spaced seed hits to regions on the reference.
   // Three different implementations providing the same interface.
+  // Dense engine, counts the hits in an array of bins covering the entire reference.
   int RegionSelectionNoCopy_(int64_t bin_size, MappingData *mapping_data, const std::vector<Index *> indexes, const SingleSequence *read, const ProgramParameters *parameters);
+  // Sort-based engine, sorts the (bin, seed position) keys of all hits instead of allocating the bins. Produces the same
+  // bins as RegionSelectionNoCopy_, but the cost depends only on the number of hits and not on the reference length.
   int RegionSelectionNoBins_(int64_t bin_size, MappingData *mapping_data, const std::vector<Index *> indexes, const SingleSequence *read, const ProgramParameters *parameters);
   int RegionSelectionNoCopyWithDensehash_(int64_t bin_size, MappingData *mapping_data, const std::vector<Index *> indexes, const SingleSequence *read, const ProgramParameters *parameters);
-
-  int GraphMap_(ScoreRegistry *local_score, Index *index_read, MappingData *mapping_data, const std::vector<Index *> indexes, const SingleSequence *read, const ProgramParameters *parameters);
-  int ProcessKmerCacheFriendly_(int8_t *kmer, int64_t kmer_start_position, ScoreRegistry *local_score, MappingData* mapping_data, Index *index_read, const SingleSequence* read, const ProgramParameters* parameters);
+  // Returns true if the sort-based engine should be used for the given read (see parameters->region_engine).
+  bool UseSortedRegionSelection_(int64_t bin_size, const std::vector<Index *> &indexes, const SingleSequence *read, const ProgramParameters *parameters) const;
+  // Used by the lazy sensitive mode. Returns true if the bins collected with the primary index have a top bin with enough
+  // support (parameters->lazy_secondary_support) and a large enough margin over the runner-up (parameters->lazy_secondary_margin).
+  bool IsPrimarySelectionConclusive_(const std::vector<std::vector<float> > &bins_chromosome, int64_t num_seeds, const ProgramParameters *parameters) const;
+  // Same as above, for the sparse bins of the sort-based engine: bin_ids are the global ids of non-empty bins in ascending
+  // order, and the bins of reference i have the ids [bin_starts[i], bin_starts[i + 1]).
+  bool IsPrimarySelectionConclusive_(const std::vector<int64_t> &bin_ids, const std::vector<float> &bin_counts, int64_t num_bins, const std::vector<int64_t> &bin_starts, int64_t num_seeds, const ProgramParameters *parameters) const;
+
+  int GraphMap_(ScoreRegistry *local_score, ReadKmerIndex *index_read, MappingData *mapping_data, const std::vector<Index *> indexes, const SingleSequence *read, const ProgramParameters *parameters);
+  int ProcessKmerCacheFriendly_(int8_t *kmer, int64_t kmer_start_position, ScoreRegistry *local_score, MappingData* mapping_data, ReadKmerIndex *index_read, const SingleSequence* read, const ProgramParameters* parameters);
 
   // Perform the LCSk calculation and simple filtering of the anchores that survived the LCSk.
   int SemiglobalPostProcessRegionWithLCS_(ScoreRegistry *local_score, MappingData *mapping_data, const std::vector<Index *> indexes, const SingleSequence *read, const ProgramParameters *parameters);
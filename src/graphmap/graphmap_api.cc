@@ -0,0 +1,76 @@
+/*
+ * graphmap_api.cc
+ *
+ *  Library interface for embedding the mapper: an immutable index handle and reentrant mapping of single reads.
+ */
+
+#include "graphmap/graphmap_api.h"
+#include "log_system/log_system.h"
+
+GraphMapIndex::GraphMapIndex() : mapper_(NULL), evalue_params_(NULL) {
+}
+
+GraphMapIndex::~GraphMapIndex() {
+  if (evalue_params_) {
+    DeleteEValueParams(evalue_params_);
+    evalue_params_ = NULL;
+  }
+  if (mapper_) {
+    delete mapper_;
+    mapper_ = NULL;
+  }
+}
+
+GraphMapIndex* GraphMapIndex::Load(const ProgramParameters &parameters) {
+  LogSystem::GetInstance().SetProgramVerboseLevelFromInt(parameters.verbose_level);
+
+  GraphMapIndex *handle = new GraphMapIndex;
+  handle->parameters_ = parameters;
+  if (handle->parameters_.index_file.size() == 0) {
+    handle->parameters_.index_file = handle->parameters_.reference_path + std::string(".gmidx");
+  }
+
+  handle->mapper_ = new GraphMap;
+  if (handle->mapper_->BuildIndex(handle->parameters_) || handle->mapper_->get_indexes().size() == 0) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_WARNING, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_OPENING_FILE, "Could not load or build the index '%s' of the reference '%s'.", handle->parameters_.index_file.c_str(), handle->parameters_.reference_path.c_str()));
+    delete handle;
+    return NULL;
+  }
+  handle->mapper_->ResolveAutomaticParameters(handle->parameters_);
+
+  handle->parameters_multiple_ = handle->parameters_;
+  handle->parameters_multiple_.output_multiple_alignments = true;
+  handle->parameters_.output_multiple_alignments = false;
+
+  // Only read by the mapping, so the same parameters are shared by all threads (as in ProcessSequenceFileInParallel).
+  SetupScorer((char *) "EDNA_FULL_5_4", handle->mapper_->get_indexes()[0]->get_data_length_forward(), -handle->parameters_.evalue_gap_open, -handle->parameters_.evalue_gap_extend, &handle->evalue_params_);
+
+  return handle;
+}
+
+const ProgramParameters& GraphMapIndex::get_parameters() const {
+  return parameters_;
+}
+
+const Index* GraphMapIndex::get_index() const {
+  return mapper_->get_indexes()[0];
+}
+
+int MapRead(const GraphMapIndex *handle, const std::string &seq, const std::string &qual, const MapReadOptions &options, std::vector<AlignmentResults> &ret_alignments) {
+  ret_alignments.clear();
+  if (handle == NULL || seq.size() == 0 || (qual.size() > 0 && qual.size() != seq.size())) {
+    return 1;
+  }
+
+  std::string header = (options.header.size() > 0) ? options.header : std::string("read");
+  SingleSequence read;
+  read.InitAllFromAscii((char *) header.c_str(), header.size(), (int8_t *) seq.c_str(), seq.size(),
+                        (qual.size() > 0) ? ((int8_t *) qual.c_str()) : NULL, qual.size(), options.read_id, options.read_id);
+
+  const ProgramParameters *parameters = (options.output_multiple_alignments == true) ? &handle->parameters_multiple_ : &handle->parameters_;
+  MappingData mapping_data;
+  handle->mapper_->ProcessRead(&mapping_data, handle->mapper_->get_indexes(), &read, parameters, handle->evalue_params_);
+  handle->mapper_->CollectAlignmentResults(&mapping_data, ret_alignments);
+
+  return 0;
+}
@@ -0,0 +1,66 @@
+/*
+ * graphmap_api.h
+ *
+ *  Library interface for embedding the mapper. The index is loaded once into an immutable handle, and single reads
+ *  are mapped with MapRead from any number of threads, without files and without formatting the results. Build the
+ *  library with "make lib" (lib/libgraphmap.a and lib/libgraphmap.so).
+ *
+ *  Example:
+ *    ProgramParameters parameters;
+ *    parameters.reference_path = "ref.fa";
+ *    parameters.index_file = "ref.fa.gmidx";
+ *    GraphMapIndex *handle = GraphMapIndex::Load(parameters);
+ *    std::vector<AlignmentResults> alignments;
+ *    MapRead(handle, seq, qual, MapReadOptions(), alignments);   // From any thread.
+ *    delete handle;
+ */
+
+#ifndef SRC_GRAPHMAP_GRAPHMAP_API_H_
+#define SRC_GRAPHMAP_GRAPHMAP_API_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "graphmap/graphmap.h"
+
+// Options of a single MapRead call. Everything else is set by the parameters of the handle.
+struct MapReadOptions {
+  std::string header = "";                    // Name of the read, reported in query_header of the results. If empty, "read" is used.
+  int64_t read_id = 0;                        // Reported in query_id of the results.
+  bool output_multiple_alignments = false;    // Return all similarly good alignments (secondary after the primary), instead of only the best one.
+};
+
+// Loaded index with the mapping parameters. It is not changed after Load, so it can be shared by all threads which
+// call MapRead. The parameters which depend on the index size (max_num_regions, max_num_hits) are resolved in Load.
+class GraphMapIndex {
+ public:
+  // Loads the index from parameters.index_file, or builds it from parameters.reference_path and stores it there if
+  // it does not exist yet (as graphmap align does). Returns NULL if the index could not be loaded or built.
+  static GraphMapIndex* Load(const ProgramParameters &parameters);
+  ~GraphMapIndex();
+
+  // Parameters used for mapping, after the automatic ones were resolved.
+  const ProgramParameters& get_parameters() const;
+  // Index of the forward and reverse strand, for the reference names and lengths (ref_id in the results).
+  const Index* get_index() const;
+
+ private:
+  GraphMapIndex();
+  GraphMapIndex(const GraphMapIndex&) = delete;
+  GraphMapIndex& operator=(const GraphMapIndex&) = delete;
+
+  GraphMap *mapper_;                            // Holds the loaded indexes. Only its reentrant functions are used after Load.
+  ProgramParameters parameters_;
+  ProgramParameters parameters_multiple_;       // Same as parameters_, with output_multiple_alignments set.
+  EValueParams *evalue_params_;
+
+  friend int MapRead(const GraphMapIndex *handle, const std::string &seq, const std::string &qual, const MapReadOptions &options, std::vector<AlignmentResults> &ret_alignments);
+};
+
+// Maps a single read (bases in ASCII) with the given handle, and returns its alignments in ret_alignments, primary
+// first. ret_alignments is empty if the read is unmapped. qual can be empty, otherwise it needs to have the same length
+// as seq. Thread-safe: any number of threads can map with the same handle at once. Returns 0 if OK (mapped or not),
+// and 1 if the arguments are not valid.
+int MapRead(const GraphMapIndex *handle, const std::string &seq, const std::string &qual, const MapReadOptions &options, std::vector<AlignmentResults> &ret_alignments);
+
+#endif /* SRC_GRAPHMAP_GRAPHMAP_API_H_ */
@@ -0,0 +1,41 @@
+/*
+ * instrumentation.cc
+ *
+ *  Building blocks of the run-level instrumentation of the mapping (mapping_stats, pipeline_trace, perf_counters and
+ *  memory_accounting).
+ */
+
+#include "graphmap/instrumentation.h"
+#include <algorithm>
+#include <mutex>
+
+// All existing ThreadSlots. Allocated once and never released, so that the slots which are destroyed at exit
+// (the singletons) can still unregister themselves.
+static std::vector<ThreadSlotsBase *>& ThreadSlotsRegistry() {
+  static std::vector<ThreadSlotsBase *> *registry = new std::vector<ThreadSlotsBase *>();
+  return *registry;
+}
+
+static std::mutex& ThreadSlotsRegistryMutex() {
+  static std::mutex *registry_mutex = new std::mutex();
+  return *registry_mutex;
+}
+
+ThreadSlotsBase::ThreadSlotsBase() {
+  std::lock_guard<std::mutex> lock(ThreadSlotsRegistryMutex());
+  ThreadSlotsRegistry().push_back(this);
+}
+
+ThreadSlotsBase::~ThreadSlotsBase() {
+  std::lock_guard<std::mutex> lock(ThreadSlotsRegistryMutex());
+  std::vector<ThreadSlotsBase *> &registry = ThreadSlotsRegistry();
+  registry.erase(std::remove(registry.begin(), registry.end(), this), registry.end());
+}
+
+void ThreadSlotsBase::ReserveAll(int64_t num_threads) {
+  std::lock_guard<std::mutex> lock(ThreadSlotsRegistryMutex());
+  std::vector<ThreadSlotsBase *> &registry = ThreadSlotsRegistry();
+  for (int64_t i = 0; i < ((int64_t) registry.size()); i++) {
+    registry[i]->Reserve(num_threads);
+  }
+}
@@ -0,0 +1,127 @@
+/*
+ * instrumentation.h
+ *
+ *  Building blocks of the run-level instrumentation of the mapping (mapping_stats, pipeline_trace, perf_counters and
+ *  memory_accounting).
+ */
+
+#ifndef SRC_GRAPHMAP_INSTRUMENTATION_H_
+#define SRC_GRAPHMAP_INSTRUMENTATION_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// Padding around every per-thread slot, so that no other allocation shares a cache line with it.
+#define THREAD_SLOT_PADDING   64
+
+// Base of all ThreadSlots, so that the slots of every subsystem are reserved with a single call.
+class ThreadSlotsBase {
+ public:
+  // Makes sure that every ThreadSlots has a slot for every thread id < num_threads. Not thread-safe, call outside of
+  // the parallel regions. The slots of a singleton exist only after its first GetInstance, so only the subsystems
+  // which are in use get slots.
+  static void ReserveAll(int64_t num_threads);
+
+ protected:
+  ThreadSlotsBase();
+  virtual ~ThreadSlotsBase();
+  virtual void Reserve(int64_t num_threads) = 0;
+
+ private:
+  ThreadSlotsBase(const ThreadSlotsBase&) = delete;
+  ThreadSlotsBase& operator=(const ThreadSlotsBase&) = delete;
+};
+
+// One T per thread id, which the threads record into without locking, since every thread uses only the slot of its
+// own id. The slots are small (some are a few words) and written after every read, so each one is padded by
+// THREAD_SLOT_PADDING bytes on both sides. Allocating them separately alone would not keep them on different cache lines.
+template <class T>
+class ThreadSlots : public ThreadSlotsBase {
+ public:
+  ThreadSlots() { }
+  ~ThreadSlots() {
+    Clear();
+  }
+
+  // Slot of the given thread id, or NULL if the slots were not reserved for it.
+  inline T* Get(int64_t thread_id) const {
+    return (thread_id >= 0 && thread_id < ((int64_t) slots_.size())) ? &(slots_[thread_id]->value) : NULL;
+  }
+  inline T& operator[](int64_t thread_id) { return slots_[thread_id]->value; }
+  inline const T& operator[](int64_t thread_id) const { return slots_[thread_id]->value; }
+  inline int64_t size() const { return slots_.size(); }
+
+  // Releases all slots. They are allocated again by the next ReserveAll.
+  void Clear() {
+    for (int64_t i = 0; i < ((int64_t) slots_.size()); i++) {
+      if (slots_[i]) { delete slots_[i]; }
+    }
+    slots_.clear();
+  }
+  // Resets every slot to a new T, keeping the slots.
+  void Reset() {
+    for (int64_t i = 0; i < ((int64_t) slots_.size()); i++) {
+      slots_[i]->value = T();
+    }
+  }
+
+ protected:
+  void Reserve(int64_t num_threads) {
+    while (((int64_t) slots_.size()) < num_threads) {
+      slots_.push_back(new PaddedSlot);
+    }
+  }
+
+ private:
+  struct PaddedSlot {
+    char padding_front[THREAD_SLOT_PADDING];
+    T value;
+    char padding_back[THREAD_SLOT_PADDING];
+  };
+
+  std::vector<PaddedSlot *> slots_;
+};
+
+// Enable flag of an opt-in subsystem. It is checked on the hot path, so it is a plain flag and not an atomic: it only
+// changes outside of the parallel regions.
+class InstrumentationSwitch {
+ public:
+  constexpr InstrumentationSwitch() : is_on_(false) { }
+  inline bool is_on() const { return is_on_; }
+  inline void set_on(bool is_on) { is_on_ = is_on; }
+
+ private:
+  bool is_on_;
+};
+
+// Measures a block of code for an opt-in subsystem. Policy::Begin() is called on construction, and returns false if
+// the subsystem is off. Policy::End() is then called once, from End() or at the end of the scope. When the subsystem
+// is off, the cost is the check of its flag in Begin (the destructor only tests a local).
+template <class Policy>
+class InstrumentationScope {
+ public:
+  template <class... Args>
+  explicit InstrumentationScope(Args... args) : policy_(args...) {
+    is_active_ = policy_.Begin();
+  }
+  ~InstrumentationScope() {
+    End();
+  }
+  // Ends the scope before the end of the block.
+  void End() {
+    if (is_active_) {
+      policy_.End();
+      is_active_ = false;
+    }
+  }
+
+ private:
+  Policy policy_;
+  bool is_active_;
+
+  InstrumentationScope(const InstrumentationScope&) = delete;
+  InstrumentationScope& operator=(const InstrumentationScope&) = delete;
+};
+
+#endif /* SRC_GRAPHMAP_INSTRUMENTATION_H_ */
@@ -5,6 +5,7 @@
  *      Author: isovic
  */
 
+#include <omp.h>
 #include "graphmap/graphmap.h"
 #include "graphmap/filter_anchors.h"
 
@@ -12,7 +13,12 @@ int GraphMap::AnchoredPostProcessRegionWithLCS_(ScoreRegistry* local_score, Mapp
   LOG_DEBUG_SPEC("Entering function. [time: %.2f sec, RSS: %ld MB, peakRSS: %ld MB] current_readid = %ld, current_local_score = %ld\n", (((float) (clock())) / CLOCKS_PER_SEC), getCurrentRSS() / (1024 * 1024), getPeakRSS() / (1024 * 1024), read->get_sequence_id(), local_score->get_scores_id());
   int lcskpp_length = 0;
   std::vector<int> lcskpp_indices;
-  CalcLCSFromLocalScoresCacheFriendly_(&(local_score->get_registry_entries()), false, 0, 0, &lcskpp_length, &lcskpp_indices);
+  double lcsk_clock = omp_get_wtime();
+  {
+    PerfStageScope perf_lcsk(STAGE_LCSK);
+    CalcLCSFromLocalScoresCacheFriendly_(&(local_score->get_registry_entries()), false, 0, 0, &lcskpp_length, &lcskpp_indices);
+  }
+  mapping_data->time_lcsk += omp_get_wtime() - lcsk_clock;
   if (lcskpp_length == 0) {
     LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, read->get_sequence_id() == parameters->debug_read, FormatString("Current local scores: %ld, lcskpp_length == 0 || best_score == NULL\n", local_score->get_scores_id()), "ExperimentalPostProcessRegionWithLCS");
     return 1;
@@ -15,6 +15,7 @@
 #include <cassert>
 #include <cmath>
 #include <cstdlib>
+#include <omp.h>
 
 #include "graphmap/graphmap.h"
 #include "algorithm/fenwick.h"
@@ -326,7 +327,12 @@ int GraphMap::SemiglobalPostProcessRegionWithLCS_(ScoreRegistry* local_score, Ma
   #endif
 
 //  CalcLCSFromLocalScores2(&(local_score->get_registry_entries()), false, 0, 0, &lcskpp_length, &lcskpp_indices);
-  CalcLCSFromLocalScoresCacheFriendly_(&(local_score->get_registry_entries()), false, 0, 0, &lcskpp_length, &lcskpp_indices);
+  double lcsk_clock = omp_get_wtime();
+  {
+    PerfStageScope perf_lcsk(STAGE_LCSK);
+    CalcLCSFromLocalScoresCacheFriendly_(&(local_score->get_registry_entries()), false, 0, 0, &lcskpp_length, &lcskpp_indices);
+  }
+  mapping_data->time_lcsk += omp_get_wtime() - lcsk_clock;
 
   if (lcskpp_length == 0) {
     LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, read->get_sequence_id() == parameters->debug_read, FormatString("Current local scores: %ld, lcskpp_length == 0 || best_score == NULL\n", local_score->get_scores_id()), "PostProcessRegionWithLCS_");
@@ -359,7 +365,12 @@ int GraphMap::SemiglobalPostProcessRegionWithLCS_(ScoreRegistry* local_score, Ma
   lcskpp_indices.clear();
 
   // Call the LCSk again, only on the bricks within the L1 bounded window.
-  CalcLCSFromLocalScoresCacheFriendly_(&(local_score->get_registry_entries()), true, l, allowed_L1_deviation, &lcskpp_length, &lcskpp_indices);
+  lcsk_clock = omp_get_wtime();
+  {
+    PerfStageScope perf_lcsk(STAGE_LCSK);
+    CalcLCSFromLocalScoresCacheFriendly_(&(local_score->get_registry_entries()), true, l, allowed_L1_deviation, &lcskpp_length, &lcskpp_indices);
+  }
+  mapping_data->time_lcsk += omp_get_wtime() - lcsk_clock;
 
   // Count the number of covered bases, and find the first and last element of the LCSk.
   int64_t indexfirst = -1;
@@ -0,0 +1,208 @@
+/*
+ * mapping_stats.cc
+ *
+ *  Run-level statistics of the mapping: latency histograms of the pipeline stages of every read, and throughput
+ *  counters.
+ */
+
+#include "graphmap/mapping_stats.h"
+#include <stdio.h>
+#include <omp.h>
+#include <algorithm>
+#include "log_system/log_system.h"
+
+const char* StageName(int stage) {
+  switch (stage) {
+    case STAGE_SEED_LOOKUP: return "seed_lookup";
+    case STAGE_BIN_COUNTING: return "bin_counting";
+    case STAGE_GRAPH: return "graph";
+    case STAGE_LCSK: return "lcsk";
+    case STAGE_FILTERING: return "filtering";
+    case STAGE_ALIGNMENT: return "alignment";
+    case STAGE_FORMATTING: return "formatting";
+    case STAGE_TOTAL: return "total";
+    default: break;
+  }
+  return "unknown";
+}
+
+LatencyHistogram::LatencyHistogram() {
+  Clear();
+}
+
+void LatencyHistogram::Clear() {
+  buckets_.assign(LATENCY_HISTOGRAM_NUM_BUCKETS, 0);
+  count_ = 0;
+  sum_ = 0;
+  min_ = 0;
+  max_ = 0;
+}
+
+int64_t LatencyHistogram::BucketIndex_(int64_t value) {
+  if (value < (((int64_t) 1) << LATENCY_HISTOGRAM_SUB_BITS)) {
+    return std::max((int64_t) 0, value);
+  }
+  value = std::min(value, (((int64_t) 1) << LATENCY_HISTOGRAM_MAX_BITS) - 1);
+  int64_t msb = 63 - __builtin_clzll((uint64_t) value);
+  int64_t shift = msb - LATENCY_HISTOGRAM_SUB_BITS;
+  return ((shift + 1) << LATENCY_HISTOGRAM_SUB_BITS) + ((value >> shift) - (((int64_t) 1) << LATENCY_HISTOGRAM_SUB_BITS));
+}
+
+int64_t LatencyHistogram::BucketValue_(int64_t bucket) {
+  int64_t group = bucket >> LATENCY_HISTOGRAM_SUB_BITS;
+  int64_t sub_bucket = bucket & ((((int64_t) 1) << LATENCY_HISTOGRAM_SUB_BITS) - 1);
+  if (group == 0) {
+    return sub_bucket;
+  }
+  int64_t shift = group - 1;
+  int64_t lower = (sub_bucket + (((int64_t) 1) << LATENCY_HISTOGRAM_SUB_BITS)) << shift;
+  return lower + ((((int64_t) 1) << shift) / 2);
+}
+
+void LatencyHistogram::Record(int64_t value_ns) {
+  value_ns = std::max((int64_t) 0, value_ns);
+  buckets_[BucketIndex_(value_ns)] += 1;
+  min_ = (count_ == 0) ? value_ns : std::min(min_, value_ns);
+  max_ = (count_ == 0) ? value_ns : std::max(max_, value_ns);
+  count_ += 1;
+  sum_ += value_ns;
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram &other) {
+  if (other.count_ == 0) {
+    return;
+  }
+  for (int64_t i = 0; i < LATENCY_HISTOGRAM_NUM_BUCKETS; i++) {
+    buckets_[i] += other.buckets_[i];
+  }
+  min_ = (count_ == 0) ? other.min_ : std::min(min_, other.min_);
+  max_ = (count_ == 0) ? other.max_ : std::max(max_, other.max_);
+  count_ += other.count_;
+  sum_ += other.sum_;
+}
+
+int64_t LatencyHistogram::GetPercentile(double percentile) const {
+  if (count_ == 0) {
+    return 0;
+  }
+  int64_t rank = (int64_t) ((std::min(100.0, std::max(0.0, percentile)) / 100.0) * count_ + 0.5);
+  rank = std::max((int64_t) 1, std::min(count_, rank));
+  int64_t cumulative = 0;
+  for (int64_t i = 0; i < LATENCY_HISTOGRAM_NUM_BUCKETS; i++) {
+    cumulative += buckets_[i];
+    if (cumulative >= rank) {
+      // The bucket value is only an approximation, so it is kept within the observed range.
+      return std::max(min_, std::min(max_, BucketValue_(i)));
+    }
+  }
+  return max_;
+}
+
+int64_t LatencyHistogram::get_count() const {
+  return count_;
+}
+
+int64_t LatencyHistogram::get_sum() const {
+  return sum_;
+}
+
+int64_t LatencyHistogram::get_min() const {
+  return min_;
+}
+
+int64_t LatencyHistogram::get_max() const {
+  return max_;
+}
+
+MappingStats::MappingStats() : start_time_(0.0) {
+}
+
+MappingStats::~MappingStats() {
+}
+
+void MappingStats::Start() {
+  threads_.Clear();
+  start_time_ = omp_get_wtime();
+}
+
+void MappingStats::RecordRead(int64_t thread_id, const ReadStageTimes &times, int64_t read_length, bool is_mapped) {
+  Counters *thread_stats = threads_.Get(thread_id);
+  if (thread_stats == NULL) {
+    return;
+  }
+  for (int stage = 0; stage < NUM_STAGES; stage++) {
+    thread_stats->stages[stage].Record((int64_t) (times.time[stage] * 1e9));
+  }
+  thread_stats->num_reads += 1;
+  thread_stats->num_mapped += (is_mapped) ? 1 : 0;
+  thread_stats->num_bases += read_length;
+}
+
+MappingStats::Counters MappingStats::GetTotals() const {
+  Counters merged;
+  for (int64_t i = 0; i < threads_.size(); i++) {
+    for (int stage = 0; stage < NUM_STAGES; stage++) {
+      merged.stages[stage].Merge(threads_[i].stages[stage]);
+    }
+    merged.num_reads += threads_[i].num_reads;
+    merged.num_mapped += threads_[i].num_mapped;
+    merged.num_bases += threads_[i].num_bases;
+  }
+  return merged;
+}
+
+double MappingStats::GetWallTime() const {
+  return omp_get_wtime() - start_time_;
+}
+
+std::string MappingStats::FormatSummary() const {
+  Counters merged = GetTotals();
+  double wall_time = GetWallTime();
+
+  std::string ret = FormatString("Mapping statistics (wall-clock time per read, in ms):\n");
+  ret += FormatString("  %-14s %10s %10s %10s %10s %10s %10s %10s\n", "stage", "total_s", "mean", "p50", "p90", "p99", "p99.9", "max");
+  for (int stage = 0; stage < NUM_STAGES; stage++) {
+    const LatencyHistogram &histogram = merged.stages[stage];
+    double mean = (histogram.get_count() > 0) ? (((double) histogram.get_sum()) / histogram.get_count()) : 0.0;
+    ret += FormatString("  %-14s %10.2f %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n", StageName(stage), histogram.get_sum() / 1e9, mean / 1e6,
+                        histogram.GetPercentile(50.0) / 1e6, histogram.GetPercentile(90.0) / 1e6, histogram.GetPercentile(99.0) / 1e6,
+                        histogram.GetPercentile(99.9) / 1e6, histogram.get_max() / 1e6);
+  }
+  ret += FormatString("Throughput: %ld reads (%ld mapped) and %.2f Mbp in %.2f sec of wall time, %.2f reads/s, %.2f Mbp/s, %ld threads.\n",
+                      merged.num_reads, merged.num_mapped, merged.num_bases / 1e6, wall_time,
+                      (wall_time > 0.0) ? (merged.num_reads / wall_time) : 0.0, (wall_time > 0.0) ? (merged.num_bases / 1e6 / wall_time) : 0.0, (int64_t) threads_.size());
+
+  return ret;
+}
+
+int MappingStats::WriteJSON(std::string path) const {
+  FILE *fp = fopen(path.c_str(), "w");
+  if (fp == NULL) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_WARNING, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_OPENING_FILE, "Could not open '%s' for writing the mapping statistics.", path.c_str()));
+    return 1;
+  }
+
+  Counters merged = GetTotals();
+  double wall_time = GetWallTime();
+
+  fprintf (fp, "{\n");
+  fprintf (fp, "  \"wall_time_s\": %.6f,\n", wall_time);
+  fprintf (fp, "  \"num_threads\": %ld,\n", (int64_t) threads_.size());
+  fprintf (fp, "  \"num_reads\": %ld,\n", merged.num_reads);
+  fprintf (fp, "  \"num_mapped\": %ld,\n", merged.num_mapped);
+  fprintf (fp, "  \"num_bases\": %ld,\n", merged.num_bases);
+  fprintf (fp, "  \"reads_per_s\": %.3f,\n", (wall_time > 0.0) ? (merged.num_reads / wall_time) : 0.0);
+  fprintf (fp, "  \"bases_per_s\": %.3f,\n", (wall_time > 0.0) ? (merged.num_bases / wall_time) : 0.0);
+  fprintf (fp, "  \"stages\": {\n");
+  for (int stage = 0; stage < NUM_STAGES; stage++) {
+    const LatencyHistogram &histogram = merged.stages[stage];
+    fprintf (fp, "    \"%s\": {\"count\": %ld, \"total_ns\": %ld, \"min_ns\": %ld, \"p50_ns\": %ld, \"p90_ns\": %ld, \"p99_ns\": %ld, \"p999_ns\": %ld, \"max_ns\": %ld}%s\n",
+             StageName(stage), histogram.get_count(), histogram.get_sum(), histogram.get_min(), histogram.GetPercentile(50.0), histogram.GetPercentile(90.0),
+             histogram.GetPercentile(99.0), histogram.GetPercentile(99.9), histogram.get_max(), ((stage + 1) < NUM_STAGES) ? "," : "");
+  }
+  fprintf (fp, "  }\n");
+  fprintf (fp, "}\n");
+  fclose(fp);
+
+  return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * mapping_stats.h
+ *
+ *  Run-level statistics of the mapping: latency histograms of the pipeline stages of every read, and throughput
+ *  counters. Every mapping thread records into its own slot, and the slots are merged only for the report.
+ */
+
+#ifndef SRC_GRAPHMAP_MAPPING_STATS_H_
+#define SRC_GRAPHMAP_MAPPING_STATS_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "graphmap/instrumentation.h"
+
+// Pipeline stages of a read.
+#define STAGE_SEED_LOOKUP   0   // Seed lookups in region selection.
+#define STAGE_BIN_COUNTING  1   // Rest of region selection (bin allocation, counting and sorting).
+#define STAGE_GRAPH         2   // Graph mapping of the read to all regions.
+#define STAGE_LCSK          3   // LCSk of the anchors, for all regions.
+#define STAGE_FILTERING     4   // L1 and anchor filtering, for all regions.
+#define STAGE_ALIGNMENT     5
+#define STAGE_FORMATTING    6   // Conversion of the alignments to the output format.
+#define STAGE_TOTAL         7   // Whole read.
+#define NUM_STAGES          8
+
+// Log-linear (HDR-style) buckets: values below 2^LATENCY_HISTOGRAM_SUB_BITS ns are stored exactly, and every
+// larger power of two is split into 2^LATENCY_HISTOGRAM_SUB_BITS buckets, which is ~3% relative precision.
+#define LATENCY_HISTOGRAM_SUB_BITS    5
+#define LATENCY_HISTOGRAM_MAX_BITS    42   // Values are clamped to 2^42 ns (~73 min).
+#define LATENCY_HISTOGRAM_NUM_BUCKETS ((LATENCY_HISTOGRAM_MAX_BITS - LATENCY_HISTOGRAM_SUB_BITS + 1) << LATENCY_HISTOGRAM_SUB_BITS)
+
+class LatencyHistogram {
+ public:
+  LatencyHistogram();
+
+  void Clear();
+  // Records one latency, in nanoseconds.
+  void Record(int64_t value_ns);
+  void Merge(const LatencyHistogram &other);
+  // Returns the latency (ns) at the given percentile (0.0 - 100.0), up to the precision of the buckets.
+  int64_t GetPercentile(double percentile) const;
+
+  int64_t get_count() const;
+  int64_t get_sum() const;
+  int64_t get_min() const;
+  int64_t get_max() const;
+
+ private:
+  std::vector<int64_t> buckets_;
+  int64_t count_;
+  int64_t sum_;
+  int64_t min_;
+  int64_t max_;
+
+  static int64_t BucketIndex_(int64_t value);
+  static int64_t BucketValue_(int64_t bucket);    // Middle of the range of values of the bucket.
+};
+
+// Stage times of a single read, in seconds of wall-clock time.
+struct ReadStageTimes {
+  double time[NUM_STAGES] = {0.0};
+};
+
+class MappingStats {
+ public:
+  struct Counters {
+    LatencyHistogram stages[NUM_STAGES];
+    int64_t num_reads = 0;
+    int64_t num_mapped = 0;
+    int64_t num_bases = 0;
+  };
+
+  MappingStats();
+  ~MappingStats();
+
+  // Clears all counters and starts the wall clock of the run. The slots of the threads are allocated by ThreadSlotsBase::ReserveAll.
+  void Start();
+  // Records one processed read into the slot of the thread.
+  void RecordRead(int64_t thread_id, const ReadStageTimes &times, int64_t read_length, bool is_mapped);
+
+  // Human readable table of the per-stage latencies and the throughput.
+  std::string FormatSummary() const;
+  // Writes the same data as JSON. Returns 0 if OK.
+  int WriteJSON(std::string path) const;
+
+  // Counters merged over all threads.
+  Counters GetTotals() const;
+  // Wall time since Start, in seconds.
+  double GetWallTime() const;
+
+ private:
+  ThreadSlots<Counters> threads_;
+  double start_time_;
+};
+
+// Name of the stage, as used in the report.
+const char* StageName(int stage);
+
+#endif /* SRC_GRAPHMAP_MAPPING_STATS_H_ */
@@ -0,0 +1,141 @@
+/*
+ * memory_accounting.cc
+ *
+ *  Memory use of the mapping per subsystem, for the report and the memory governor.
+ */
+
+#include "graphmap/memory_accounting.h"
+#include <algorithm>
+#include "log_system/log_system.h"
+#include "utility/utility_general.h"
+
+const char* MemorySubsystemName(int subsystem) {
+  switch (subsystem) {
+    case MEMORY_INDEX: return "index";
+    case MEMORY_READS: return "reads";
+    case MEMORY_THREAD_SCRATCH: return "thread_scratch";
+    case MEMORY_OUTPUT: return "output";
+    default: break;
+  }
+  return "unknown";
+}
+
+MemoryAccounting& MemoryAccounting::GetInstance() {
+  static MemoryAccounting accounting;
+  return accounting;
+}
+
+MemoryAccounting::MemoryAccounting() {
+  for (int subsystem = 0; subsystem < NUM_MEMORY_SUBSYSTEMS; subsystem++) {
+    current_[subsystem] = 0;
+    peak_[subsystem] = 0;
+  }
+}
+
+MemoryAccounting::~MemoryAccounting() {
+}
+
+void MemoryAccounting::ResetMapping() {
+  for (int subsystem = 0; subsystem < NUM_MEMORY_SUBSYSTEMS; subsystem++) {
+    if (subsystem == MEMORY_INDEX) { continue; }
+    current_[subsystem] = 0;
+    peak_[subsystem] = 0;
+  }
+  threads_.Reset();
+}
+
+void MemoryAccounting::SetIndexSections(const std::vector<std::pair<std::string, int64_t> > &sections) {
+  index_sections_ = sections;
+  int64_t total = 0;
+  for (int64_t i = 0; i < sections.size(); i++) {
+    total += sections[i].second;
+  }
+  Set(MEMORY_INDEX, total);
+}
+
+void MemoryAccounting::Set(int subsystem, int64_t bytes) {
+  current_[subsystem] = bytes;
+  UpdatePeak_(subsystem, bytes);
+}
+
+void MemoryAccounting::Add(int subsystem, int64_t bytes) {
+  int64_t current = current_[subsystem].fetch_add(bytes) + bytes;
+  UpdatePeak_(subsystem, current);
+}
+
+void MemoryAccounting::UpdatePeak_(int subsystem, int64_t bytes) {
+  int64_t peak = peak_[subsystem].load();
+  while (bytes > peak && peak_[subsystem].compare_exchange_weak(peak, bytes) == false) {
+  }
+}
+
+void MemoryAccounting::RecordReadScratch(int64_t thread_id, int64_t bytes, int64_t read_length) {
+  ThreadScratch *thread_scratch = threads_.Get(thread_id);
+  if (thread_scratch == NULL) { return; }
+  if (bytes > thread_scratch->max_bytes) {
+    thread_scratch->max_bytes = bytes;
+    thread_scratch->max_read_length = read_length;
+  }
+  if (read_length > 0) {
+    thread_scratch->max_bytes_per_base = std::max(thread_scratch->max_bytes_per_base, ((double) bytes) / read_length);
+  }
+}
+
+int64_t MemoryAccounting::get_current(int subsystem) const {
+  return current_[subsystem];
+}
+
+int64_t MemoryAccounting::get_peak(int subsystem) const {
+  if (subsystem == MEMORY_THREAD_SCRATCH) {
+    int64_t sum = 0;
+    for (int64_t i = 0; i < threads_.size(); i++) {
+      sum += threads_[i].max_bytes;
+    }
+    return sum;
+  }
+  return peak_[subsystem];
+}
+
+int64_t MemoryAccounting::EstimateReadScratch(int64_t read_length) const {
+  double max_bytes_per_base = 0.0;
+  for (int64_t i = 0; i < threads_.size(); i++) {
+    max_bytes_per_base = std::max(max_bytes_per_base, threads_[i].max_bytes_per_base);
+  }
+  return std::max(MEMORY_SCRATCH_MIN_PER_THREAD, (int64_t) (max_bytes_per_base * read_length));
+}
+
+int64_t MemoryAccounting::GetMaxReadScratch() const {
+  int64_t max_bytes = 0;
+  for (int64_t i = 0; i < threads_.size(); i++) {
+    max_bytes = std::max(max_bytes, threads_[i].max_bytes);
+  }
+  return max_bytes;
+}
+
+std::string MemoryAccounting::FormatSummary() const {
+  const double MB = 1024.0 * 1024.0;
+
+  std::string ret = FormatString("Memory use per subsystem (tracked allocations, in MB):\n");
+  ret += FormatString("  %-20s %10s %10s\n", "subsystem", "current", "peak");
+  for (int subsystem = 0; subsystem < NUM_MEMORY_SUBSYSTEMS; subsystem++) {
+    ret += FormatString("  %-20s %10.2f %10.2f\n", MemorySubsystemName(subsystem), get_current(subsystem) / MB, get_peak(subsystem) / MB);
+    if (subsystem == MEMORY_INDEX) {
+      for (int64_t i = 0; i < index_sections_.size(); i++) {
+        ret += FormatString("    %-18s %10.2f\n", index_sections_[i].first.c_str(), index_sections_[i].second / MB);
+      }
+    }
+  }
+
+  // The thread with the largest working memory of a read shows the read length at which it happened.
+  int64_t max_bytes = 0, max_read_length = 0;
+  for (int64_t i = 0; i < threads_.size(); i++) {
+    if (threads_[i].max_bytes > max_bytes) {
+      max_bytes = threads_[i].max_bytes;
+      max_read_length = threads_[i].max_read_length;
+    }
+  }
+  ret += FormatString("Largest working memory of a read: %.2f MB (read length %ld). RSS: %.2f MB current, %.2f MB peak.\n",
+                      max_bytes / MB, max_read_length, getCurrentRSS() / MB, getPeakRSS() / MB);
+
+  return ret;
+}
@@ -0,0 +1,89 @@
+/*
+ * memory_accounting.h
+ *
+ *  Memory use of the mapping per subsystem: the loaded index (per section), the current batch of reads, the working
+ *  memory of the mapping threads and the output lines kept in memory. The numbers are sizes of the tracked
+ *  allocations, not the RSS, so they also show where the memory goes. The memory governor of GraphMap picks the batch
+ *  size and the number of threads from them, to stay within --max-memory.
+ */
+
+#ifndef SRC_GRAPHMAP_MEMORY_ACCOUNTING_H_
+#define SRC_GRAPHMAP_MEMORY_ACCOUNTING_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <utility>
+#include <vector>
+#include "graphmap/instrumentation.h"
+
+#define MEMORY_INDEX            0   // Reference data and index structures, of all loaded indexes and their replicas.
+#define MEMORY_READS            1   // Current batch of reads.
+#define MEMORY_THREAD_SCRATCH   2   // Working memory of the reads being mapped (vertices, bins, score registry, LCSk buffers).
+#define MEMORY_OUTPUT           3   // Output lines which were formatted, but not written yet.
+#define NUM_MEMORY_SUBSYSTEMS   4
+
+// Approximate working memory per unit of a read, for the buffers which are freed before the end of a region and
+// cannot be measured directly. From the sizes of the element types in region selection and in the LCSk.
+#define REGION_SCRATCH_BYTES_PER_HIT    20   // Hit key, bin id and bin count of every seed hit (sorted region selection).
+#define LCSK_SCRATCH_BYTES_PER_ANCHOR   72   // Two events, the match arrays and the DP, reconstruction and result arrays.
+#define LCSK_SCRATCH_BYTES_PER_BASE     16   // Fenwick tree over the coordinates of the region.
+
+#define MEMORY_SCRATCH_MIN_PER_THREAD       ((int64_t) 64 * 1024 * 1024)    // Working memory assumed per thread before any read was mapped.
+#define MEMORY_UNTRACKED_OVERHEAD           ((int64_t) 128 * 1024 * 1024)   // Binary, libraries, thread stacks and allocator slack, assumed by the governor.
+#define MEMORY_READS_PER_BATCH_BYTE         2.0                             // Tracked bytes of a loaded batch per byte of --batch-mb (headers, qualities, object overhead).
+#define MEMORY_DEFAULT_OUTPUT_PER_READ_BYTE 1.5                             // Output bytes per byte of the reads, until it is measured on a batch.
+
+class MemoryAccounting {
+ public:
+  static MemoryAccounting& GetInstance();
+
+  // Clears the counters of all subsystems except the index, which stays loaded between runs.
+  void ResetMapping();
+
+  // Replaces the index sections, as (name, bytes) pairs, and sets the size of MEMORY_INDEX to their sum.
+  void SetIndexSections(const std::vector<std::pair<std::string, int64_t> > &sections);
+  // Sets the current size of a subsystem, and updates its peak. Thread-safe.
+  void Set(int subsystem, int64_t bytes);
+  // Adds bytes (can be negative) to the current size of a subsystem, and updates its peak. Thread-safe.
+  void Add(int subsystem, int64_t bytes);
+  // Records the working memory of a mapped read into the slot of the thread.
+  void RecordReadScratch(int64_t thread_id, int64_t bytes, int64_t read_length);
+
+  int64_t get_current(int subsystem) const;
+  // For MEMORY_THREAD_SCRATCH, the sum of the per-thread peaks, which is the most the threads could have used at once.
+  int64_t get_peak(int subsystem) const;
+
+  // Working memory expected for mapping a read of the given length, from the largest working memory per base seen so
+  // far. Never less than MEMORY_SCRATCH_MIN_PER_THREAD. Not thread-safe, call outside of the parallel region.
+  int64_t EstimateReadScratch(int64_t read_length) const;
+  // Largest working memory of a single read seen so far.
+  int64_t GetMaxReadScratch() const;
+
+  // Human readable table of the current and peak size of every subsystem, with the index sections and the RSS.
+  std::string FormatSummary() const;
+
+ private:
+  MemoryAccounting();
+  ~MemoryAccounting();
+  MemoryAccounting(const MemoryAccounting&) = delete;
+  MemoryAccounting& operator=(const MemoryAccounting&) = delete;
+
+  struct ThreadScratch {
+    int64_t max_bytes = 0;
+    int64_t max_read_length = 0;
+    double max_bytes_per_base = 0.0;
+  };
+
+  std::atomic<int64_t> current_[NUM_MEMORY_SUBSYSTEMS];
+  std::atomic<int64_t> peak_[NUM_MEMORY_SUBSYSTEMS];
+  std::vector<std::pair<std::string, int64_t> > index_sections_;
+  ThreadSlots<ThreadScratch> threads_;
+
+  void UpdatePeak_(int subsystem, int64_t bytes);
+};
+
+// Name of the subsystem, as used in the report.
+const char* MemorySubsystemName(int subsystem);
+
+#endif /* SRC_GRAPHMAP_MEMORY_ACCOUNTING_H_ */
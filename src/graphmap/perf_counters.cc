@@ -0,0 +1,314 @@
+/*
+ * perf_counters.cc
+ *
+ *  Opt-in hardware performance counters per pipeline stage, using perf_event_open.
+ */
+
+#include "graphmap/perf_counters.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <omp.h>
+#include <algorithm>
+#include "log_system/log_system.h"
+
+#ifdef __linux__
+  #include <unistd.h>
+  #include <sys/syscall.h>
+  #include <sys/mman.h>
+  #include <linux/perf_event.h>
+#endif
+
+static const char *kPerfCounterNames[NUM_PERF_COUNTERS] = {"cycles", "instructions", "llc_misses", "l1d_misses", "dtlb_misses", "branch_misses"};
+
+struct PerfCounters::ThreadCounters {
+  int64_t os_thread_id = -1;                  // The counters only count the thread which opened them.
+  bool is_open = false;
+  int fds[NUM_PERF_COUNTERS];                 // fds[PERF_COUNTER_CYCLES] is the group leader. -1 if not open.
+  void *pages[NUM_PERF_COUNTERS];             // Mapped perf_event_mmap_page of every counter, for rdpmc. NULL if not mapped.
+  int active_stage = PERF_STAGE_NONE;
+  uint64_t last[NUM_PERF_COUNTERS];           // Counter values at the last stage boundary.
+  uint64_t counts[NUM_STAGES][NUM_PERF_COUNTERS];
+
+  ThreadCounters() {
+    for (int c = 0; c < NUM_PERF_COUNTERS; c++) { fds[c] = -1; pages[c] = NULL; last[c] = 0; }
+    memset(counts, 0, sizeof(counts));
+  }
+};
+
+InstrumentationSwitch PerfCounters::enabled_;
+InstrumentationSwitch PerfCounters::fine_grained_enabled_;
+
+#ifdef __linux__
+static int64_t GetOSThreadId() {
+  // The system call is made only once per thread.
+  static thread_local int64_t os_thread_id = -1;
+  if (os_thread_id < 0) {
+    os_thread_id = (int64_t) syscall(SYS_gettid);
+  }
+  return os_thread_id;
+}
+
+static int OpenPerfEvent(int counter, int group_fd) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  switch (counter) {
+    case PERF_COUNTER_CYCLES: attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+    case PERF_COUNTER_INSTRUCTIONS: attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+    case PERF_COUNTER_LLC_MISSES: attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+    case PERF_COUNTER_L1D_MISSES: attr.type = PERF_TYPE_HW_CACHE; attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16); break;
+    case PERF_COUNTER_DTLB_MISSES: attr.type = PERF_TYPE_HW_CACHE; attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16); break;
+    case PERF_COUNTER_BRANCH_MISSES: attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+    default: return -1;
+  }
+  // Only the user space of the calling thread is counted, which is allowed with the default perf_event_paranoid.
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return (int) syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+// Reads the counter from user space, as described in the perf_event_open man page. Returns false if the counter
+// can not be read this way (not x86-64, rdpmc not allowed, or the counter is not scheduled on the CPU).
+static inline bool ReadPerfEventRdpmc(void *page_ptr, uint64_t *value) {
+#if defined(__x86_64__)
+  volatile struct perf_event_mmap_page *page = (volatile struct perf_event_mmap_page *) page_ptr;
+  uint32_t seq = 0;
+  uint64_t count = 0;
+  do {
+    seq = page->lock;
+    __asm__ __volatile__("" ::: "memory");
+    uint32_t index = page->index;
+    if (page->cap_user_rdpmc == 0 || index == 0) {
+      return false;
+    }
+    uint32_t low = 0, high = 0;
+    __asm__ __volatile__("rdpmc" : "=a" (low), "=d" (high) : "c" (index - 1));
+    int64_t pmc = (int64_t) ((((uint64_t) high) << 32) | low);
+    uint16_t width = page->pmc_width;
+    pmc <<= 64 - width;     // Sign extend the counter to 64 bits.
+    pmc >>= 64 - width;
+    count = page->offset + pmc;
+    __asm__ __volatile__("" ::: "memory");
+  } while (page->lock != seq);
+  *value = count;
+  return true;
+#else
+  return false;
+#endif
+}
+
+static void ClosePerfEvents(int *fds, void **pages) {
+  long page_size = sysconf(_SC_PAGESIZE);
+  for (int c = NUM_PERF_COUNTERS - 1; c >= 0; c--) {
+    if (pages[c] != NULL) { munmap(pages[c], page_size); pages[c] = NULL; }
+    if (fds[c] >= 0) { close(fds[c]); fds[c] = -1; }
+  }
+}
+
+// Opens the counters of the calling thread as one group, so that they are scheduled together. Counters which are
+// not in use_counters, or which the CPU does not support, are left out. Returns errno of the group leader, or 0.
+static int OpenPerfEvents(const bool *use_counters, int *fds, void **pages) {
+  long page_size = sysconf(_SC_PAGESIZE);
+  fds[PERF_COUNTER_CYCLES] = OpenPerfEvent(PERF_COUNTER_CYCLES, -1);
+  if (fds[PERF_COUNTER_CYCLES] < 0) {
+    return errno;
+  }
+  for (int c = 0; c < NUM_PERF_COUNTERS; c++) {
+    if (c != PERF_COUNTER_CYCLES) {
+      fds[c] = (use_counters[c] == true) ? OpenPerfEvent(c, fds[PERF_COUNTER_CYCLES]) : -1;
+    }
+    if (fds[c] >= 0) {
+      void *page = mmap(NULL, page_size, PROT_READ, MAP_SHARED, fds[c], 0);
+      pages[c] = (page == MAP_FAILED) ? NULL : page;
+    }
+  }
+  return 0;
+}
+
+// Reads all counters of the calling thread. Uses rdpmc if possible, and a single read of the group otherwise.
+static void ReadPerfEvents(const int *fds, void * const *pages, uint64_t *values) {
+  bool is_read = true;
+  for (int c = 0; c < NUM_PERF_COUNTERS && is_read == true; c++) {
+    values[c] = 0;
+    if (fds[c] >= 0) {
+      is_read = (pages[c] != NULL && ReadPerfEventRdpmc(pages[c], &values[c]));
+    }
+  }
+  if (is_read == true) {
+    return;
+  }
+
+  // Layout with PERF_FORMAT_GROUP: nr, time_enabled, time_running, and the values of the open counters in the order of opening.
+  uint64_t buffer[3 + NUM_PERF_COUNTERS];
+  memset(buffer, 0, sizeof(buffer));
+  if (read(fds[PERF_COUNTER_CYCLES], buffer, sizeof(buffer)) <= 0) {
+    return;
+  }
+  int64_t value_id = 0;
+  for (int c = 0; c < NUM_PERF_COUNTERS; c++) {
+    values[c] = (fds[c] >= 0 && value_id < buffer[0]) ? buffer[3 + value_id++] : 0;
+  }
+}
+#endif
+
+PerfCounters& PerfCounters::GetInstance() {
+  static PerfCounters perf_counters;
+  return perf_counters;
+}
+
+PerfCounters::PerfCounters() {
+  for (int c = 0; c < NUM_PERF_COUNTERS; c++) { is_counter_available_[c] = false; }
+}
+
+PerfCounters::~PerfCounters() {
+  Stop();
+  Clear_();
+}
+
+void PerfCounters::Clear_() {
+  threads_.Clear();
+}
+
+int PerfCounters::Start() {
+  Stop();
+  Clear_();
+  fine_grained_enabled_.set_on(false);
+
+#ifndef __linux__
+  LogSystem::GetInstance().Error(SEVERITY_INT_WARNING, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_NOT_IMPLEMENTED, "Hardware performance counters are only supported on Linux. Continuing without them."));
+  return 1;
+#else
+  // Probe the counters in the calling thread, to find out which are supported and if they can be read with rdpmc.
+  bool use_all[NUM_PERF_COUNTERS];
+  int fds[NUM_PERF_COUNTERS];
+  void *pages[NUM_PERF_COUNTERS];
+  for (int c = 0; c < NUM_PERF_COUNTERS; c++) { use_all[c] = true; fds[c] = -1; pages[c] = NULL; }
+  int open_errno = OpenPerfEvents(use_all, fds, pages);
+  if (open_errno != 0) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_WARNING, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_UNEXPECTED_VALUE,
+        "Could not open the hardware performance counters (perf_event_open: %s). Check /proc/sys/kernel/perf_event_paranoid (needs to be <= 2), or the seccomp profile of the container. Continuing without them.", strerror(open_errno)));
+    return 1;
+  }
+
+  std::string available = "";
+  bool fine_grained = true;
+  for (int c = 0; c < NUM_PERF_COUNTERS; c++) {
+    is_counter_available_[c] = (fds[c] >= 0);
+    if (is_counter_available_[c] == true) {
+      available += FormatString("%s%s", (available.size() > 0) ? ", " : "", kPerfCounterNames[c]);
+      uint64_t value = 0;
+      fine_grained = fine_grained && pages[c] != NULL && ReadPerfEventRdpmc(pages[c], &value);
+    }
+  }
+  ClosePerfEvents(fds, pages);
+
+  fine_grained_enabled_.set_on(fine_grained);
+  enabled_.set_on(true);
+  LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Hardware performance counters enabled: %s. Counters are read with %s%s.\n", available.c_str(),
+                               (fine_grained == true) ? "rdpmc" : "read()",
+                               (fine_grained == true) ? "" : ", so seed lookups are counted as a part of bin counting"), "PerfCounters");
+  return 0;
+#endif
+}
+
+void PerfCounters::Stop() {
+  if (enabled_.is_on() == false) {
+    return;
+  }
+  enabled_.set_on(false);
+#ifdef __linux__
+  for (int64_t i = 0; i < threads_.size(); i++) {
+    ThreadCounters &thread_counters = threads_[i];
+    if (thread_counters.is_open) {
+      ClosePerfEvents(thread_counters.fds, thread_counters.pages);
+      thread_counters.is_open = false;
+      thread_counters.os_thread_id = -1;
+      thread_counters.active_stage = PERF_STAGE_NONE;
+    }
+  }
+#endif
+}
+
+int PerfCounters::Enter(int stage) {
+#ifndef __linux__
+  return PERF_STAGE_NONE;
+#else
+  ThreadCounters *thread_counters = threads_.Get(omp_get_thread_num());
+  if (thread_counters == NULL) {
+    return PERF_STAGE_NONE;
+  }
+
+  // Open the counters on the first boundary of the thread. If another thread got the same OpenMP id, the counters are
+  // reopened, since they would count the old thread.
+  int64_t os_thread_id = GetOSThreadId();
+  if (thread_counters->os_thread_id != os_thread_id) {
+    if (thread_counters->is_open) { ClosePerfEvents(thread_counters->fds, thread_counters->pages); }
+    thread_counters->os_thread_id = os_thread_id;
+    thread_counters->active_stage = PERF_STAGE_NONE;
+    thread_counters->is_open = (OpenPerfEvents(is_counter_available_, thread_counters->fds, thread_counters->pages) == 0);
+    if (thread_counters->is_open) {
+      ReadPerfEvents(thread_counters->fds, thread_counters->pages, thread_counters->last);
+    }
+  }
+  if (thread_counters->is_open == false) {
+    return PERF_STAGE_NONE;
+  }
+
+  uint64_t values[NUM_PERF_COUNTERS];
+  ReadPerfEvents(thread_counters->fds, thread_counters->pages, values);
+  int previous_stage = thread_counters->active_stage;
+  if (previous_stage >= 0 && previous_stage < NUM_STAGES) {
+    for (int c = 0; c < NUM_PERF_COUNTERS; c++) {
+      thread_counters->counts[previous_stage][c] += values[c] - thread_counters->last[c];
+    }
+  }
+  for (int c = 0; c < NUM_PERF_COUNTERS; c++) { thread_counters->last[c] = values[c]; }
+  thread_counters->active_stage = stage;
+
+  return previous_stage;
+#endif
+}
+
+std::string PerfCounters::FormatSummary() const {
+  uint64_t counts[NUM_STAGES][NUM_PERF_COUNTERS];
+  memset(counts, 0, sizeof(counts));
+  uint64_t total[NUM_PERF_COUNTERS];
+  memset(total, 0, sizeof(total));
+  int64_t num_threads_counted = 0;
+  for (int64_t i = 0; i < threads_.size(); i++) {
+    num_threads_counted += (threads_[i].os_thread_id >= 0) ? 1 : 0;
+    for (int stage = 0; stage < NUM_STAGES; stage++) {
+      for (int c = 0; c < NUM_PERF_COUNTERS; c++) {
+        counts[stage][c] += threads_[i].counts[stage][c];
+        total[c] += threads_[i].counts[stage][c];
+      }
+    }
+  }
+
+  // Misses are reported per 1000 instructions (MPKI).
+  std::string ret = FormatString("Hardware performance counters per stage (user space, %ld threads):\n", num_threads_counted);
+  ret += FormatString("  %-14s %12s %8s %8s %10s %10s %10s %10s\n", "stage", "Mcycles", "cycles%", "IPC", "LLC_MPKI", "L1D_MPKI", "dTLB_MPKI", "br_MPKI");
+  for (int stage = 0; stage <= NUM_STAGES; stage++) {
+    const uint64_t *values = (stage < NUM_STAGES) ? counts[stage] : total;
+    const char *name = (stage == STAGE_TOTAL) ? "other" : ((stage == NUM_STAGES) ? "total" : StageName(stage));
+    double kilo_instructions = values[PERF_COUNTER_INSTRUCTIONS] / 1000.0;
+    std::string line = FormatString("  %-14s %12.1f %8.2f %8.2f", name, values[PERF_COUNTER_CYCLES] / 1e6,
+                                    (total[PERF_COUNTER_CYCLES] > 0) ? (100.0 * values[PERF_COUNTER_CYCLES] / total[PERF_COUNTER_CYCLES]) : 0.0,
+                                    (values[PERF_COUNTER_CYCLES] > 0) ? (((double) values[PERF_COUNTER_INSTRUCTIONS]) / values[PERF_COUNTER_CYCLES]) : 0.0);
+    for (int c = PERF_COUNTER_LLC_MISSES; c < NUM_PERF_COUNTERS; c++) {
+      if (is_counter_available_[c] == false || is_counter_available_[PERF_COUNTER_INSTRUCTIONS] == false) {
+        line += FormatString(" %10s", "n/a");
+      } else {
+        line += FormatString(" %10.3f", (kilo_instructions > 0.0) ? (values[c] / kilo_instructions) : 0.0);
+      }
+    }
+    ret += line + "\n";
+  }
+  if (fine_grained_enabled_.is_on() == false) {
+    ret += FormatString("  (seed_lookup is counted as a part of bin_counting, because rdpmc is not available.)\n");
+  }
+
+  return ret;
+}
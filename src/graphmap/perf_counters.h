@@ -0,0 +1,93 @@
+/*
+ * perf_counters.h
+ *
+ *  Opt-in hardware performance counters (cycles, instructions, cache, TLB and branch misses) per pipeline stage.
+ *  Every mapping thread opens its own counters with perf_event_open, and the counts between stage boundaries are
+ *  attributed to the innermost active stage, so nested stages are not counted twice. If the counters cannot be
+ *  opened (not Linux, perf_event_paranoid, containers), a warning is logged and the mapping runs without them.
+ */
+
+#ifndef SRC_GRAPHMAP_PERF_COUNTERS_H_
+#define SRC_GRAPHMAP_PERF_COUNTERS_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "graphmap/mapping_stats.h"
+#include "graphmap/instrumentation.h"
+
+#define PERF_COUNTER_CYCLES         0
+#define PERF_COUNTER_INSTRUCTIONS   1
+#define PERF_COUNTER_LLC_MISSES     2
+#define PERF_COUNTER_L1D_MISSES     3
+#define PERF_COUNTER_DTLB_MISSES    4
+#define PERF_COUNTER_BRANCH_MISSES  5
+#define NUM_PERF_COUNTERS           6
+
+// Stage counts use the STAGE_* ids of mapping_stats.h. STAGE_TOTAL only holds the part of the read outside of all
+// other stages (I/O of the read, setup), and the totals are summed up for the report.
+#define PERF_STAGE_NONE             -1
+
+class PerfCounters {
+ public:
+  static PerfCounters& GetInstance();
+
+  static inline bool IsEnabled() { return enabled_.is_on(); }
+  // Fine-grained stages (e.g. every seed lookup) are only counted if the counters can be read from user space (rdpmc),
+  // which costs tens of cycles instead of a system call. Otherwise they are counted as part of the enclosing stage.
+  static inline bool IsFineGrainedEnabled() { return fine_grained_enabled_.is_on(); }
+
+  // Checks that the counters can be opened, and enables counting. Returns 0 if OK. If not, a warning with the reason
+  // is logged and counting stays disabled. The counters of every thread are opened by the thread itself, on its first
+  // stage boundary.
+  int Start();
+  // Disables counting and closes the counters. The counts are kept until the next Start.
+  void Stop();
+
+  // Switches the calling thread to the given stage: the counts since the previous boundary go to the stage which
+  // was active until now. Returns that stage, so that it can be restored with another Enter when the scope ends.
+  int Enter(int stage);
+
+  std::string FormatSummary() const;
+
+ private:
+  PerfCounters();
+  ~PerfCounters();
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  struct ThreadCounters;
+
+  static InstrumentationSwitch enabled_;
+  static InstrumentationSwitch fine_grained_enabled_;
+  ThreadSlots<ThreadCounters> threads_;
+  bool is_counter_available_[NUM_PERF_COUNTERS];
+
+  void Clear_();
+};
+
+// Begin and end of a PerfStageScope.
+struct PerfStagePolicy {
+  int stage;
+  bool fine_grained;
+  int previous_stage;
+
+  PerfStagePolicy(int scope_stage, bool scope_fine_grained=false)
+      : stage(scope_stage), fine_grained(scope_fine_grained), previous_stage(PERF_STAGE_NONE) {
+  }
+  inline bool Begin() {
+    if (PerfCounters::IsEnabled() == false || (fine_grained == true && PerfCounters::IsFineGrainedEnabled() == false)) {
+      return false;
+    }
+    previous_stage = PerfCounters::GetInstance().Enter(stage);
+    return true;
+  }
+  inline void End() {
+    PerfCounters::GetInstance().Enter(previous_stage);
+  }
+};
+
+// Counts the hardware events of its scope (or up to End()) into the given stage.
+typedef InstrumentationScope<PerfStagePolicy> PerfStageScope;
+
+#endif /* SRC_GRAPHMAP_PERF_COUNTERS_H_ */
@@ -0,0 +1,100 @@
+/*
+ * pipeline_trace.cc
+ *
+ *  Opt-in tracing of the mapping pipeline. Spans of every read and of the stages within it are recorded into
+ *  per-thread ring buffers, and dumped as Chrome trace JSON (chrome://tracing, ui.perfetto.dev) at the end of a run.
+ */
+
+#include "graphmap/pipeline_trace.h"
+#include <stdio.h>
+#include <algorithm>
+#include "log_system/log_system.h"
+
+InstrumentationSwitch PipelineTrace::enabled_;
+
+PipelineTrace& PipelineTrace::GetInstance() {
+  static PipelineTrace trace;
+  return trace;
+}
+
+PipelineTrace::PipelineTrace() : buffer_size_(0), num_dropped_(0), start_time_(0.0) {
+}
+
+PipelineTrace::~PipelineTrace() {
+  Clear_();
+}
+
+void PipelineTrace::Clear_() {
+  threads_.Clear();
+  num_dropped_ = 0;
+}
+
+void PipelineTrace::Start(int64_t buffer_size) {
+  Clear_();
+  buffer_size_ = std::max((int64_t) 1, buffer_size);
+  start_time_ = omp_get_wtime();
+  enabled_.set_on(true);
+}
+
+void PipelineTrace::Stop() {
+  enabled_.set_on(false);
+}
+
+void PipelineTrace::Record(const char *name, double start_time, double end_time, int64_t read_id, int64_t read_length) {
+  ThreadBuffer *thread_buffer = threads_.Get(omp_get_thread_num());
+  if (thread_buffer == NULL) {
+    #pragma omp atomic
+    num_dropped_ += 1;
+    return;
+  }
+  // The ring buffer is allocated by its own thread, on its first span.
+  if (thread_buffer->events.size() == 0) {
+    thread_buffer->events.resize(buffer_size_);
+  }
+  TraceEvent &event = thread_buffer->events[thread_buffer->num_recorded % buffer_size_];
+  event.name = name;
+  event.start_time = start_time;
+  event.end_time = end_time;
+  event.read_id = read_id;
+  event.read_length = read_length;
+  thread_buffer->num_recorded += 1;
+}
+
+int64_t PipelineTrace::get_num_lost() const {
+  int64_t num_lost = num_dropped_;
+  for (int64_t i = 0; i < threads_.size(); i++) {
+    num_lost += std::max((int64_t) 0, threads_[i].num_recorded - buffer_size_);
+  }
+  return num_lost;
+}
+
+int PipelineTrace::WriteChromeTrace(std::string path) const {
+  FILE *fp = fopen(path.c_str(), "w");
+  if (fp == NULL) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_WARNING, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_OPENING_FILE, "Could not open '%s' for writing the trace.", path.c_str()));
+    return 1;
+  }
+
+  // Complete events ("ph": "X") with the timestamps in microseconds since Start. Each mapping thread is a track.
+  fprintf (fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+  fprintf (fp, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"graphmap\"}}");
+  for (int64_t thread_id = 0; thread_id < threads_.size(); thread_id++) {
+    fprintf (fp, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %ld, \"args\": {\"name\": \"mapping thread %ld\"}}", thread_id, thread_id);
+  }
+
+  for (int64_t thread_id = 0; thread_id < threads_.size(); thread_id++) {
+    const ThreadBuffer *thread_buffer = &threads_[thread_id];
+    // If the ring buffer wrapped around, the oldest kept span is the one after the last written.
+    int64_t first = std::max((int64_t) 0, thread_buffer->num_recorded - buffer_size_);
+    for (int64_t i = first; i < thread_buffer->num_recorded; i++) {
+      const TraceEvent &event = thread_buffer->events[i % buffer_size_];
+      fprintf (fp, ",\n{\"name\": \"%s\", \"cat\": \"mapping\", \"ph\": \"X\", \"pid\": 1, \"tid\": %ld, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"read_id\": %ld, \"read_length\": %ld}}",
+               event.name, thread_id, (event.start_time - start_time_) * 1e6, (event.end_time - event.start_time) * 1e6, event.read_id, event.read_length);
+    }
+  }
+
+  fprintf (fp, "\n]}\n");
+  fclose(fp);
+
+  return 0;
+}
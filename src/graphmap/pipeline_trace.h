@@ -0,0 +1,89 @@
+/*
+ * pipeline_trace.h
+ *
+ *  Opt-in tracing of the mapping pipeline. Spans of every read and of the stages within it are recorded into
+ *  per-thread ring buffers, and dumped as Chrome trace JSON (chrome://tracing, ui.perfetto.dev) at the end of a run.
+ */
+
+#ifndef SRC_GRAPHMAP_PIPELINE_TRACE_H_
+#define SRC_GRAPHMAP_PIPELINE_TRACE_H_
+
+#include <stdint.h>
+#include <omp.h>
+#include <string>
+#include <vector>
+#include "graphmap/instrumentation.h"
+
+struct TraceEvent {
+  const char *name;       // Must be a string literal, only the pointer is stored.
+  double start_time;      // omp_get_wtime() at the beginning and the end of the span.
+  double end_time;
+  int64_t read_id;
+  int64_t read_length;
+};
+
+class PipelineTrace {
+ public:
+  static PipelineTrace& GetInstance();
+
+  static inline bool IsEnabled() { return enabled_.is_on(); }
+
+  // Enables tracing and discards the spans of a previous run. Each thread keeps the last buffer_size spans.
+  void Start(int64_t buffer_size);
+  // Disables tracing. The recorded spans are kept until the next Start.
+  void Stop();
+
+  // Records a span into the buffer of the calling thread. Spans of threads without a slot are dropped.
+  void Record(const char *name, double start_time, double end_time, int64_t read_id, int64_t read_length);
+
+  // Writes all recorded spans as Chrome trace JSON. Returns 0 if OK.
+  int WriteChromeTrace(std::string path) const;
+  // Number of spans which were overwritten in the ring buffers or dropped.
+  int64_t get_num_lost() const;
+
+ private:
+  PipelineTrace();
+  ~PipelineTrace();
+  PipelineTrace(const PipelineTrace&) = delete;
+  PipelineTrace& operator=(const PipelineTrace&) = delete;
+
+  struct ThreadBuffer {
+    std::vector<TraceEvent> events;   // Ring buffer, the span i goes to events[i % events.size()].
+    int64_t num_recorded = 0;
+  };
+
+  static InstrumentationSwitch enabled_;
+  ThreadSlots<ThreadBuffer> threads_;
+  int64_t buffer_size_;
+  int64_t num_dropped_;               // Spans of threads without a buffer. Updated atomically.
+  double start_time_;
+
+  void Clear_();
+};
+
+// Begin and end of a TraceSpan.
+struct TraceSpanPolicy {
+  const char *name;
+  int64_t read_id;
+  int64_t read_length;
+  double start_time;
+
+  TraceSpanPolicy(const char *span_name, int64_t span_read_id, int64_t span_read_length)
+      : name(span_name), read_id(span_read_id), read_length(span_read_length), start_time(0.0) {
+  }
+  inline bool Begin() {
+    if (PipelineTrace::IsEnabled() == false) {
+      return false;
+    }
+    start_time = omp_get_wtime();
+    return true;
+  }
+  inline void End() {
+    PipelineTrace::GetInstance().Record(name, start_time, omp_get_wtime(), read_id, read_length);
+  }
+};
+
+// Records a span from its construction to the end of the scope (or to End()).
+typedef InstrumentationScope<TraceSpanPolicy> TraceSpan;
+
+#endif /* SRC_GRAPHMAP_PIPELINE_TRACE_H_ */
@@ -6,10 +6,11 @@
  */
 
 #include <ctime>
+#include <omp.h>
 #include <limits>
 #include <algorithm>
 #include "graphmap/graphmap.h"
-#include "index/index_hash.h"
+#include "index/read_kmer_index.h"
 
 #include "log_system/log_system.h"
 #include "utility/utility_general.h"
@@ -24,6 +25,7 @@ int GraphMap::ProcessRead(MappingData *mapping_data, const std::vector<Index *>
 //  LogSystem::GetInstance().Log(VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG, parameters->num_threads == 1 || read->get_sequence_id() == parameters->debug_read, FormatString("Entered function. [time: %.2f sec, RSS: %ld MB, peakRSS: %ld MB]\n", (((float) (clock())) / CLOCKS_PER_SEC), getCurrentRSS() / (1024 * 1024), getPeakRSS() / (1024 * 1024)), "ProcessRead");
   LOG_DEBUG_SPEC_NEWLINE;
   LOG_DEBUG_SPEC("Entered function. [time: %.2f sec, RSS: %ld MB, peakRSS: %ld MB]\n", (((float) (clock())) / CLOCKS_PER_SEC), getCurrentRSS() / (1024 * 1024), getPeakRSS() / (1024 * 1024));
+  TraceSpan trace_read("ProcessRead", read->get_sequence_id(), read->get_sequence_length());
 
   // If the read length is too short, call it unmapped.
   if (read->get_sequence_length() < parameters->min_read_len) {
@@ -36,21 +38,30 @@ int GraphMap::ProcessRead(MappingData *mapping_data, const std::vector<Index *>
   ////////////////////////////////////
   ///// Perform Region Selection /////
   ////////////////////////////////////
-  clock_t begin_clock = clock();
+  double begin_clock = omp_get_wtime();
+  TraceSpan trace_region_selection("region_selection", read->get_sequence_id(), read->get_sequence_length());
+  PerfStageScope perf_region_selection(STAGE_BIN_COUNTING);   // The seed lookups within are counted separately.
   int64_t bin_size = (parameters->overlapper == true) ? -1 : read->get_sequence_length() / 3;
 
 //  RegionSelection_(bin_size, mapping_data, indexes, read, parameters);
-//  RegionSelectionNoBins_(bin_size, mapping_data, indexes, read, parameters);
-  RegionSelectionNoCopy_(bin_size, mapping_data, indexes, read, parameters);
+  if (UseSortedRegionSelection_(bin_size, indexes, read, parameters) == true) {
+    RegionSelectionNoBins_(bin_size, mapping_data, indexes, read, parameters);
+  } else {
+    RegionSelectionNoCopy_(bin_size, mapping_data, indexes, read, parameters);
+  }
 //  RegionSelectionNoCopyWithMap_(bin_size, mapping_data, indexes, read, parameters);
 //  RegionSelectionNoCopyWithDensehash_(bin_size, mapping_data, indexes, read, parameters);
 
 //  int64_t bin_size = (parameters->alignment_approach == "overlapper") ? -1 : 100000;
 //  RegionSelectionNoCopy_(bin_size, mapping_data, indexes, read, parameters);
 
-  clock_t end_clock = clock();
-  double elapsed_secs = double(end_clock - begin_clock) / CLOCKS_PER_SEC;
+  perf_region_selection.End();
+  trace_region_selection.End();
+  double end_clock = omp_get_wtime();
+  double elapsed_secs = end_clock - begin_clock;
   mapping_data->time_region_selection = elapsed_secs;
+  mapping_data->scratch_bytes = mapping_data->vertices.CalcMemoryBytes() + mapping_data->bins.capacity() * sizeof(ChromosomeBin) +
+                                mapping_data->num_seed_hits * REGION_SCRATCH_BYTES_PER_HIT;
   LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, read->get_sequence_id() == parameters->debug_read, FormatString("\n+++++++++++++++++ Region selection elapsed time: %f sec.\n\n", mapping_data->time_region_selection), "ProcessRead");
 
   /// Sanity check.
@@ -65,20 +76,20 @@ int GraphMap::ProcessRead(MappingData *mapping_data, const std::vector<Index *>
     return 0;
   }
 
-  begin_clock = clock();
+  begin_clock = omp_get_wtime();
+  mapping_data->time_graph = 0.0;
+  mapping_data->time_lcsk = 0.0;
+  mapping_data->time_filtering = 0.0;
 
   /////////////////////////////////////////////
   ///// Create a hash index from the read /////
   /////////////////////////////////////////////
   // Create the index for the current read. This index is used in graph construction.
-  Index *index_read = NULL;
-  if (parameters->k_graph < 10) {
-    index_read = new IndexHash();
-    ((IndexHash *) index_read)->set_k(parameters->k_graph);
-  } else {
-    index_read = new IndexSA();
-  }
-  index_read->GenerateFromSingleSequenceOnlyForward(*read);
+  // It is kept per thread and rebuilt in place for every read, so its arrays are allocated only when a longer read comes along.
+  TraceSpan trace_read_index("read_index", read->get_sequence_id(), read->get_sequence_length());
+  static thread_local ReadKmerIndex index_read;
+  index_read.Build(read->get_data(), read->get_sequence_length(), parameters->k_graph);
+  trace_read_index.End();
 
   //////////////////////////////
   ///// Initialize stuff.  /////
@@ -181,7 +192,13 @@ int GraphMap::ProcessRead(MappingData *mapping_data, const std::vector<Index *>
     LogSystem::GetInstance().Log(VERBOSE_LEVEL_HIGH_DEBUG, read->get_sequence_id() == parameters->debug_read, FormatString("[i = %ld] location_start = %ld, location_end = %ld, is_reverse = %d, vote = %ld, region_index = %ld\n", i, region.start, region.end, (int) (region.start >= indexes[0]->get_data_length_forward()), region.region_votes, region.region_index), "ProcessRead");
 
     // Perform the GraphMap on a single region.
-    GraphMap_(&local_score, index_read, mapping_data, indexes, read, parameters);
+    double graph_clock = omp_get_wtime();
+    PerfStageScope perf_graph(STAGE_GRAPH);
+    GraphMap_(&local_score, &index_read, mapping_data, indexes, read, parameters);
+    perf_graph.End();
+    mapping_data->time_graph += omp_get_wtime() - graph_clock;
+    mapping_data->num_anchors += local_score.get_registry_entries().num_vertices;
+    int64_t num_region_anchors = local_score.get_registry_entries().num_vertices;
 
     // Just verbose.
     if (parameters->verbose_level > 5 && read->get_sequence_id() == parameters->debug_read) {
@@ -190,11 +207,25 @@ int GraphMap::ProcessRead(MappingData *mapping_data, const std::vector<Index *>
       LogSystem::GetInstance().Log(VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG, read->get_sequence_id() == parameters->debug_read, FormatString("Running PostProcessRegionWithLCS_. j = %ld / %ld, local_score.size() = %ld\n", i, mapping_data->bins.size(), local_score.get_registry_entries().num_vertices), "ProcessRead");
     }
 
+    // The LCSk part of the post-processing is accumulated into time_lcsk by the functions themselves, and the rest is the filtering.
+    double postprocess_clock = omp_get_wtime();
+    double lcsk_time_before = mapping_data->time_lcsk;
+    TraceSpan trace_postprocess("lcsk_and_filtering", read->get_sequence_id(), read->get_sequence_length());
+    PerfStageScope perf_postprocess(STAGE_FILTERING);   // The LCSk within is counted separately.
     if (parameters->alignment_algorithm == "sg" || parameters->alignment_algorithm == "sggotoh") {
       int ret_value_lcs = SemiglobalPostProcessRegionWithLCS_(&local_score, mapping_data, indexes, read, parameters);
     } else {
       int ret_value_lcs = AnchoredPostProcessRegionWithLCS_(&local_score, mapping_data, indexes, read, parameters);
     }
+    perf_postprocess.End();
+    trace_postprocess.End();
+    mapping_data->time_filtering += (omp_get_wtime() - postprocess_clock) - (mapping_data->time_lcsk - lcsk_time_before);
+
+    // The LCSk buffers are already freed at this point, so their size is estimated from the number of anchors.
+    int64_t region_scratch_bytes = mapping_data->vertices.CalcMemoryBytes() + mapping_data->bins.capacity() * sizeof(ChromosomeBin) +
+                                   local_score.get_registry_entries().CalcMemoryBytes() + num_region_anchors * LCSK_SCRATCH_BYTES_PER_ANCHOR +
+                                   read->get_sequence_length() * LCSK_SCRATCH_BYTES_PER_BASE;
+    mapping_data->scratch_bytes = std::max(mapping_data->scratch_bytes, region_scratch_bytes);
 
     local_score.Clear();
 
@@ -204,23 +235,23 @@ int GraphMap::ProcessRead(MappingData *mapping_data, const std::vector<Index *>
   }
 
   LogSystem::GetInstance().Log(VERBOSE_LEVEL_HIGH_DEBUG, read->get_sequence_id() == parameters->debug_read, FormatString("Last region processed: num_regions_processed = %ld.\n", num_regions_processed), "ProcessRead");
+  mapping_data->num_regions_processed = num_regions_processed;
 
-  if (index_read)
-    delete index_read;
-  index_read = NULL;
   mapping_data->vertices.Clear();
 
-  end_clock = clock();
-  elapsed_secs = double(end_clock - begin_clock) / CLOCKS_PER_SEC;
+  end_clock = omp_get_wtime();
+  elapsed_secs = end_clock - begin_clock;
   mapping_data->time_mapping = elapsed_secs;
   LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, read->get_sequence_id() == parameters->debug_read, FormatString("\n+++++++++++++++++ Read mapping elapsed time: %f sec.\n\n", elapsed_secs), "ProcessRead");
 
-  begin_clock = clock();
+  begin_clock = omp_get_wtime();
 
+  PerfStageScope perf_alignment(STAGE_ALIGNMENT);
   GenerateAlignments_(mapping_data, indexes[0], read, parameters, evalue_params);
+  perf_alignment.End();
 
-  end_clock = clock();
-  elapsed_secs = double(end_clock - begin_clock) / CLOCKS_PER_SEC;
+  end_clock = omp_get_wtime();
+  elapsed_secs = end_clock - begin_clock;
   mapping_data->time_alignment = elapsed_secs;
   LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, read->get_sequence_id() == parameters->debug_read, FormatString("\n+++++++++++++++++ GenerateAlignments elapsed time: %f sec.\n\n", elapsed_secs), "ProcessRead");
 
@@ -410,13 +441,16 @@ int GraphMap::EvaluateMappings_(MappingData *mapping_data, const SingleSequence
 }
 
 int GraphMap::GenerateAlignments_(MappingData *mapping_data, const Index *index, const SingleSequence *read, const ProgramParameters *parameters, const EValueParams *evalue_params) {
+  TraceSpan trace_generate_alignments("GenerateAlignments_", read->get_sequence_id(), read->get_sequence_length());
   if (mapping_data->intermediate_mappings.size() == 0) {
     LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, read->get_sequence_id() == parameters->debug_read, FormatString("mapping_data->intermediate_mappings.size() == 0\n"), "GenerateAlignments_");
     return 1;
   }
 
+  TraceSpan trace_final_mappings("final_mappings_and_mapq", read->get_sequence_id(), read->get_sequence_length());
   EvaluateMappings_(mapping_data, read, parameters);
   CollectFinalMappingsAndMapQ_(true, mapping_data, read, parameters);
+  trace_final_mappings.End();
 
 
 
@@ -437,10 +471,10 @@ int GraphMap::GenerateAlignments_(MappingData *mapping_data, const Index *index,
     }
 
     /// Align the region and measure the time for execution.
-    clock_t begin_clock = clock();
+    double begin_clock = omp_get_wtime();
     int ret_aln = AlignRegion(read, index, parameters, evalue_params, true, region_data);
-    clock_t end_clock = clock();
-    double elapsed_secs = double(end_clock - begin_clock) / CLOCKS_PER_SEC;
+    double end_clock = omp_get_wtime();
+    double elapsed_secs = end_clock - begin_clock;
     LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, read->get_sequence_id() == parameters->debug_read, FormatString("\n+++++++++++++++++ Alignment elapsed time: %f sec.\n\n", elapsed_secs), "GenerateAlignments_");
 
     /// Set the number of different regions as an estimate of the mapping quality.
@@ -510,7 +544,14 @@ int GraphMap::GenerateAlignments_(MappingData *mapping_data, const Index *index,
 }
 
 int GraphMap::CollectAlignments(const SingleSequence *read, const ProgramParameters *parameters, MappingData *mapping_data, std::string &ret_aln_lines) {
-  std::stringstream ss;
+  OutputBuffer out;
+  int mapped_state = CollectAlignments(read, parameters, mapping_data, out);
+  ret_aln_lines = out.str();
+  return mapped_state;
+}
+
+int GraphMap::CollectAlignments(const SingleSequence *read, const ProgramParameters *parameters, MappingData *mapping_data, OutputBuffer &out) {
+  int64_t record_start = out.size();
 
   int64_t num_mapped_alignments = 0;
   int64_t num_unmapped_alignments = 0;
@@ -519,17 +560,17 @@ int GraphMap::CollectAlignments(const SingleSequence *read, const ProgramParamet
       num_unmapped_alignments += 1;
       continue;
     }
-    if (ss.tellp() > 0)
-      ss << "\n";
+    if (out.size() > record_start)
+      out.Append('\n');
 
     if (parameters->outfmt == "sam") {
-      ss << mapping_data->final_mapping_ptrs.at(i)->GenerateSAM((num_mapped_alignments == 0), parameters->verbose_sam_output);  // TODO: Don't make the first alignment primary by default, but the best one.
+      mapping_data->final_mapping_ptrs.at(i)->AppendSAM(out, (num_mapped_alignments == 0), parameters->verbose_sam_output);  // TODO: Don't make the first alignment primary by default, but the best one.
     } else if (parameters->outfmt == "afg") {
-      ss << mapping_data->final_mapping_ptrs.at(i)->GenerateAFG();
+      mapping_data->final_mapping_ptrs.at(i)->AppendAFG(out);
     } else if (parameters->outfmt == "m5") {
-      ss << mapping_data->final_mapping_ptrs.at(i)->GenerateM5((num_mapped_alignments == 0), parameters->verbose_sam_output);
+      mapping_data->final_mapping_ptrs.at(i)->AppendM5(out, (num_mapped_alignments == 0), parameters->verbose_sam_output);
     } else {  // Default to SAM output if the specified format is unknown.
-      ss << mapping_data->final_mapping_ptrs.at(i)->GenerateSAM((num_mapped_alignments == 0), parameters->verbose_sam_output);
+      mapping_data->final_mapping_ptrs.at(i)->AppendSAM(out, (num_mapped_alignments == 0), parameters->verbose_sam_output);
     }
     num_mapped_alignments += 1;
   }
@@ -549,23 +590,41 @@ int GraphMap::CollectAlignments(const SingleSequence *read, const ProgramParamet
   }
 
   if (mapping_data->unmapped_reason.size() > 0) {
+    // The lines of the alignments appended above are replaced by the unmapped line.
+    out.Resize(record_start);
     if (parameters->outfmt == "sam") {
-      ret_aln_lines = GenerateUnmappedSamLine_(mapping_data, parameters->verbose_sam_output, read);
+      AppendUnmappedSamLine_(out, mapping_data, parameters->verbose_sam_output, read);
     } else if (parameters->outfmt == "afg") {
       // In AFG format there is no need to report 'unmapped' (or non-overlapping) reads).
     } else if (parameters->outfmt == "m5") {
 
     } else {  // Default to SAM output if the specified format is unknown.
-      ret_aln_lines = GenerateUnmappedSamLine_(mapping_data, parameters->verbose_sam_output, read);
+      AppendUnmappedSamLine_(out, mapping_data, parameters->verbose_sam_output, read);
     }
     return STATE_UNMAPPED;
   }
 
-  ret_aln_lines = ss.str();
-
   return STATE_MAPPED;
 }
 
+int GraphMap::CollectAlignmentResults(const MappingData *mapping_data, std::vector<AlignmentResults> &ret_alignments) const {
+  ret_alignments.clear();
+  if (mapping_data->unmapped_reason.size() > 0) {
+    return STATE_UNMAPPED;
+  }
+
+  for (int64_t i = 0; i < mapping_data->final_mapping_ptrs.size(); i++) {
+    const std::vector<AlignmentResults> &alignments = mapping_data->final_mapping_ptrs[i]->get_alignments();
+    for (int64_t j = 0; j < alignments.size(); j++) {
+      if (alignments[j].is_aligned == true) {
+        ret_alignments.push_back(alignments[j]);
+      }
+    }
+  }
+
+  return (ret_alignments.size() > 0) ? STATE_MAPPED : STATE_UNMAPPED;
+}
+
 int GraphMap::CollectFinalMappingsAndMapQ_(bool generate_final_mapping_ptrs, MappingData *mapping_data, const SingleSequence *read, const ProgramParameters *parameters) {
   auto *first_entry = (mapping_data->intermediate_mappings.at(0));
 
@@ -624,44 +683,51 @@ int GraphMap::CollectFinalMappingsAndMapQ_(bool generate_final_mapping_ptrs, Map
 }
 
 std::string GraphMap::GenerateUnmappedSamLine_(MappingData *mapping_data, int64_t verbose_sam_output, const SingleSequence *read) const {
-  std::stringstream ss;
-
-  std::string qname = ((std::string) (read->get_header()));
-  std::string qname_for_out = (verbose_sam_output < 4) ? (TrimToFirstSpace(qname)) : (qname);
-
-  uint32_t flag = SAM_THIS_SEG_UNMAPPED;
+  OutputBuffer out;
+  AppendUnmappedSamLine_(out, mapping_data, verbose_sam_output, read);
+  return out.str();
+}
 
-  ss << qname_for_out << "\t";
-  ss << flag << "\t";
-  ss << SAM_DEFAULT_RNAME << "\t";
-  ss << SAM_DEFAULT_POS << "\t";
-  ss << SAM_DEFAULT_MAPQ << "\t";      // To avoid confusion with the definition of mapping quality, we will use the value of 255, and report the actual quality as AS optional parameter.
-  ss << SAM_DEFAULT_CIGAR << "\t";
-  ss << SAM_DEFAULT_RNEXT << "\t";
-  ss << SAM_DEFAULT_PNEXT << "\t";
-  ss << SAM_DEFAULT_TLEN << "\t";
-  ss << read->get_data() << "\t";
+void GraphMap::AppendUnmappedSamLine_(OutputBuffer &out, MappingData *mapping_data, int64_t verbose_sam_output, const SingleSequence *read) const {
+  // The fields between QNAME and SEQ are the same for all unmapped reads, so they are formatted only once.
+  static const std::string unmapped_fields = [] {
+    std::stringstream ss;
+    uint32_t flag = SAM_THIS_SEG_UNMAPPED;
+    ss << "\t" << flag << "\t";
+    ss << SAM_DEFAULT_RNAME << "\t";
+    ss << SAM_DEFAULT_POS << "\t";
+    ss << SAM_DEFAULT_MAPQ << "\t";      // To avoid confusion with the definition of mapping quality, we will use the value of 255, and report the actual quality as AS optional parameter.
+    ss << SAM_DEFAULT_CIGAR << "\t";
+    ss << SAM_DEFAULT_RNEXT << "\t";
+    ss << SAM_DEFAULT_PNEXT << "\t";
+    ss << SAM_DEFAULT_TLEN << "\t";
+    return ss.str();
+  }();
+
+  if (verbose_sam_output < 4) { out.AppendToFirstSpace(read->get_header()); } else { out.AppendCString(read->get_header()); }
+  out.Append(unmapped_fields);
+  out.AppendCString((const char *) read->get_data());
+  out.Append('\t');
 
   if (verbose_sam_output < 5 && read->get_quality_length() > 0 && read->get_quality() != NULL) {
-    ss << read->get_quality() << "\t";
+    out.AppendCString((const char *) read->get_quality());
   } else {
-    ss << "*" << "\t";
+    out.Append('*');
   }
 
-  std::stringstream ss_optional1;
-  ss_optional1 << "NM:i:" << -1 << "\t";  // Specified by SAM format.
-  ss_optional1 << "AS:i:" << -((int64_t) read->get_sequence_length()) << "\t";
-  ss_optional1 << "H0:i:" << 0 << "\t";  // Specified by SAM format.
-  ss_optional1 << "ZE:f:" << std::numeric_limits<float>::infinity() << "\t";
-  ss_optional1 << "ZF:f:" << 0.0f << "\t";
-  ss_optional1 << "ZQ:i:" << read->get_sequence_length() << "\t";
-  ss_optional1 << "ZR:i:" << 0;
-
-  ss << ss_optional1.str();
+  out.Append("\tNM:i:-1", 8);  // Specified by SAM format.
+  out.Append("\tAS:i:", 6);
+  out.AppendInt(-((int64_t) read->get_sequence_length()));
+  out.Append("\tH0:i:0", 7);   // Specified by SAM format.
+  out.Append("\tZE:f:", 6);
+  out.AppendFloat(std::numeric_limits<float>::infinity());
+  out.Append("\tZF:f:0", 7);
+  out.Append("\tZQ:i:", 6);
+  out.AppendInt(read->get_sequence_length());
+  out.Append("\tZR:i:0", 7);
 
   if (verbose_sam_output >= 3) {
-    ss << "\tX3:Z:" << mapping_data->unmapped_reason;
+    out.Append("\tX3:Z:", 6);
+    out.Append(mapping_data->unmapped_reason);
   }
-
-  return ss.str();
 }
@@ -6,6 +6,7 @@
  */
 
 #include <string.h>
+#include <omp.h>
 #include <algorithm>
 #include "graphmap/graphmap.h"
 #include "log_system/log_system.h"
@@ -18,11 +19,97 @@ struct DenseType2 {
   float count = 0.0;
 };
 
-typedef unsigned __int128 uint128_t;
+// Keeps track of the ADAPTIVE_SEEDS_NUM_TOP_BINS highest bins while the bins are being counted. Since the counts only
+// grow, a bin can get above the lowest tracked bin only through an update, so the tracked values are exact. This is
+// enough to find the runner-up which is not a direct neighbour of the top bin, without scanning all the bins.
+struct TopBins {
+  int64_t reference_id[ADAPTIVE_SEEDS_NUM_TOP_BINS];
+  int64_t bin_id[ADAPTIVE_SEEDS_NUM_TOP_BINS];
+  float value[ADAPTIVE_SEEDS_NUM_TOP_BINS];
+  int64_t num_bins = 0;
+
+  void Clear() {
+    num_bins = 0;
+  }
+
+  void Update(int64_t new_reference_id, int64_t new_bin_id, float new_value) {
+    int64_t min_id = 0;
+    for (int64_t i = 0; i < num_bins; i++) {
+      if (reference_id[i] == new_reference_id && bin_id[i] == new_bin_id) {
+        value[i] = new_value;
+        return;
+      }
+      if (value[i] < value[min_id]) { min_id = i; }
+    }
+    if (num_bins < ADAPTIVE_SEEDS_NUM_TOP_BINS) {
+      min_id = num_bins;
+      num_bins += 1;
+    } else if (new_value <= value[min_id]) {
+      return;
+    }
+    reference_id[min_id] = new_reference_id;
+    bin_id[min_id] = new_bin_id;
+    value[min_id] = new_value;
+  }
+
+  // The counts of the top bin and the runner-up are treated as Poisson distributed, and the top bin is confidently
+  // ahead if the difference is at least margin standard deviations of the difference.
+  bool IsConfident(double margin, float min_top_value) const {
+    int64_t top_id = -1;
+    for (int64_t i = 0; i < num_bins; i++) {
+      if (top_id < 0 || value[i] > value[top_id]) { top_id = i; }
+    }
+    if (top_id < 0 || value[top_id] < min_top_value) {
+      return false;
+    }
+    float second_value = 0.0f;
+    for (int64_t i = 0; i < num_bins; i++) {
+      if (i == top_id || (reference_id[i] == reference_id[top_id] && std::abs(bin_id[i] - bin_id[top_id]) <= 1)) {
+        continue;
+      }
+      second_value = std::max(second_value, value[i]);
+    }
+    return ((value[top_id] - second_value) >= (margin * sqrt(value[top_id] + second_value)));
+  }
+};
+
+bool GraphMap::IsPrimarySelectionConclusive_(const std::vector<std::vector<float> > &bins_chromosome, int64_t num_seeds, const ProgramParameters *parameters) const {
+  // Find the top bin.
+  float top_value = 0.0f;
+  int64_t top_ref = -1, top_bin = -1;
+  for (int64_t i = 0; i < bins_chromosome.size(); i++) {
+    for (int64_t j = 0; j < bins_chromosome[i].size(); j++) {
+      if (bins_chromosome[i][j] > top_value) {
+        top_value = bins_chromosome[i][j];
+        top_ref = i;
+        top_bin = j;
+      }
+    }
+  }
+
+  if (top_ref < 0 || num_seeds <= 0 || top_value < (parameters->lazy_secondary_support * num_seeds)) {
+    return false;
+  }
+
+  // Find the runner-up, skipping the direct neighbours of the top bin because they belong to the same region.
+  float second_value = 0.0f;
+  for (int64_t i = 0; i < bins_chromosome.size(); i++) {
+    for (int64_t j = 0; j < bins_chromosome[i].size(); j++) {
+      if (i == top_ref && j >= (top_bin - 1) && j <= (top_bin + 1)) {
+        continue;
+      }
+      if (bins_chromosome[i][j] > second_value) {
+        second_value = bins_chromosome[i][j];
+      }
+    }
+  }
+
+  return ((top_value - second_value) >= (parameters->lazy_secondary_margin * top_value));
+}
 
 int GraphMap::RegionSelectionNoCopy_(int64_t bin_size, MappingData* mapping_data, const std::vector<Index *> indexes, const SingleSequence* read, const ProgramParameters* parameters) {
-  clock_t begin_clock = clock();
-  clock_t diff_clock = begin_clock;
+  double begin_clock = omp_get_wtime();
+  double diff_clock = begin_clock;
 
   if (indexes.size() == 0 || indexes[0] == NULL) {
     LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_UNEXPECTED_VALUE, "No reference indexes are specified."));
@@ -41,7 +128,7 @@ int GraphMap::RegionSelectionNoCopy_(int64_t bin_size, MappingData* mapping_data
   ///// This part prepares the bins. /////
   ////////////////////////////////////////////////////
   // Create bins for each chromosome (or reference sequence) separately.
-  diff_clock = clock();
+  diff_clock = omp_get_wtime();
   std::vector<std::vector<float> > bins_chromosome;
   std::vector<std::vector<int64_t> > last_update_chromosome;
 
@@ -66,8 +153,8 @@ int GraphMap::RegionSelectionNoCopy_(int64_t bin_size, MappingData* mapping_data
 
   int64_t k = (int64_t) ((IndexSpacedHashFast *) indexes[0])->get_shape_index_length();
 
-  mapping_data->time_region_alloc = ((double) clock() - diff_clock) / CLOCKS_PER_SEC;
-  diff_clock = clock();
+  mapping_data->time_region_alloc = omp_get_wtime() - diff_clock;
+  diff_clock = omp_get_wtime();
 
   ////////////////////////////////////////////////////
   ///// This part counts the occurrences in bins. /////
@@ -76,93 +163,142 @@ int GraphMap::RegionSelectionNoCopy_(int64_t bin_size, MappingData* mapping_data
   float max_bin_value = -1.0f;
   mapping_data->time_region_seed_lookup = 0.0;
   int64_t total_num_hits = 0;
-  diff_clock = clock();
-  for (int64_t i = 0; i < (readlength - k + 1); i += parameters->kmer_step) {  // i++) {
-    int8_t *seed = (int8_t *) &(read->get_data()[i]);
-
-    for (int64_t index_id = 0; index_id < indexes.size(); index_id++) {
-      IndexSpacedHashFast *index = (IndexSpacedHashFast *) indexes[index_id];
-
-      if (index != NULL) {
-        clock_t diff_find_seeds = clock();
-        std::vector<int64_t *> hit_vector;
-        std::vector<uint64_t> hit_counts;
-        int ret_search = index->FindAllRawPositionsOfSeedNoCopy(seed, k, parameters->max_num_hits, hit_vector, hit_counts);
-        mapping_data->time_region_seed_lookup += ((double) clock() - diff_find_seeds) / CLOCKS_PER_SEC;
-
-        // Check if there is too many hits (or too few).
-        if (ret_search == 1) {
-          mapping_data->num_seeds_with_no_hits += 1;
-        } else if (ret_search == 2) {
-          mapping_data->num_seeds_over_limit += 1;
-          continue;
-        } else if (ret_search > 2) {
-          mapping_data->num_seeds_errors += 1;
-        }
-
-        // Counting kmers in regions of bin_size on the genome
-//        printf ("[%ld[ num_hits = %ld\n", i, num_hits);
-
-        for (int64_t hits_id = 0; hits_id < hit_vector.size(); hits_id++) {
-          int64_t *hits = hit_vector[hits_id];
-          total_num_hits += hit_counts[hits_id];
-
-          for (int64_t j = 0; j < hit_counts[hits_id]; j++) {
-            int64_t position = hits[j];
-            int64_t local_position = (int64_t) (((uint64_t) position) & MASK_32_BIT);
-            int64_t reference_index = (int64_t) (((uint64_t) position) >> 32);  // (raw_position - reference_starting_pos_[(uint64_t) reference_index]);
-
-            if ((is_overlapper == true && (reference_index % num_fwd_seqs) == read->get_sequence_id()) ||
-                (no_self_overlap == true && index->get_headers()[reference_index % num_fwd_seqs] == std::string(read->get_header()))) {
-              continue;
+  diff_clock = omp_get_wtime();
+
+  // In the lazy mode, only the primary index is used at first. If the resulting bins do not have a clear winner, the
+  // counting is repeated with all indexes, so that the result is the same as in the normal sensitive mode.
+  int64_t num_indexes_to_use = (parameters->lazy_secondary == true && indexes.size() > 1) ? 1 : indexes.size();
+  int64_t max_stride = parameters->kmer_step;
+  while (parameters->adaptive_seeds == true && (max_stride * 2) <= parameters->adaptive_seed_stride) { max_stride *= 2; }
+  int64_t num_seeds_looked_up = 0;
+  TopBins top_bins;
+  for (bool counting_done = false; counting_done == false; ) {
+    // With adaptive seeding, the first pass looks up only every max_stride-th seed, and every next pass the seeds halfway
+    // between those already looked up, until the top bin is confidently ahead of the runner-up. Without it, this is a
+    // single pass over all seeds.
+    top_bins.Clear();
+    num_seeds_looked_up = 0;
+    for (int64_t stride = max_stride; stride >= parameters->kmer_step; stride /= 2) {
+      int64_t first_seed = (stride == max_stride) ? 0 : stride;
+      int64_t seed_step = (stride == max_stride) ? stride : (2 * stride);
+      for (int64_t i = first_seed; i < (readlength - k + 1); i += seed_step) {  // i++) {
+        int8_t *seed = (int8_t *) &(read->get_data()[i]);
+        num_seeds_looked_up += 1;
+
+        for (int64_t index_id = 0; index_id < num_indexes_to_use; index_id++) {
+          IndexSpacedHashFast *index = (IndexSpacedHashFast *) indexes[index_id];
+
+          if (index != NULL) {
+            double diff_find_seeds = omp_get_wtime();
+            SeedHits seed_hits;
+            int ret_search = 0;
+            {
+              PerfStageScope perf_seed_lookup(STAGE_SEED_LOOKUP, true);
+              ret_search = index->FindAllRawPositionsOfSeedNoCopy(seed, k, parameters->max_num_hits, &seed_hits);
             }
+            mapping_data->time_region_seed_lookup += omp_get_wtime() - diff_find_seeds;
 
-            if (reference_index < 0) {
-              LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, read->get_sequence_id() == parameters->debug_read, LogSystem::GetInstance().GenerateErrorMessage(ERR_UNEXPECTED_VALUE, "Offending variable: reference_index. reference_index = %ld, y = %ld, j = %ld / (%ld, %ld)\n", reference_index, local_position, j, 0, hit_counts[hits_id]), "SelectRegionsWithHoughAndCircular");
+            // Check if there is too many hits (or too few).
+            if (ret_search == 1) {
+              mapping_data->num_seeds_with_no_hits += 1;
+            } else if (ret_search == 2) {
+              mapping_data->num_seeds_over_limit += 1;
               continue;
+            } else if (ret_search > 2) {
+              mapping_data->num_seeds_errors += 1;
             }
 
-            // Convert the absolute coordinates to local coordinates on the hit reference.
-            int64_t x = i;          // Coordinate on the read.
-            int64_t y_local = local_position;
-            int64_t l_local = y_local - x;
-
-            // Compensate for sequence overhangs.
-            if (l_local < 0 && parameters->is_reference_circular == false) {
-              l_local = 0;
-            }
-            if (l_local < 0 && parameters->is_reference_circular == true) {
-              l_local = index->get_reference_lengths()[reference_index] - 1;
-            }
-
-            // Calculate the index of the bin the position belongs to.
-            int64_t position_bin = floor(((float) l_local) * bin_size_inverse);
-
-            // We mark the last update with (i + 1) and not only i to avoid the default value of zero that has been set with vector initialization.
-            if (last_update_chromosome[reference_index][position_bin] == (i + 1)) {
-              continue;
-            }
-            if (reference_index >= bins_chromosome.size() ||
-                position_bin >= bins_chromosome[reference_index].size()) {
-              continue;
+            // Counting kmers in regions of bin_size on the genome
+//            printf ("[%ld[ num_hits = %ld\n", i, num_hits);
+
+            for (int64_t bucket_id = 0; bucket_id < seed_hits.num_buckets; bucket_id++) {
+              SeedHitCursor cursor(index, seed_hits.hash_keys[bucket_id]);
+              total_num_hits += seed_hits.num_hits[bucket_id];
+
+              int64_t position = 0;
+              for (int64_t j = 0; cursor.Next(&position); j++) {
+                int64_t local_position = (int64_t) (((uint64_t) position) & MASK_32_BIT);
+                int64_t reference_index = (int64_t) (((uint64_t) position) >> 32);  // (raw_position - reference_starting_pos_[(uint64_t) reference_index]);
+
+                if ((is_overlapper == true && (reference_index % num_fwd_seqs) == read->get_sequence_id()) ||
+                    (no_self_overlap == true && index->get_headers()[reference_index % num_fwd_seqs] == std::string(read->get_header()))) {
+                  continue;
+                }
+
+                if (reference_index < 0) {
+                  LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, read->get_sequence_id() == parameters->debug_read, LogSystem::GetInstance().GenerateErrorMessage(ERR_UNEXPECTED_VALUE, "Offending variable: reference_index. reference_index = %ld, y = %ld, j = %ld / (%ld, %ld)\n", reference_index, local_position, j, 0, seed_hits.num_hits[bucket_id]), "SelectRegionsWithHoughAndCircular");
+                  continue;
+                }
+
+                // Convert the absolute coordinates to local coordinates on the hit reference.
+                int64_t x = i;          // Coordinate on the read.
+                int64_t y_local = local_position;
+                int64_t l_local = y_local - x;
+
+                // Compensate for sequence overhangs.
+                if (l_local < 0 && parameters->is_reference_circular == false) {
+                  l_local = 0;
+                }
+                if (l_local < 0 && parameters->is_reference_circular == true) {
+                  l_local = index->get_reference_lengths()[reference_index] - 1;
+                }
+
+                // Calculate the index of the bin the position belongs to.
+                int64_t position_bin = floor(((float) l_local) * bin_size_inverse);
+
+                // We mark the last update with (i + 1) and not only i to avoid the default value of zero that has been set with vector initialization.
+                if (last_update_chromosome[reference_index][position_bin] == (i + 1)) {
+                  continue;
+                }
+                if (reference_index >= bins_chromosome.size() ||
+                    position_bin >= bins_chromosome[reference_index].size()) {
+                  continue;
+                }
+
+                bins_chromosome[reference_index][position_bin] += 1.0f;
+                if (bins_chromosome[reference_index][position_bin] > max_bin_value) { max_bin_value = bins_chromosome[reference_index][position_bin]; }
+
+                last_update_chromosome[reference_index][position_bin] = (i + 1);
+                if (parameters->adaptive_seeds == true) { top_bins.Update(reference_index, position_bin, bins_chromosome[reference_index][position_bin]); }
+              }  // for (int64_t j=hits_start; j<(hits_start + num_hits); j++)
             }
 
-            bins_chromosome[reference_index][position_bin] += 1.0f;
-            if (bins_chromosome[reference_index][position_bin] > max_bin_value) { max_bin_value = bins_chromosome[reference_index][position_bin]; }
-
-            last_update_chromosome[reference_index][position_bin] = (i + 1);
-          }  // for (int64_t j=hits_start; j<(hits_start + num_hits); j++)
+          }
         }
+      }  // for (int64_t i=0; i<(readlength - parameters->k_region + 1); i++)
 
+      if (stride > parameters->kmer_step && parameters->adaptive_seeds == true &&
+          top_bins.IsConfident(parameters->adaptive_seed_margin, ADAPTIVE_SEEDS_MIN_TOP_COUNT) == true) {
+        LOG_DEBUG_SPEC("Adaptive seeding stopped at stride %ld, after %ld seeds.\n", stride, num_seeds_looked_up);
+        break;
       }
     }
-  }  // for (int64_t i=0; i<(readlength - parameters->k_region + 1); i++)
+
+    if (num_indexes_to_use >= indexes.size() ||
+        IsPrimarySelectionConclusive_(bins_chromosome, num_seeds_looked_up, parameters)) {
+      counting_done = true;
+    } else {
+      LOG_DEBUG_SPEC("Primary index is inconclusive (max_bin_value = %f), using all indexes.\n", max_bin_value);
+      num_indexes_to_use = indexes.size();
+      for (int64_t i = 0; i < bins_chromosome.size(); i++) {
+        std::fill(bins_chromosome[i].begin(), bins_chromosome[i].end(), 0.0f);
+        std::fill(last_update_chromosome[i].begin(), last_update_chromosome[i].end(), 0);
+      }
+      max_bin_value = -1.0f;
+      total_num_hits = 0;
+      mapping_data->num_seeds_with_no_hits = 0;
+      mapping_data->num_seeds_over_limit = 0;
+      mapping_data->num_seeds_errors = 0;
+    }
+  }  // for (bool counting_done = false; counting_done == false; )
+
+  mapping_data->num_seeds_looked_up = num_seeds_looked_up;
 
   LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, read->get_sequence_id() == parameters->debug_read, FormatString("\n[BuildOccuranceMap] k_region = %d, num_seeds_with_no_hits = %ld, num_seeds_over_limit = %ld\n", parameters->k_region, mapping_data->num_seeds_with_no_hits, mapping_data->num_seeds_over_limit), "ProcessKmersInBins_");
 //  LOG_DEBUG_HIGH("total_num_hits = %ld\n", total_num_hits);
 
-  mapping_data->time_region_counting = ((double) clock() - diff_clock) / CLOCKS_PER_SEC;
-  diff_clock = clock();
+  mapping_data->time_region_counting = omp_get_wtime() - diff_clock;
+  diff_clock = omp_get_wtime();
 
   float min_allowed_bin_value = std::max(2.0f, (float) std::floor(parameters->min_bin_percent * max_bin_value));
   int64_t num_bins_above_min = 0;
@@ -175,7 +311,7 @@ int GraphMap::RegionSelectionNoCopy_(int64_t bin_size, MappingData* mapping_data
   // Convert the bins to a more compact form, which will be easier to sort.
   // The tuple will contain: reference_id, bin_index, bin_count.
   mapping_data->bins.clear();
-  mapping_data->bins.resize(num_bins_above_min);
+  mapping_data->bins.reserve(num_bins_above_min);
   for (int64_t i = 0; i < (indexes[0]->get_num_sequences_forward() * 2); i++) {
     for (int64_t j = 0; j < bins_chromosome[i].size(); j++) {
       if (bins_chromosome[i][j] > min_allowed_bin_value) {
@@ -190,17 +326,17 @@ int GraphMap::RegionSelectionNoCopy_(int64_t bin_size, MappingData* mapping_data
     }
   }
 
-  mapping_data->time_region_conversion = ((double) clock() - diff_clock) / CLOCKS_PER_SEC;
-  diff_clock = clock();
+  mapping_data->time_region_conversion = omp_get_wtime() - diff_clock;
+  diff_clock = omp_get_wtime();
 
-  // Sort the bins in the descending order of bins_[i].bin_value;
-  std::sort(mapping_data->bins.begin(), mapping_data->bins.end(), bins_greater_than_key());
+  // Sort the bins in the descending order of bins_[i].bin_value. Stable, so that the order of the ties is defined (same as in RegionSelectionNoBins_).
+  std::stable_sort(mapping_data->bins.begin(), mapping_data->bins.end(), bins_greater_than_key());
 
-  mapping_data->time_region_hitsort = ((double) clock() - diff_clock) / CLOCKS_PER_SEC;
-  diff_clock = clock();
+  mapping_data->time_region_hitsort = omp_get_wtime() - diff_clock;
+  diff_clock = omp_get_wtime();
 
-  clock_t end_clock = clock();
-  double elapsed_secs = double(end_clock - begin_clock) / CLOCKS_PER_SEC;
+  double end_clock = omp_get_wtime();
+  double elapsed_secs = end_clock - begin_clock;
   mapping_data->time_region_selection = elapsed_secs;
   LOG_DEBUG_SPEC("Region selection timings:\n");
   LOG_DEBUG_SPEC("    time_region_seed_lookup = %f\n", mapping_data->time_region_seed_lookup);
@@ -209,6 +345,7 @@ int GraphMap::RegionSelectionNoCopy_(int64_t bin_size, MappingData* mapping_data
   LOG_DEBUG_SPEC("    time_region_conversion = %f\n", mapping_data->time_region_conversion);
   LOG_DEBUG_SPEC("    time_region_sort = %f\n", mapping_data->time_region_hitsort);
   LOG_DEBUG_SPEC("\n");
+  mapping_data->num_seed_hits = total_num_hits;
   LOG_DEBUG_SPEC("    total_num_hits = %ld\n", total_num_hits);
   LOG_DEBUG_SPEC("    read_len = %ld\n", read->get_sequence_length());
 //  exit(1);
@@ -216,149 +353,288 @@ int GraphMap::RegionSelectionNoCopy_(int64_t bin_size, MappingData* mapping_data
   return 0;
 }
 
+bool GraphMap::IsPrimarySelectionConclusive_(const std::vector<int64_t> &bin_ids, const std::vector<float> &bin_counts, int64_t num_bins, const std::vector<int64_t> &bin_starts, int64_t num_seeds, const ProgramParameters *parameters) const {
+  // Find the top bin. Ties are resolved the same as with the dense bins, because the ids are in the same order.
+  float top_value = 0.0f;
+  int64_t top_id = -1;
+  for (int64_t i = 0; i < num_bins; i++) {
+    if (bin_counts[i] > top_value) {
+      top_value = bin_counts[i];
+      top_id = bin_ids[i];
+    }
+  }
+
+  if (top_id < 0 || num_seeds <= 0 || top_value < (parameters->lazy_secondary_support * num_seeds)) {
+    return false;
+  }
+
+  // Find the runner-up, skipping the direct neighbours of the top bin on the same reference.
+  int64_t top_ref = (std::upper_bound(bin_starts.begin(), bin_starts.end(), top_id) - bin_starts.begin()) - 1;
+  int64_t skip_start = std::max(top_id - 1, bin_starts[top_ref]);
+  int64_t skip_end = std::min(top_id + 1, bin_starts[top_ref + 1] - 1);
+  float second_value = 0.0f;
+  for (int64_t i = 0; i < num_bins; i++) {
+    if (bin_ids[i] >= skip_start && bin_ids[i] <= skip_end) {
+      continue;
+    }
+    if (bin_counts[i] > second_value) {
+      second_value = bin_counts[i];
+    }
+  }
+
+  return ((top_value - second_value) >= (parameters->lazy_secondary_margin * top_value));
+}
+
+bool GraphMap::UseSortedRegionSelection_(int64_t bin_size, const std::vector<Index *> &indexes, const SingleSequence *read, const ProgramParameters *parameters) const {
+  if (parameters->region_engine == "sort") {
+    return true;
+  } else if (parameters->region_engine == "dense" || parameters->adaptive_seeds == true) {
+    // Adaptive seeding is implemented only in the dense engine, it needs the counts while the seeds are looked up.
+    return false;
+  }
+
+  int64_t genome_length = indexes[0]->get_data_length_forward();
+  if (genome_length > REGION_SELECTION_AUTO_MAX_GENOME_LENGTH) {
+    return false;
+  }
+
+  // Both strands are binned, with one extra bin per reference sequence.
+  int64_t num_fwd_seqs = indexes[0]->get_num_sequences_forward();
+  int64_t num_bins = (bin_size > 0) ? (2 * (genome_length / bin_size + num_fwd_seqs)) : (2 * num_fwd_seqs);
+  int64_t num_seeds = std::max((int64_t) 1, read->get_sequence_length() / std::max((int64_t) 1, parameters->kmer_step));
+
+  return (num_bins > (REGION_SELECTION_AUTO_BINS_PER_SEED * num_seeds));
+}
+
 int GraphMap::RegionSelectionNoBins_(int64_t bin_size, MappingData* mapping_data, const std::vector<Index *> indexes, const SingleSequence* read, const ProgramParameters* parameters) {
+  double begin_clock = omp_get_wtime();
+  double diff_clock = begin_clock;
+
   if (indexes.size() == 0 || indexes[0] == NULL) {
     LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_UNEXPECTED_VALUE, "No reference indexes are specified."));
   }
 
-  clock_t begin_clock = clock();
-
   int64_t readlength = read->get_sequence_length();
   int64_t num_fwd_seqs = indexes[0]->get_num_sequences_forward();
   bool is_overlapper = (parameters->overlapper == true && parameters->reference_path == parameters->reads_path);
   bool no_self_overlap = (parameters->no_self_hits == true);
 
+  mapping_data->bin_size = bin_size;
+
   float bin_size_inverse = (bin_size > 0) ? (1.0f / ((float) bin_size)) : (0.0f);
-  int64_t k = (int64_t) ((IndexSpacedHash *) indexes[0])->get_shape_index_length();
+  int64_t k = (int64_t) ((IndexSpacedHashFast *) indexes[0])->get_shape_index_length();
+
+  ////////////////////////////////////////////////////
+  ///// This part prepares the bin ids. /////
+  ////////////////////////////////////////////////////
+  // The bins are not allocated, but every bin of every reference gets a global id, and the bins of reference i
+  // (forward i, reverse i + num_fwd_seqs) have the ids [bin_starts[i], bin_starts[i + 1]). The number of bins per
+  // reference is the same as in RegionSelectionNoCopy_. All buffers are kept per thread and reused between reads.
+  diff_clock = omp_get_wtime();
+  static thread_local std::vector<int64_t> bin_starts;
+  static thread_local std::vector<uint64_t> hit_keys;
+  static thread_local std::vector<int64_t> bin_ids;
+  static thread_local std::vector<float> bin_counts;
+
+  bin_starts.resize(num_fwd_seqs * 2 + 1);
+  bin_starts[0] = 0;
+  for (int64_t i = 0; i < (num_fwd_seqs * 2); i++) {
+    int64_t current_reference_length = indexes[0]->get_reference_lengths()[i % num_fwd_seqs];
+    int64_t current_num_bins = ceil(((float) current_reference_length) * bin_size_inverse) + 1;
+    bin_starts[i + 1] = bin_starts[i] + current_num_bins;
+  }
+
+  // Hits are sorted as 64-bit keys of (bin_id << num_pos_bits) | seed_position. This is only a safeguard, even
+  // for a human genome with short reads there are plenty of bits to spare.
+  int64_t num_pos_bits = 1, num_bin_bits = 1;
+  while (num_pos_bits < 63 && (((int64_t) 1) << num_pos_bits) <= readlength) { num_pos_bits += 1; }
+  while (num_bin_bits < 63 && (((int64_t) 1) << num_bin_bits) <= bin_starts.back()) { num_bin_bits += 1; }
+  if ((num_pos_bits + num_bin_bits) > 64) {
+    LOG_DEBUG_SPEC("Bin ids do not fit into the sort keys (num_pos_bits = %ld, num_bin_bits = %ld), using the dense bins.\n", num_pos_bits, num_bin_bits);
+    return RegionSelectionNoCopy_(bin_size, mapping_data, indexes, read, parameters);
+  }
 
-  mapping_data->bin_size = bin_size;
   mapping_data->num_seeds_with_no_hits = 0;
   mapping_data->num_seeds_over_limit = 0;
   mapping_data->num_seeds_errors = 0;
 
-  std::vector<uint128_t> hit_coords;
-  hit_coords.reserve(10000);
-//  hit_coords.reserve(parameters->max_num_hits * read->get_sequence_length() + 1);
+  mapping_data->time_region_alloc = omp_get_wtime() - diff_clock;
+  diff_clock = omp_get_wtime();
+
+  ////////////////////////////////////////////////////
+  ///// This part collects and counts the hits. /////
+  ////////////////////////////////////////////////////
+  float max_bin_value = -1.0f;
+  int64_t num_bins = 0;
+  mapping_data->time_region_seed_lookup = 0.0;
+  mapping_data->time_region_hitsort = 0.0;
+  int64_t total_num_hits = 0;
 
-  for (int64_t index_id = 0; index_id < indexes.size(); index_id++) {
-    IndexSpacedHash *index = (IndexSpacedHash *) indexes[index_id];
-    if (index == NULL) { continue; }
+  // The lazy mode works the same as in RegionSelectionNoCopy_.
+  int64_t num_indexes_to_use = (parameters->lazy_secondary == true && indexes.size() > 1) ? 1 : indexes.size();
+  for (bool counting_done = false; counting_done == false; ) {
+    hit_keys.clear();
 
     for (int64_t i = 0; i < (readlength - k + 1); i += parameters->kmer_step) {
       int8_t *seed = (int8_t *) &(read->get_data()[i]);
-      uint64_t hits_start = 0, num_hits = 0;
-      int64_t *hits = NULL;
 
-      int ret_search = index->FindAllRawPositionsOfSeed(seed, k, parameters->max_num_hits, &hits, &hits_start, &num_hits);
+      for (int64_t index_id = 0; index_id < num_indexes_to_use; index_id++) {
+        IndexSpacedHashFast *index = (IndexSpacedHashFast *) indexes[index_id];
 
-      // Check if there is too many hits (or too few).
-      if (ret_search == 1) {
-        mapping_data->num_seeds_with_no_hits += 1;
-      } else if (ret_search == 2) {
-        mapping_data->num_seeds_over_limit += 1;
-        continue;
-      } else if (ret_search > 2) {
-        mapping_data->num_seeds_errors += 1;
-      }
+        if (index != NULL) {
+          double diff_find_seeds = omp_get_wtime();
+          SeedHits seed_hits;
+          int ret_search = 0;
+          {
+            PerfStageScope perf_seed_lookup(STAGE_SEED_LOOKUP, true);
+            ret_search = index->FindAllRawPositionsOfSeedNoCopy(seed, k, parameters->max_num_hits, &seed_hits);
+          }
+          mapping_data->time_region_seed_lookup += omp_get_wtime() - diff_find_seeds;
+
+          // Check if there is too many hits (or too few).
+          if (ret_search == 1) {
+            mapping_data->num_seeds_with_no_hits += 1;
+          } else if (ret_search == 2) {
+            mapping_data->num_seeds_over_limit += 1;
+            continue;
+          } else if (ret_search > 2) {
+            mapping_data->num_seeds_errors += 1;
+          }
 
-      // Counting kmers in regions of bin_size on the genome
-      for (int64_t j = hits_start; j < (hits_start + num_hits); j++) {
-        int64_t position = hits[j];
-        int64_t local_position = (int64_t) (((uint64_t) position) & MASK_32_BIT);
-        int64_t reference_index = (int64_t) (((uint64_t) position) >> 32);  // (raw_position - reference_starting_pos_[(uint64_t) reference_index]);
-        // Convert the absolute coordinates to local coordinates on the hit reference.
-        int64_t x = i;          // Coordinate on the read.
-        int64_t y = local_position;
-        int64_t l = y - x;
-        // Compensate for sequence overhangs.
-        if (l < 0 && parameters->is_reference_circular == false) { l = 0; }
-        else if (l < 0 && parameters->is_reference_circular == true) { l = index->get_reference_lengths()[reference_index] - 1; }
-        // Calculate the index of the bin the position belongs to.
-        int64_t position_bin = floor(((float) l) * bin_size_inverse);
-
-        if ((is_overlapper == true && (reference_index % num_fwd_seqs) == read->get_sequence_id()) ||
-            (no_self_overlap == true && index->get_headers()[reference_index % num_fwd_seqs] == std::string(read->get_header()))) {
-          continue;
-        }
+          for (int64_t bucket_id = 0; bucket_id < seed_hits.num_buckets; bucket_id++) {
+            SeedHitCursor cursor(index, seed_hits.hash_keys[bucket_id]);
+            total_num_hits += seed_hits.num_hits[bucket_id];
+
+            int64_t position = 0;
+            for (int64_t j = 0; cursor.Next(&position); j++) {
+              int64_t local_position = (int64_t) (((uint64_t) position) & MASK_32_BIT);
+              int64_t reference_index = (int64_t) (((uint64_t) position) >> 32);
+
+              if ((is_overlapper == true && (reference_index % num_fwd_seqs) == read->get_sequence_id()) ||
+                  (no_self_overlap == true && index->get_headers()[reference_index % num_fwd_seqs] == std::string(read->get_header()))) {
+                continue;
+              }
+
+              if (reference_index < 0) {
+                LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, read->get_sequence_id() == parameters->debug_read, LogSystem::GetInstance().GenerateErrorMessage(ERR_UNEXPECTED_VALUE, "Offending variable: reference_index. reference_index = %ld, y = %ld, j = %ld / (%ld, %ld)\n", reference_index, local_position, j, 0, seed_hits.num_hits[bucket_id]), "SelectRegionsWithHoughAndCircular");
+                continue;
+              }
+
+              // Convert the absolute coordinates to local coordinates on the hit reference.
+              int64_t x = i;          // Coordinate on the read.
+              int64_t y_local = local_position;
+              int64_t l_local = y_local - x;
+
+              // Compensate for sequence overhangs.
+              if (l_local < 0 && parameters->is_reference_circular == false) {
+                l_local = 0;
+              }
+              if (l_local < 0 && parameters->is_reference_circular == true) {
+                l_local = index->get_reference_lengths()[reference_index] - 1;
+              }
+
+              // Calculate the index of the bin the position belongs to.
+              int64_t position_bin = floor(((float) l_local) * bin_size_inverse);
+
+              if (reference_index >= (num_fwd_seqs * 2) ||
+                  position_bin >= (bin_starts[reference_index + 1] - bin_starts[reference_index])) {
+                continue;
+              }
+
+              hit_keys.push_back((((uint64_t) (bin_starts[reference_index] + position_bin)) << num_pos_bits) | ((uint64_t) i));
+            }
+          }
 
-        if (reference_index < 0) {
-          LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, read->get_sequence_id() == parameters->debug_read, LogSystem::GetInstance().GenerateErrorMessage(ERR_UNEXPECTED_VALUE, "Offending variable: reference_index. reference_index = %ld, y = %ld, j = %ld / (%ld, %ld)\n", reference_index, local_position, j, hits_start, num_hits), "SelectRegionsWithHoughAndCircular");
-          continue;
         }
-
-        uint128_t hit_coord = (((uint128_t) reference_index) & ((uint128_t) 0x00000000FFFFFFFF)) << 64 |
-                              (((uint128_t) position_bin) & ((uint128_t) 0x00000000FFFFFFFF)) << 32 |
-                              (((uint128_t) i) & ((uint128_t) 0x00000000FFFFFFFF)) << 0;
-        hit_coords.push_back(hit_coord);
-
-      }  // for (int64_t j=hits_start; j<(hits_start + num_hits); j++)
-
-
-      if (index->IsManualCleanupRequired("FindAllRawPositionsOfSeed") == 0) {
-        if (hits)
-          free(hits);
-        hits = NULL;
       }
-      hits = NULL;
-
+    }  // for (int64_t i=0; i<(readlength - parameters->k_region + 1); i++)
+
+    double diff_sort = omp_get_wtime();
+    std::sort(hit_keys.begin(), hit_keys.end());
+    mapping_data->time_region_hitsort += omp_get_wtime() - diff_sort;
+
+    // Count the hits per bin. Same keys are the same seed hitting the same bin several times (or from several
+    // indexes), which is counted only once, like the last_update check of the dense bins.
+    num_bins = 0;
+    max_bin_value = -1.0f;
+    for (int64_t i = 0; i < hit_keys.size(); i++) {
+      if (i > 0 && hit_keys[i] == hit_keys[i - 1]) {
+        continue;
+      }
+      int64_t bin_id = (int64_t) (hit_keys[i] >> num_pos_bits);
+      if (num_bins == 0 || bin_ids[num_bins - 1] != bin_id) {
+        if (bin_ids.size() <= num_bins) {
+          bin_ids.resize(num_bins + 1);
+          bin_counts.resize(num_bins + 1);
+        }
+        bin_ids[num_bins] = bin_id;
+        bin_counts[num_bins] = 0.0f;
+        num_bins += 1;
+      }
+      bin_counts[num_bins - 1] += 1.0f;
+      if (bin_counts[num_bins - 1] > max_bin_value) { max_bin_value = bin_counts[num_bins - 1]; }
     }
-  }
-
-  double elapsed_secs_lookup = double(clock() - begin_clock) / CLOCKS_PER_SEC;
-  mapping_data->time_region_seed_lookup = elapsed_secs_lookup;
-  begin_clock = clock();
 
-  LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, read->get_sequence_id() == parameters->debug_read, FormatString("Finished fetching seed hits. Sorting %ld hits.\n", hit_coords.size()), std::string(__FUNCTION__));
+    if (num_indexes_to_use >= indexes.size() ||
+        IsPrimarySelectionConclusive_(bin_ids, bin_counts, num_bins, bin_starts, (readlength - k + parameters->kmer_step) / parameters->kmer_step, parameters)) {
+      counting_done = true;
+    } else {
+      LOG_DEBUG_SPEC("Primary index is inconclusive (max_bin_value = %f), using all indexes.\n", max_bin_value);
+      num_indexes_to_use = indexes.size();
+      total_num_hits = 0;
+      mapping_data->num_seeds_with_no_hits = 0;
+      mapping_data->num_seeds_over_limit = 0;
+      mapping_data->num_seeds_errors = 0;
+    }
+  }  // for (bool counting_done = false; counting_done == false; )
 
-  std::sort(hit_coords.begin(), hit_coords.end());
+  mapping_data->num_seeds_looked_up = std::max((int64_t) 0, (readlength - k + parameters->kmer_step) / parameters->kmer_step);
 
-  double elapsed_secs_hitsort = double(clock() - begin_clock) / CLOCKS_PER_SEC;
-  mapping_data->time_region_hitsort = elapsed_secs_hitsort;
-  begin_clock = clock();
+  LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, read->get_sequence_id() == parameters->debug_read, FormatString("\n[BuildOccuranceMap] k_region = %d, num_seeds_with_no_hits = %ld, num_seeds_over_limit = %ld, hit_keys.size() = %ld\n", parameters->k_region, mapping_data->num_seeds_with_no_hits, mapping_data->num_seeds_over_limit, hit_keys.size()), std::string(__FUNCTION__));
 
-  LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, read->get_sequence_id() == parameters->debug_read, FormatString("\n[BuildOccuranceMap] k_region = %d, num_seeds_with_no_hits = %ld, num_seeds_over_limit = %ld, hit_coords.size() = %ld\n", parameters->k_region, mapping_data->num_seeds_with_no_hits, mapping_data->num_seeds_over_limit, hit_coords.size()), std::string(__FUNCTION__));
+  mapping_data->time_region_counting = omp_get_wtime() - diff_clock;
+  diff_clock = omp_get_wtime();
 
-  // Convert the bins to a more compact form. Count occurrences of all bins, and discard the same hits (same query coordinate and same hit position (rasterized to a bin)).
-  // The tuple will contain: reference_id, bin_index, bin_count.
+  // Convert the bins to a more compact form, which will be easier to sort. Neighbouring bins are adjacent in bin_ids
+  // only if both are non-empty, otherwise their count is zero.
+  float min_allowed_bin_value = std::max(2.0f, (float) std::floor(parameters->min_bin_percent * max_bin_value));
   mapping_data->bins.clear();
-  mapping_data->bins.reserve(10000);
-
-  if (hit_coords.size() > 0) {
+  int64_t reference_id = 0;
+  for (int64_t i = 0; i < num_bins; i++) {
+    if (bin_counts[i] <= min_allowed_bin_value) {
+      continue;
+    }
+    while (bin_ids[i] >= bin_starts[reference_id + 1]) { reference_id += 1; }
     ChromosomeBin new_bin;
-    new_bin.reference_id = (hit_coords[0] >> 64) & ((uint128_t) 0x00000000FFFFFFFF);
-    new_bin.bin_id = (hit_coords[0] >> 32) & ((uint128_t) 0x00000000FFFFFFFF);
-    new_bin.bin_value = 1;
+    new_bin.reference_id = reference_id;
+    new_bin.bin_id = bin_ids[i] - bin_starts[reference_id];
+    new_bin.bin_value = bin_counts[i];
+    if (i > 0 && bin_ids[i - 1] == (bin_ids[i] - 1) && new_bin.bin_id > 0) { new_bin.bin_value += bin_counts[i - 1] / 2.0f; }
+    if ((i + 1) < num_bins && bin_ids[i + 1] == (bin_ids[i] + 1) && bin_ids[i + 1] < bin_starts[reference_id + 1]) { new_bin.bin_value += bin_counts[i + 1] / 2.0f; }
     mapping_data->bins.push_back(new_bin);
   }
-  int64_t prev_query_pos = 0;
-  for (int64_t i = 1; i < hit_coords.size(); i++) {
-    int64_t ref_id = (hit_coords[i] >> 64) & ((uint128_t) 0x00000000FFFFFFFF);
-    int64_t bin_id = (hit_coords[i] >> 32) & ((uint128_t) 0x00000000FFFFFFFF);
-    int64_t query_pos = (hit_coords[i] >> 0) & ((uint128_t) 0x00000000FFFFFFFF);
-    if (bin_id != mapping_data->bins.back().bin_id || ref_id != mapping_data->bins.back().reference_id) {
-      ChromosomeBin new_bin;
-      new_bin.reference_id = ref_id;
-      new_bin.bin_id = bin_id;
-      new_bin.bin_value = 1;
-      mapping_data->bins.push_back(new_bin);
-    } else if (i == 0 || (i > 0 && query_pos != prev_query_pos)) {
-      mapping_data->bins.back().bin_value += 1;
-    }
-    prev_query_pos = query_pos;
-  }
 
-  // Sort the bins in the descending order of bins_[i].bin_value;
-  std::sort(mapping_data->bins.begin(), mapping_data->bins.end(), bins_greater_than_key());
+  mapping_data->time_region_conversion = omp_get_wtime() - diff_clock;
+  diff_clock = omp_get_wtime();
+
+  // Sort the bins in the descending order of bins_[i].bin_value. Stable, so that the order is the same as with the dense engine.
+  std::stable_sort(mapping_data->bins.begin(), mapping_data->bins.end(), bins_greater_than_key());
 
-  double elapsed_secs_conversion = double(clock() - begin_clock) / CLOCKS_PER_SEC;
-  mapping_data->time_region_conversion = elapsed_secs_conversion;
-  begin_clock = clock();
+  mapping_data->time_region_hitsort += omp_get_wtime() - diff_clock;
 
-//  for (int64_t i=0; i<mapping_data->bins.size(); i++) {
-//    printf ("[%ld] ref_id = %ld\tbin_id = %ld\tbin_value = %.2f\n", i, mapping_data->bins[i].reference_id, mapping_data->bins[i].bin_id, mapping_data->bins[i].bin_value);
-//  }
-//  printf ("\n");
-//  fflush(stdout);
+  double end_clock = omp_get_wtime();
+  double elapsed_secs = end_clock - begin_clock;
+  mapping_data->time_region_selection = elapsed_secs;
+  LOG_DEBUG_SPEC("Region selection timings (sort-based):\n");
+  LOG_DEBUG_SPEC("    time_region_seed_lookup = %f\n", mapping_data->time_region_seed_lookup);
+  LOG_DEBUG_SPEC("    time_region_alloc = %f\n", mapping_data->time_region_alloc);
+  LOG_DEBUG_SPEC("    time_region_counting = %f\n", mapping_data->time_region_counting);
+  LOG_DEBUG_SPEC("    time_region_conversion = %f\n", mapping_data->time_region_conversion);
+  LOG_DEBUG_SPEC("    time_region_sort = %f\n", mapping_data->time_region_hitsort);
+  LOG_DEBUG_SPEC("\n");
+  mapping_data->num_seed_hits = total_num_hits;
+  LOG_DEBUG_SPEC("    total_num_hits = %ld\n", total_num_hits);
+  LOG_DEBUG_SPEC("    read_len = %ld\n", read->get_sequence_length());
 
   return 0;
 }
@@ -366,8 +642,8 @@ int GraphMap::RegionSelectionNoBins_(int64_t bin_size, MappingData* mapping_data
 
 
 int GraphMap::RegionSelectionNoCopyWithDensehash_(int64_t bin_size, MappingData* mapping_data, const std::vector<Index *> indexes, const SingleSequence* read, const ProgramParameters* parameters) {
-  clock_t begin_clock = clock();
-  clock_t diff_clock = begin_clock;
+  double begin_clock = omp_get_wtime();
+  double diff_clock = begin_clock;
 
   if (indexes.size() == 0 || indexes[0] == NULL) {
     LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_UNEXPECTED_VALUE, "No reference indexes are specified."));
@@ -386,7 +662,7 @@ int GraphMap::RegionSelectionNoCopyWithDensehash_(int64_t bin_size, MappingData*
   ///// This part prepares the bins. /////
   ////////////////////////////////////////////////////
   // Create bins for each chromosome (or reference sequence) separately.
-  diff_clock = clock();
+  diff_clock = omp_get_wtime();
 //  std::vector<std::vector<float> > bins_chromosome;
 //  std::vector<std::vector<int64_t> > last_update_chromosome;
 
@@ -425,8 +701,8 @@ int GraphMap::RegionSelectionNoCopyWithDensehash_(int64_t bin_size, MappingData*
 
   int64_t k = (int64_t) ((IndexSpacedHashFast *) indexes[0])->get_shape_index_length();
 
-  mapping_data->time_region_alloc = ((double) clock() - diff_clock) / CLOCKS_PER_SEC;
-  diff_clock = clock();
+  mapping_data->time_region_alloc = omp_get_wtime() - diff_clock;
+  diff_clock = omp_get_wtime();
 
   ////////////////////////////////////////////////////
   ///// This part counts the occurrences in bins. /////
@@ -434,7 +710,7 @@ int GraphMap::RegionSelectionNoCopyWithDensehash_(int64_t bin_size, MappingData*
   // Filling the bins with values, so we get an occurrence map.
   mapping_data->time_region_seed_lookup = 0.0;
   int64_t total_num_hits = 0;
-  diff_clock = clock();
+  diff_clock = omp_get_wtime();
   for (int64_t i = 0; i < (readlength - k + 1); i += parameters->kmer_step) {  // i++) {
     int8_t *seed = (int8_t *) &(read->get_data()[i]);
 
@@ -443,11 +719,14 @@ int GraphMap::RegionSelectionNoCopyWithDensehash_(int64_t bin_size, MappingData*
       IndexSpacedHashFast *index = (IndexSpacedHashFast *) indexes[index_id];
 
       if (index != NULL) {
-        clock_t diff_find_seeds = clock();
-        std::vector<int64_t *> hit_vector;
-        std::vector<uint64_t> hit_counts;
-        int ret_search = index->FindAllRawPositionsOfSeedNoCopy(seed, k, parameters->max_num_hits, hit_vector, hit_counts);
-        mapping_data->time_region_seed_lookup += ((double) clock() - diff_find_seeds) / CLOCKS_PER_SEC;
+        double diff_find_seeds = omp_get_wtime();
+        SeedHits seed_hits;
+        int ret_search = 0;
+        {
+          PerfStageScope perf_seed_lookup(STAGE_SEED_LOOKUP, true);
+          ret_search = index->FindAllRawPositionsOfSeedNoCopy(seed, k, parameters->max_num_hits, &seed_hits);
+        }
+        mapping_data->time_region_seed_lookup += omp_get_wtime() - diff_find_seeds;
 
         // Check if there is too many hits (or too few).
         if (ret_search == 1) {
@@ -462,14 +741,14 @@ int GraphMap::RegionSelectionNoCopyWithDensehash_(int64_t bin_size, MappingData*
         // Counting kmers in regions of bin_size on the genome
 //        printf ("[%ld[ num_hits = %ld\n", i, num_hits);
 
-        for (int64_t hits_id = 0; hits_id < hit_vector.size(); hits_id++) {
-          int64_t *hits = hit_vector[hits_id];
-          total_num_hits += hit_counts[hits_id];
+        for (int64_t bucket_id = 0; bucket_id < seed_hits.num_buckets; bucket_id++) {
+          SeedHitCursor cursor(index, seed_hits.hash_keys[bucket_id]);
+          total_num_hits += seed_hits.num_hits[bucket_id];
 
           int64_t prev_position_bin = -1, prev_reference_index = -1;
 
-          for (int64_t j = 0; j < hit_counts[hits_id]; j++) {
-            int64_t position = hits[j];
+          int64_t position = 0;
+          for (int64_t j = 0; cursor.Next(&position); j++) {
             int64_t local_position = (int64_t) (((uint64_t) position) & MASK_32_BIT);
             int64_t reference_index = (int64_t) (((uint64_t) position) >> 32);  // (raw_position - reference_starting_pos_[(uint64_t) reference_index]);
 
@@ -479,7 +758,7 @@ int GraphMap::RegionSelectionNoCopyWithDensehash_(int64_t bin_size, MappingData*
             }
 
 //            if (reference_index < 0 || reference_index >= num_seqs) {
-//              LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, read->get_sequence_id() == parameters->debug_read, LogSystem::GetInstance().GenerateErrorMessage(ERR_UNEXPECTED_VALUE, "Offending variable: reference_index. reference_index = %ld, y = %ld, j = %ld / (%ld, %ld)\n", reference_index, local_position, j, 0, hit_counts[hits_id]), "SelectRegionsWithHoughAndCircular");
+//              LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, read->get_sequence_id() == parameters->debug_read, LogSystem::GetInstance().GenerateErrorMessage(ERR_UNEXPECTED_VALUE, "Offending variable: reference_index. reference_index = %ld, y = %ld, j = %ld / (%ld, %ld)\n", reference_index, local_position, j, 0, seed_hits.num_hits[bucket_id]), "SelectRegionsWithHoughAndCircular");
 //              printf ("Tu sam 123!\n");
 //              fflush(stdout);
 //              exit(1);
@@ -528,8 +807,8 @@ int GraphMap::RegionSelectionNoCopyWithDensehash_(int64_t bin_size, MappingData*
   LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, read->get_sequence_id() == parameters->debug_read, FormatString("\n[BuildOccuranceMap] k_region = %d, num_seeds_with_no_hits = %ld, num_seeds_over_limit = %ld, total_num_hits = %ld\n", parameters->k_region, mapping_data->num_seeds_with_no_hits, mapping_data->num_seeds_over_limit, total_num_hits), "ProcessKmersInBins_");
   LOG_DEBUG_HIGH("total_num_hits = %ld\n", total_num_hits);
 
-  mapping_data->time_region_counting = ((double) clock() - diff_clock) / CLOCKS_PER_SEC;
-  diff_clock = clock();
+  mapping_data->time_region_counting = omp_get_wtime() - diff_clock;
+  diff_clock = omp_get_wtime();
 
   int64_t num_bins_above_zero = 0;
   for (int64_t i = 0; i < (indexes[0]->get_num_sequences_forward() * 2); i++) {
@@ -558,8 +837,8 @@ int GraphMap::RegionSelectionNoCopyWithDensehash_(int64_t bin_size, MappingData*
     }
   }
 
-  mapping_data->time_region_conversion = ((double) clock() - diff_clock) / CLOCKS_PER_SEC;
-  diff_clock = clock();
+  mapping_data->time_region_conversion = omp_get_wtime() - diff_clock;
+  diff_clock = omp_get_wtime();
 
   // Debug verbose.
   if (parameters->verbose_level > 5 && read->get_sequence_id() == parameters->debug_read) {
@@ -590,16 +869,16 @@ int GraphMap::RegionSelectionNoCopyWithDensehash_(int64_t bin_size, MappingData*
     }
   }
 
-  diff_clock = clock();
+  diff_clock = omp_get_wtime();
 
   // Sort the bins in the descending order of bins_[i].bin_value;
   std::sort(mapping_data->bins.begin(), mapping_data->bins.end(), bins_greater_than_key());
 
-  mapping_data->time_region_hitsort = ((double) clock() - diff_clock) / CLOCKS_PER_SEC;
-  diff_clock = clock();
+  mapping_data->time_region_hitsort = omp_get_wtime() - diff_clock;
+  diff_clock = omp_get_wtime();
 
-  clock_t end_clock = clock();
-  double elapsed_secs = double(end_clock - begin_clock) / CLOCKS_PER_SEC;
+  double end_clock = omp_get_wtime();
+  double elapsed_secs = end_clock - begin_clock;
   mapping_data->time_region_selection = elapsed_secs;
   LOG_DEBUG_SPEC("Region selection timings:\n");
   LOG_DEBUG_SPEC("    time_region_seed_lookup = %f\n", mapping_data->time_region_seed_lookup);
@@ -608,6 +887,7 @@ int GraphMap::RegionSelectionNoCopyWithDensehash_(int64_t bin_size, MappingData*
   LOG_DEBUG_SPEC("    time_region_conversion = %f\n", mapping_data->time_region_conversion);
   LOG_DEBUG_SPEC("    time_region_sort = %f\n", mapping_data->time_region_hitsort);
   LOG_DEBUG_SPEC("\n");
+  mapping_data->num_seed_hits = total_num_hits;
   LOG_DEBUG_SPEC("    total_num_hits = %ld\n", total_num_hits);
   LOG_DEBUG_SPEC("    read_len = %ld\n", read->get_sequence_length());
 //  exit(1);
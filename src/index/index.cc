@@ -6,6 +6,9 @@
  */
 
 #include <index/index.h>
+#include <algorithm>
+#include <omp.h>
+#include <unistd.h>
 #include "log_system/log_system.h"
 
 Index::Index() {
@@ -18,28 +21,114 @@ Index::Index() {
   data_ptr_ = 0;
   num_sequences_ = 0;
   data_ = NULL;
+  data_owner_ = NULL;
+  pack_data_ = false;
+  data_packed_ = NULL;
+  loaded_bytes_ = 0;
+  memory_node_ = -1;
 }
 
 Index::~Index() {
-  if (data_)
-    delete[] data_;
-  data_ = NULL;
+  FreeData_();
+  ClearPackedData_();
 }
 
 int Index::LoadFromFile(std::string index_path) {
     LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, true, FormatString("Loading index from file.\n"), "LoadFromFile");
     Clear();
+    loaded_bytes_ = 0;
     FILE *fp = fopen(index_path.c_str(), "r");
     if (fp == NULL) {
       LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_OPENING_FILE, "Path: '%s'", index_path.c_str()));
       return 1;
     }
+    double time_start = omp_get_wtime();
     int ret_deserialize = Deserialize_(fp);
+    int64_t num_bytes = ftello(fp);
     fclose(fp);
-    LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, true, FormatString("Index loaded.\n"), "LoadFromFile");
+    double time_load = omp_get_wtime() - time_start;
+    if (ret_deserialize == 0) {
+      loaded_bytes_ = num_bytes;
+    }
+    LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, true, FormatString("Index loaded (%.2f GB in %.2f sec, %.2f GB/s).\n", ((double) num_bytes) / 1e9, time_load, (time_load > 0.0) ? (((double) num_bytes) / 1e9 / time_load) : 0.0), "LoadFromFile");
     return ret_deserialize;
 }
 
+int Index::ReadSectionParallel_(FILE *fp_in, void *dest, int64_t length) const {
+  if (length < PARALLEL_READ_MIN_SIZE) {
+    return (fread(dest, sizeof(int8_t), length, fp_in) == length) ? 0 : 1;
+  }
+
+  // pread does not go through the buffer of fp_in. ftello gives the logical position of the stream (including
+  // what is already buffered), and the stream is moved past the section afterwards.
+  int64_t section_start = ftello(fp_in);
+  if (section_start < 0) {
+    return 1;
+  }
+  int fd = fileno(fp_in);
+  int64_t num_chunks = (length + PARALLEL_READ_CHUNK_SIZE - 1) / PARALLEL_READ_CHUNK_SIZE;
+  int64_t num_failed = 0;
+
+  #pragma omp parallel for schedule(dynamic, 1) reduction(+:num_failed)
+  for (int64_t i = 0; i < num_chunks; i++) {
+    int64_t chunk_start = i * PARALLEL_READ_CHUNK_SIZE;
+    int64_t chunk_length = std::min(PARALLEL_READ_CHUNK_SIZE, length - chunk_start);
+    int64_t num_read = 0;
+    while (num_read < chunk_length) {
+      ssize_t ret_read = pread(fd, ((int8_t *) dest) + chunk_start + num_read, chunk_length - num_read, section_start + chunk_start + num_read);
+      if (ret_read <= 0) {
+        break;
+      }
+      num_read += ret_read;
+    }
+    if (num_read != chunk_length) {
+      num_failed += 1;
+    }
+  }
+
+  if (fseeko(fp_in, section_start + length, SEEK_SET) != 0) {
+    return 1;
+  }
+
+  return (num_failed > 0) ? 1 : 0;
+}
+
+int64_t Index::get_loaded_bytes() const {
+  return loaded_bytes_;
+}
+
+void Index::set_memory_node(int memory_node) {
+  memory_node_ = memory_node;
+}
+
+int Index::get_memory_node() const {
+  return memory_node_;
+}
+
+void Index::AddMemorySection_(std::string name, int64_t bytes, std::vector<std::pair<std::string, int64_t> > &ret_sections) {
+  for (int64_t i=0; i<ret_sections.size(); i++) {
+    if (ret_sections[i].first == name) {
+      ret_sections[i].second += bytes;
+      return;
+    }
+  }
+  ret_sections.push_back(std::make_pair(name, bytes));
+}
+
+void Index::CalcMemorySections(std::vector<std::pair<std::string, int64_t> > &ret_sections) const {
+  if (data_owner_ != NULL) { return; }
+
+  int64_t reference_bytes = 0;
+  if (data_ != NULL) { reference_bytes += data_length_ + 1; }
+  if (data_packed_ != NULL) { reference_bytes += (data_length_forward_ + 3) / 4 + data_packed_runs_.size() * sizeof(PackedDataRun); }
+  AddMemorySection_("reference", reference_bytes, ret_sections);
+
+  int64_t header_bytes = 0;
+  for (int64_t i=0; i<headers_.size(); i++) { header_bytes += headers_[i].capacity() + sizeof(std::string); }
+  header_bytes += (reference_starting_pos_.capacity() + reference_lengths_.capacity()) * sizeof(uint64_t);
+  AddMemorySection_("headers", header_bytes, ret_sections);
+}
+
 int Index::GenerateFromFile(std::string sequence_file_path) {
   Clear();
   LogSystem::GetInstance().Log(VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG, true, FormatString("Loading reference from file to generate index.\n"), "GenerateFromFile");
@@ -48,19 +137,28 @@ int Index::GenerateFromFile(std::string sequence_file_path) {
 }
 
 int Index::GenerateFromSequenceFile(const SequenceFile& sequence_file) {
-  LogSystem::GetInstance().Log(VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG, true, FormatString("Generating index from SequenceFile.\n"), "GenerateFromSequenceFile");
+  return GenerateFromSequenceRange(sequence_file, 0, sequence_file.get_sequences().size());
+}
+
+int Index::GenerateFromSequenceRange(const SequenceFile& sequence_file, int64_t first_seq, int64_t num_seqs) {
+  LogSystem::GetInstance().Log(VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG, true, FormatString("Generating index from SequenceFile.\n"), "GenerateFromSequenceRange");
 
   Clear();
 
   clock_t time_start = clock();
 
+  const SequenceVector &sequences = sequence_file.get_sequences();
+  if (first_seq < 0 || num_seqs < 0 || (first_seq + num_seqs) > ((int64_t) sequences.size())) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_UNEXPECTED_VALUE, "Sequence range out of bounds. first_seq = %ld, num_seqs = %ld, sequences.size() = %ld.", first_seq, num_seqs, sequences.size()));
+    return 1;
+  }
+
   uint64_t total_data_length = 0;
-  for (SequenceVector::const_iterator sequence_iterator = sequence_file.get_sequences().begin();
-      sequence_iterator != sequence_file.get_sequences().end(); sequence_iterator++) {
-    total_data_length += (*sequence_iterator)->get_sequence_length();
+  for (int64_t i = first_seq; i < (first_seq + num_seqs); i++) {
+    total_data_length += sequences[i]->get_sequence_length();
   }
 
-  uint64_t mem_to_alloc = (total_data_length + sequence_file.get_sequences().size())*2;  // Special sign '!' will be added after every base, and there will be twice as many sequences because of reverse complements.
+  uint64_t mem_to_alloc = (total_data_length + num_seqs)*2;  // Special sign '!' will be added after every base, and there will be twice as many sequences because of reverse complements.
 
   data_ = new int8_t[mem_to_alloc];
 
@@ -72,11 +170,18 @@ int Index::GenerateFromSequenceFile(const SequenceFile& sequence_file) {
   data_length_ = mem_to_alloc;
   data_ptr_ = 0;
 
-  InsertHeaders_(sequence_file);
-  InsertSequencesIntoData_(sequence_file);
+  headers_.clear();
+  for (int64_t i = first_seq; i < (first_seq + num_seqs); i++) {
+    InsertSingleHeader_(sequences[i]);
+  }
+  for (int64_t i = first_seq; i < (first_seq + num_seqs); i++) {
+    InsertSingleSequenceIntoData_(sequences[i]);
+  }
   data_length_forward_ = data_ptr_;
-  num_sequences_forward_ = sequence_file.get_sequences().size();
-  InsertReverseSequencesIntoData_(sequence_file);
+  num_sequences_forward_ = num_seqs;
+  for (int64_t i = first_seq; i < (first_seq + num_seqs); i++) {
+    InsertReverseSingleSequenceIntoData_(sequences[i]);
+  }
 
   CreateIndex_(data_, data_length_);
 
@@ -183,6 +288,10 @@ int Index::LoadOrGenerate(std::string reference_path, std::string out_index_path
     LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("New index stored.\n"), "LoadOrGenerate");
   }
 
+  if (pack_data_ == true) {
+    PackData();
+  }
+
   return 0;
 }
 
@@ -196,13 +305,209 @@ int Index::StoreToFile(std::string output_index_path) {
     return 1;
   }
 
-  Serialize_(fp);
+  int ret_serialize = Serialize_(fp);
 
   fclose(fp);
 
+  return ret_serialize;
+}
+
+int Index::ShareReferenceData(const Index *owner) {
+  if (owner == NULL || owner == this) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_UNEXPECTED_VALUE, "Invalid owner of the reference data."));
+    return 1;
+  }
+  // Always point to the index which actually holds the data.
+  if (owner->data_owner_ != NULL) {
+    owner = owner->data_owner_;
+  }
+
+  Clear();
+  data_owner_ = owner;
+  num_sequences_ = owner->num_sequences_;
+  num_sequences_forward_ = owner->num_sequences_forward_;
+  data_length_ = owner->data_length_;
+  data_length_forward_ = owner->data_length_forward_;
+  reference_starting_pos_ = owner->reference_starting_pos_;
+  reference_lengths_ = owner->reference_lengths_;
+
   return 0;
 }
 
+int Index::GenerateFromSharedReference(const Index *owner) {
+  if (ShareReferenceData(owner)) {
+    return 1;
+  }
+
+  clock_t time_start = clock();
+
+  const int8_t *owner_data = data_owner_->get_data();
+  if (owner_data != NULL) {
+    return CreateIndex_((int8_t *) owner_data, data_length_);
+  }
+
+  // The owner's data is packed. Unpack it temporarily, only for the duration of the index construction.
+  int8_t *unpacked_data = new int8_t[data_length_ + 1];
+  if (unpacked_data == NULL) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_MEMORY, "Offending variable: unpacked_data."));
+    return 1;
+  }
+  data_owner_->CopyData(0, data_length_, unpacked_data);
+  unpacked_data[data_length_] = ((int8_t) '\0');
+  int ret_create = CreateIndex_(unpacked_data, data_length_);
+  delete[] unpacked_data;
+
+  return ret_create;
+}
+
+int Index::StoreSharedToFile(std::string output_index_path) {
+  if (data_owner_ == NULL) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_UNEXPECTED_VALUE, "Index does not share the reference data. Use StoreToFile instead."));
+    return 1;
+  }
+
+  FILE *fp_out = fopen(output_index_path.c_str(), "w");
+  if (fp_out == NULL) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_OPENING_FILE, "Path: '%s'", output_index_path.c_str()));
+    return 1;
+  }
+
+  int64_t version_number = INDEX_VERSION;
+  char out_designator[] = "SHARED  ";
+  int64_t out_dlen = 1 * sizeof(int64_t);
+  fwrite(out_designator, sizeof(char), 8, fp_out);
+  fwrite(&out_dlen, sizeof(int64_t), 1, fp_out);
+  fwrite(&version_number, sizeof(int64_t), 1, fp_out);
+
+  // Used only to check that the file was generated for the same reference as the owner's.
+  fwrite(&num_sequences_, sizeof(num_sequences_), 1, fp_out);
+  fwrite(&num_sequences_forward_, sizeof(num_sequences_forward_), 1, fp_out);
+  fwrite(&data_length_, sizeof(data_length_), 1, fp_out);
+  fwrite(&data_length_forward_, sizeof(data_length_forward_), 1, fp_out);
+  uint64_t vector_length = reference_lengths_.size();
+  fwrite(&vector_length, sizeof(vector_length), 1, fp_out);
+  fwrite((reference_lengths_.data()), sizeof(uint64_t), vector_length, fp_out);
+
+  int ret_serialize_index = SerializeIndex_(fp_out);
+  fclose(fp_out);
+
+  return ret_serialize_index;
+}
+
+int Index::LoadSharedFromFile(const Index *owner, std::string index_path) {
+  LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, true, FormatString("Loading shared index from file.\n"), "LoadSharedFromFile");
+
+  if (ShareReferenceData(owner)) {
+    return 1;
+  }
+  loaded_bytes_ = 0;
+
+  FILE *fp_in = fopen(index_path.c_str(), "r");
+  if (fp_in == NULL) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_OPENING_FILE, "Path: '%s'", index_path.c_str()));
+    return 1;
+  }
+
+  char file_header[9];
+  int64_t temp_int = 0, version_number = 0;
+  if (fread(file_header, sizeof(char), 8, fp_in) != 8) {
+    fclose(fp_in);
+    return 1;
+  }
+  file_header[8] = '\0';
+  if (std::string(file_header) != std::string("SHARED  ")) {
+    fclose(fp_in);
+    return -1;
+  }
+  if (fread(&temp_int, sizeof(int64_t), 1, fp_in) != 1 || fread(&version_number, sizeof(int64_t), 1, fp_in) != 1) {
+    fclose(fp_in);
+    return 2;
+  }
+  if (version_number != INDEX_VERSION) {
+    fclose(fp_in);
+    return -3;
+  }
+
+  uint64_t num_sequences = 0, num_sequences_forward = 0, data_length = 0, data_length_forward = 0, vector_length = 0;
+  if (fread(&num_sequences, sizeof(num_sequences), 1, fp_in) != 1 ||
+      fread(&num_sequences_forward, sizeof(num_sequences_forward), 1, fp_in) != 1 ||
+      fread(&data_length, sizeof(data_length), 1, fp_in) != 1 ||
+      fread(&data_length_forward, sizeof(data_length_forward), 1, fp_in) != 1 ||
+      fread(&vector_length, sizeof(vector_length), 1, fp_in) != 1) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_FILE_READ_DATA, "Occured when reading the reference info."));
+    fclose(fp_in);
+    return 4;
+  }
+  std::vector<uint64_t> reference_lengths(vector_length);
+  if (fread(reference_lengths.data(), sizeof(uint64_t), vector_length, fp_in) != vector_length) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_FILE_READ_DATA, "Occured when reading variable reference_lengths."));
+    fclose(fp_in);
+    return 5;
+  }
+  if (num_sequences != num_sequences_ || num_sequences_forward != num_sequences_forward_ ||
+      data_length != data_length_ || data_length_forward != data_length_forward_ || reference_lengths != reference_lengths_) {
+    LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, true, FormatString("Shared index was generated for a different reference.\n"), "LoadSharedFromFile");
+    fclose(fp_in);
+    return -4;
+  }
+
+  int ret_deserialize_index = DeserializeIndex_(fp_in);
+  int64_t num_bytes = ftello(fp_in);
+  fclose(fp_in);
+  if (ret_deserialize_index)
+    return (20 + ret_deserialize_index);
+  loaded_bytes_ = num_bytes;
+
+  LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, true, FormatString("Shared index loaded.\n"), "LoadSharedFromFile");
+
+  return 0;
+}
+
+int Index::LoadOrGenerateShared(const Index *owner, std::string out_index_path, bool verbose) {
+  FILE *fp = fopen(out_index_path.c_str(), "r");
+  if (fp != NULL) {
+    fclose(fp);
+    int ret_load_from_file = LoadSharedFromFile(owner, out_index_path);
+
+    if (ret_load_from_file == 0) {
+      return 0;
+    }
+
+    if (verbose == true) {
+      LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Index needs to be rebuilt. It was generated using an older version or for a different reference.\n"), "LoadOrGenerateShared");
+      LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, true, FormatString("ret_load_from_file = %d\n", ret_load_from_file), "LoadOrGenerateShared");
+      fflush(stderr);
+    }
+  }
+
+  if (verbose == true) {
+    LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Started generating new index over the shared reference data...\n"), "LoadOrGenerateShared");
+    fflush(stderr);
+  }
+
+  if (GenerateFromSharedReference(owner)) {
+    return 1;
+  }
+
+  if (verbose == true) {
+    LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Storing new index to file '%s'...\n", out_index_path.c_str()), "LoadOrGenerateShared");
+  }
+
+  if (StoreSharedToFile(out_index_path)) {
+    return 1;
+  }
+
+  if (verbose == true) {
+    LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("New index stored.\n"), "LoadOrGenerateShared");
+  }
+
+  return 0;
+}
+
+bool Index::is_data_shared() const {
+  return (data_owner_ != NULL);
+}
+
 int Index::InsertReverseSingleSequenceIntoData_(const SingleSequence *sequence) {
   SingleSequence *ascii_sequence = NULL;
 
@@ -510,14 +815,36 @@ int Index::Deserialize_(FILE* fp_in) {
   LogSystem::GetInstance().Log(VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG, true, FormatString("done.\n"), "[]");
 
   LogSystem::GetInstance().Log(VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG, true, FormatString("\t- data_...\n"), "Deserialize_");
-  if (data_)
-    delete[] data_;
-  data_ = new int8_t[data_length_ + 1];
+  FreeData_();
+  ClearPackedData_();
+
+  if (pack_data_ == true) {
+    // Only the forward strand is read, in chunks, and packed on the fly. The reverse complement is derived from it when needed.
+    data_packed_ = (uint8_t *) IndexMemory::GetInstance().Allocate((data_length_forward_ + 3) / 4, memory_node_);
+    if (data_packed_ == NULL) {
+      LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_MEMORY, "Offending variable: data_packed_."));
+      return 1;
+    }
+    const uint64_t chunk_size = 64 * 1024 * 1024;
+    std::vector<int8_t> chunk(std::min(chunk_size, data_length_forward_));
+    for (uint64_t chunk_start = 0; chunk_start < data_length_forward_; chunk_start += chunk_size) {
+      uint64_t chunk_length = std::min(chunk_size, data_length_forward_ - chunk_start);
+      if (ReadSectionParallel_(fp_in, &chunk[0], chunk_length)) {
+        LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_FILE_READ_DATA, "Occured when reading variable data_."));
+        return 14;
+      }
+      PackDataChunk_(&chunk[0], chunk_start, chunk_length);
+    }
+    LogSystem::GetInstance().Log(VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG, true, FormatString("packed, %ld runs of non-ACGT bases.\n", data_packed_runs_.size()), "Deserialize_");
+    return 0;
+  }
+
+  data_ = (int8_t *) IndexMemory::GetInstance().Allocate(data_length_ + 1, memory_node_);
   if (data_ == NULL) {
     LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_MEMORY, "Offending variable: data_."));
     return 1;
   }
-  if (fread(data_, sizeof(int8_t), data_length_, fp_in) != data_length_) {
+  if (ReadSectionParallel_(fp_in, data_, data_length_)) {
     LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_FILE_READ_DATA, "Occured when reading variable data_."));
     return 14;
   }
@@ -651,8 +978,7 @@ int Index::DeprecatedDeserialize_(FILE* fp_in) {
   LogSystem::GetInstance().Log(VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG, true, FormatString("done.\n"), "[]");
 
   LogSystem::GetInstance().Log(VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG, true, FormatString("\t- data_...\n"), "Deserialize_");
-  if (data_)
-    delete[] data_;
+  FreeData_();
   data_ = new int8_t[data_length_ + 1];
   if (data_ == NULL) {
     LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_MEMORY, "Offending variable: data_."));
@@ -804,8 +1130,7 @@ int Index::InsertSequence_(const int8_t *sequence_data, uint64_t sequence_length
     // memcpy is not used because it was updated recently and requires new GLIBC symbols,
     // thus binaries won't run on older versions of systems.
     memmove(data, data_, data_length_);
-    if (data_)
-      delete[] data_;
+    FreeData_();
 
     data_ = data;
     data_length_ = data_ptr_ + sequence_length + 1;
@@ -860,13 +1185,235 @@ uint64_t Index::get_data_length_forward() const {
 }
 
 const std::vector<std::string>& Index::get_headers() const {
+  if (data_owner_ != NULL) {
+    return data_owner_->get_headers();
+  }
   return headers_;
 }
 
 const int8_t* Index::get_data() const {
+  if (data_owner_ != NULL) {
+    return data_owner_->get_data();
+  }
   return data_;
 }
 
+bool Index::is_data_packed() const {
+  if (data_owner_ != NULL) {
+    return data_owner_->is_data_packed();
+  }
+  return (data_packed_ != NULL);
+}
+
+void Index::set_pack_data(bool pack_data) {
+  pack_data_ = pack_data;
+}
+
+void Index::FreeData_() {
+  if (data_ && IndexMemory::GetInstance().Free(data_))
+    delete[] data_;
+  data_ = NULL;
+}
+
+void Index::ClearPackedData_() {
+  if (data_packed_ && IndexMemory::GetInstance().Free(data_packed_))
+    free(data_packed_);
+  data_packed_ = NULL;
+  data_packed_runs_.clear();
+}
+
+int Index::PackData() {
+  if (data_owner_ != NULL) {
+    // The data belongs to the owner, which is packed separately.
+    return 0;
+  }
+  if (data_packed_ != NULL) {
+    return 0;
+  }
+  if (data_ == NULL) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_UNEXPECTED_VALUE, "Data not initialized."));
+    return 1;
+  }
+
+  data_packed_ = (uint8_t *) calloc((data_length_forward_ + 3) / 4, sizeof(uint8_t));
+  if (data_packed_ == NULL) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_MEMORY, "Offending variable: data_packed_."));
+    return 1;
+  }
+  PackDataChunk_(data_, 0, data_length_forward_);
+
+  FreeData_();
+
+  LogSystem::GetInstance().Log(VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG, true, FormatString("Reference data packed, %ld runs of non-ACGT bases.\n", data_packed_runs_.size()), "PackData");
+
+  return 0;
+}
+
+void Index::PackDataChunk_(const int8_t *chunk, uint64_t chunk_start, uint64_t chunk_length) {
+  for (uint64_t i = 0; i < chunk_length; i++) {
+    uint64_t pos = chunk_start + i;
+    uint8_t code = 0;
+    switch (chunk[i]) {
+      case 'A': code = 0; break;
+      case 'C': code = 1; break;
+      case 'G': code = 2; break;
+      case 'T': code = 3; break;
+      default:
+        // Extend the last run if it is adjacent and holds the same character, otherwise open a new one.
+        if (data_packed_runs_.size() > 0 && data_packed_runs_.back().base == chunk[i] &&
+            (data_packed_runs_.back().start + data_packed_runs_.back().length) == pos) {
+          data_packed_runs_.back().length += 1;
+        } else {
+          PackedDataRun run;
+          run.start = pos;
+          run.length = 1;
+          run.base = chunk[i];
+          data_packed_runs_.push_back(run);
+        }
+        continue;
+    }
+    data_packed_[pos >> 2] |= (code << ((pos & 3) << 1));
+  }
+}
+
+void Index::UnpackForward_(uint64_t start, uint64_t length, int8_t *dest) const {
+  static const int8_t kPackedToBase[4] = {'A', 'C', 'G', 'T'};
+  for (uint64_t i = 0; i < length; i++) {
+    uint64_t pos = start + i;
+    dest[i] = kPackedToBase[(data_packed_[pos >> 2] >> ((pos & 3) << 1)) & 3];
+  }
+
+  // Overlay the runs which intersect [start, start + length). Find the last run beginning at or before start.
+  uint64_t end = start + length;
+  int64_t low = 0, high = ((int64_t) data_packed_runs_.size()) - 1, run_id = 0;
+  while (low <= high) {
+    int64_t mid = (low + high) / 2;
+    if (data_packed_runs_[mid].start <= start) { run_id = mid; low = mid + 1; }
+    else { high = mid - 1; }
+  }
+  for (; run_id < data_packed_runs_.size() && data_packed_runs_[run_id].start < end; run_id++) {
+    const PackedDataRun &run = data_packed_runs_[run_id];
+    uint64_t run_start = std::max(run.start, start);
+    uint64_t run_end = std::min(run.start + run.length, end);
+    for (uint64_t pos = run_start; pos < run_end; pos++) {
+      dest[pos - start] = run.base;
+    }
+  }
+}
+
+static inline int8_t ComplementPackedBase(int8_t base) {
+  switch (base) {
+    case 'A': return 'T';
+    case 'C': return 'G';
+    case 'G': return 'C';
+    case 'T': return 'A';
+    case 'R': return 'Y';
+    case 'Y': return 'R';
+    case 'K': return 'M';
+    case 'M': return 'K';
+    case 'B': return 'V';
+    case 'V': return 'B';
+    case 'D': return 'H';
+    case 'H': return 'D';
+    default: return base;
+  }
+}
+
+void Index::CopyData(int64_t start, int64_t length, int8_t *dest) const {
+  if (length <= 0) {
+    return;
+  }
+
+  if (data_owner_ != NULL) {
+    data_owner_->CopyData(start, length, dest);
+    return;
+  }
+
+  if (data_packed_ == NULL) {
+    for (int64_t i = 0; i < length; i++) {
+      dest[i] = (data_ != NULL && (start + i) >= 0 && (start + i) < data_length_) ? data_[start + i] : ((int8_t) '\0');
+    }
+    return;
+  }
+
+  int64_t end = start + length;
+  int64_t pos = start;
+
+  // Out of bounds on the left.
+  for (; pos < end && pos < 0; pos++) {
+    dest[pos - start] = '\0';
+  }
+
+  // Forward strand is unpacked directly.
+  int64_t fwd_end = std::min(end, (int64_t) data_length_forward_);
+  if (pos < fwd_end) {
+    UnpackForward_(pos, fwd_end - pos, dest + (pos - start));
+    pos = fwd_end;
+  }
+
+  // Reverse strand. Base at offset q of the reverse sequence j is the complement of the base at
+  // offset (len - 1 - q) of the forward sequence (j - num_sequences_forward_). Each sequence is followed by a '!'.
+  while (pos < end && pos < data_length_) {
+    int64_t ref_id = RawPositionToReferenceIndexWithReverse(pos);
+    if (ref_id < ((int64_t) num_sequences_forward_)) {
+      dest[pos - start] = '\0';
+      pos += 1;
+      continue;
+    }
+    int64_t rev_start = reference_starting_pos_[ref_id];
+    int64_t ref_len = reference_lengths_[ref_id];
+    int64_t fwd_start = reference_starting_pos_[ref_id - num_sequences_forward_];
+    int64_t seg_end = std::min(end, rev_start + ref_len);
+
+    if (pos < seg_end) {
+      int64_t seg_len = seg_end - pos;
+      int8_t *seg_dest = dest + (pos - start);
+      UnpackForward_(fwd_start + ref_len - 1 - (seg_end - 1 - rev_start), seg_len, seg_dest);
+      std::reverse(seg_dest, seg_dest + seg_len);
+      for (int64_t i = 0; i < seg_len; i++) {
+        seg_dest[i] = ComplementPackedBase(seg_dest[i]);
+      }
+      pos = seg_end;
+    }
+    if (pos < end && pos == (rev_start + ref_len)) {
+      dest[pos - start] = '!';
+      pos += 1;
+    }
+  }
+
+  // Out of bounds on the right.
+  for (; pos < end; pos++) {
+    dest[pos - start] = '\0';
+  }
+}
+
+const int8_t* Index::GetDataWindow(int64_t start, int64_t end, DataWindow *window) const {
+  if (data_owner_ != NULL) {
+    return data_owner_->GetDataWindow(start, end, window);
+  }
+
+  if (end < start) { end = start; }
+  window->start_ = start;
+  window->end_ = end;
+
+  // Unpacked data is pointed to directly. Otherwise (packed, or split into shards) the window is filled by CopyData.
+  const int8_t *data = get_data();
+  if (data != NULL) {
+    window->data_ = data + start;
+    return window->data_;
+  }
+
+  int64_t length = end - start + 1;
+  if (window->buffer_.size() < (length + 1)) {
+    window->buffer_.resize(length + 1);
+  }
+  CopyData(start, length, &window->buffer_[0]);
+  window->buffer_[length] = '\0';
+  window->data_ = &window->buffer_[0];
+
+  return window->data_;
+}
+
 uint64_t Index::get_data_length() const {
   return data_length_;
 }
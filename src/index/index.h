@@ -13,17 +13,60 @@
 #include <string>
 #include <iostream>
 #include <cmath>
+#include <vector>
+#include <utility>
 #include "sequences/sequence_file.h"
 #include "utility/utility_general.h"
 #include "utility/utility_conversion-inl.h"
+#include "index/index_memory.h"
 
 
 
-#define INDEX_VERSION     ((int64_t) 8)
+#define INDEX_VERSION     ((int64_t) 11)
 
 #define SHAPE_TYPE_444  0
 #define SHAPE_TYPE_66    1
 
+// Sections of the index file larger than this are read with multiple threads (pread at offsets), in chunks of
+// PARALLEL_READ_CHUNK_SIZE bytes. Smaller sections are read with a single fread.
+#define PARALLEL_READ_MIN_SIZE    ((int64_t) 64 * 1024 * 1024)
+#define PARALLEL_READ_CHUNK_SIZE  ((int64_t) 16 * 1024 * 1024)
+
+// A run of non-ACGT characters (N bases, IUPAC codes, sequence separators) in the forward strand of the packed data.
+struct PackedDataRun {
+  uint64_t start = 0;
+  uint64_t length = 0;
+  int8_t base = 'N';
+};
+
+// A window [start, end] of the unpacked data array, filled out by Index::GetDataWindow. The bases are addressed relative
+// to the start of the window: data()[i] is the base at position start() + i. If the index holds the unpacked data, the
+// window points into it. Otherwise (packed or sharded data) the bases are copied into the window's own buffer, which is
+// kept for the next call. Windows are owned by the caller, so two windows (of the same or different indexes) never
+// overwrite each other.
+class DataWindow {
+ public:
+  DataWindow() : data_(NULL), start_(0), end_(-1) { }
+
+  inline const int8_t* data() const {
+    return data_;
+  }
+  inline int64_t start() const {
+    return start_;
+  }
+  inline int64_t end() const {
+    return end_;
+  }
+
+ private:
+  const int8_t *data_;          // Base at position start_.
+  int64_t start_;
+  int64_t end_;
+  std::vector<int8_t> buffer_;  // Unpacked copy of the window, if the data of the index is not unpacked. Never shrinks.
+
+  friend class Index;
+};
+
 class Index {
  public:
   Index();
@@ -34,11 +77,34 @@ class Index {
   virtual int LoadFromFile(std::string index_path);
   virtual int GenerateFromFile(std::string sequence_file_path);
   virtual int GenerateFromSequenceFile(const SequenceFile &sequence_file);
+  // Generates the index only from num_seqs sequences of the sequence_file, starting with first_seq.
+  virtual int GenerateFromSequenceRange(const SequenceFile &sequence_file, int64_t first_seq, int64_t num_seqs);
   virtual int GenerateFromSingleSequence(const SingleSequence &sequence);
   virtual int GenerateFromSingleSequenceOnlyForward(const SingleSequence &sequence);
   virtual int LoadOrGenerate(std::string reference_path, std::string out_index_path, bool verbose=false);
   virtual int StoreToFile(std::string output_index_path);
 
+  // Makes this index use the reference data (sequences and headers) of the owner index instead of holding its own copy.
+  // Only the sequence lengths and starting positions are copied. The owner must outlive this index.
+  int ShareReferenceData(const Index *owner);
+  // Builds the index structures over the reference data of the owner index. The data is not copied.
+  int GenerateFromSharedReference(const Index *owner);
+  // Same as StoreToFile, LoadFromFile and LoadOrGenerate, but for an index which shares the reference data with the owner.
+  // The file holds only the index structures and the sequence lengths, which are checked against the owner when loading.
+  int StoreSharedToFile(std::string output_index_path);
+  int LoadSharedFromFile(const Index *owner, std::string index_path);
+  int LoadOrGenerateShared(const Index *owner, std::string out_index_path, bool verbose=false);
+  bool is_data_shared() const;
+  // Number of bytes read from the index file(s) by the last successful LoadFromFile or LoadSharedFromFile. 0 if the index was generated.
+  int64_t get_loaded_bytes() const;
+  // NUMA node on which the arrays loaded from file are placed. If < 0 (default), the global IndexMemory policy is used.
+  void set_memory_node(int memory_node);
+  int get_memory_node() const;
+  // Adds the number of bytes held by each section of the index (reference data, headers, and the index structures of
+  // subclasses) to ret_sections, as (name, bytes) pairs. Sections with the same name are summed. Data shared with
+  // another index is not counted.
+  virtual void CalcMemorySections(std::vector<std::pair<std::string, int64_t> > &ret_sections) const;
+
   // Converts the raw position of a query to the real position on the original sequence. This is required in cases when the index has been
   // constructed from both the forward and the reverse complement sequences. Since the sequences are truncated into a single data array,
   // this function can be used to identify to which sequence the raw position belongs to, and whether it is the forward of the reverse strand.
@@ -61,6 +127,19 @@ class Index {
 
 
 
+  // Converts the data_ array into a 2-bit packed representation of the forward strand, with non-ACGT bases stored
+  // in a sparse list of runs. The reverse complement strand is not stored, but derived on the fly. data_ is released,
+  // and get_data() returns NULL afterwards. All accesses to the reference then need to go through CopyData or GetDataWindow.
+  virtual int PackData();
+  // Copies length bases of the (unpacked) data array starting at start into dest. Works for packed and unpacked data.
+  virtual void CopyData(int64_t start, int64_t length, int8_t *dest) const;
+  // Fills out the window with the bases at positions [start, end] of the unpacked data array, and returns window->data().
+  // The window is valid until the next call with the same window, or until the index is destroyed.
+  const int8_t* GetDataWindow(int64_t start, int64_t end, DataWindow *window) const;
+  bool is_data_packed() const;
+  // If set, the data will be packed while being loaded from file (without holding the unpacked copy in memory).
+  void set_pack_data(bool pack_data);
+
   virtual const int8_t* get_data() const;
   virtual uint64_t get_data_length() const;
   virtual uint64_t get_data_length_forward() const;
@@ -84,6 +163,26 @@ class Index {
   std::vector<std::string> headers_;
   uint64_t data_ptr_;
 
+  const Index *data_owner_;                     // If not NULL, data_, data_packed_ and headers_ are not used, and the owner's are used instead.
+
+  bool pack_data_;
+  uint8_t *data_packed_;                        // 2-bit packed forward strand, 4 bases per byte, first base in the lowest bits.
+  std::vector<PackedDataRun> data_packed_runs_; // Sorted by start.
+
+  int64_t loaded_bytes_;
+  int memory_node_;
+
+  // Adds bytes to the section with the given name in ret_sections, or appends the section if it is not there yet.
+  static void AddMemorySection_(std::string name, int64_t bytes, std::vector<std::pair<std::string, int64_t> > &ret_sections);
+  // Releases data_, which can be allocated either with new[] or through IndexMemory.
+  void FreeData_();
+  void ClearPackedData_();
+  void PackDataChunk_(const int8_t *chunk, uint64_t chunk_start, uint64_t chunk_length);
+  void UnpackForward_(uint64_t start, uint64_t length, int8_t *dest) const;
+  // Reads length bytes from the current position of fp_in, like fread, but large sections are read in parallel.
+  // The position of fp_in is moved to the end of the section. Returns 0 if OK.
+  int ReadSectionParallel_(FILE *fp_in, void *dest, int64_t length) const;
+
  private:
   virtual int Serialize_(FILE *fp_out);
   virtual int Deserialize_(FILE *fp_in);
@@ -0,0 +1,380 @@
+/*
+ * index_memory.cc
+ *
+ *  Allocation of the large index arrays (reference data and seed tables) with a NUMA placement policy
+ *  and huge page backing.
+ */
+
+#include "index/index_memory.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "log_system/log_system.h"
+#include "utility/utility_general.h"
+
+#ifdef __linux__
+  #include <sched.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/syscall.h>
+#endif
+
+// Memory policy modes of the mbind and set_mempolicy system calls (linux/mempolicy.h). They are called directly,
+// so that there is no dependency on libnuma.
+#ifndef MPOL_PREFERRED
+  #define MPOL_PREFERRED    1
+#endif
+#ifndef MPOL_BIND
+  #define MPOL_BIND         2
+#endif
+#ifndef MPOL_INTERLEAVE
+  #define MPOL_INTERLEAVE   3
+#endif
+#define NODE_MASK_WORDS     16
+
+IndexMemory& IndexMemory::GetInstance() {
+  static IndexMemory instance;
+  return instance;
+}
+
+IndexMemory::IndexMemory() : policy_(INDEX_MEMORY_POLICY_DEFAULT), huge_pages_(INDEX_HUGE_PAGES_NONE), num_huge_tlb_fallbacks_(0) {
+  DetectNodes_();
+}
+
+IndexMemory::~IndexMemory() {
+  // The arrays are owned (and released) by the indexes.
+  allocations_.clear();
+}
+
+int IndexMemory::SetPolicy(std::string policy_name, std::string huge_pages_name) {
+  int policy = INDEX_MEMORY_POLICY_DEFAULT;
+  if (policy_name == "none" || policy_name == "") {
+    policy = INDEX_MEMORY_POLICY_DEFAULT;
+  } else if (policy_name == "interleave") {
+    policy = INDEX_MEMORY_POLICY_INTERLEAVE;
+  } else if (policy_name == "replicate") {
+    policy = INDEX_MEMORY_POLICY_REPLICATE;
+  } else {
+    LogSystem::GetInstance().Error(SEVERITY_INT_WARNING, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_UNEXPECTED_VALUE, "Unknown NUMA policy '%s'.", policy_name.c_str()));
+    return 1;
+  }
+
+  int huge_pages = INDEX_HUGE_PAGES_NONE;
+  if (huge_pages_name == "none" || huge_pages_name == "") {
+    huge_pages = INDEX_HUGE_PAGES_NONE;
+  } else if (huge_pages_name == "thp") {
+    huge_pages = INDEX_HUGE_PAGES_TRANSPARENT;
+  } else if (huge_pages_name == "explicit") {
+    huge_pages = INDEX_HUGE_PAGES_EXPLICIT;
+  } else {
+    LogSystem::GetInstance().Error(SEVERITY_INT_WARNING, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_UNEXPECTED_VALUE, "Unknown huge page mode '%s'.", huge_pages_name.c_str()));
+    return 1;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  policy_ = policy;
+  huge_pages_ = huge_pages;
+  // Placement only makes sense with more than one node.
+  if (node_cpus_.size() <= 1 && policy_ != INDEX_MEMORY_POLICY_DEFAULT) {
+    policy_ = INDEX_MEMORY_POLICY_DEFAULT;
+  }
+
+  return 0;
+}
+
+int IndexMemory::get_policy() const {
+  return policy_;
+}
+
+int IndexMemory::get_huge_pages() const {
+  return huge_pages_;
+}
+
+int IndexMemory::get_num_nodes() const {
+  return node_cpus_.size();
+}
+
+int64_t IndexMemory::get_num_node_cpus(int node) const {
+  if (node < 0 || node >= node_cpus_.size()) {
+    return 0;
+  }
+  return node_cpus_[node].size();
+}
+
+void* IndexMemory::Allocate(int64_t size, int node) {
+  if (size < 0) {
+    return NULL;
+  }
+  size = std::max((int64_t) 1, size);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  Allocation allocation;
+  allocation.size = size;
+  allocation.node = node;
+
+  void *ptr = NULL;
+  bool placed = (size >= INDEX_MEMORY_MIN_PLACED_SIZE) &&
+                (node >= 0 || policy_ != INDEX_MEMORY_POLICY_DEFAULT || huge_pages_ != INDEX_HUGE_PAGES_NONE);
+  if (placed) {
+    ptr = Map_(size, node, allocation);
+  }
+  if (ptr == NULL) {
+    allocation.mapped_size = 0;
+    allocation.huge_tlb = false;
+    ptr = calloc(size, 1);
+  }
+  if (ptr == NULL) {
+    return NULL;
+  }
+
+  allocations_[ptr] = allocation;
+  return ptr;
+}
+
+int IndexMemory::Free(void *ptr) {
+  if (ptr == NULL) {
+    return 0;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::map<void *, Allocation>::iterator it = allocations_.find(ptr);
+  if (it == allocations_.end()) {
+    return 1;
+  }
+
+  #ifdef __linux__
+    if (it->second.mapped_size > 0) {
+      munmap(ptr, it->second.mapped_size);
+    } else {
+      free(ptr);
+    }
+  #else
+    free(ptr);
+  #endif
+  allocations_.erase(it);
+
+  return 0;
+}
+
+int IndexMemory::BindCurrentThreadToNode(int node) const {
+  if (node < 0 || node >= node_cpus_.size() || node_cpus_[node].size() == 0) {
+    return 1;
+  }
+
+  #ifdef __linux__
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (int64_t i = 0; i < node_cpus_[node].size(); i++) {
+      CPU_SET(node_cpus_[node][i], &cpu_set);
+    }
+    if (sched_setaffinity(0, sizeof(cpu_set), &cpu_set) != 0) {
+      return 1;
+    }
+
+    // Thread-local data (read buffers, mapping structures) then also come from the local node.
+    unsigned long node_mask[NODE_MASK_WORDS];
+    memset(node_mask, 0, sizeof(node_mask));
+    node_mask[node / (8 * sizeof(unsigned long))] |= (1UL << (node % (8 * sizeof(unsigned long))));
+    syscall(SYS_set_mempolicy, MPOL_PREFERRED, node_mask, 8 * sizeof(node_mask));
+    return 0;
+  #else
+    return 1;
+  #endif
+}
+
+std::string IndexMemory::FormatPolicy() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  const char *policy_name = (policy_ == INDEX_MEMORY_POLICY_INTERLEAVE) ? "interleave across nodes" :
+                            (policy_ == INDEX_MEMORY_POLICY_REPLICATE) ? "replicate per node" : "first touch";
+  const char *huge_pages_name = (huge_pages_ == INDEX_HUGE_PAGES_TRANSPARENT) ? "transparent" :
+                                (huge_pages_ == INDEX_HUGE_PAGES_EXPLICIT) ? "explicit (reserved pool)" : "off";
+
+  return FormatString("NUMA nodes: %ld, index placement: %s, huge pages: %s", node_cpus_.size(), policy_name, huge_pages_name);
+}
+
+std::string IndexMemory::FormatPlacement() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  int64_t total_size = 0, num_arrays = 0, num_huge_tlb = 0;
+  std::vector<double> node_bytes(std::max((size_t) 1, node_cpus_.size()), 0.0);
+  double unknown_bytes = 0.0;
+
+  for (std::map<void *, Allocation>::const_iterator it = allocations_.begin(); it != allocations_.end(); it++) {
+    const Allocation &allocation = it->second;
+    if (allocation.size < INDEX_MEMORY_MIN_PLACED_SIZE) {
+      continue;
+    }
+    total_size += allocation.size;
+    num_arrays += 1;
+    num_huge_tlb += (allocation.huge_tlb) ? 1 : 0;
+
+    // Query the node of a sample of pages of the array.
+    int64_t num_samples = std::min((int64_t) INDEX_MEMORY_PLACEMENT_SAMPLES, allocation.size / 4096);
+    if (num_samples <= 0) {
+      unknown_bytes += allocation.size;
+      continue;
+    }
+    double sample_bytes = ((double) allocation.size) / num_samples;
+    #ifdef __linux__
+      std::vector<void *> pages(num_samples);
+      std::vector<int> status(num_samples, -1);
+      int64_t page_size = sysconf(_SC_PAGESIZE);
+      for (int64_t i = 0; i < num_samples; i++) {
+        uintptr_t address = ((uintptr_t) it->first) + (uintptr_t) ((allocation.size / num_samples) * i);
+        pages[i] = (void *) (address - (address % page_size));
+      }
+      if (syscall(SYS_move_pages, 0, num_samples, &pages[0], NULL, &status[0], 0) != 0) {
+        std::fill(status.begin(), status.end(), -1);
+      }
+      for (int64_t i = 0; i < num_samples; i++) {
+        if (status[i] >= 0 && status[i] < node_bytes.size()) {
+          node_bytes[status[i]] += sample_bytes;
+        } else {
+          unknown_bytes += sample_bytes;
+        }
+      }
+    #else
+      unknown_bytes += allocation.size;
+    #endif
+  }
+
+  std::string ret = FormatString("%.2f GB in %ld arrays", ((double) total_size) / 1e9, num_arrays);
+  for (int64_t i = 0; i < node_bytes.size(); i++) {
+    if (node_bytes[i] > 0.0) {
+      ret += FormatString(", node %ld: %.2f GB", i, node_bytes[i] / 1e9);
+    }
+  }
+  if (unknown_bytes > 0.0) {
+    ret += FormatString(", not resident or unknown: %.2f GB", unknown_bytes / 1e9);
+  }
+  if (huge_pages_ == INDEX_HUGE_PAGES_EXPLICIT) {
+    ret += FormatString(", %ld arrays from the huge page pool (%ld fell back to transparent)", num_huge_tlb, num_huge_tlb_fallbacks_);
+  }
+
+  #ifdef __linux__
+    // Amount of memory actually backed by transparent huge pages in this process.
+    FILE *fp = fopen("/proc/self/smaps_rollup", "r");
+    if (fp != NULL) {
+      char line[256];
+      long long anon_huge_kb = -1;
+      while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "AnonHugePages: %lld kB", &anon_huge_kb) == 1) {
+          break;
+        }
+      }
+      fclose(fp);
+      if (anon_huge_kb >= 0 && huge_pages_ != INDEX_HUGE_PAGES_NONE) {
+        ret += FormatString(", transparent huge pages in use: %.2f GB", ((double) anon_huge_kb) * 1024.0 / 1e9);
+      }
+    }
+  #endif
+
+  return ret;
+}
+
+void IndexMemory::DetectNodes_() {
+  node_cpus_.clear();
+
+  #ifdef __linux__
+    // Node list and the CPU list of each node are in the same range format, e.g. "0-3,8-11".
+    auto parse_list = [](std::string path, std::vector<int> &values) -> int {
+      FILE *fp = fopen(path.c_str(), "r");
+      if (fp == NULL) { return 1; }
+      char buffer[4096];
+      size_t length = fread(buffer, 1, sizeof(buffer) - 1, fp);
+      fclose(fp);
+      buffer[length] = '\0';
+
+      char *token = strtok(buffer, ",\n");
+      while (token != NULL) {
+        int first = 0, last = 0;
+        int num_parsed = sscanf(token, "%d-%d", &first, &last);
+        if (num_parsed == 1) { last = first; }
+        if (num_parsed >= 1) {
+          for (int i = first; i <= last; i++) { values.push_back(i); }
+        }
+        token = strtok(NULL, ",\n");
+      }
+      return 0;
+    };
+
+    std::vector<int> nodes;
+    if (parse_list("/sys/devices/system/node/online", nodes) == 0 && nodes.size() > 0) {
+      int max_node = *std::max_element(nodes.begin(), nodes.end());
+      if (max_node < 8 * sizeof(unsigned long) * NODE_MASK_WORDS) {
+        node_cpus_.resize(max_node + 1);
+        for (int64_t i = 0; i < nodes.size(); i++) {
+          parse_list(FormatString("/sys/devices/system/node/node%d/cpulist", nodes[i]), node_cpus_[nodes[i]]);
+        }
+      }
+    }
+  #endif
+
+  if (node_cpus_.size() == 0) {
+    node_cpus_.resize(1);
+  }
+}
+
+void* IndexMemory::Map_(int64_t size, int node, Allocation &allocation) {
+  #ifdef __linux__
+    void *ptr = MAP_FAILED;
+    allocation.huge_tlb = false;
+
+    if (huge_pages_ == INDEX_HUGE_PAGES_EXPLICIT) {
+      #ifdef MAP_HUGETLB
+        allocation.mapped_size = ((size + INDEX_MEMORY_HUGE_PAGE_SIZE - 1) / INDEX_MEMORY_HUGE_PAGE_SIZE) * INDEX_MEMORY_HUGE_PAGE_SIZE;
+        ptr = mmap(NULL, allocation.mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        allocation.huge_tlb = (ptr != MAP_FAILED);
+      #endif
+      if (ptr == MAP_FAILED) {
+        num_huge_tlb_fallbacks_ += 1;
+      }
+    }
+
+    if (ptr == MAP_FAILED) {
+      // Map one huge page more than needed, and trim the mapping so that it starts on a huge page boundary.
+      // Otherwise, the first and the last partial huge page of the array cannot be backed by a transparent huge page.
+      int64_t page_size = sysconf(_SC_PAGESIZE);
+      int64_t length = ((size + page_size - 1) / page_size) * page_size;
+      uint8_t *raw = (uint8_t *) mmap(NULL, length + INDEX_MEMORY_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (raw == MAP_FAILED) {
+        return NULL;
+      }
+      uintptr_t head = (INDEX_MEMORY_HUGE_PAGE_SIZE - (((uintptr_t) raw) % INDEX_MEMORY_HUGE_PAGE_SIZE)) % INDEX_MEMORY_HUGE_PAGE_SIZE;
+      if (head > 0) { munmap(raw, head); }
+      munmap(raw + head + length, INDEX_MEMORY_HUGE_PAGE_SIZE - head);
+      ptr = raw + head;
+      allocation.mapped_size = length;
+
+      #ifdef MADV_HUGEPAGE
+        if (huge_pages_ != INDEX_HUGE_PAGES_NONE) {
+          madvise(ptr, allocation.mapped_size, MADV_HUGEPAGE);
+        }
+      #endif
+    }
+
+    // The policy is set before the pages are touched, so they are allocated in place without migration.
+    unsigned long node_mask[NODE_MASK_WORDS];
+    memset(node_mask, 0, sizeof(node_mask));
+    int mode = -1;
+    if (node >= 0 && node < node_cpus_.size()) {
+      node_mask[node / (8 * sizeof(unsigned long))] |= (1UL << (node % (8 * sizeof(unsigned long))));
+      mode = MPOL_BIND;
+    } else if (policy_ == INDEX_MEMORY_POLICY_INTERLEAVE) {
+      for (int64_t i = 0; i < node_cpus_.size(); i++) {
+        node_mask[i / (8 * sizeof(unsigned long))] |= (1UL << (i % (8 * sizeof(unsigned long))));
+      }
+      mode = MPOL_INTERLEAVE;
+    }
+    if (mode >= 0 && syscall(SYS_mbind, ptr, allocation.mapped_size, mode, node_mask, 8 * sizeof(node_mask), 0) != 0) {
+      LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, true, FormatString("mbind failed, the array will be placed by first touch.\n"), "IndexMemory");
+    }
+
+    return ptr;
+  #else
+    return NULL;
+  #endif
+}
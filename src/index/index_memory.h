@@ -0,0 +1,85 @@
+/*
+ * index_memory.h
+ *
+ *  Allocation of the large index arrays (reference data and seed tables) with a NUMA placement policy
+ *  and huge page backing.
+ */
+
+#ifndef INDEX_MEMORY_H_
+#define INDEX_MEMORY_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+
+// Placement of the index arrays on a multi-socket machine.
+#define INDEX_MEMORY_POLICY_DEFAULT     0   // First touch, pages land on the node of the thread which loaded them.
+#define INDEX_MEMORY_POLICY_INTERLEAVE  1   // Pages are interleaved round-robin across all nodes.
+#define INDEX_MEMORY_POLICY_REPLICATE   2   // One copy of the index per node, worker threads are bound to the node of their copy.
+
+#define INDEX_HUGE_PAGES_NONE         0
+#define INDEX_HUGE_PAGES_TRANSPARENT  1     // madvise(MADV_HUGEPAGE) on the array.
+#define INDEX_HUGE_PAGES_EXPLICIT     2     // MAP_HUGETLB from the reserved pool, falls back to transparent if the pool is too small.
+
+// Arrays smaller than this are allocated with calloc regardless of the policy.
+#define INDEX_MEMORY_MIN_PLACED_SIZE  ((int64_t) 2 * 1024 * 1024)
+#define INDEX_MEMORY_HUGE_PAGE_SIZE   ((int64_t) 2 * 1024 * 1024)
+// Number of pages sampled per array when reporting the placement.
+#define INDEX_MEMORY_PLACEMENT_SAMPLES  256
+
+class IndexMemory {
+ public:
+  static IndexMemory& GetInstance();
+
+  // Parses the policy names used on the command line ("none", "interleave", "replicate" and "none", "thp", "explicit").
+  // Returns 0 if OK.
+  int SetPolicy(std::string policy_name, std::string huge_pages_name);
+  int get_policy() const;
+  int get_huge_pages() const;
+  int get_num_nodes() const;
+  // Number of CPUs on the given node. Memory-only nodes have none.
+  int64_t get_num_node_cpus(int node) const;
+
+  // Allocates size zero-initialized bytes. If node >= 0, the pages are bound to that node. Otherwise, the global
+  // policy is applied. Returns NULL if the allocation failed. Thread-safe.
+  void* Allocate(int64_t size, int node=-1);
+  // Releases the memory obtained with Allocate. Returns 0 if OK, or 1 if ptr was not obtained with Allocate
+  // (the caller then releases it the usual way).
+  int Free(void *ptr);
+
+  // Restricts the calling thread to the CPUs of the given node, and makes its own allocations prefer that node.
+  // Returns 0 if OK.
+  int BindCurrentThreadToNode(int node) const;
+
+  // Human readable description of the active policy, for logging at startup.
+  std::string FormatPolicy() const;
+  // Summary of where the pages of all currently allocated arrays reside, per node.
+  std::string FormatPlacement() const;
+
+ private:
+  IndexMemory();
+  ~IndexMemory();
+  IndexMemory(const IndexMemory&) = delete;
+  IndexMemory& operator=(const IndexMemory&) = delete;
+
+  struct Allocation {
+    int64_t size = 0;
+    int64_t mapped_size = 0;      // 0 if the memory was obtained with calloc, otherwise the length of the mapping.
+    int node = -1;
+    bool huge_tlb = false;
+  };
+
+  int policy_;
+  int huge_pages_;
+  int64_t num_huge_tlb_fallbacks_;
+  std::vector<std::vector<int> > node_cpus_;
+  std::map<void *, Allocation> allocations_;
+  mutable std::mutex mutex_;
+
+  void DetectNodes_();
+  void* Map_(int64_t size, int node, Allocation &allocation);
+};
+
+#endif /* INDEX_MEMORY_H_ */
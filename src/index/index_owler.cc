@@ -24,6 +24,7 @@ IndexOwler::IndexOwler() {
   all_subindexes_ = NULL;
   subindex_counts_ = NULL;
   all_subindexes_size_ = 0;
+  minimizer_window_ = 0;
 
   Clear();
 
@@ -63,6 +64,7 @@ IndexOwler::IndexOwler(uint32_t shape_type) {
   all_subindexes_ = NULL;
   subindex_counts_ = NULL;
   all_subindexes_size_ = 0;
+  minimizer_window_ = 0;
 
   Clear();
 
@@ -98,9 +100,7 @@ void IndexOwler::Clear() {
   data_ptr_ = 0;
   num_sequences_ = 0;
 
-  if (data_)
-    delete[] data_;
-  data_ = NULL;
+  FreeData_();
 
   // num_sequences_ counts both forward and reverse sequences.
   all_subindexes_size_ = 0;
@@ -221,7 +221,7 @@ int64_t IndexOwler::GenerateHashKeyFromShape(int8_t *seed, const char *shape, in
 //  return num_sparse_kmers;
 //}
 
-void IndexOwler::CountKmersFromShape(int8_t *sequence_data, int64_t sequence_length, const char *shape, int64_t shape_length, int64_t **ret_kmer_counts, int64_t *ret_num_kmers) const {  // std::vector<int64_t> &ret_kmer_counts) {
+void IndexOwler::CountKmersFromShape(int8_t *sequence_data, int64_t sequence_length, const char *shape, int64_t shape_length, int64_t **ret_kmer_counts, int64_t *ret_num_kmers, const std::vector<bool> *sampled_positions) const {  // std::vector<int64_t> &ret_kmer_counts) {
   int64_t hash_key = -1;
 
 //  ret_kmer_counts.resize(std::pow(2, (2 * k)));
@@ -229,6 +229,9 @@ void IndexOwler::CountKmersFromShape(int8_t *sequence_data, int64_t sequence_len
   int64_t *kmer_counts = (int64_t *) calloc(sizeof(int64_t), num_kmers);
 
   for (uint64_t i = 0; i < (sequence_length - shape_length + 1); i++) {
+    if (sampled_positions != NULL && (*sampled_positions)[i] == false)
+      continue;
+
     int8_t *seed_start = &(sequence_data[i]);
     hash_key = GenerateHashKeyFromShape(seed_start, shape, shape_length);
 
@@ -241,6 +244,68 @@ void IndexOwler::CountKmersFromShape(int8_t *sequence_data, int64_t sequence_len
   *ret_num_kmers = num_kmers;
 }
 
+uint64_t IndexOwler::MinimizerOrder(int64_t hash_key) const {
+  // Invertible integer hash (Thomas Wang's 64-bit mix), limited to the bits which are actually used by the key.
+  uint64_t key_mask = (num_kmers_ > 0) ? ((uint64_t) (num_kmers_ - 1)) : ((uint64_t) 0xFFFFFFFFFFFFFFFF);
+  uint64_t key = ((uint64_t) hash_key) & key_mask;
+  key = (~key + (key << 21)) & key_mask;
+  key = key ^ (key >> 24);
+  key = ((key + (key << 3)) + (key << 8)) & key_mask;
+  key = key ^ (key >> 14);
+  key = ((key + (key << 2)) + (key << 4)) & key_mask;
+  key = key ^ (key >> 28);
+  key = (key + (key << 31)) & key_mask;
+  return key;
+}
+
+void IndexOwler::SelectMinimizers(const std::vector<int64_t> &hash_keys, int64_t window, std::vector<bool> &ret_selected) const {
+  int64_t num_keys = hash_keys.size();
+  ret_selected.assign(num_keys, false);
+
+  if (num_keys == 0)
+    return;
+
+  if (window <= 1) {
+    for (int64_t i = 0; i < num_keys; i++)
+      ret_selected[i] = (hash_keys[i] >= 0);
+    return;
+  }
+
+  std::vector<uint64_t> order(num_keys, 0);
+  for (int64_t i = 0; i < num_keys; i++) {
+    if (hash_keys[i] >= 0)
+      order[i] = MinimizerOrder(hash_keys[i]);
+  }
+
+  /// Sliding window minimum using a monotone queue. Equal values are kept in the queue, so the leftmost minimum of a window is picked.
+  std::vector<int64_t> queue(num_keys, 0);
+  int64_t queue_start = 0, queue_end = 0;
+  for (int64_t i = 0; i < num_keys; i++) {
+    if (hash_keys[i] >= 0) {
+      while (queue_end > queue_start && order[queue[queue_end - 1]] > order[i])
+        queue_end -= 1;
+      queue[queue_end++] = i;
+    }
+
+    // Sequences shorter than the window length are treated as a single window.
+    if (i < (window - 1) && i != (num_keys - 1))
+      continue;
+
+    while (queue_end > queue_start && queue[queue_start] <= (i - window))
+      queue_start += 1;
+    if (queue_end > queue_start)
+      ret_selected[queue[queue_start]] = true;
+  }
+}
+
+void IndexOwler::SelectMinimizersFromSequence(const int8_t *sequence_data, int64_t sequence_length, int64_t window, std::vector<bool> &ret_selected) const {
+  int64_t num_positions = std::max((int64_t) 0, sequence_length - shape_index_length_ + 1);
+  std::vector<int64_t> hash_keys(num_positions, -1);
+  for (int64_t i = 0; i < num_positions; i++)
+    hash_keys[i] = GenerateHashKeyFromShape((int8_t *) &(sequence_data[i]), shape_index_, shape_index_length_);
+  SelectMinimizers(hash_keys, window, ret_selected);
+}
+
 int64_t IndexOwler::CalcNumHashKeysFromShape(const char *shape, int64_t shape_length) const {
   int64_t num_accepted_bases = 0;
 
@@ -565,8 +630,28 @@ int IndexOwler::CreateIndex_(int8_t *data, uint64_t data_length) {
 
   LogSystem::GetInstance().Log(VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG, true, FormatString("Index shape: '%s', length: %ld.\n", shape_index_, shape_index_length_), "CreateIndex_");
 
+  /// If minimizer sampling is turned on, mark the window minimizers of every sequence separately, so that windows never span two sequences.
+  std::vector<bool> sampled_positions;
+  if (minimizer_window_ > 1) {
+    num_kmers_ = CalcNumHashKeysFromShape(shape_index_, shape_index_length_);
+    sampled_positions.resize(data_length_, false);
+    int64_t num_sampled = 0;
+    std::vector<bool> selected;
+    for (int64_t ref_id = 0; ref_id < num_sequences_; ref_id++) {
+      int64_t ref_start = reference_starting_pos_[ref_id];
+      SelectMinimizersFromSequence(&(data_[ref_start]), reference_lengths_[ref_id], minimizer_window_, selected);
+      for (int64_t i = 0; i < selected.size(); i++) {
+        if (selected[i] == true) {
+          sampled_positions[ref_start + i] = true;
+          num_sampled += 1;
+        }
+      }
+    }
+    LogSystem::GetInstance().Log(VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG, true, FormatString("Minimizer sampling with window %ld selected %ld positions (%.2f%% of the data).\n", minimizer_window_, num_sampled, ((data_length_ > 0) ? (100.0f * ((float) num_sampled) / ((float) data_length_)) : 0.0f)), "CreateIndex_");
+  }
+
   int64_t num_kmers = 0;
-  CountKmersFromShape(data_, data_length_, shape_index_, shape_index_length_, &kmer_counts_, &num_kmers);
+  CountKmersFromShape(data_, data_length_, shape_index_, shape_index_length_, &kmer_counts_, &num_kmers, ((minimizer_window_ > 1) ? (&sampled_positions) : NULL));
   int64_t *kmer_countdown = (int64_t *) malloc(sizeof(int64_t) * num_kmers);
   memmove(kmer_countdown, kmer_counts_, sizeof(int64_t) * num_kmers);
   num_kmers_ = num_kmers;
@@ -621,6 +706,9 @@ int IndexOwler::CreateIndex_(int8_t *data, uint64_t data_length) {
       LogSystem::GetInstance().Log(VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG, true, FormatString("\rProcessed %.2f%%", (((float) i) / ((float) (data_length_ - shape_index_length_ + 1))) * 100.0f), "[]");
     }
 
+    if (minimizer_window_ > 1 && sampled_positions[i] == false)
+      continue;
+
     int8_t *seed_start = &(data_[i]);
     hash_key = GenerateHashKeyFromShape(seed_start, shape_index_, shape_index_length_);
 
@@ -962,6 +1050,14 @@ void IndexOwler::set_subindex_counts(int64_t* subindexCounts) {
   subindex_counts_ = subindexCounts;
 }
 
+int64_t IndexOwler::get_minimizer_window() const {
+  return minimizer_window_;
+}
+
+void IndexOwler::set_minimizer_window(int64_t minimizerWindow) {
+  minimizer_window_ = minimizerWindow;
+}
+
 int IndexOwler::InitShapesPredefined(uint32_t shape_type) {
 //  std::string shape_temp = "11111011111";
 //  std::vector<std::string> shapes_lookup_temp;
@@ -45,7 +45,16 @@ class IndexOwler : public Index {
 
   int64_t GenerateHashKeyFromShape(int8_t *seed, const char *shape, int64_t shape_length) const;
   int64_t CalcNumHashKeysFromShape(const char *shape, int64_t shape_length) const;
-  void CountKmersFromShape(int8_t *sequence_data, int64_t sequence_length, const char *shape, int64_t shape_length, int64_t **ret_kmer_counts, int64_t *ret_num_kmers) const;
+  void CountKmersFromShape(int8_t *sequence_data, int64_t sequence_length, const char *shape, int64_t shape_length, int64_t **ret_kmer_counts, int64_t *ret_num_kmers, const std::vector<bool> *sampled_positions=NULL) const;
+
+  // Order of keys used for minimizer selection. An invertible hash of the key, so that low-complexity keys (e.g. poly-A) are not always picked.
+  uint64_t MinimizerOrder(int64_t hash_key) const;
+  // Marks positions whose key is the minimum of at least one window of 'window' consecutive keys. Negative keys are invalid and never selected.
+  void SelectMinimizers(const std::vector<int64_t> &hash_keys, int64_t window, std::vector<bool> &ret_selected) const;
+  // Marks the window minimizers of a sequence, keyed with the index shape. Both the reference (when building the index)
+  // and the reads (when looking up) are sampled with it, so both sides pick the same minimizers from the same windows.
+  // ret_selected has one element per start position of the index shape in the sequence.
+  void SelectMinimizersFromSequence(const int8_t *sequence_data, int64_t sequence_length, int64_t window, std::vector<bool> &ret_selected) const;
 
   void Verbose(FILE *fp) const;
   std::string VerboseToString() const;
@@ -64,6 +73,8 @@ class IndexOwler : public Index {
   void set_read_subindex(SubIndex** readSubindex);
   int64_t* get_subindex_counts() const;
   void set_subindex_counts(int64_t* subindexCounts);
+  int64_t get_minimizer_window() const;
+  void set_minimizer_window(int64_t minimizerWindow);
 
 //  int get_k() const;
 //  void set_k(int k);
@@ -81,6 +92,7 @@ class IndexOwler : public Index {
   int64_t *all_kmers_;
   int64_t all_kmers_size_;
   std::vector<std::string> shapes_lookup_;
+  int64_t minimizer_window_;      // If > 1, only the window minimizers of the index shape are stored. Not serialized, the sampled index is kept in a separate file.
 
 //  SubIndex *read_subindex_;
 //  std::vector<std::vector<SubIndex> > read_subindex_;
@@ -27,9 +27,7 @@ IndexSA::~IndexSA() {
 }
 
 void IndexSA::Clear() {
-  if (data_)
-    delete[] data_;
-  data_ = NULL;
+  FreeData_();
 
   if (suffix_array_)
     delete[] suffix_array_;
@@ -90,9 +90,7 @@ void IndexSpacedHash::Clear() {
   data_ptr_ = 0;
   num_sequences_ = 0;
 
-  if (data_)
-    delete[] data_;
-  data_ = NULL;
+  FreeData_();
 
 //  k_ = 15;
 //  k_ = 12;
@@ -11,11 +11,27 @@
 #include <cstdio>
 #include <cstdlib>
 #include <iostream>
+#include <omp.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <errno.h>
 
 #include "index/index_spaced_hash_fast.h"
 #include "log_system/log_system.h"
 #include "utility/utility_general.h"
 
+// Closes the lock file taken with LockIndexFile_ when it goes out of scope, which releases the lock.
+struct IndexFileLockScope {
+  int lock_fd;
+  explicit IndexFileLockScope(int fd) : lock_fd(fd) { }
+  ~IndexFileLockScope() {
+    if (lock_fd >= 0) {
+      close(lock_fd);
+    }
+  }
+};
+
 CompiledSeed::CompiledSeed(std::string m_shape) {
   Generate(m_shape);
 }
@@ -56,10 +72,16 @@ uint64_t CompiledSeed::Apply(uint64_t full_seed) {
 
 IndexSpacedHashFast::IndexSpacedHashFast() {
   data_ = NULL;
-  kmer_hash_array_ = NULL;
+  kmer_offsets_ = NULL;
   kmer_counts_ = NULL;
   all_kmers_ = NULL;
+  all_kmers_pos_bytes_ = POSITION_BYTES_32_BIT;
   shape_index_ = NULL;
+  max_seed_count_ = 0;
+  repetitive_cutoff_ = 0;
+  shape_type_ = SHAPE_TYPE_444;
+  max_shard_length_ = 0;
+  max_build_memory_ = 0;
 
   Clear();
 
@@ -91,10 +113,16 @@ IndexSpacedHashFast::IndexSpacedHashFast() {
 
 IndexSpacedHashFast::IndexSpacedHashFast(uint32_t shape_type) {
   data_ = NULL;
-  kmer_hash_array_ = NULL;
+  kmer_offsets_ = NULL;
   kmer_counts_ = NULL;
   all_kmers_ = NULL;
+  all_kmers_pos_bytes_ = POSITION_BYTES_32_BIT;
   shape_index_ = NULL;
+  max_seed_count_ = 0;
+  repetitive_cutoff_ = 0;
+  shape_type_ = shape_type;
+  max_shard_length_ = 0;
+  max_build_memory_ = 0;
 
   Clear();
 
@@ -113,29 +141,42 @@ IndexSpacedHashFast::~IndexSpacedHashFast() {
 }
 
 void IndexSpacedHashFast::Clear() {
-  if (kmer_hash_array_)
-    free(kmer_hash_array_);
-  kmer_hash_array_ = NULL;
-  if (all_kmers_)
+  if (kmer_offsets_ && IndexMemory::GetInstance().Free(kmer_offsets_))
+    free(kmer_offsets_);
+  kmer_offsets_ = NULL;
+  if (all_kmers_ && IndexMemory::GetInstance().Free(all_kmers_))
     free(all_kmers_);
   all_kmers_ = NULL;
-  if (kmer_counts_)
+  if (kmer_counts_ && IndexMemory::GetInstance().Free(kmer_counts_))
     free(kmer_counts_);
   kmer_counts_ = NULL;
 
   reference_starting_pos_.clear();
   reference_lengths_.clear();
+  data_owner_ = NULL;
   data_length_ = 0;
   data_length_forward_ = 0;
   data_ptr_ = 0;
   num_sequences_ = 0;
 
-  if (data_)
-    delete[] data_;
-  data_ = NULL;
+  FreeData_();
+  ClearPackedData_();
 
   num_kmers_ = 0;
   all_kmers_size_ = 0;
+
+  ClearKmerStatistics_();
+  ClearShards_();
+  ClearExternalKmers_();
+}
+
+void IndexSpacedHashFast::ClearKmerStatistics_() {
+  kmer_count_histogram_.clear();
+  stored_percentiles_.clear();
+  stored_percentile_counts_.clear();
+  repetitive_keys_.clear();
+  max_seed_count_ = 0;
+  repetitive_cutoff_ = 0;
 }
 
 int64_t IndexSpacedHashFast::GenerateHashKeyFromShape(int8_t *seed, const char *shape, int64_t shape_length) const {
@@ -237,7 +278,7 @@ int IndexSpacedHashFast::FindAllRawPositionsOfSeed(int8_t *seed, uint64_t seed_l
 //        all_hits = (int64_t *) malloc(sizeof(int64_t) * (current_data_ptr + kmer_counts_[hash_key]));
 //      else
 //        all_hits = (int64_t *) realloc(all_hits, (sizeof(int64_t) * (current_data_ptr + kmer_counts_[hash_key])));
-      memmove(&(all_hits[current_data_ptr]), &(kmer_hash_array_[hash_key][0]), kmer_counts_[hash_key] * sizeof(int64_t));
+      DecodeBucket_(hash_key, &(all_hits[current_data_ptr]));
       current_data_ptr += kmer_counts_[hash_key];
 //    }
   }
@@ -264,23 +305,31 @@ int IndexSpacedHashFast::FindAllRawPositionsOfSeed(int8_t *seed, uint64_t seed_l
 
 }
 
-int IndexSpacedHashFast::FindAllRawPositionsOfSeedNoCopy(int8_t *seed, uint64_t seed_length, uint64_t max_num_of_hits, std::vector<int64_t *> &ret_hits, std::vector<uint64_t> &ret_num_hits) const {
+int IndexSpacedHashFast::FindAllRawPositionsOfSeedNoCopy(int8_t *seed, uint64_t seed_length, uint64_t max_num_of_hits, SeedHits *ret_hits) const {
   seed_length = shape_index_length_;
-  ret_hits.clear();
-  ret_num_hits.clear();
-  ret_hits.resize(shapes_lookup_.size(), NULL);
-  ret_num_hits.resize(shapes_lookup_.size(), 0);
+  ret_hits->num_buckets = 0;
+
+  // A repetitive key alone has more than repetitive_cutoff_ hits, so if the limit is not above the cutoff the
+  // seed would be rejected anyway. Check the bitset before touching the (much larger) kmer_counts_ array.
+  bool check_repetitive = (max_num_of_hits > 0 && repetitive_keys_.size() > 0 && ((int64_t) max_num_of_hits) <= repetitive_cutoff_);
 
   int64_t total_num_hits = 0;
   for (int64_t i = 0; i < shapes_lookup_.size(); i++) {
     int64_t hash_key = GenerateHashKeyFromShape(seed, shapes_lookup_[i].c_str(), shapes_lookup_[i].size());
-    if (hash_key < 0 || hash_key > num_kmers_ || kmer_counts_[hash_key] <= 0) {
+    if (hash_key < 0 || hash_key >= num_kmers_) {
+      continue;
+    }
+    if (check_repetitive == true && IsKeyRepetitive(hash_key)) {
+      return 2;
+    }
+    if (kmer_counts_[hash_key] <= 0) {
       continue;
     }
 
-    ret_hits[i] = &kmer_hash_array_[hash_key][0];
-    ret_num_hits[i] = kmer_counts_[hash_key];
-    total_num_hits += ret_num_hits[i];
+    ret_hits->hash_keys[ret_hits->num_buckets] = hash_key;
+    ret_hits->num_hits[ret_hits->num_buckets] = kmer_counts_[hash_key];
+    total_num_hits += kmer_counts_[hash_key];
+    ret_hits->num_buckets += 1;
   }
 
   if (total_num_hits == 0) {
@@ -376,8 +425,14 @@ int IndexSpacedHashFast::FindAllRawPositionsOfSeedKey(int64_t hash_key, int64_t
   int64_t num_hits = 0;
 
   if (hash_key >= 0 && hash_key < num_kmers_ && kmer_counts_[hash_key] > 0) {
-    all_hits = kmer_hash_array_[hash_key];
+    // Decoded into a thread-local buffer, valid until the next call from the same thread.
+    static thread_local std::vector<int64_t> decoded_hits;
     num_hits = kmer_counts_[hash_key];
+    if (decoded_hits.size() < num_hits) {
+      decoded_hits.resize(num_hits);
+    }
+    all_hits = &decoded_hits[0];
+    DecodeBucket_(hash_key, all_hits);
   }
 
   *ret_hits = all_hits;
@@ -396,9 +451,1088 @@ int IndexSpacedHashFast::FindAllRawPositionsOfSeedKey(int64_t hash_key, int64_t
 }
 
 void IndexSpacedHashFast::CalcPercentileHits(double percentile, int64_t *ret_count, int64_t *ret_max_seed_count) {
+  if (GetPrecomputedPercentileHits(percentile, ret_count, ret_max_seed_count) == 0) {
+    return;
+  }
   return CalcPercentileHits_(kmer_counts_, num_kmers_, percentile, ret_count, ret_max_seed_count);
 }
 
+int IndexSpacedHashFast::GetPrecomputedPercentileHits(double percentile, int64_t *ret_count, int64_t *ret_max_seed_count) const {
+  for (int64_t i = 0; i < stored_percentiles_.size(); i++) {
+    if (fabs(stored_percentiles_[i] - percentile) < 1e-9) {
+      *ret_count = stored_percentile_counts_[i];
+      if (ret_max_seed_count) {
+        *ret_max_seed_count = max_seed_count_;
+      }
+      return 0;
+    }
+  }
+  return 1;
+}
+
+const std::vector<int64_t>& IndexSpacedHashFast::get_kmer_count_histogram() const {
+  return kmer_count_histogram_;
+}
+
+int64_t IndexSpacedHashFast::get_repetitive_cutoff() const {
+  return repetitive_cutoff_;
+}
+
+int IndexSpacedHashFast::InitKmerOffsets_() {
+  if (kmer_offsets_ && IndexMemory::GetInstance().Free(kmer_offsets_))
+    free(kmer_offsets_);
+  kmer_offsets_ = (int64_t *) IndexMemory::GetInstance().Allocate(sizeof(int64_t) * num_kmers_, memory_node_);
+  if (kmer_offsets_ == NULL) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_MEMORY, "Offending variable: kmer_offsets_."));
+    return 1;
+  }
+
+  // Prefix sum in two passes over blocks of keys: sum of each block, then the offsets within each block.
+  int64_t num_blocks = std::max((int64_t) 1, std::min((int64_t) omp_get_max_threads(), num_kmers_ / (1024 * 1024)));
+  int64_t block_size = (num_kmers_ + num_blocks - 1) / num_blocks;
+  std::vector<int64_t> block_offsets(num_blocks + 1, 0);
+
+  #pragma omp parallel for num_threads(num_blocks) schedule(static, 1)
+  for (int64_t block_id = 0; block_id < num_blocks; block_id++) {
+    int64_t block_end = std::min(num_kmers_, (block_id + 1) * block_size);
+    int64_t block_sum = 0;
+    for (int64_t i = block_id * block_size; i < block_end; i++) {
+      block_sum += kmer_counts_[i];
+    }
+    block_offsets[block_id + 1] = block_sum;
+  }
+  for (int64_t block_id = 0; block_id < num_blocks; block_id++) {
+    block_offsets[block_id + 1] += block_offsets[block_id];
+  }
+
+  #pragma omp parallel for num_threads(num_blocks) schedule(static, 1)
+  for (int64_t block_id = 0; block_id < num_blocks; block_id++) {
+    int64_t block_end = std::min(num_kmers_, (block_id + 1) * block_size);
+    int64_t kmer_ptr = block_offsets[block_id];
+    for (int64_t i = block_id * block_size; i < block_end; i++) {
+      kmer_offsets_[i] = kmer_ptr;
+      kmer_ptr += kmer_counts_[i];
+    }
+  }
+
+  return 0;
+}
+
+void IndexSpacedHashFast::DecodeBucket_(int64_t hash_key, int64_t *dest) const {
+  SeedHitCursor cursor(this, hash_key);
+  int64_t num_decoded = 0;
+  while (cursor.Next(&dest[num_decoded])) {
+    num_decoded += 1;
+  }
+}
+
+SeedHitCursor::SeedHitCursor(const IndexSpacedHashFast *index, int64_t hash_key)
+    : index_(index), part_(NULL), hash_key_(hash_key), shard_id_(-1), offset_(0), num_hits_(0), hit_id_(0),
+      ref_id_(-1), ref_start_(0), ref_next_start_(0), ref_code_(0) {
+}
+
+bool SeedHitCursor::NextPart_() {
+  if (index_->shards_.size() == 0) {
+    if (shard_id_ >= 0) {
+      return false;
+    }
+    shard_id_ = 0;
+    part_ = index_;
+  } else {
+    // kmer_counts_[hash_key] of a sharded index is the sum over all shards, so the hits of the shards simply follow one another.
+    shard_id_ += 1;
+    if (shard_id_ >= ((int64_t) index_->shards_.size())) {
+      return false;
+    }
+    part_ = index_->shards_[shard_id_];
+  }
+
+  offset_ = part_->kmer_offsets_[hash_key_];
+  num_hits_ = std::max(part_->kmer_counts_[hash_key_], (int64_t) 0);
+  hit_id_ = 0;
+  ref_id_ = -1;
+  ref_start_ = ref_next_start_ = 0;
+
+  return true;
+}
+
+void SeedHitCursor::FindReference_(uint64_t global_pos) {
+  const std::vector<uint64_t> &starts = part_->reference_starting_pos_;
+  int64_t num_refs = starts.size();
+
+  // Hits are sorted, so the position is most often on the next reference. Binary search only after that.
+  if ((ref_id_ + 1) < num_refs && ((ref_id_ + 2) >= num_refs || global_pos < starts[ref_id_ + 2])) {
+    ref_id_ += 1;
+  } else {
+    ref_id_ = (std::upper_bound(starts.begin() + (ref_id_ + 1), starts.end(), global_pos) - starts.begin()) - 1;
+  }
+  ref_start_ = starts[ref_id_];
+  ref_next_start_ = ((ref_id_ + 1) < num_refs) ? starts[ref_id_ + 1] : ((uint64_t) -1);
+
+  uint64_t global_ref_id = ref_id_;
+  if (part_ != index_) {
+    uint64_t shard_num_fwd = part_->num_sequences_forward_;
+    uint64_t first_ref = index_->shard_first_ref_[shard_id_];
+    global_ref_id = (global_ref_id < shard_num_fwd) ? (first_ref + global_ref_id) : (index_->num_sequences_forward_ + first_ref + (global_ref_id - shard_num_fwd));
+  }
+  ref_code_ = global_ref_id << 32;
+}
+
+void IndexSpacedHashFast::set_max_shard_length(int64_t max_shard_length) {
+  max_shard_length_ = max_shard_length;
+}
+
+int64_t IndexSpacedHashFast::get_num_shards() const {
+  return shards_.size();
+}
+
+void IndexSpacedHashFast::CalcMemorySections(std::vector<std::pair<std::string, int64_t> > &ret_sections) const {
+  Index::CalcMemorySections(ret_sections);
+  AddMemorySection_("seed counts", (kmer_counts_ != NULL) ? (num_kmers_ * sizeof(int64_t)) : 0, ret_sections);
+  AddMemorySection_("seed offsets", (kmer_offsets_ != NULL) ? (num_kmers_ * sizeof(int64_t)) : 0, ret_sections);
+  AddMemorySection_("seed positions", (all_kmers_ != NULL) ? (all_kmers_size_ * all_kmers_pos_bytes_) : 0, ret_sections);
+  AddMemorySection_("seed statistics", repetitive_keys_.capacity() * sizeof(uint64_t) + compiled_seeds_.capacity() * sizeof(CompiledSeed), ret_sections);
+  for (int64_t i=0; i<shards_.size(); i++) {
+    if (shards_[i]) { shards_[i]->CalcMemorySections(ret_sections); }
+  }
+}
+
+int64_t IndexSpacedHashFast::GlobalToShardReferenceId(int64_t global_ref_id, int64_t *ret_shard_ref_id) const {
+  if (shards_.size() == 0) {
+    *ret_shard_ref_id = global_ref_id;
+    return 0;
+  }
+
+  int64_t fwd_ref_id = global_ref_id % num_sequences_forward_;
+  int64_t shard_id = ref_to_shard_[fwd_ref_id];
+  int64_t shard_ref_id = fwd_ref_id - shard_first_ref_[shard_id];
+  if (global_ref_id >= num_sequences_forward_) {
+    shard_ref_id += shards_[shard_id]->num_sequences_forward_;
+  }
+  *ret_shard_ref_id = shard_ref_id;
+
+  return shard_id;
+}
+
+std::string IndexSpacedHashFast::GetShardPath_(std::string index_path, int64_t shard_id) const {
+  return FormatString("%s.shard%ld", index_path.c_str(), shard_id);
+}
+
+void IndexSpacedHashFast::ClearShards_() {
+  for (int64_t i = 0; i < shards_.size(); i++) {
+    if (shards_[i])
+      delete shards_[i];
+    shards_[i] = NULL;
+  }
+  shards_.clear();
+  shard_first_ref_.clear();
+  ref_to_shard_.clear();
+}
+
+int IndexSpacedHashFast::GenerateFromFile(std::string sequence_file_path) {
+  if (max_shard_length_ < 0) {
+    return Index::GenerateFromFile(sequence_file_path);
+  }
+
+  Clear();
+  LogSystem::GetInstance().Log(VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG, true, FormatString("Loading reference from file to generate index.\n"), "GenerateFromFile");
+  SequenceFile sequences(sequence_file_path);
+
+  std::vector<int64_t> first_seqs, num_seqs;
+  SplitIntoShards_(sequences, first_seqs, num_seqs);
+
+  if (first_seqs.size() <= 1) {
+    return Index::GenerateFromSequenceFile(sequences);
+  }
+
+  return GenerateShards_(sequences, first_seqs, num_seqs);
+}
+
+void IndexSpacedHashFast::SplitIntoShards_(const SequenceFile &sequences, std::vector<int64_t> &ret_first_seqs, std::vector<int64_t> &ret_num_seqs) const {
+  // A sequence longer than the limit gets a shard of its own.
+  int64_t max_shard_length = (max_shard_length_ > 0) ? max_shard_length_ : AUTO_MAX_SHARD_LENGTH;
+  ret_first_seqs.clear();
+  ret_num_seqs.clear();
+  int64_t shard_length = 0;
+  for (int64_t i = 0; i < sequences.get_sequences().size(); i++) {
+    int64_t seq_length = sequences.get_sequences()[i]->get_sequence_length();
+    if (ret_first_seqs.size() == 0 || (shard_length > 0 && (shard_length + seq_length) > max_shard_length)) {
+      ret_first_seqs.push_back(i);
+      ret_num_seqs.push_back(0);
+      shard_length = 0;
+    }
+    ret_num_seqs.back() += 1;
+    shard_length += seq_length;
+  }
+}
+
+int IndexSpacedHashFast::GenerateShards_(const SequenceFile &sequences, const std::vector<int64_t> &first_seqs, const std::vector<int64_t> &num_seqs) {
+  LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Splitting the index into %ld shards.\n", first_seqs.size()), "GenerateShards_");
+
+  shards_.resize(first_seqs.size(), NULL);
+  for (int64_t i = 0; i < shards_.size(); i++) {
+    shards_[i] = new IndexSpacedHashFast(shape_type_);
+    shards_[i]->set_max_shard_length(-1);
+    shards_[i]->set_pack_data(pack_data_);
+  }
+
+  // Shards are built in parallel, so each one gets a part of the build memory.
+  if (max_build_memory_ > 0) {
+    int64_t num_parallel = std::min((int64_t) shards_.size(), (int64_t) omp_get_max_threads());
+    for (int64_t i = 0; i < shards_.size(); i++) {
+      shards_[i]->set_max_build_memory(max_build_memory_ / num_parallel, GetShardPath_(build_temp_prefix_, i));
+    }
+  }
+
+  int64_t num_failed = 0;
+  #pragma omp parallel for schedule(dynamic, 1) reduction(+:num_failed)
+  for (int64_t i = 0; i < shards_.size(); i++) {
+    if (shards_[i]->GenerateFromSequenceRange(sequences, first_seqs[i], num_seqs[i])) {
+      num_failed += 1;
+    }
+  }
+
+  if (num_failed > 0) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_UNEXPECTED_VALUE, "Generating %ld out of %ld index shards failed.", num_failed, shards_.size()));
+    return 1;
+  }
+
+  shard_first_ref_ = first_seqs;
+  return InitFromShards_();
+}
+
+int IndexSpacedHashFast::InitFromShards_() {
+  // Global reference info, laid out in the same way as in a non-sharded index (all forward sequences, followed by all
+  // reverse complements, each followed by a '!'). There is no global data_ array, the data is accessed through CopyData.
+  num_sequences_forward_ = 0;
+  for (int64_t i = 0; i < shards_.size(); i++) {
+    num_sequences_forward_ += shards_[i]->num_sequences_forward_;
+  }
+  num_sequences_ = num_sequences_forward_ * 2;
+
+  headers_.clear();
+  ref_to_shard_.clear();
+  reference_lengths_.clear();
+  for (int64_t i = 0; i < shards_.size(); i++) {
+    if (shard_first_ref_[i] != ref_to_shard_.size()) {
+      LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_UNEXPECTED_VALUE, "Index shards are not consecutive. Shard %ld starts with reference %ld, expected %ld.", i, shard_first_ref_[i], ref_to_shard_.size()));
+      return 1;
+    }
+    for (int64_t j = 0; j < shards_[i]->num_sequences_forward_; j++) {
+      headers_.push_back(shards_[i]->get_headers()[j]);
+      reference_lengths_.push_back(shards_[i]->reference_lengths_[j]);
+      ref_to_shard_.push_back(i);
+    }
+  }
+  for (int64_t i = 0; i < num_sequences_forward_; i++) {
+    reference_lengths_.push_back(reference_lengths_[i]);
+  }
+
+  reference_starting_pos_.clear();
+  uint64_t data_ptr = 0;
+  for (int64_t i = 0; i < num_sequences_; i++) {
+    if (i == num_sequences_forward_) {
+      data_length_forward_ = data_ptr;
+    }
+    reference_starting_pos_.push_back(data_ptr);
+    data_ptr += reference_lengths_[i] + 1;
+  }
+  data_length_ = data_ptr;
+  data_ptr_ = data_ptr;
+
+  // Sum of the counts over all shards. This is what the lookups and the max_num_hits cutoff operate on.
+  num_kmers_ = shards_[0]->num_kmers_;
+  if (kmer_counts_ && IndexMemory::GetInstance().Free(kmer_counts_))
+    free(kmer_counts_);
+  kmer_counts_ = (int64_t *) calloc(num_kmers_, sizeof(int64_t));
+  if (kmer_counts_ == NULL) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_MEMORY, "Offending variable: kmer_counts_."));
+    return 1;
+  }
+  all_kmers_size_ = 0;
+  for (int64_t i = 0; i < shards_.size(); i++) {
+    if (shards_[i]->num_kmers_ != num_kmers_) {
+      LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_UNEXPECTED_VALUE, "Index shards were built with different shapes."));
+      return 1;
+    }
+    for (int64_t j = 0; j < num_kmers_; j++) {
+      kmer_counts_[j] += shards_[i]->kmer_counts_[j];
+    }
+    all_kmers_size_ += shards_[i]->all_kmers_size_;
+  }
+
+  CalcKmerStatistics_();
+
+  LogSystem::GetInstance().Log(VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG, true, FormatString("Sharded index initialized: %ld shards, %ld references, %ld positions.\n", shards_.size(), num_sequences_forward_, all_kmers_size_), "InitFromShards_");
+
+  return 0;
+}
+
+int IndexSpacedHashFast::StoreToFile(std::string output_index_path) {
+  if (shards_.size() == 0) {
+    return Index::StoreToFile(output_index_path);
+  }
+
+  // Every shard is a regular index file. The file at the index path lists them, and is written last.
+  std::vector<ShardManifestEntry> entries(shards_.size());
+  int64_t num_failed = 0;
+  for (int64_t i = 0; i < shards_.size(); i++) {
+    entries[i].first_ref = shard_first_ref_[i];
+    entries[i].num_refs = shards_[i]->num_sequences_forward_;
+    entries[i].file_id = i;
+    entries[i].length_forward = shards_[i]->data_length_forward_ - shards_[i]->num_sequences_forward_;
+    if (shards_[i]->StoreToFile(GetShardPath_(output_index_path, i))) {
+      num_failed += 1;
+    }
+  }
+  if (num_failed > 0) {
+    return 1;
+  }
+
+  return WriteShardManifest_(output_index_path, entries);
+}
+
+int IndexSpacedHashFast::ReadShardManifest_(std::string index_path, std::vector<ShardManifestEntry> &ret_entries) const {
+  ret_entries.clear();
+
+  FILE *fp_in = fopen(index_path.c_str(), "r");
+  if (fp_in == NULL) {
+    return 1;
+  }
+
+  char file_header[9];
+  if (fread(file_header, sizeof(char), 8, fp_in) != 8) {
+    fclose(fp_in);
+    return -1;
+  }
+  file_header[8] = '\0';
+  if (std::string(file_header) != std::string("SHARDS  ")) {
+    fclose(fp_in);
+    return -1;
+  }
+
+  int64_t temp_int = 0, version_number = 0, num_shards = 0;
+  if (fread(&temp_int, sizeof(int64_t), 1, fp_in) != 1 || fread(&version_number, sizeof(int64_t), 1, fp_in) != 1) {
+    fclose(fp_in);
+    return 2;
+  }
+  if (version_number != INDEX_VERSION) {
+    fclose(fp_in);
+    return -3;
+  }
+  if (fread(&num_shards, sizeof(int64_t), 1, fp_in) != 1 || num_shards <= 0) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_FILE_READ_DATA, "Occured when reading variable num_shards."));
+    fclose(fp_in);
+    return 4;
+  }
+  ret_entries.resize(num_shards);
+  for (int64_t i = 0; i < num_shards; i++) {
+    ShardManifestEntry &entry = ret_entries[i];
+    if (fread(&entry.first_ref, sizeof(int64_t), 1, fp_in) != 1 || fread(&entry.num_refs, sizeof(int64_t), 1, fp_in) != 1 ||
+        fread(&entry.file_id, sizeof(int64_t), 1, fp_in) != 1 || fread(&entry.length_forward, sizeof(int64_t), 1, fp_in) != 1) {
+      LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_FILE_READ_DATA, "Occured when reading the shard info."));
+      ret_entries.clear();
+      fclose(fp_in);
+      return 5;
+    }
+  }
+  fclose(fp_in);
+
+  return 0;
+}
+
+int IndexSpacedHashFast::WriteShardManifest_(std::string index_path, const std::vector<ShardManifestEntry> &entries) const {
+  std::string temp_path = index_path + std::string(".tmpshards");
+  FILE *fp_out = fopen(temp_path.c_str(), "w");
+  if (fp_out == NULL) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_OPENING_FILE, "Path: '%s'", temp_path.c_str()));
+    return 1;
+  }
+
+  int64_t version_number = INDEX_VERSION;
+  char out_designator[] = "SHARDS  ";
+  int64_t out_dlen = 1 * sizeof(int64_t);
+  int64_t num_shards = entries.size();
+  fwrite(out_designator, sizeof(char), 8, fp_out);
+  fwrite(&out_dlen, sizeof(int64_t), 1, fp_out);
+  fwrite(&version_number, sizeof(int64_t), 1, fp_out);
+  fwrite(&num_shards, sizeof(int64_t), 1, fp_out);
+  for (int64_t i = 0; i < num_shards; i++) {
+    fwrite(&entries[i].first_ref, sizeof(int64_t), 1, fp_out);
+    fwrite(&entries[i].num_refs, sizeof(int64_t), 1, fp_out);
+    fwrite(&entries[i].file_id, sizeof(int64_t), 1, fp_out);
+    fwrite(&entries[i].length_forward, sizeof(int64_t), 1, fp_out);
+  }
+  if (fclose(fp_out) != 0 || rename(temp_path.c_str(), index_path.c_str()) != 0) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_FILE_WRITE_DATA, "Path: '%s'", index_path.c_str()));
+    remove(temp_path.c_str());
+    return 1;
+  }
+
+  return 0;
+}
+
+int IndexSpacedHashFast::LockIndexFile_(std::string index_path, bool exclusive, bool wait) const {
+  std::string lock_path = index_path + std::string(".lock");
+  int lock_fd = open(lock_path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (lock_fd < 0) {
+    lock_fd = open(lock_path.c_str(), O_RDONLY);
+  }
+  if (lock_fd < 0) {
+    LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, true, FormatString("Could not open the lock file '%s', the index is used without locking.\n", lock_path.c_str()), "LockIndexFile_");
+    return -1;
+  }
+
+  int operation = ((exclusive == true) ? LOCK_EX : LOCK_SH) | ((wait == true) ? 0 : LOCK_NB);
+  while (flock(lock_fd, operation) != 0) {
+    if (errno == EINTR) {
+      continue;
+    }
+    close(lock_fd);
+    if (errno == EWOULDBLOCK) {
+      return -2;
+    }
+    LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, true, FormatString("Could not lock '%s', the index is used without locking.\n", lock_path.c_str()), "LockIndexFile_");
+    return -1;
+  }
+
+  return lock_fd;
+}
+
+int IndexSpacedHashFast::LoadFromFile(std::string index_path) {
+  IndexFileLockScope lock(LockIndexFile_(index_path, false, true));
+  return LoadFromFile_(index_path);
+}
+
+int IndexSpacedHashFast::LoadFromFile_(std::string index_path) {
+  std::vector<ShardManifestEntry> entries;
+  int ret_manifest = ReadShardManifest_(index_path, entries);
+  if (ret_manifest == -1 || ret_manifest == 1) {
+    return Index::LoadFromFile(index_path);
+  } else if (ret_manifest != 0) {
+    return ret_manifest;
+  }
+
+  LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, true, FormatString("Loading sharded index from file.\n"), "LoadFromFile");
+  Clear();
+  loaded_bytes_ = 0;
+
+  int64_t num_shards = entries.size();
+  shards_.resize(num_shards, NULL);
+  shard_first_ref_.resize(num_shards, 0);
+  for (int64_t i = 0; i < num_shards; i++) {
+    shards_[i] = new IndexSpacedHashFast(shape_type_);
+    shards_[i]->set_max_shard_length(-1);
+    shards_[i]->set_pack_data(pack_data_);
+    shards_[i]->set_memory_node(memory_node_);
+    shard_first_ref_[i] = entries[i].first_ref;
+  }
+
+  int64_t num_failed = 0;
+  #pragma omp parallel for schedule(dynamic, 1) reduction(+:num_failed)
+  for (int64_t i = 0; i < num_shards; i++) {
+    if (shards_[i]->LoadFromFile_(GetShardPath_(index_path, entries[i].file_id)) || shards_[i]->num_sequences_forward_ != entries[i].num_refs) {
+      num_failed += 1;
+    }
+  }
+  if (num_failed > 0) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_WARNING, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_FILE_READ_DATA, "Loading %ld out of %ld index shards failed.", num_failed, num_shards));
+    ClearShards_();
+    return 6;
+  }
+
+  if (InitFromShards_()) {
+    ClearShards_();
+    return 7;
+  }
+
+  loaded_bytes_ = 0;
+  for (int64_t i = 0; i < num_shards; i++) {
+    loaded_bytes_ += shards_[i]->get_loaded_bytes();
+  }
+
+  LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL_DEBUG, true, FormatString("Sharded index loaded.\n"), "LoadFromFile");
+
+  return 0;
+}
+
+int IndexSpacedHashFast::ReadIndexFileSummary_(std::string index_path, int64_t *ret_num_refs, int64_t *ret_length_forward) const {
+  FILE *fp_in = fopen(index_path.c_str(), "r");
+  if (fp_in == NULL) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_OPENING_FILE, "Path: '%s'", index_path.c_str()));
+    return 1;
+  }
+
+  // Same layout as written by Index::Serialize_, up to and including the reference lengths.
+  char file_header[9];
+  int64_t temp_int = 0, version_number = 0, num_sequences = 0, num_sequences_forward = 0;
+  if (fread(file_header, sizeof(char), 8, fp_in) != 8 || fread(&temp_int, sizeof(int64_t), 1, fp_in) != 1 || fread(&version_number, sizeof(int64_t), 1, fp_in) != 1) {
+    fclose(fp_in);
+    return 2;
+  }
+  file_header[8] = '\0';
+  if (std::string(file_header) != std::string("VERSION ") || version_number != INDEX_VERSION) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_WRONG_FILE_TYPE, "Index '%s' is not an index of the current version, it needs to be rebuilt.", index_path.c_str()));
+    fclose(fp_in);
+    return -3;
+  }
+  if (fread(&num_sequences, sizeof(int64_t), 1, fp_in) != 1 || fread(&num_sequences_forward, sizeof(int64_t), 1, fp_in) != 1) {
+    fclose(fp_in);
+    return 3;
+  }
+  for (int64_t i = 0; i < num_sequences_forward; i++) {
+    uint64_t string_length = 0;
+    if (fread(&string_length, sizeof(string_length), 1, fp_in) != 1 || fseek(fp_in, string_length, SEEK_CUR) != 0) {
+      fclose(fp_in);
+      return 4;
+    }
+  }
+  uint64_t vector_length = 0;
+  if (fread(&vector_length, sizeof(vector_length), 1, fp_in) != 1 || fseek(fp_in, vector_length * sizeof(uint64_t), SEEK_CUR) != 0) {
+    fclose(fp_in);
+    return 5;
+  }
+  std::vector<uint64_t> reference_lengths;
+  if (fread(&vector_length, sizeof(vector_length), 1, fp_in) != 1 || vector_length < num_sequences_forward) {
+    fclose(fp_in);
+    return 6;
+  }
+  reference_lengths.resize(vector_length);
+  if (fread(reference_lengths.data(), sizeof(uint64_t), vector_length, fp_in) != vector_length) {
+    fclose(fp_in);
+    return 7;
+  }
+  fclose(fp_in);
+
+  *ret_num_refs = num_sequences_forward;
+  *ret_length_forward = 0;
+  for (int64_t i = 0; i < num_sequences_forward; i++) {
+    *ret_length_forward += reference_lengths[i];
+  }
+
+  return 0;
+}
+
+int IndexSpacedHashFast::AppendToFile(std::string index_path, std::string sequence_file_path) {
+  IndexFileLockScope lock(LockIndexFile_(index_path, true, true));
+
+  std::vector<ShardManifestEntry> entries;
+  int ret_manifest = ReadShardManifest_(index_path, entries);
+
+  if (ret_manifest == -1) {
+    // A non-sharded index becomes the first segment. Only its header is read.
+    ShardManifestEntry entry;
+    if (ReadIndexFileSummary_(index_path, &entry.num_refs, &entry.length_forward)) {
+      return 1;
+    }
+    if (rename(index_path.c_str(), GetShardPath_(index_path, 0).c_str()) != 0) {
+      LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_FILE_WRITE_DATA, "Could not move '%s' to '%s'.", index_path.c_str(), GetShardPath_(index_path, 0).c_str()));
+      return 1;
+    }
+    entries.push_back(entry);
+    if (WriteShardManifest_(index_path, entries)) {
+      return 1;
+    }
+  } else if (ret_manifest != 0) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_FILE_READ_DATA, "Could not read the index '%s' to append to (error %d). The index needs to be generated first.", index_path.c_str(), ret_manifest));
+    return 1;
+  }
+
+  int64_t num_refs = 0, next_file_id = 0;
+  for (int64_t i = 0; i < entries.size(); i++) {
+    num_refs += entries[i].num_refs;
+    next_file_id = std::max(next_file_id, entries[i].file_id + 1);
+  }
+
+  // Index only the new sequences, as shards of their own.
+  Clear();
+  LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Appending sequences from '%s' to the index.\n", sequence_file_path.c_str()), "AppendToFile");
+  SequenceFile sequences(sequence_file_path);
+  if (sequences.get_sequences().size() == 0) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_WARNING, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_UNEXPECTED_VALUE, "No sequences to append in '%s'.", sequence_file_path.c_str()));
+    return 0;
+  }
+  std::vector<int64_t> first_seqs, num_seqs;
+  SplitIntoShards_(sequences, first_seqs, num_seqs);
+  if (GenerateShards_(sequences, first_seqs, num_seqs)) {
+    Clear();
+    return 1;
+  }
+
+  int64_t num_failed = 0;
+  for (int64_t i = 0; i < shards_.size(); i++) {
+    ShardManifestEntry entry;
+    entry.first_ref = num_refs + first_seqs[i];
+    entry.num_refs = num_seqs[i];
+    entry.file_id = next_file_id + i;
+    entry.length_forward = shards_[i]->data_length_forward_ - shards_[i]->num_sequences_forward_;
+    if (shards_[i]->StoreToFile(GetShardPath_(index_path, entry.file_id))) {
+      num_failed += 1;
+    }
+    entries.push_back(entry);
+  }
+  Clear();
+
+  if (num_failed > 0) {
+    return 1;
+  }
+
+  LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Appended %ld sequences. The index now has %ld references in %ld segments.\n", sequences.get_sequences().size(), num_refs + sequences.get_sequences().size(), entries.size()), "AppendToFile");
+
+  return WriteShardManifest_(index_path, entries);
+}
+
+int IndexSpacedHashFast::CompactFile(std::string index_path, int64_t max_segments) const {
+  int lock_fd = LockIndexFile_(index_path, true, false);
+  if (lock_fd == -2) {
+    LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Index '%s' is being used by another process, it will be compacted on a later run.\n", index_path.c_str()), "CompactFile");
+    return 0;
+  }
+  IndexFileLockScope lock(lock_fd);
+
+  std::vector<ShardManifestEntry> entries;
+  int ret_manifest = ReadShardManifest_(index_path, entries);
+  if (ret_manifest == -1) {
+    return 0;
+  } else if (ret_manifest != 0) {
+    return 1;
+  }
+  if (entries.size() <= max_segments) {
+    return 0;
+  }
+
+  // The merged segments are not made longer than the longest existing one, so the shard size which the index was
+  // built with is kept, independent of the parameters of the current run.
+  int64_t max_segment_length = 0;
+  int64_t next_file_id = 0;
+  for (int64_t i = 0; i < entries.size(); i++) {
+    max_segment_length = std::max(max_segment_length, entries[i].length_forward);
+    next_file_id = std::max(next_file_id, entries[i].file_id + 1);
+  }
+  max_segment_length = std::min(max_segment_length, AUTO_MAX_SHARD_LENGTH);
+
+  std::vector<ShardManifestEntry> new_entries;
+  std::vector<int64_t> merged_file_ids;    // Segments which were merged, removed after the new list is written.
+  std::vector<int64_t> new_file_ids;       // Merged segments written so far, removed if the compaction fails.
+  int64_t group_start = 0;
+  while (group_start < entries.size()) {
+    // Greedily extend the group while it fits.
+    int64_t group_end = group_start + 1;
+    int64_t group_length = entries[group_start].length_forward;
+    while (group_end < entries.size() && (group_length + entries[group_end].length_forward) <= max_segment_length) {
+      group_length += entries[group_end].length_forward;
+      group_end += 1;
+    }
+
+    if ((group_end - group_start) == 1) {
+      new_entries.push_back(entries[group_start]);
+      group_start = group_end;
+      continue;
+    }
+
+    LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Compacting index segments %ld to %ld (%ld bases).\n", group_start, group_end - 1, group_length), "CompactFile");
+
+    std::vector<IndexSpacedHashFast *> segments;
+    int64_t num_failed = 0;
+    for (int64_t i = group_start; i < group_end; i++) {
+      IndexSpacedHashFast *segment = new IndexSpacedHashFast(shape_type_);
+      segment->set_max_shard_length(-1);
+      if (segment->LoadFromFile_(GetShardPath_(index_path, entries[i].file_id))) {
+        num_failed += 1;
+      }
+      segments.push_back(segment);
+    }
+
+    IndexSpacedHashFast merged(shape_type_);
+    if (max_build_memory_ > 0) {
+      merged.set_max_build_memory(max_build_memory_, GetShardPath_(index_path, next_file_id));
+    }
+    ShardManifestEntry entry;
+    entry.first_ref = entries[group_start].first_ref;
+    entry.file_id = next_file_id;
+    entry.length_forward = group_length;
+    if (num_failed == 0 && (merged.GenerateFromSegments_(segments) || merged.StoreToFile(GetShardPath_(index_path, entry.file_id)))) {
+      num_failed += 1;
+    }
+    entry.num_refs = merged.num_sequences_forward_;
+    for (int64_t i = 0; i < segments.size(); i++) {
+      delete segments[i];
+    }
+    segments.clear();
+
+    if (num_failed > 0) {
+      LogSystem::GetInstance().Error(SEVERITY_INT_WARNING, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_FILE_READ_DATA, "Compacting the index '%s' failed. The index was not changed.", index_path.c_str()));
+      new_file_ids.push_back(entry.file_id);
+      for (int64_t i = 0; i < new_file_ids.size(); i++) {
+        remove(GetShardPath_(index_path, new_file_ids[i]).c_str());
+      }
+      return 1;
+    }
+
+    for (int64_t i = group_start; i < group_end; i++) {
+      merged_file_ids.push_back(entries[i].file_id);
+    }
+    new_file_ids.push_back(entry.file_id);
+    new_entries.push_back(entry);
+    next_file_id += 1;
+    group_start = group_end;
+  }
+
+  if (merged_file_ids.size() == 0) {
+    return 0;
+  }
+
+  if (WriteShardManifest_(index_path, new_entries)) {
+    for (int64_t i = 0; i < new_file_ids.size(); i++) {
+      remove(GetShardPath_(index_path, new_file_ids[i]).c_str());
+    }
+    return 1;
+  }
+  for (int64_t i = 0; i < merged_file_ids.size(); i++) {
+    remove(GetShardPath_(index_path, merged_file_ids[i]).c_str());
+  }
+
+  LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Index compacted from %ld to %ld segments.\n", entries.size(), new_entries.size()), "CompactFile");
+
+  return 0;
+}
+
+int IndexSpacedHashFast::GenerateFromSegments_(const std::vector<IndexSpacedHashFast *> &segments) {
+  Clear();
+
+  uint64_t total_data_length = 0;
+  for (int64_t i = 0; i < segments.size(); i++) {
+    total_data_length += segments[i]->data_length_;
+  }
+  data_ = new int8_t[total_data_length + 1];
+  if (data_ == NULL) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_MEMORY, "Offending variable: data_."));
+    return 1;
+  }
+
+  // All forward sequences first, then all reverse complements, in the order of the segments.
+  data_ptr_ = 0;
+  for (int64_t i = 0; i < segments.size(); i++) {
+    const IndexSpacedHashFast *segment = segments[i];
+    segment->CopyData(0, segment->data_length_forward_, data_ + data_ptr_);
+    for (int64_t j = 0; j < segment->num_sequences_forward_; j++) {
+      headers_.push_back(segment->get_headers()[j]);
+      reference_starting_pos_.push_back(data_ptr_ + segment->reference_starting_pos_[j]);
+      reference_lengths_.push_back(segment->reference_lengths_[j]);
+    }
+    data_ptr_ += segment->data_length_forward_;
+    num_sequences_forward_ += segment->num_sequences_forward_;
+  }
+  data_length_forward_ = data_ptr_;
+  for (int64_t i = 0; i < segments.size(); i++) {
+    const IndexSpacedHashFast *segment = segments[i];
+    segment->CopyData(segment->data_length_forward_, segment->data_length_ - segment->data_length_forward_, data_ + data_ptr_);
+    for (int64_t j = segment->num_sequences_forward_; j < segment->num_sequences_; j++) {
+      reference_starting_pos_.push_back(data_ptr_ + (segment->reference_starting_pos_[j] - segment->data_length_forward_));
+      reference_lengths_.push_back(segment->reference_lengths_[j]);
+    }
+    data_ptr_ += segment->data_length_ - segment->data_length_forward_;
+  }
+  num_sequences_ = num_sequences_forward_ * 2;
+  data_length_ = data_ptr_;
+  data_[data_length_] = ((int8_t) '\0');
+
+  return CreateIndex_(data_, data_length_);
+}
+
+int IndexSpacedHashFast::PackData() {
+  if (shards_.size() == 0) {
+    return Index::PackData();
+  }
+  for (int64_t i = 0; i < shards_.size(); i++) {
+    if (shards_[i]->PackData()) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void IndexSpacedHashFast::CopyData(int64_t start, int64_t length, int8_t *dest) const {
+  if (shards_.size() == 0) {
+    Index::CopyData(start, length, dest);
+    return;
+  }
+
+  // Copy sequence by sequence from the shards holding them, and fill in the separators.
+  int64_t end = start + length;
+  int64_t pos = start;
+  while (pos < end) {
+    int64_t ref_id = (pos >= 0 && pos < ((int64_t) data_length_)) ? RawPositionToReferenceIndexWithReverse(pos) : -1;
+    if (ref_id < 0) {
+      dest[pos - start] = '\0';
+      pos += 1;
+      continue;
+    }
+    int64_t ref_start = reference_starting_pos_[ref_id];
+    int64_t ref_end = ref_start + reference_lengths_[ref_id];
+    int64_t shard_ref_id = 0;
+    int64_t shard_id = GlobalToShardReferenceId(ref_id, &shard_ref_id);
+    int64_t seg_end = std::min(end, ref_end);
+    if (pos < seg_end) {
+      shards_[shard_id]->CopyData(shards_[shard_id]->reference_starting_pos_[shard_ref_id] + (pos - ref_start), seg_end - pos, dest + (pos - start));
+      pos = seg_end;
+    }
+    if (pos < end && pos == ref_end) {
+      dest[pos - start] = '!';
+      pos += 1;
+    }
+  }
+}
+
+void IndexSpacedHashFast::set_max_build_memory(int64_t max_build_memory, std::string temp_prefix) {
+  max_build_memory_ = max_build_memory;
+  build_temp_prefix_ = (temp_prefix.size() > 0) ? temp_prefix : FormatString("graphmap_index_build.%d", (int) getpid());
+}
+
+bool IndexSpacedHashFast::is_built_on_disk() const {
+  for (int64_t i = 0; i < shards_.size(); i++) {
+    if (shards_[i]->is_built_on_disk()) {
+      return true;
+    }
+  }
+  return (all_kmers_ == NULL && external_kmers_path_.size() > 0);
+}
+
+std::string IndexSpacedHashFast::GetBuildTempPath_(int64_t partition_id) const {
+  if (partition_id < 0) {
+    return FormatString("%s.tmpkmers", build_temp_prefix_.c_str());
+  }
+  return FormatString("%s.tmp%ld", build_temp_prefix_.c_str(), partition_id);
+}
+
+void IndexSpacedHashFast::ClearExternalKmers_() {
+  if (external_kmers_path_.size() > 0) {
+    remove(external_kmers_path_.c_str());
+  }
+  external_kmers_path_ = "";
+}
+
+int IndexSpacedHashFast::CreateIndexOnDisk_(int8_t *data, int64_t total_num_kmers, int64_t k) {
+  // Memory which is needed regardless of the partitioning: the reference data, kmer_counts_ (and a sorted copy of it
+  // in CalcKmerStatistics_), the I/O buffer and the stdio buffers of the partition files.
+  int64_t fixed_memory = ((int64_t) data_length_) + 2 * sizeof(int64_t) * num_kmers_ + BUILD_IO_CHUNK_SIZE + BUILD_MAX_PARTITIONS * BUFSIZ;
+  int64_t scratch_memory = max_build_memory_ - fixed_memory;
+  if (scratch_memory < BUILD_IO_CHUNK_SIZE) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_MEMORY, "Memory limit of %ld MB is too low to build the index. At least %ld MB are required.", max_build_memory_ / (1024 * 1024), (fixed_memory + BUILD_IO_CHUNK_SIZE) / (1024 * 1024) + 1));
+    return 1;
+  }
+
+  // Split the hash keys into consecutive ranges whose buckets fit into the scratch memory. Partition i holds the keys
+  // [first_keys[i], first_keys[i + 1]), and needs a fill pointer per key and the positions of all its buckets.
+  std::vector<int64_t> first_keys;
+  std::vector<int64_t> partition_sizes;
+  int64_t partition_memory = 0;
+  for (int64_t i = 0; i < num_kmers_; i++) {
+    int64_t key_memory = sizeof(int64_t) + kmer_counts_[i] * all_kmers_pos_bytes_;
+    if (key_memory > scratch_memory) {
+      LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_MEMORY, "Memory limit of %ld MB is too low to build the index. Bucket of key %ld alone takes %ld MB.", max_build_memory_ / (1024 * 1024), i, key_memory / (1024 * 1024)));
+      return 1;
+    }
+    if (first_keys.size() == 0 || (partition_memory + key_memory) > scratch_memory) {
+      first_keys.push_back(i);
+      partition_sizes.push_back(0);
+      partition_memory = 0;
+    }
+    partition_memory += key_memory;
+    partition_sizes.back() += kmer_counts_[i];
+  }
+  int64_t num_partitions = first_keys.size();
+  if (num_partitions > BUILD_MAX_PARTITIONS) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_MEMORY, "Memory limit of %ld MB is too low to build the index. It would need %ld temporary files, the maximum is %ld.", max_build_memory_ / (1024 * 1024), num_partitions, BUILD_MAX_PARTITIONS));
+    return 1;
+  }
+
+  LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Building the index on disk in %ld partitions.\n", num_partitions), "CreateIndexOnDisk_");
+
+  // First pass. Write every position to the file of the partition holding its key, in the order of the data.
+  std::vector<FILE *> fp_partitions(num_partitions, NULL);
+  for (int64_t i = 0; i < num_partitions; i++) {
+    fp_partitions[i] = fopen(GetBuildTempPath_(i).c_str(), "wb");
+    if (fp_partitions[i] == NULL) {
+      LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_OPENING_FILE, "Path: '%s'", GetBuildTempPath_(i).c_str()));
+      for (int64_t j = 0; j < i; j++) {
+        fclose(fp_partitions[j]);
+        remove(GetBuildTempPath_(j).c_str());
+      }
+      return 1;
+    }
+  }
+
+  for (uint64_t i = 0; i < (data_length_ - k + 1); i++) {
+    int64_t hash_key = GenerateHashKeyFromShape(&(data[i]), shape_index_, shape_index_length_);
+    if (hash_key < 0)
+      continue;
+    int64_t partition_id = (std::upper_bound(first_keys.begin(), first_keys.end(), hash_key) - first_keys.begin()) - 1;
+    uint64_t global_pos = (uint64_t) i;
+    fwrite(&global_pos, sizeof(uint8_t), all_kmers_pos_bytes_, fp_partitions[partition_id]);
+  }
+
+  int64_t num_failed = 0;
+  for (int64_t i = 0; i < num_partitions; i++) {
+    if (fclose(fp_partitions[i]) != 0) {
+      num_failed += 1;
+    }
+  }
+  fp_partitions.clear();
+
+  // Second pass. Scatter the positions of each partition into its buckets, and append them to the all_kmers_ file.
+  // Positions of a bucket keep the order of the data, same as in CreateIndex_.
+  external_kmers_path_ = GetBuildTempPath_(-1);
+  FILE *fp_kmers = (num_failed == 0) ? fopen(external_kmers_path_.c_str(), "wb") : NULL;
+  uint8_t *io_buffer = (uint8_t *) malloc(BUILD_IO_CHUNK_SIZE);
+  int64_t io_chunk_positions = BUILD_IO_CHUNK_SIZE / all_kmers_pos_bytes_;
+
+  for (int64_t i = 0; i < num_partitions; i++) {
+    std::string partition_path = GetBuildTempPath_(i);
+    if (fp_kmers == NULL || io_buffer == NULL) {
+      remove(partition_path.c_str());
+      continue;
+    }
+
+    int64_t first_key = first_keys[i];
+    int64_t num_keys = ((i + 1) < num_partitions) ? (first_keys[i + 1] - first_key) : (num_kmers_ - first_key);
+    int64_t *key_fill = (int64_t *) malloc(sizeof(int64_t) * num_keys);
+    uint8_t *partition_kmers = (uint8_t *) calloc(partition_sizes[i] * all_kmers_pos_bytes_ + 1, sizeof(uint8_t));
+    FILE *fp_partition = fopen(partition_path.c_str(), "rb");
+    if (key_fill == NULL || partition_kmers == NULL || fp_partition == NULL) {
+      LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_MEMORY, "Occured when scattering partition %ld.", i));
+      if (key_fill) free(key_fill);
+      if (partition_kmers) free(partition_kmers);
+      if (fp_partition) fclose(fp_partition);
+      remove(partition_path.c_str());
+      num_failed += 1;
+      continue;
+    }
+
+    int64_t offset = 0;
+    for (int64_t j = 0; j < num_keys; j++) {
+      key_fill[j] = offset;
+      offset += kmer_counts_[first_key + j];
+    }
+
+    size_t num_read = 0;
+    while ((num_read = fread(io_buffer, all_kmers_pos_bytes_, io_chunk_positions, fp_partition)) > 0) {
+      for (size_t j = 0; j < num_read; j++) {
+        uint64_t global_pos = 0;
+        memmove(&global_pos, io_buffer + j * all_kmers_pos_bytes_, all_kmers_pos_bytes_);
+        int64_t local_key = GenerateHashKeyFromShape(&(data[global_pos]), shape_index_, shape_index_length_) - first_key;
+        memmove(partition_kmers + key_fill[local_key] * all_kmers_pos_bytes_, &global_pos, all_kmers_pos_bytes_);
+        key_fill[local_key] += 1;
+      }
+    }
+    fclose(fp_partition);
+    remove(partition_path.c_str());
+
+    if (fwrite(partition_kmers, all_kmers_pos_bytes_, partition_sizes[i], fp_kmers) != partition_sizes[i]) {
+      num_failed += 1;
+    }
+
+    free(key_fill);
+    free(partition_kmers);
+  }
+
+  if (io_buffer)
+    free(io_buffer);
+  if (fp_kmers == NULL || io_buffer == NULL || fclose(fp_kmers) != 0) {
+    num_failed += 1;
+  }
+
+  if (num_failed > 0) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_FILE_WRITE_DATA, "Writing the temporary files of the index failed. Path of the positions: '%s'", external_kmers_path_.c_str()));
+    ClearExternalKmers_();
+    return 1;
+  }
+
+  CalcKmerStatistics_();
+
+  LogSystem::GetInstance().Log(VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG, true, FormatString("Finished creating spaced hash index on disk.\n"), "CreateIndexOnDisk_");
+
+  return 0;
+}
+
+int IndexSpacedHashFast::CopyExternalKmers_(FILE *fp_out) const {
+  FILE *fp_kmers = fopen(external_kmers_path_.c_str(), "rb");
+  uint8_t *io_buffer = (uint8_t *) malloc(BUILD_IO_CHUNK_SIZE);
+  if (fp_kmers == NULL || io_buffer == NULL) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_OPENING_FILE, "Path: '%s'", external_kmers_path_.c_str()));
+    if (fp_kmers) fclose(fp_kmers);
+    if (io_buffer) free(io_buffer);
+    return 1;
+  }
+
+  int64_t num_bytes = all_kmers_pos_bytes_ * all_kmers_size_;
+  int64_t num_copied = 0;
+  size_t num_read = 0;
+  while (num_copied < num_bytes && (num_read = fread(io_buffer, sizeof(uint8_t), std::min(BUILD_IO_CHUNK_SIZE, num_bytes - num_copied), fp_kmers)) > 0) {
+    fwrite(io_buffer, sizeof(uint8_t), num_read, fp_out);
+    num_copied += num_read;
+  }
+  fclose(fp_kmers);
+  free(io_buffer);
+
+  if (num_copied != num_bytes) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_FILE_READ_DATA, "Expected %ld bytes of positions, found %ld in '%s'.", num_bytes, num_copied, external_kmers_path_.c_str()));
+    return 1;
+  }
+
+  return 0;
+}
+
+void IndexSpacedHashFast::CalcKmerStatistics_() {
+  ClearKmerStatistics_();
+  if (kmer_counts_ == NULL || num_kmers_ <= 0) {
+    return;
+  }
+
+  LOG_DEBUG("Calculating the seed occurrence statistics.\n");
+
+  // Sort a copy of the counts once, and pick all the percentiles from it. Same selection as in CalcPercentileHits_.
+  std::vector<int64_t> sorted_counts(kmer_counts_, kmer_counts_ + num_kmers_);
+  std::sort(sorted_counts.begin(), sorted_counts.end());
+  int64_t num_nonzero = num_kmers_ - (std::upper_bound(sorted_counts.begin(), sorted_counts.end(), 0) - sorted_counts.begin());
+  max_seed_count_ = sorted_counts.back();
+
+  const double percentiles[] = {0.99, 0.999, REPETITIVE_KEY_PERCENTILE};
+  for (int32_t i = 0; i < (sizeof(percentiles) / sizeof(percentiles[0])); i++) {
+    int64_t percentil_id = num_kmers_ - (int64_t) round(((double) 1.0 - percentiles[i]) * ((double) num_nonzero)) - 2;
+    if (percentil_id < 0) { percentil_id = 0; }
+    if (percentil_id >= num_kmers_) { percentil_id = num_kmers_ - 1; }
+    stored_percentiles_.push_back(percentiles[i]);
+    stored_percentile_counts_.push_back(sorted_counts[percentil_id]);
+    if (percentiles[i] == REPETITIVE_KEY_PERCENTILE) {
+      repetitive_cutoff_ = sorted_counts[percentil_id];
+    }
+  }
+  sorted_counts.clear();
+  sorted_counts.shrink_to_fit();
+
+  repetitive_keys_.resize((num_kmers_ + 63) / 64, 0);
+  for (int64_t i = 0; i < num_kmers_; i++) {
+    int64_t count = kmer_counts_[i];
+
+    int64_t bin = 0;
+    while (count > 0) {
+      bin += 1;
+      count >>= 1;
+    }
+    if (bin >= kmer_count_histogram_.size()) {
+      kmer_count_histogram_.resize(bin + 1, 0);
+    }
+    kmer_count_histogram_[bin] += 1;
+
+    if (kmer_counts_[i] > repetitive_cutoff_) {
+      repetitive_keys_[((uint64_t) i) >> 6] |= (((uint64_t) 1) << (((uint64_t) i) & 0x3F));
+    }
+  }
+
+  LOG_DEBUG("Seed statistics: max. seed count = %ld, repetitive cutoff = %ld.\n", max_seed_count_, repetitive_cutoff_);
+}
+
 void IndexSpacedHashFast::CalcPercentileHits_(int64_t *seed_counts, int64_t num_seeds, double percentile, int64_t *ret_count, int64_t *ret_max_seed_count) {
   // Sort the counts so that we can get an occurance histogram.
   // We will select a percentile of the data as the cutoff value.
@@ -430,62 +1564,57 @@ int IndexSpacedHashFast::CreateIndex_(int8_t *data, uint64_t data_length) {
   VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG,
                                       true, FormatString("Creating spaced hash index.\n"), "CreateIndex_");
 
-  if (kmer_hash_array_)
-    free(kmer_hash_array_);
-  kmer_hash_array_ = NULL;
-  if (all_kmers_)
+  if (kmer_offsets_ && IndexMemory::GetInstance().Free(kmer_offsets_))
+    free(kmer_offsets_);
+  kmer_offsets_ = NULL;
+  if (all_kmers_ && IndexMemory::GetInstance().Free(all_kmers_))
     free(all_kmers_);
   all_kmers_ = NULL;
-  if (kmer_counts_)
+  if (kmer_counts_ && IndexMemory::GetInstance().Free(kmer_counts_))
     free(kmer_counts_);
   kmer_counts_ = NULL;
+  ClearExternalKmers_();
 
   LogSystem::GetInstance().Log(VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG, true, FormatString("Index shape: '%s', length: %ld.\n", shape_index_, shape_index_length_), "CreateIndex_");
 
   int64_t num_kmers = 0;
-  CountKmersFromShape(data_, data_length_, shape_index_, shape_index_length_, &kmer_counts_, &num_kmers);
-  int64_t *kmer_countdown = (int64_t *) malloc(sizeof(int64_t) * num_kmers);
-  memmove(kmer_countdown, kmer_counts_, sizeof(int64_t) * num_kmers);
+  CountKmersFromShape(data, data_length_, shape_index_, shape_index_length_, &kmer_counts_, &num_kmers);
   num_kmers_ = num_kmers;
 
   LogSystem::GetInstance().Log(VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG, true, FormatString("Kmer counting finished (kmer_counts.size() = %ld)\n", num_kmers_), "CreateIndex_");
 
   int64_t total_num_kmers = 0;
   for (uint64_t i = 0; i < num_kmers; i++) {
-    kmer_countdown[i] = 0;
     total_num_kmers += kmer_counts_[i];
   }
 
-  kmer_hash_array_ = (int64_t **) malloc(sizeof(int64_t *) * num_kmers);
-  all_kmers_ = (int64_t *) malloc(sizeof(int64_t) * total_num_kmers);
+  // Positions are stored as global offsets into data_. 32 bits are enough for references shorter than 4 Gbp (including the reverse strand).
+  all_kmers_pos_bytes_ = (data_length_ <= ((uint64_t) 0xFFFFFFFF)) ? POSITION_BYTES_32_BIT : POSITION_BYTES_40_BIT;
   all_kmers_size_ = total_num_kmers;
 
-  int64_t kmer_hash_ptr = 0;
-  for (uint64_t i = 0; i < num_kmers; i++) {
-    if (kmer_counts_[i] > 0)
-      kmer_hash_array_[i] = (all_kmers_ + kmer_hash_ptr);
-    else
-      kmer_hash_array_[i] = NULL;
-    kmer_hash_ptr += kmer_counts_[i];
-  }
-
-  LogSystem::GetInstance().Log(VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG, true, FormatString("Index memory allocated.\n"), "CreateIndex_");
-
-  int64_t hash_key = -1;
-
-  uint64_t current_ref_id = 0;
-
   /// Calculate the largest gapped spaced seed length, so we don't step out of boundaries of the read.
   int64_t k = 0;
   for (int32_t i = 0; i < shape_index_length_; i++) {
     k += ((shape_index_[i] == '1') ? 1 : 2);  /// '0' can also mean an insertion, so it can occupy two bases instead of one.
   }
 
-  for (uint64_t i = 0; i < (data_length_ - k + 1); i++) {
-    if (i >= (reference_starting_pos_[current_ref_id] + reference_lengths_[current_ref_id]))
-      current_ref_id += 1;
+  // Reference data, kmer_counts_, kmer_offsets_, the countdown array and all_kmers_.
+  int64_t in_memory_size = ((int64_t) data_length_) + 3 * sizeof(int64_t) * num_kmers_ + all_kmers_pos_bytes_ * total_num_kmers;
+  if (max_build_memory_ > 0 && in_memory_size > max_build_memory_) {
+    LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Building the index in memory would take %ld MB, which is above the limit of %ld MB. Building on disk.\n", in_memory_size / (1024 * 1024), max_build_memory_ / (1024 * 1024)), "CreateIndex_");
+    return CreateIndexOnDisk_(data, total_num_kmers, k);
+  }
+
+  int64_t *kmer_countdown = (int64_t *) calloc(num_kmers, sizeof(int64_t));
+  all_kmers_ = (uint8_t *) calloc(all_kmers_pos_bytes_ * total_num_kmers, sizeof(uint8_t));
+  InitKmerOffsets_();
 
-    int8_t *seed_start = &(data_[i]);
+  LogSystem::GetInstance().Log(VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG, true, FormatString("Index memory allocated (%ld bytes per position).\n", all_kmers_pos_bytes_), "CreateIndex_");
+
+  int64_t hash_key = -1;
+
+  for (uint64_t i = 0; i < (data_length_ - k + 1); i++) {
+    int8_t *seed_start = &(data[i]);
     hash_key = GenerateHashKeyFromShape(seed_start, shape_index_, shape_index_length_);
 
 //    ErrorReporting::GetInstance().VerboseLog(VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG, true, FormatString("%s = %ld = %X\n", GetSubstring((char *) seed_start, k_).c_str(), hash_key, hash_key), "[]");
@@ -497,17 +1626,15 @@ int IndexSpacedHashFast::CreateIndex_(int8_t *data, uint64_t data_length) {
 //    uint64_t ref_id = ((uint64_t) current_ref_id) & ((uint64_t) 0x00000000FFFFFFFF);
 //    int64_t coded_position = (int64_t) (local_pos << 32) | ref_id;
 //    int64_t reference_index = RawPositionToReferenceIndexWithReverse(i);
-    int64_t local_i = ((int64_t) i) - ((int64_t) reference_starting_pos_[current_ref_id]);
-    uint64_t local_pos = ((uint64_t) local_i) & ((uint64_t) 0x00000000FFFFFFFF);
-    uint64_t ref_id = ((uint64_t) current_ref_id) & ((uint64_t) 0x00000000FFFFFFFF);
 //    printf ("%ld\t%ld\t\tcurrent_ref_id = %ld, reference_index = %ld, i = %ld, reference_starting_pos_[reference_index] = %ld\n", ref_id, local_pos, current_ref_id, reference_index, i, reference_starting_pos_[reference_index]);
 //    fflush(stdout);
 
 //    uint64_t local_pos = ((uint64_t) (i - reference_starting_pos_[current_ref_id])) & ((uint64_t) 0x00000000FFFFFFFF);
 //    uint64_t ref_id = ((uint64_t) current_ref_id) & ((uint64_t) 0x00000000FFFFFFFF);
-    int64_t coded_position = (int64_t) ((ref_id << 32) | local_pos);
-
-    kmer_hash_array_[hash_key][kmer_countdown[hash_key]] = coded_position;
+//    int64_t coded_position = (int64_t) ((ref_id << 32) | local_pos);
+    // Only the global position is stored, the ref_id and local_pos are recovered from reference_starting_pos_ when decoding.
+    uint64_t global_pos = (uint64_t) i;
+    memmove(all_kmers_ + (kmer_offsets_[hash_key] + kmer_countdown[hash_key]) * all_kmers_pos_bytes_, &global_pos, all_kmers_pos_bytes_);
     kmer_countdown[hash_key] += 1;
   }
 
@@ -515,6 +1642,8 @@ int IndexSpacedHashFast::CreateIndex_(int8_t *data, uint64_t data_length) {
     free(kmer_countdown);
   kmer_countdown = NULL;
 
+  CalcKmerStatistics_();
+
   LogSystem::GetInstance().Log(
   VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG,
                                       true, FormatString("Finished creating spaced hash index.\n"), "CreateIndex_");
@@ -531,7 +1660,29 @@ int IndexSpacedHashFast::SerializeIndex_(FILE* fp_out) {
 
   fwrite(kmer_counts_, sizeof(int64_t), num_kmers_, fp_out);
   fwrite(&all_kmers_size_, sizeof(int64_t), 1, fp_out);
-  fwrite(all_kmers_, sizeof(int64_t), all_kmers_size_, fp_out);
+  fwrite(&all_kmers_pos_bytes_, sizeof(int64_t), 1, fp_out);
+  if (all_kmers_ == NULL && external_kmers_path_.size() > 0) {
+    // Built on disk, the positions are only in the temporary file.
+    if (CopyExternalKmers_(fp_out)) {
+      return 1;
+    }
+  } else {
+    fwrite(all_kmers_, sizeof(uint8_t), all_kmers_pos_bytes_ * all_kmers_size_, fp_out);
+  }
+
+  // Seed occurrence statistics.
+  fwrite(&max_seed_count_, sizeof(int64_t), 1, fp_out);
+  fwrite(&repetitive_cutoff_, sizeof(int64_t), 1, fp_out);
+  vector_length = stored_percentiles_.size();
+  fwrite(&vector_length, sizeof(int64_t), 1, fp_out);
+  fwrite(stored_percentiles_.data(), sizeof(double), vector_length, fp_out);
+  fwrite(stored_percentile_counts_.data(), sizeof(int64_t), vector_length, fp_out);
+  vector_length = kmer_count_histogram_.size();
+  fwrite(&vector_length, sizeof(int64_t), 1, fp_out);
+  fwrite(kmer_count_histogram_.data(), sizeof(int64_t), vector_length, fp_out);
+  vector_length = repetitive_keys_.size();
+  fwrite(&vector_length, sizeof(int64_t), 1, fp_out);
+  fwrite(repetitive_keys_.data(), sizeof(uint64_t), vector_length, fp_out);
 
   return 0;
 }
@@ -564,15 +1715,16 @@ int IndexSpacedHashFast::DeserializeIndex_(FILE* fp_in) {
     free(shape_index_);
   shape_index_ = NULL;
   shape_index_length_ = 0;
-  if (kmer_hash_array_)
-    free(kmer_hash_array_);
-  kmer_hash_array_ = NULL;
-  if (all_kmers_)
+  if (kmer_offsets_ && IndexMemory::GetInstance().Free(kmer_offsets_))
+    free(kmer_offsets_);
+  kmer_offsets_ = NULL;
+  if (all_kmers_ && IndexMemory::GetInstance().Free(all_kmers_))
     free(all_kmers_);
   all_kmers_ = NULL;
-  if (kmer_counts_)
+  if (kmer_counts_ && IndexMemory::GetInstance().Free(kmer_counts_))
     free(kmer_counts_);
   kmer_counts_ = NULL;
+  ClearKmerStatistics_();
 
   int64_t vector_length = 0;
 
@@ -619,8 +1771,8 @@ int IndexSpacedHashFast::DeserializeIndex_(FILE* fp_in) {
     return 1;
   }
 
-  kmer_counts_ = (int64_t *) malloc(sizeof(int64_t) * num_kmers_);
-  if (fread(kmer_counts_, sizeof(int64_t), num_kmers_, fp_in) != num_kmers_) {
+  kmer_counts_ = (int64_t *) IndexMemory::GetInstance().Allocate(sizeof(int64_t) * num_kmers_, memory_node_);
+  if (kmer_counts_ == NULL || ReadSectionParallel_(fp_in, kmer_counts_, sizeof(int64_t) * num_kmers_)) {
     LogSystem::GetInstance().Error(
     SEVERITY_INT_FATAL,
                                  __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(
@@ -639,10 +1791,16 @@ int IndexSpacedHashFast::DeserializeIndex_(FILE* fp_in) {
     return 1;
   }
 
+  if (fread(&all_kmers_pos_bytes_, sizeof(int64_t), 1, fp_in) != 1 ||
+      (all_kmers_pos_bytes_ != POSITION_BYTES_32_BIT && all_kmers_pos_bytes_ != POSITION_BYTES_40_BIT)) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_FILE_READ_DATA, "Occured when reading variable all_kmers_pos_bytes_.\n"));
+    return 1;
+  }
+
   LogSystem::GetInstance().Log(VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG, true, FormatString("\t- started allocating space for kmers...\n"), "DeserializeIndex_");
-  all_kmers_ = (int64_t *) malloc(sizeof(int64_t) * all_kmers_size_);
+  all_kmers_ = (uint8_t *) IndexMemory::GetInstance().Allocate(all_kmers_pos_bytes_ * all_kmers_size_, memory_node_);
   LogSystem::GetInstance().Log(VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG, true, FormatString("\t- started reading the kmers from file...\n"), "DeserializeIndex_");
-  if (fread(all_kmers_, sizeof(int64_t), all_kmers_size_, fp_in) != all_kmers_size_) {
+  if (all_kmers_ == NULL || ReadSectionParallel_(fp_in, all_kmers_, all_kmers_pos_bytes_ * all_kmers_size_)) {
     LogSystem::GetInstance().Error(
     SEVERITY_INT_FATAL,
                                  __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(
@@ -651,15 +1809,44 @@ int IndexSpacedHashFast::DeserializeIndex_(FILE* fp_in) {
     return 3;
   }
 
-  LogSystem::GetInstance().Log(VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG, true, FormatString("\t- initializing the kmer_hash_array_...\n"), "DeserializeIndex_");
-  kmer_hash_array_ = (int64_t **) malloc(sizeof(int64_t *) * num_kmers_);
-  int64_t kmer_ptr = 0;
-  for (int64_t i = 0; i < num_kmers_; i++) {
-    if (kmer_counts_[i] > 0)
-      kmer_hash_array_[i] = (all_kmers_ + kmer_ptr);
-    else
-      kmer_hash_array_[i] = NULL;
-    kmer_ptr += kmer_counts_[i];
+  LogSystem::GetInstance().Log(VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG, true, FormatString("\t- initializing the kmer_offsets_...\n"), "DeserializeIndex_");
+  if (InitKmerOffsets_()) {
+    return 1;
+  }
+
+  LogSystem::GetInstance().Log(VERBOSE_LEVEL_MED_DEBUG | VERBOSE_LEVEL_HIGH_DEBUG, true, FormatString("\t- seed occurrence statistics...\n"), "DeserializeIndex_");
+  if (fread(&max_seed_count_, sizeof(int64_t), 1, fp_in) != 1 || fread(&repetitive_cutoff_, sizeof(int64_t), 1, fp_in) != 1) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_FILE_READ_DATA, "Occured when reading the seed occurrence statistics.\n"));
+    return 1;
+  }
+  if (fread(&vector_length, sizeof(int64_t), 1, fp_in) != 1) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_FILE_READ_DATA, "Occured when reading the number of stored percentiles.\n"));
+    return 1;
+  }
+  stored_percentiles_.resize(vector_length);
+  stored_percentile_counts_.resize(vector_length);
+  if (vector_length > 0 && (fread(&stored_percentiles_[0], sizeof(double), vector_length, fp_in) != vector_length ||
+                            fread(&stored_percentile_counts_[0], sizeof(int64_t), vector_length, fp_in) != vector_length)) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_FILE_READ_DATA, "Occured when reading variable stored_percentiles_.\n"));
+    return 3;
+  }
+  if (fread(&vector_length, sizeof(int64_t), 1, fp_in) != 1) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_FILE_READ_DATA, "Occured when reading the length of kmer_count_histogram_.\n"));
+    return 1;
+  }
+  kmer_count_histogram_.resize(vector_length);
+  if (vector_length > 0 && fread(&kmer_count_histogram_[0], sizeof(int64_t), vector_length, fp_in) != vector_length) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_FILE_READ_DATA, "Occured when reading variable kmer_count_histogram_.\n"));
+    return 3;
+  }
+  if (fread(&vector_length, sizeof(int64_t), 1, fp_in) != 1) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_FILE_READ_DATA, "Occured when reading the length of repetitive_keys_.\n"));
+    return 1;
+  }
+  repetitive_keys_.resize(vector_length);
+  if (vector_length > 0 && fread(&repetitive_keys_[0], sizeof(uint64_t), vector_length, fp_in) != vector_length) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_FATAL, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_FILE_READ_DATA, "Occured when reading variable repetitive_keys_.\n"));
+    return 3;
   }
 
 
@@ -775,7 +1962,7 @@ int IndexSpacedHashFast::InitShapesPredefined(uint32_t shape_type) {
 
   }
 
-  if (shape_for_indexing.size() == 0 || shapes_for_search.size() == 0) {
+  if (shape_for_indexing.size() == 0 || shapes_for_search.size() == 0 || shapes_for_search.size() > MAX_NUM_LOOKUP_SHAPES) {
     return 1;
   }
 
@@ -806,6 +1993,11 @@ int IndexSpacedHashFast::InitShapesPredefined(uint32_t shape_type) {
 //index66.InitShapes(shape_for_indexing_66, shapes_for_search_66);
 //index444.InitShapes(shape_for_indexing_444, shapes_for_search_444);
 int IndexSpacedHashFast::InitShapes(std::string shape_for_indexing, std::vector<std::string> &shapes_for_search) {
+  if (shapes_for_search.size() > MAX_NUM_LOOKUP_SHAPES) {
+    LogSystem::GetInstance().Error(SEVERITY_INT_ERROR, __FUNCTION__, LogSystem::GetInstance().GenerateErrorMessage(ERR_UNEXPECTED_VALUE, "Too many lookup shapes (%ld), at most %d are supported.", shapes_for_search.size(), MAX_NUM_LOOKUP_SHAPES));
+    return 1;
+  }
+
   shape_index_length_ = shape_for_indexing.size();
   shape_index_ = (char *) malloc(sizeof(char) * (shape_index_length_ + 1));
   memmove(shape_index_, shape_for_indexing.c_str(), shape_index_length_);
@@ -958,13 +2150,15 @@ int IndexSpacedHashFast::LookUpHashKeys(int64_t bin_size, const SingleSequence *
 
   float bin_size_inverse = 1.0f / ((float) bin_size);
 
+  std::vector<int64_t> hits;
   for (int64_t i = 0; i < hash_keys.size(); i++) {
     int64_t x = key_counts[i];
     int64_t hash_key = hash_keys[i];
-    int64_t *hits = kmer_hash_array_[hash_key];
     int64_t num_hits = kmer_counts_[hash_key];
     if (num_hits == 0)
       continue;
+    hits.resize(num_hits);
+    DecodeBucket_(hash_key, &hits[0]);
 
 //    printf ("hash_key = %X, ref_id = %ld, y = %ld, x = %ld\n", hash_keys[i], hits[0]>>32, hits[0]&MASK_32_BIT, x);
 //    fflush(stdout);
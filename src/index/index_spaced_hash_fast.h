@@ -8,6 +8,7 @@
 #ifndef INDEX_SPACED_HASH_FAST_H_
 #define INDEX_SPACED_HASH_FAST_H_
 
+#include <string.h>
 #include <vector>
 #include <algorithm>
 #include "index/index.h"
@@ -18,7 +19,44 @@
 #define MASK_SEED_POS     ((uint64_t) 0xFFFFFFFF00000000)
 #define MASK_32_BIT       ((uint64_t) 0x00000000FFFFFFFF)
 
+/// Positions in all_kmers_ are stored as global offsets into the data array, in 4 bytes if the data is shorter
+/// than 4 Gbp, and in 5 bytes (40 bits) otherwise. They are decoded to (ref_id << 32) | local_pos on lookup.
+#define POSITION_BYTES_32_BIT   4
+#define POSITION_BYTES_40_BIT   5
 
+/// Automatic sharding (max_shard_length_ == 0) splits references which are too long for 32-bit positions. A shard holds
+/// at most this many forward bases, so that its data (forward + reverse) stays within 32-bit positions.
+#define AUTO_MAX_SHARD_LENGTH   ((int64_t) 0x7F000000)
+
+/// External-memory build. Size of the buffer used for reading/copying the temporary files, and the max. number of
+/// temporary partition files which can be open at the same time.
+#define BUILD_IO_CHUNK_SIZE     ((int64_t) 16 * 1024 * 1024)
+#define BUILD_MAX_PARTITIONS    ((int64_t) 1000)
+
+/// Max. number of lookup shapes of an index. The predefined shape types use at most 9 (SHAPE_TYPE_444).
+#define MAX_NUM_LOOKUP_SHAPES   16
+
+/// Percentile of the seed occurrence distribution which is used as the default max_num_hits cutoff. Keys occurring
+/// more often than this are marked as repetitive in the index.
+#define REPETITIVE_KEY_PERCENTILE   ((double) 0.9999)
+
+/// One shard (segment) of a sharded index, as listed in the file at the index path.
+struct ShardManifestEntry {
+  int64_t first_ref = 0;        // Global id of the first forward reference in the shard.
+  int64_t num_refs = 0;         // Number of forward references in the shard.
+  int64_t file_id = 0;          // The shard is stored in <index_path>.shard<file_id>.
+  int64_t length_forward = 0;   // Number of forward bases in the shard, without separators.
+};
+
+
+
+/// Buckets hit by one seed, one per lookup shape, as returned by FindAllRawPositionsOfSeedNoCopy. Only the non-empty
+/// buckets are listed. The positions themselves are read with a SeedHitCursor.
+struct SeedHits {
+  int64_t num_buckets = 0;
+  int64_t hash_keys[MAX_NUM_LOOKUP_SHAPES];
+  int64_t num_hits[MAX_NUM_LOOKUP_SHAPES];
+};
 
 struct SeedHit3 {
   int32_t ref_id;
@@ -97,10 +135,68 @@ class IndexSpacedHashFast : public Index {
 
   int CalcAllKeysFromSequence(const SingleSequence *read, int64_t kmer_step, std::vector<int64_t> &ret_hash_keys, std::vector<int64_t> &ret_key_counts);
   int LookUpHashKeys(int64_t bin_size, const SingleSequence *read, const std::vector<int64_t> &hash_keys, const std::vector<int64_t> &key_counts, std::vector<SeedHit3> &ret_hits);
+  /// Returns the seed count at the given percentile of the occurrence distribution. Percentiles stored in the index
+  /// at build time are returned directly, other values are calculated from kmer_counts_.
   void CalcPercentileHits(double percentile, int64_t *ret_count, int64_t *ret_max_seed_count=NULL);
+  /// Looks up a percentile precomputed at index build time. Returns 0 if found, 1 otherwise.
+  int GetPrecomputedPercentileHits(double percentile, int64_t *ret_count, int64_t *ret_max_seed_count=NULL) const;
+
+  /// True if the key occurs more than repetitive_cutoff_ times in the reference. Single bit test, does not touch kmer_counts_.
+  inline bool IsKeyRepetitive(int64_t hash_key) const {
+    return ((repetitive_keys_[((uint64_t) hash_key) >> 6] >> (((uint64_t) hash_key) & 0x3F)) & 1);
+  }
+
+  /// Does not copy or decode the hits, only returns the non-empty buckets of the seed in ret_hits. The positions of
+  /// each bucket are then decoded one at a time with a SeedHitCursor. Returns 1 if there are no hits, and 2 if the seed
+  /// has more than max_num_of_hits hits or is repetitive.
+  int FindAllRawPositionsOfSeedNoCopy(int8_t *seed, uint64_t seed_length, uint64_t max_num_of_hits, SeedHits *ret_hits) const;
+
+  /// Sharding. A sharded index holds one IndexSpacedHashFast per group of consecutive reference sequences. Every shard
+  /// is built (in parallel) and stored independently (<index_path>.shard<N>), and the file at index_path lists the shards.
+  /// The sharded index itself holds only the global reference info and the summed kmer_counts_, and converts the
+  /// hits of every shard to global reference ids, so it is used exactly like a non-sharded index.
+  /// max_shard_length is the number of forward bases per shard. If 0, the index is sharded only if it would not fit
+  /// into 32-bit positions (see AUTO_MAX_SHARD_LENGTH). If < 0, the index is never sharded.
+  void set_max_shard_length(int64_t max_shard_length);
+  int64_t get_num_shards() const;
+  /// Returns the id of the shard holding the given global reference (forward or reverse), and the id of the
+  /// reference within that shard in ret_shard_ref_id. For a non-sharded index, returns 0 and the same reference id.
+  int64_t GlobalToShardReferenceId(int64_t global_ref_id, int64_t *ret_shard_ref_id) const;
+
+  /// External-memory build. If building the index in memory would take more than max_build_memory bytes (including
+  /// the reference data), the index is built in two passes over the data instead: the positions are first written
+  /// to temporary files (<temp_prefix>.tmpN), one per range of hash keys, and then every range is scattered into
+  /// its buckets separately and appended to <temp_prefix>.tmpkmers. The positions are streamed from that file when
+  /// the index is stored, so the stored index is exactly the same as one built in memory.
+  /// An index built on disk holds no positions, and needs to be loaded from the stored file before it can be used
+  /// (see is_built_on_disk). If max_build_memory <= 0, the index is always built in memory.
+  void set_max_build_memory(int64_t max_build_memory, std::string temp_prefix);
+  bool is_built_on_disk() const;
+
+  /// Incremental update. Appends the sequences from sequence_file_path to the index stored at index_path as new shards
+  /// (segments), without loading or rebuilding the existing ones, so the time depends only on the size of the new
+  /// sequences. They get the global reference ids following the existing ones. A non-sharded index file is turned
+  /// into the first segment of a sharded index (<index_path>.shard0). This object is cleared afterwards.
+  int AppendToFile(std::string index_path, std::string sequence_file_path);
+  /// If the index stored at index_path has more than max_segments segments, merges every run of consecutive segments
+  /// whose total length is within the length of the longest existing segment (in forward bases, at most
+  /// AUTO_MAX_SHARD_LENGTH) into one segment, rebuilt from their data. The list of segments is replaced at the end in a single rename, and only then the merged
+  /// segment files are removed, so processes which already loaded the index are not affected. Only the shape and
+  /// the build memory limit of this object are used.
+  /// AppendToFile and CompactFile hold an exclusive lock on <index_path>.lock, and LoadFromFile a shared one, so that
+  /// no process reads the list of segments while they are being changed. CompactFile does not wait for the lock, it
+  /// returns 0 without compacting if the index is in use.
+  int CompactFile(std::string index_path, int64_t max_segments) const;
+
+  int GenerateFromFile(std::string sequence_file_path);
+  int LoadFromFile(std::string index_path);
+  int StoreToFile(std::string output_index_path);
+  int PackData();
+  void CopyData(int64_t start, int64_t length, int8_t *dest) const;
+  void CalcMemorySections(std::vector<std::pair<std::string, int64_t> > &ret_sections) const;
 
-  // Experimental function, does not copy the hits but only returns the pointers to the buckets.
-  int FindAllRawPositionsOfSeedNoCopy(int8_t *seed, uint64_t seed_length, uint64_t max_num_of_hits, std::vector<int64_t *> &ret_hits, std::vector<uint64_t> &ret_num_hits) const;
+  const std::vector<int64_t>& get_kmer_count_histogram() const;
+  int64_t get_repetitive_cutoff() const;
 
 //  int get_k() const;
 //  void set_k(int k);
@@ -109,18 +205,37 @@ class IndexSpacedHashFast : public Index {
 
  private:
 //  std::vector<std::vector<int64_t> > kmer_hash_;
-  int64_t **kmer_hash_array_;
+  int64_t *kmer_offsets_;           // Index of the first position of each bucket in all_kmers_. Not stored in the file, calculated from kmer_counts_.
   int64_t *kmer_counts_;
   int64_t num_kmers_;
 //  int64_t k_;
   char *shape_index_;
   int64_t shape_index_length_;
-  int64_t *all_kmers_;
-  int64_t all_kmers_size_;
+  uint8_t *all_kmers_;              // Packed global positions, all_kmers_pos_bytes_ bytes each.
+  int64_t all_kmers_size_;          // Number of positions in all_kmers_.
+  int64_t all_kmers_pos_bytes_;     // POSITION_BYTES_32_BIT or POSITION_BYTES_40_BIT, chosen at build time from the data length.
   std::vector<std::string> shapes_lookup_;
+  uint32_t shape_type_;
+
+  int64_t max_shard_length_;
+  std::vector<IndexSpacedHashFast *> shards_;
+  std::vector<int64_t> shard_first_ref_;    // Global id of the first forward reference of each shard.
+  std::vector<int64_t> ref_to_shard_;       // Shard id of each global forward reference.
+
+  int64_t max_build_memory_;
+  std::string build_temp_prefix_;
+  std::string external_kmers_path_;         // Temporary file holding all_kmers_ of an index which was built on disk.
 
   std::vector<CompiledSeed> compiled_seeds_;
 
+  // Seed occurrence statistics, calculated in CreateIndex_ and stored in the index file.
+  std::vector<int64_t> kmer_count_histogram_;       // Bin 0 holds the number of empty buckets, bin i the number of buckets with count in [2^(i-1), 2^i).
+  std::vector<double> stored_percentiles_;          // Percentiles for which the cutoffs were precomputed.
+  std::vector<int64_t> stored_percentile_counts_;   // Seed count at each of the stored_percentiles_.
+  int64_t max_seed_count_;
+  int64_t repetitive_cutoff_;                       // Count at REPETITIVE_KEY_PERCENTILE. Keys above it are set in repetitive_keys_.
+  std::vector<uint64_t> repetitive_keys_;           // Bitset over all num_kmers_ keys.
+
   int CreateIndex_(int8_t *data, uint64_t data_length);
   int SerializeIndex_(FILE *fp_out);
   int DeserializeIndex_(FILE *fp_in);
@@ -130,7 +245,103 @@ class IndexSpacedHashFast : public Index {
   int64_t CalcNumHashKeysFromShape(const char *shape, int64_t shape_length) const;
   void CountKmersFromShape(int8_t *sequence_data, int64_t sequence_length, const char *shape, int64_t shape_length, int64_t **ret_kmer_counts, int64_t *ret_num_kmers) const;
   void CalcPercentileHits_(int64_t *seed_counts, int64_t num_seeds, double percentile, int64_t *ret_count, int64_t *ret_max_seed_count=NULL);
+  // Calculates kmer_offsets_ from kmer_counts_.
+  int InitKmerOffsets_();
+  // Returns the global offset of the position with the given id in all_kmers_.
+  inline uint64_t GetPackedPosition_(int64_t position_id) const {
+    uint64_t position = 0;
+    const uint8_t *position_ptr = all_kmers_ + position_id * all_kmers_pos_bytes_;
+    if (all_kmers_pos_bytes_ == POSITION_BYTES_32_BIT) {
+      uint32_t position32 = 0;
+      memmove(&position32, position_ptr, POSITION_BYTES_32_BIT);
+      position = position32;
+    } else {
+      memmove(&position, position_ptr, POSITION_BYTES_40_BIT);
+    }
+    return position;
+  }
+  // Decodes all positions of a bucket into the (ref_id << 32) | local_pos format. dest needs to hold kmer_counts_[hash_key] values.
+  // Used where the hits need to be copied anyway, the lookups on the mapping path use a SeedHitCursor directly.
+  void DecodeBucket_(int64_t hash_key, int64_t *dest) const;
+  // Builds the shards from consecutive groups of sequences, in parallel. Returns 0 if OK.
+  int GenerateShards_(const SequenceFile &sequences, const std::vector<int64_t> &first_seqs, const std::vector<int64_t> &num_seqs);
+  // Initializes the global reference info, kmer_counts_ and the statistics from the loaded/generated shards.
+  int InitFromShards_();
+  void ClearShards_();
+  std::string GetShardPath_(std::string index_path, int64_t shard_id) const;
+  // Splits the sequences into groups of consecutive sequences of at most max_shard_length_ forward bases.
+  void SplitIntoShards_(const SequenceFile &sequences, std::vector<int64_t> &ret_first_seqs, std::vector<int64_t> &ret_num_seqs) const;
+  // Reads the list of shards from the file at index_path. Returns 0 if OK, -1 if the file is not a sharded index,
+  // -3 if it was generated with a different version, and > 0 on error.
+  int ReadShardManifest_(std::string index_path, std::vector<ShardManifestEntry> &ret_entries) const;
+  // Writes the list of shards to a temporary file, and renames it to index_path.
+  int WriteShardManifest_(std::string index_path, const std::vector<ShardManifestEntry> &entries) const;
+  // Locks <index_path>.lock with flock, shared or exclusive. Returns the file descriptor of the lock, or -1 if the
+  // lock file cannot be created (e.g. a read-only directory, then the index is used without locking). If wait is
+  // false and the lock is held by another process, returns -2.
+  // The lock is released by closing the descriptor.
+  int LockIndexFile_(std::string index_path, bool exclusive, bool wait) const;
+  // LoadFromFile without the lock, also used for the shards.
+  int LoadFromFile_(std::string index_path);
+  // Reads only the number of forward references and forward bases from the header of a non-sharded index file.
+  int ReadIndexFileSummary_(std::string index_path, int64_t *ret_num_refs, int64_t *ret_length_forward) const;
+  // Builds a non-sharded index from the concatenated reference data of the given segments, as if it were generated
+  // from all their sequences at once.
+  int GenerateFromSegments_(const std::vector<IndexSpacedHashFast *> &segments);
+  // Builds all_kmers_ into external_kmers_path_ instead of memory. kmer_counts_ need to be already calculated.
+  int CreateIndexOnDisk_(int8_t *data, int64_t total_num_kmers, int64_t k);
+  // Appends the positions of an index built on disk to fp_out, in chunks.
+  int CopyExternalKmers_(FILE *fp_out) const;
+  void ClearExternalKmers_();
+  // Path of the temporary file of the given partition. If partition_id < 0, path of the file holding all_kmers_.
+  std::string GetBuildTempPath_(int64_t partition_id) const;
+  // Fills the histogram, the precomputed percentiles and the repetitive key bitset from kmer_counts_.
+  void CalcKmerStatistics_();
+  void ClearKmerStatistics_();
+
+  friend class SeedHitCursor;
+};
+
+/// Reads the positions of one bucket directly from the packed all_kmers_, and decodes them one at a time into the
+/// (ref_id << 32) | local_pos format. Positions within a bucket are sorted, so the reference id only needs to be
+/// looked up again when a position leaves the current reference. For a sharded index, the buckets of the shards are
+/// read one after another, and the shard reference ids are converted to global ones.
+/// The cursor holds no buffers, and is valid as long as the index is.
+class SeedHitCursor {
+ public:
+  SeedHitCursor(const IndexSpacedHashFast *index, int64_t hash_key);
+
+  // Returns false when there are no more positions in the bucket.
+  inline bool Next(int64_t *ret_position) {
+    while (hit_id_ >= num_hits_) {
+      if (NextPart_() == false)
+        return false;
+    }
+    uint64_t global_pos = part_->GetPackedPosition_(offset_ + hit_id_);
+    hit_id_ += 1;
+    if (global_pos >= ref_next_start_) {
+      FindReference_(global_pos);
+    }
+    *ret_position = (int64_t) (ref_code_ | ((global_pos - ref_start_) & MASK_32_BIT));
+    return true;
+  }
+
+ private:
+  const IndexSpacedHashFast *index_;
+  const IndexSpacedHashFast *part_;   // The index itself, or the shard whose bucket is being read.
+  int64_t hash_key_;
+  int64_t shard_id_;
+  int64_t offset_;                    // Index of the first position of the bucket in part_->all_kmers_.
+  int64_t num_hits_;
+  int64_t hit_id_;
+  int64_t ref_id_;                    // Reference id within part_ of the last position.
+  uint64_t ref_start_;
+  uint64_t ref_next_start_;
+  uint64_t ref_code_;                 // Global reference id of the last position, shifted to the upper 32 bits.
 
+  // Moves to the bucket of the next shard. Returns false if there are no more shards.
+  bool NextPart_();
+  void FindReference_(uint64_t global_pos);
 };
 
 #endif /* INDEX_SPACED_HASH_H_ */
@@ -0,0 +1,143 @@
+/*
+ * read_kmer_index.cc
+ *
+ *  Lightweight index of the k-mers of a single read, used in the graph stage of mapping. It is meant to be
+ *  kept per thread and rebuilt for every read, reusing its arrays.
+ */
+
+#include "index/read_kmer_index.h"
+#include <string.h>
+#include <algorithm>
+#include "utility/utility_general.h"
+
+ReadKmerIndex::ReadKmerIndex() : k_(0), num_keys_(0), num_kmers_(0), last_key_(0), last_key_initialized_(false) {
+}
+
+ReadKmerIndex::~ReadKmerIndex() {
+}
+
+int ReadKmerIndex::Build(const int8_t *data, int64_t length, int k) {
+  if (k <= 0 || k > 31) {
+    return 1;
+  }
+
+  k_ = k;
+  num_kmers_ = 0;
+  last_key_ = 0;
+  last_key_initialized_ = false;
+  num_keys_ = (k_ <= READ_KMER_INDEX_MAX_TABLE_K) ? (((int64_t) 1) << (2 * k_)) : 0;
+
+  int64_t num_positions = std::max((int64_t) 0, length - k_ + 1);
+  if (keys_.size() < num_positions) { keys_.resize(num_positions); }
+  if (positions_.size() < num_positions) { positions_.resize(num_positions); }
+
+  // Rolling keys of all k-mers of the sequence. Bases are converted to upper case on the fly instead of copying the read.
+  int64_t key = -1;
+  for (int64_t i = 0; i < num_positions; i++) {
+    key = (key < 0) ? GenerateKey_(&data[i]) : UpdateKey_(&data[i], key);
+    keys_[i] = key;
+    num_kmers_ += (key >= 0) ? 1 : 0;
+  }
+
+  if (num_keys_ > 0) {
+    // Counting sort into the preallocated arrays. Positions are filled from the end of the read, so that each
+    // bucket holds them in descending order.
+    if (bucket_starts_.size() < (num_keys_ + 1)) { bucket_starts_.resize(num_keys_ + 1); }
+    memset(&bucket_starts_[0], 0, sizeof(int64_t) * (num_keys_ + 1));
+    for (int64_t i = 0; i < num_positions; i++) {
+      if (keys_[i] >= 0) { bucket_starts_[keys_[i] + 1] += 1; }
+    }
+    for (int64_t i = 0; i < num_keys_; i++) {
+      bucket_starts_[i + 1] += bucket_starts_[i];
+    }
+    for (int64_t i = (num_positions - 1); i >= 0; i--) {
+      if (keys_[i] >= 0) {
+        // bucket_starts_[key] is used as the fill pointer, and is restored below.
+        positions_[bucket_starts_[keys_[i]]++] = i;
+      }
+    }
+    for (int64_t i = num_keys_; i > 0; i--) {
+      bucket_starts_[i] = bucket_starts_[i - 1];
+    }
+    bucket_starts_[0] = 0;
+
+  } else {
+    // Sort the positions by key, and by descending position within the same key. The keys are then
+    // gathered in the same order, for the binary search.
+    int64_t num_valid = 0;
+    for (int64_t i = (num_positions - 1); i >= 0; i--) {
+      if (keys_[i] >= 0) { positions_[num_valid++] = i; }
+    }
+    const std::vector<int64_t> &keys = keys_;
+    std::stable_sort(positions_.begin(), positions_.begin() + num_valid, [&keys](int64_t a, int64_t b) { return keys[a] < keys[b]; });
+    if (sorted_keys_.size() < num_valid) { sorted_keys_.resize(num_valid); }
+    for (int64_t i = 0; i < num_valid; i++) {
+      sorted_keys_[i] = keys_[positions_[i]];
+    }
+  }
+
+  return 0;
+}
+
+int ReadKmerIndex::FindAllRawPositionsOfIncrementalSeed(const int8_t *seed, uint64_t seed_length, uint64_t max_num_of_hits, int64_t **hits, uint64_t *start_hit, uint64_t *num_hits) {
+  int64_t key = (last_key_initialized_ == false) ? GenerateKey_(seed) : UpdateKey_(seed, last_key_);
+  last_key_initialized_ = true;
+
+  if (key < 0 || seed_length != k_ || (num_keys_ > 0 && key >= num_keys_)) {
+    last_key_initialized_ = false;
+    return 3;
+  }
+  last_key_ = key;
+
+  int64_t first = 0, count = 0;
+  if (num_keys_ > 0) {
+    first = bucket_starts_[key];
+    count = bucket_starts_[key + 1] - first;
+  } else {
+    std::vector<int64_t>::const_iterator begin = sorted_keys_.begin(), end = sorted_keys_.begin() + num_kmers_;
+    std::pair<std::vector<int64_t>::const_iterator, std::vector<int64_t>::const_iterator> range = std::equal_range(begin, end, key);
+    first = range.first - begin;
+    count = range.second - range.first;
+  }
+
+  *hits = (positions_.size() > 0) ? &positions_[first] : NULL;
+  *start_hit = 0;
+  *num_hits = count;
+
+  if (count == 0)
+    return 1;
+
+  if (count > max_num_of_hits)
+    return 2;
+
+  return 0;
+}
+
+int ReadKmerIndex::get_k() const {
+  return k_;
+}
+
+int64_t ReadKmerIndex::get_num_kmers() const {
+  return num_kmers_;
+}
+
+int64_t ReadKmerIndex::GenerateKey_(const int8_t *seed) const {
+  int64_t key = 0;
+  for (int64_t i = 0; i < k_; i++) {
+    uint8_t base = kBaseToUpper[(uint8_t) seed[i]];
+    if (!kIsBase[base])
+      return -1;
+    int8_t base_2bit = kBaseToBwa[base];
+    key = (key << 2) | base_2bit;
+  }
+  return key;
+}
+
+int64_t ReadKmerIndex::UpdateKey_(const int8_t *seed, int64_t key) const {
+  uint8_t base = kBaseToUpper[(uint8_t) seed[k_ - 1]];
+  if (!kIsBase[base])
+    return -1;
+  int8_t base_2bit = kBaseToBwa[base];
+  uint64_t mask = (((uint64_t) 1) << (2 * k_)) - 1;
+  return (int64_t) ((((uint64_t) key << 2) | base_2bit) & mask);
+}
@@ -0,0 +1,52 @@
+/*
+ * read_kmer_index.h
+ *
+ *  Lightweight index of the k-mers of a single read, used in the graph stage of mapping. It is meant to be
+ *  kept per thread and rebuilt for every read, reusing its arrays.
+ */
+
+#ifndef READ_KMER_INDEX_H_
+#define READ_KMER_INDEX_H_
+
+#include <stdint.h>
+#include <vector>
+
+// For k up to this value, the k-mers are bucketed into a direct table of 4^k keys (counting sort).
+// For larger k, the table would be too large to reset for every read, so (key, position) pairs are sorted instead.
+#define READ_KMER_INDEX_MAX_TABLE_K   9
+
+class ReadKmerIndex {
+ public:
+  ReadKmerIndex();
+  ~ReadKmerIndex();
+
+  // Rebuilds the index over the given sequence. The arrays of the previous build are reused, and only grow
+  // if needed. The sequence data is not copied. Returns 0 if OK.
+  int Build(const int8_t *data, int64_t length, int k);
+
+  // Looks up the positions of the seed on the sequence, in descending order. Same interface and return values
+  // as IndexHash::FindAllRawPositionsOfIncrementalSeed: 0 if OK, 1 if there are no hits, 2 if there are more than
+  // max_num_of_hits hits (they are still returned), 3 if the seed contains a non-ACGT base.
+  // Consecutive calls are expected to be made on consecutive k-mers, and only the last base of the seed is added
+  // to the key of the previous call. After a non-ACGT base, the key is generated from the whole seed.
+  int FindAllRawPositionsOfIncrementalSeed(const int8_t *seed, uint64_t seed_length, uint64_t max_num_of_hits, int64_t **hits, uint64_t *start_hit, uint64_t *num_hits);
+
+  int get_k() const;
+  int64_t get_num_kmers() const;
+
+ private:
+  int k_;
+  int64_t num_keys_;                    // 4^k, if the direct table is used. 0 otherwise.
+  int64_t num_kmers_;                   // Number of indexed k-mers (k-mers with non-ACGT bases are skipped).
+  std::vector<int64_t> bucket_starts_;  // Direct table: positions of key i are in [bucket_starts_[i], bucket_starts_[i + 1]).
+  std::vector<int64_t> positions_;      // Positions of all indexed k-mers, grouped by key.
+  std::vector<int64_t> keys_;           // Key of each position of the sequence (-1 if not valid).
+  std::vector<int64_t> sorted_keys_;    // Only without the direct table: keys of positions_, in the same order.
+  int64_t last_key_;
+  bool last_key_initialized_;
+
+  int64_t GenerateKey_(const int8_t *seed) const;
+  int64_t UpdateKey_(const int8_t *seed, int64_t key) const;
+};
+
+#endif /* READ_KMER_INDEX_H_ */
@@ -181,9 +181,18 @@ int Owler::BuildIndex(ProgramParameters &parameters) {
 
 //  Index *index_primary = new IndexSpacedHash(SHAPE_TYPE_444);
 //  Index *index_primary = new IndexSpacedHashFast(SHAPE_TYPE_66);
-  Index *index_primary = new IndexOwler(SHAPE_TYPE_66);
+  IndexOwler *index_owler = new IndexOwler(SHAPE_TYPE_66);
+  index_owler->set_minimizer_window(parameters.minimizer_window);
+  Index *index_primary = index_owler;
   Index *index_secondary = NULL;
 
+  // The minimizer-sampled index contains only a subset of the positions, so it is stored separately from the dense one.
+  std::string index_path = parameters.index_file + std::string("owl");
+  if (parameters.minimizer_window > 1) {
+    index_path += FormatString("w%ld", parameters.minimizer_window);
+    LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Using minimizer sampling of seeds with window length %ld.\n", parameters.minimizer_window), "Index");
+  }
+
 //  if (parameters.parsimonious_mode) {
 //    LogSystem::GetInstance().VerboseLog(VERBOSE_LEVEL_ALL, true, FormatString("Running in parsimonious mode. Only one index will be used.\n"), "Index");
 //
@@ -199,7 +208,6 @@ int Owler::BuildIndex(ProgramParameters &parameters) {
 
   if (parameters.calc_only_index == false) {
     // Check if index already exists, if not generate it.
-    std::string index_path = parameters.index_file + std::string("owl");
     FILE *fp = fopen(index_path.c_str(), "r");
     if (fp == NULL) {
       LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Index is not prebuilt. Generating index.\n"), "Index");
@@ -226,7 +234,7 @@ int Owler::BuildIndex(ProgramParameters &parameters) {
     LogSystem::GetInstance().Log(VERBOSE_LEVEL_ALL, true, FormatString("Generating index.\n"), "Index");
 
     index_primary->GenerateFromFile(parameters.reference_path);
-    index_primary->StoreToFile(parameters.index_file);
+    index_primary->StoreToFile(index_path);
 
 //    if (parameters.parsimonious_mode == false) {
 //      LogSystem::GetInstance().VerboseLog(VERBOSE_LEVEL_ALL, true, FormatString("Generating secondary index.\n"), "Index");
@@ -455,6 +455,15 @@ int Owler::CollectSeedHitsExperimentalCalcSubseedsFast(OwlerData* owler_data, st
     fflush(stdout);
   }
 
+  /// With minimizer sampling, the index holds only the window minimizers of the reference, selected with the index shape.
+  /// The read is sampled with the same shape and key order, and all lookup shapes are queried only at the selected positions.
+  IndexOwler *index_owler = (IndexOwler *) indexes[0];
+  bool use_minimizers = (parameters->minimizer_window > 1);
+  std::vector<bool> is_minimizer;
+  if (use_minimizers) {
+    index_owler->SelectMinimizersFromSequence(read->get_data(), readlength, parameters->minimizer_window, is_minimizer);
+  }
+
   uint64_t seed_full = 0x0;
 
   if (test_verbose == true && parameters->verbose_level > 5 && read->get_sequence_id() == parameters->debug_read) {
@@ -485,6 +494,9 @@ int Owler::CollectSeedHitsExperimentalCalcSubseedsFast(OwlerData* owler_data, st
     uint64_t hits_start = 0, num_hits = 0;
     int64_t *hits = NULL;
     for (int64_t key_id = 0; key_id < 3; key_id++) {
+      if (use_minimizers && (i >= is_minimizer.size() || is_minimizer[i] == false))
+        continue;
+
       int ret_search = index->FindAllRawPositionsOfSeedKey(keys[key_id], 12, parameters->max_num_hits, &hits, &hits_start, &num_hits);
 
       // Check if there is too many hits (or too few).
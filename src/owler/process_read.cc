@@ -1116,6 +1116,17 @@ int Owler::ApplyLCS2(OwlerData* owler_data, std::vector<Index*> &indexes, const
   float min_perc_overlap_len = 0.0f;
   int64_t seed_length = 13;
 
+  /// With minimizer sampling the thresholds which depend on the number of hits are scaled by the expected sampling density.
+  /// A random key order selects on average 2/(w+1) of the positions (Roberts et al., 2004). The read and the reference are
+  /// sampled with the same shape and order, so a window shared by both yields the same minimizer on both sides, and the
+  /// hits of an overlap (and the bases they cover) drop by about the same factor. The LCSk and the breakpoint filtering
+  /// work on the sparse hits as-is.
+  if (parameters->minimizer_window > 1) {
+    float sampling_density = 2.0f / ((float) (parameters->minimizer_window + 1));
+    min_num_hits = std::max((int64_t) 2, (int64_t) (min_num_hits * sampling_density));
+    min_perc_covered_bases *= sampling_density;
+  }
+
   Index *index = indexes[0];
 
   int64_t read_id = read->get_sequence_absolute_id();
@@ -21,7 +21,7 @@ int ProcessArgsGraphMap(int argc, char **argv, ProgramParameters *parameters)
 //  argparser.AddCompositeArgument("sensitive", "-a gotoh -w sg -M 5 -X 4 -G 8 -E 6");
 
   argparser.AddArgument(&parameters->reference_path, VALUE_TYPE_STRING, "r", "ref", "", "Path to the reference sequence (fastq or fasta).", 0, "Input/Output options");
-  argparser.AddArgument(&parameters->index_file, VALUE_TYPE_STRING, "i", "index", "", "Path to the index of the reference sequence. If not specified, index is generated in the same folder as the reference file, with .gmidx extension. For non-parsimonious mode, secondary index .gmidxsec is also generated.", 0, "Input/Output options");
+  argparser.AddArgument(&parameters->index_file, VALUE_TYPE_STRING, "i", "index", "", "Path to the index of the reference sequence. If not specified, index is generated in the same folder as the reference file, with .gmidx extension. For non-parsimonious mode, secondary index .gmidxsec (seed tables only, without the reference data) is also generated.", 0, "Input/Output options");
   argparser.AddArgument(&parameters->reads_path, VALUE_TYPE_STRING, "d", "reads", "", "Path to the reads file.", 0, "Input/Output options");
   argparser.AddArgument(&parameters->out_sam_path, VALUE_TYPE_STRING, "o", "out", "", "Path to the output file that will be generated.", 0, "Input/Output options");
   argparser.AddArgument(&parameters->infmt, VALUE_TYPE_STRING, "K", "in-fmt", "auto", "Format in which to input reads. Options are:\n auto  - Determines the format automatically from file extension.\n fastq - Loads FASTQ or FASTA files.\n fasta - Loads FASTQ or FASTA files.\n gfa   - Graphical Fragment Assembly format.\n sam   - Sequence Alignment/Mapping format.", 0, "Input/Output options");
@@ -29,6 +29,12 @@ int ProcessArgsGraphMap(int argc, char **argv, ProgramParameters *parameters)
   argparser.AddArgument(&parameters->outfmt, VALUE_TYPE_STRING, "L", "out-fmt", "sam", "Format in which to output results. Options are:\n sam  - Standard SAM output (in normal and '-w overlap' modes).\n m5   - BLASR M5 format.", 0, "Input/Output options");
   argparser.AddArgument(&parameters->calc_only_index, VALUE_TYPE_BOOL, "I", "index-only", "0", "Build only the index from the given reference and exit. If not specified, index will automatically be built if it does not exist, or loaded from file otherwise.", 0, "Input/Output options");
   argparser.AddArgument(&parameters->rebuild_index, VALUE_TYPE_BOOL, "", "rebuild-index", "0", "Rebuild index even if it already exists in given path.", 0, "Input/Output options");
+  argparser.AddArgument(&parameters->pack_reference, VALUE_TYPE_BOOL, "", "pack-ref", "0", "Keep the reference 2-bit packed in memory, and unpack only the regions needed for alignment. Reduces the memory used by the reference sequences by about 8x, at a small cost in speed.", 0, "Input/Output options");
+  argparser.AddArgument(&parameters->index_shard_size, VALUE_TYPE_INT64, "", "shard-size", "0", "Split the index into shards of at most INT Mbp of reference sequences each. Shards are built in parallel and stored in separate files (<index>.shardN). If 0, the index is split only if the reference is too large for 32-bit positions. If < 0, the index is never split.", 0, "Input/Output options");
+  argparser.AddArgument(&parameters->index_build_memory, VALUE_TYPE_INT64, "", "build-mem", "0", "Limit the memory used for building the index to INT MB. If the index would not fit, it is built in two passes using temporary files next to the index file. The generated index is the same. If <= 0, there is no limit.", 0, "Input/Output options");
+  argparser.AddArgument(&parameters->append_reference_path, VALUE_TYPE_STRING, "", "append-ref", "", "Path to new reference sequences which will be appended to the existing index (-i) as a new segment, without rebuilding the index. The new sequences are then mapped to together with the existing ones.", 0, "Input/Output options");
+  argparser.AddArgument(&parameters->index_max_segments, VALUE_TYPE_INT64, "", "max-segments", "8", "With --append-ref or --compact-index, if the index consists of more than INT segments, consecutive small segments are merged up to the length of the longest existing segment, after all reads are mapped (or right after --append-ref when only building the index), within the --build-mem and --max-memory limits. If <= 0, segments are never merged.", 0, "Input/Output options");
+  argparser.AddArgument(&parameters->compact_index, VALUE_TYPE_BOOL, "", "compact-index", "0", "Merge the index segments (see --max-segments) after all reads are mapped, also without --append-ref.", 0, "Input/Output options");
   argparser.AddArgument(&parameters->output_in_original_order, VALUE_TYPE_BOOL, "u", "ordered", "0", "SAM alignments will be output after the processing has finished, in the order of input reads.", 0, "Input/Output options");
   argparser.AddArgument(&parameters->batch_size_in_mb, VALUE_TYPE_INT64, "B", "batch-mb", "1024", "Reads will be loaded in batches of the size specified in megabytes. Value <= 0 loads the entire file.", 0, "Input/Output options");
   //    argparser.AddArgument(&parameters->reads_folder, VALUE_TYPE_STRING, "D", "readsfolder", "", "Path to a folder containing read files (in fastq or fasta format) to process. Cannot be used in combination with '-d' or '-o'.", 0, "Input/Output options");
@@ -75,13 +81,29 @@ int ProcessArgsGraphMap(int argc, char **argv, ProgramParameters *parameters)
   argparser.AddArgument(&parameters->margin_for_ambiguity, VALUE_TYPE_FLOAT, "F", "ambiguity", "0.02", "All mapping positions within the given fraction of the top score will be counted for ambiguity (mapping quality). Value of 0.0 counts only identical mappings.", 0, "Algorithmic options");
   argparser.AddArgument(&parameters->output_multiple_alignments, VALUE_TYPE_BOOL, "Z", "secondary", "0", "If specified, all (secondary) alignments within (-F FLT) will be output to a file. Otherwise, only one alignment will be output.", 0, "Algorithmic options");
 //  argparser.AddArgument(&parameters->output_multiple_alignments, VALUE_TYPE_BOOL, "Z", "no-secondary", "1", "If specified, all (secondary) alignments within (-F FLT) will be output to a file. Otherwise, only one alignment will be output.", 0, "Algorithmic options");
-  argparser.AddArgument(&parameters->sensitive_mode, VALUE_TYPE_BOOL, "P", "sensitive", "0", "If false, only one gapped spaced index will be used in region selection. If true, two such indexes (with different shapes) will be used (2x memory-hungry but more powerful for very high error rates).", 0, "Algorithmic options");
+  argparser.AddArgument(&parameters->sensitive_mode, VALUE_TYPE_BOOL, "P", "sensitive", "0", "If false, only one gapped spaced index will be used in region selection. If true, two such indexes (with different shapes) will be used (more powerful for very high error rates). The secondary index shares the reference data with the primary one, so only the seed tables are added to memory.", 0, "Algorithmic options");
+  argparser.AddArgument(&parameters->lazy_secondary, VALUE_TYPE_BOOL, "", "lazy-sec", "0", "In sensitive mode, look up the secondary index only for reads where the primary index alone does not give a clear top region (see --lazy-sec-support and --lazy-sec-margin).", 0, "Algorithmic options");
+  argparser.AddArgument(&parameters->lazy_secondary_support, VALUE_TYPE_DOUBLE, "", "lazy-sec-support", "0.10", "With --lazy-sec, the primary index is conclusive only if the top bin is hit by at least FLT * num_seeds seeds of the read.", 0, "Algorithmic options");
+  argparser.AddArgument(&parameters->lazy_secondary_margin, VALUE_TYPE_DOUBLE, "", "lazy-sec-margin", "0.20", "With --lazy-sec, the primary index is conclusive only if the runner-up bin is lower than the top bin by at least FLT * top_bin.", 0, "Algorithmic options");
   argparser.AddArgument(&parameters->min_bin_percent, VALUE_TYPE_DOUBLE, "", "min-bin-perc", "0.75", "Consider only bins with counts above FLT * max_bin, where max_bin is the count of the top scoring bin.", 0, "Algorithmic options");
+  argparser.AddArgument(&parameters->adaptive_seeds, VALUE_TYPE_BOOL, "", "adaptive-seeds", "0", "In region selection, look up the seeds of a read in passes of decreasing stride, starting with --adaptive-stride, and skip the remaining seeds once the top bin is clearly ahead of the runner-up (see --adaptive-margin). Reduces the seed lookups for long, accurate reads. Uses the dense region selection.", 0, "Algorithmic options");
+  argparser.AddArgument(&parameters->adaptive_seed_stride, VALUE_TYPE_INT64, "", "adaptive-stride", "64", "With --adaptive-seeds, the stride of the first pass of seed lookups. Rounded down to a power of 2 multiple of the k-mer step.", 0, "Algorithmic options");
+  argparser.AddArgument(&parameters->adaptive_seed_margin, VALUE_TYPE_DOUBLE, "", "adaptive-margin", "3.0", "With --adaptive-seeds, the lookups stop once top - second >= FLT * sqrt(top + second), where top and second are the seed counts of the top bin and the runner-up.", 0, "Algorithmic options");
+  argparser.AddArgument(&parameters->region_engine, VALUE_TYPE_STRING, "", "region-engine", "dense", "Implementation of the region selection. All give the same regions. Options are:\n dense - counts the seed hits in bins covering the entire reference.\n sort  - sorts the seed hits, the cost does not depend on the reference length.\n auto  - sort for references up to 100 Mbp where the bins would vastly outnumber the hits (e.g. short reads, viral and bacterial panels), dense otherwise.", 0, "Algorithmic options");
 //  argparser.AddArgument(&parameters->bin_threshold_step, VALUE_TYPE_DOUBLE, "", "bin-step", "0.10", "After a chunk of bins with values above FLT * max_bin is processed, check if there is one extremely dominant region, and stop the search.", 0, "Algorithmic options");
   argparser.AddArgument(&parameters->bin_threshold_step, VALUE_TYPE_DOUBLE, "", "bin-step", "0.25", "After a chunk of bins with values above FLT * max_bin is processed, check if there is one extremely dominant region, and stop the search.", 0, "Algorithmic options");
   argparser.AddArgument(&parameters->min_read_len, VALUE_TYPE_INT64, "", "min-read-len", "80", "If a read is shorter than this, it will be marked as unmapped. This value can be lowered if the reads are known to be accurate.", 0, "Algorithmic options");
 
   argparser.AddArgument(&parameters->num_threads, VALUE_TYPE_INT64, "t", "threads", "-1", "Number of threads to use. If '-1', number of threads will be equal to min(24, num_cores/2).", 0, "Other options");
+  argparser.AddArgument(&parameters->numa_policy, VALUE_TYPE_STRING, "", "numa", "none", "Placement of the index in memory on multi-socket machines. Options are:\n none       - pages are placed on the node which first touches them.\n interleave - pages are interleaved across all NUMA nodes.\n replicate  - one copy of the index per node, mapping threads are bound to the node of their copy.", 0, "Other options");
+  argparser.AddArgument(&parameters->huge_pages, VALUE_TYPE_STRING, "", "huge-pages", "none", "Back the large index arrays with huge pages. Options are:\n none     - regular pages.\n thp      - transparent huge pages (madvise).\n explicit - pages from the reserved pool (vm.nr_hugepages), falls back to thp if the pool is too small.", 0, "Other options");
+  argparser.AddArgument(&parameters->stats_path, VALUE_TYPE_STRING, "", "stats", "", "Path to a JSON file for the statistics of the run: wall-clock latency percentiles of each pipeline stage per read (seed lookup, bin counting, graph, LCSk, filtering, alignment, formatting), and the throughput. The same summary is printed at the end of the run.", 0, "Other options");
+  argparser.AddArgument(&parameters->trace_path, VALUE_TYPE_STRING, "", "trace", "", "Path to a Chrome trace JSON file (chrome://tracing or ui.perfetto.dev) with the spans of every read and of its pipeline stages, per mapping thread. Tracing is off if not specified.", 0, "Other options");
+  argparser.AddArgument(&parameters->trace_buffer_size, VALUE_TYPE_INT64, "", "trace-buffer", "262144", "With --trace, the number of spans kept per thread. When the buffer is full, the oldest spans are overwritten.", 0, "Other options");
+  argparser.AddArgument(&parameters->slow_read_log_path, VALUE_TYPE_STRING, "", "slow-read-log", "", "Path to a FASTQ/FASTA file for the reads which took longer than --slow-read-ms to process. The header of each read holds its stage times, seed hit counts, number of regions and anchors. The file can be given as the reads (-d) to replay only those reads.", 0, "Other options");
+  argparser.AddArgument(&parameters->slow_read_threshold, VALUE_TYPE_DOUBLE, "", "slow-read-ms", "1000", "With --slow-read-log, the wall-clock time of a read (in milliseconds) above which it is logged.", 0, "Other options");
+  argparser.AddArgument(&parameters->perf_counters, VALUE_TYPE_BOOL, "", "perf-counters", "0", "Count the hardware events (cycles, instructions, LLC, L1D, dTLB and branch misses) of every pipeline stage with perf_event_open, and print the totals per stage at the end of the run. If the counters are not permitted (see /proc/sys/kernel/perf_event_paranoid), the mapping runs without them.", 0, "Other options");
+  argparser.AddArgument(&parameters->max_memory, VALUE_TYPE_INT64, "", "max-memory", "0", "Memory budget for mapping, in MB. The read batch size (up to --batch-mb) and the number of threads (up to --threads) are chosen for every batch from the size of the loaded index and the memory used by the reads mapped so far. The per-subsystem memory use is reported at the end. If <= 0, there is no budget.", 0, "Other options");
   argparser.AddArgument(&parameters->verbose_level, VALUE_TYPE_INT64, "v", "verbose", "5", "Verbose level. If equal to 0 nothing except strict output will be placed on stdout.", 0, "Other options");
   argparser.AddArgument(&parameters->start_read, VALUE_TYPE_INT64, "s", "start", "0", "Ordinal number of the read from which to start processing data.", 0, "Other options");
   argparser.AddArgument(&parameters->num_reads_to_process, VALUE_TYPE_INT64, "n", "numreads", "-1", "Number of reads to process per batch. Value of '-1' processes all reads.", 0, "Other options");
@@ -191,6 +213,41 @@ int ProcessArgsGraphMap(int argc, char **argv, ProgramParameters *parameters)
     VerboseShortHelpAndExit(argc, argv);
   }
 
+  if (parameters->numa_policy != "none" && parameters->numa_policy != "interleave" && parameters->numa_policy != "replicate") {
+    fprintf (stderr, "Unknown NUMA policy '%s'!\n\n", parameters->numa_policy.c_str());
+    VerboseShortHelpAndExit(argc, argv);
+  }
+
+  if (parameters->huge_pages != "none" && parameters->huge_pages != "thp" && parameters->huge_pages != "explicit") {
+    fprintf (stderr, "Unknown huge page mode '%s'!\n\n", parameters->huge_pages.c_str());
+    VerboseShortHelpAndExit(argc, argv);
+  }
+
+  if (parameters->region_engine != "auto" && parameters->region_engine != "dense" && parameters->region_engine != "sort") {
+    fprintf (stderr, "Unknown region selection engine '%s'!\n\n", parameters->region_engine.c_str());
+    VerboseShortHelpAndExit(argc, argv);
+  }
+
+  if (parameters->adaptive_seeds == true && parameters->region_engine == "sort") {
+    fprintf (stderr, "Adaptive seeding (--adaptive-seeds) is not supported with the sort-based region selection (--region-engine sort)!\n\n");
+    VerboseShortHelpAndExit(argc, argv);
+  }
+
+  if (parameters->trace_path.size() > 0 && parameters->trace_buffer_size <= 0) {
+    fprintf (stderr, "The trace buffer size (--trace-buffer) needs to be larger than 0!\n\n");
+    VerboseShortHelpAndExit(argc, argv);
+  }
+
+  if (parameters->slow_read_threshold < 0.0) {
+    fprintf (stderr, "The slow read threshold (--slow-read-ms) cannot be negative!\n\n");
+    VerboseShortHelpAndExit(argc, argv);
+  }
+
+  if (parameters->max_memory > 0 && parameters->max_memory < MIN_MAX_MEMORY_MB) {
+    fprintf (stderr, "The memory budget (--max-memory) needs to be at least %d MB!\n\n", MIN_MAX_MEMORY_MB);
+    VerboseShortHelpAndExit(argc, argv);
+  }
+
 #ifndef RELEASE_VERSION
   if (parameters->debug_read >= 0 || parameters->debug_read_by_qname != "") {
     parameters->verbose_level = 9;
@@ -216,7 +273,7 @@ int ProcessArgsOwler(int argc, char **argv, ProgramParameters *parameters)
   ArgumentParser argparser;
 
   argparser.AddArgument(&parameters->reference_path, VALUE_TYPE_STRING, "r", "ref", "", "Path to the reference sequence (fastq or fasta).", 0, "Input/Output options");
-  argparser.AddArgument(&parameters->index_file, VALUE_TYPE_STRING, "i", "index", "", "Path to the index of the reference sequence. If not specified, index is generated in the same folder as the reference file, with .gmidx extension. For non-parsimonious mode, secondary index .gmidxsec is also generated.", 0, "Input/Output options");
+  argparser.AddArgument(&parameters->index_file, VALUE_TYPE_STRING, "i", "index", "", "Path to the index of the reference sequence. If not specified, index is generated in the same folder as the reference file, with .gmidx extension. For non-parsimonious mode, secondary index .gmidxsec (seed tables only, without the reference data) is also generated.", 0, "Input/Output options");
   argparser.AddArgument(&parameters->reads_path, VALUE_TYPE_STRING, "d", "reads", "", "Path to the reads file.", 0, "Input/Output options");
   argparser.AddArgument(&parameters->out_sam_path, VALUE_TYPE_STRING, "o", "out", "", "Path to the output file that will be generated.", 0, "Input/Output options");
   argparser.AddArgument(&parameters->infmt, VALUE_TYPE_STRING, "K", "in-fmt", "auto", "Format in which to input reads. Options are:\n auto  - Determines the format automatically from file extension.\n fastq - Loads FASTQ or FASTA files.\n fasta - Loads FASTQ or FASTA files.\n gfa   - Graphical Fragment Assembly format.\n sam   - Sequence Alignment/Mapping format.", 0, "Input/Output options");
@@ -228,6 +285,7 @@ int ProcessArgsOwler(int argc, char **argv, ProgramParameters *parameters)
   argparser.AddArgument(&parameters->error_rate, VALUE_TYPE_FLOAT, "e", "error-rate", "0.45", "Approximate error rate of the input read sequences.", 0, "Algorithmic options");
   argparser.AddArgument(&parameters->max_num_hits, VALUE_TYPE_INT64, "", "max-hits", "0", "Maximum allowed number of hits per seed. If 0, all seeds will be used. If < 0, threshold will be calculated automatically.", 0, "Algorithmic options");
   argparser.AddArgument(&parameters->min_read_len, VALUE_TYPE_INT64, "", "min-read-len", "80", "If a read is shorter than this, it will be skipped. This value can be lowered if the reads are known to be accurate.", 0, "Algorithmic options");
+  argparser.AddArgument(&parameters->minimizer_window, VALUE_TYPE_INT64, "w", "minimizer-window", "0", "If > 1, only the (w,k)-minimizers of the spaced seeds are indexed and looked up, where w is the given window length. This reduces the index size and the number of seed hits at a small cost in sensitivity. The sampled index is stored separately from the dense one. Value <= 1 uses all seeds.", 0, "Algorithmic options");
 
   argparser.AddArgument(&parameters->num_threads, VALUE_TYPE_INT64, "t", "threads", "-1", "Number of threads to use. If '-1', number of threads will be equal to min(24, num_cores/2).", 0, "Other options");
   argparser.AddArgument(&parameters->verbose_level, VALUE_TYPE_INT64, "v", "verbose", "5", "Verbose level. If equal to 0 nothing except strict output will be placed on stdout.", 0, "Other options");
@@ -367,7 +425,7 @@ int ProcessArgsDaemon(int argc, char **argv, ProgramParameters *parameters)
 //  argparser.AddCompositeArgument("sensitive", "-a gotoh -w sg -M 5 -X 4 -G 8 -E 6");
 
   argparser.AddArgument(&parameters->reference_path, VALUE_TYPE_STRING, "r", "ref", "", "Path to the reference sequence (fastq or fasta).", 0, "Input/Output options");
-  argparser.AddArgument(&parameters->index_file, VALUE_TYPE_STRING, "i", "index", "", "Path to the index of the reference sequence. If not specified, index is generated in the same folder as the reference file, with .gmidx extension. For non-parsimonious mode, secondary index .gmidxsec is also generated.", 0, "Input/Output options");
+  argparser.AddArgument(&parameters->index_file, VALUE_TYPE_STRING, "i", "index", "", "Path to the index of the reference sequence. If not specified, index is generated in the same folder as the reference file, with .gmidx extension. For non-parsimonious mode, secondary index .gmidxsec (seed tables only, without the reference data) is also generated.", 0, "Input/Output options");
 //  argparser.AddArgument(&parameters->reads_path, VALUE_TYPE_STRING, "d", "reads", "", "Path to the reads file.", 0, "Input/Output options");
 //  argparser.AddArgument(&parameters->out_sam_path, VALUE_TYPE_STRING, "o", "out", "", "Path to the output file that will be generated.", 0, "Input/Output options");
   argparser.AddArgument(&parameters->daemon_in_path, VALUE_TYPE_STRING, "", "daemon-in-path", "", "Input folder which will be monitored by the daemon.", 0, "Input/Output options");
@@ -380,6 +438,12 @@ int ProcessArgsDaemon(int argc, char **argv, ProgramParameters *parameters)
   argparser.AddArgument(&parameters->outfmt, VALUE_TYPE_STRING, "L", "out-fmt", "sam", "Format in which to output results. Options are:\n sam  - Standard SAM output (in normal and '-w overlap' modes).\n m5   - BLASR M5 format.", 0, "Input/Output options");
   argparser.AddArgument(&parameters->calc_only_index, VALUE_TYPE_BOOL, "I", "index-only", "0", "Build only the index from the given reference and exit. If not specified, index will automatically be built if it does not exist, or loaded from file otherwise.", 0, "Input/Output options");
   argparser.AddArgument(&parameters->rebuild_index, VALUE_TYPE_BOOL, "", "rebuild-index", "0", "Rebuild index even if it already exists in given path.", 0, "Input/Output options");
+  argparser.AddArgument(&parameters->pack_reference, VALUE_TYPE_BOOL, "", "pack-ref", "0", "Keep the reference 2-bit packed in memory, and unpack only the regions needed for alignment. Reduces the memory used by the reference sequences by about 8x, at a small cost in speed.", 0, "Input/Output options");
+  argparser.AddArgument(&parameters->index_shard_size, VALUE_TYPE_INT64, "", "shard-size", "0", "Split the index into shards of at most INT Mbp of reference sequences each. Shards are built in parallel and stored in separate files (<index>.shardN). If 0, the index is split only if the reference is too large for 32-bit positions. If < 0, the index is never split.", 0, "Input/Output options");
+  argparser.AddArgument(&parameters->index_build_memory, VALUE_TYPE_INT64, "", "build-mem", "0", "Limit the memory used for building the index to INT MB. If the index would not fit, it is built in two passes using temporary files next to the index file. The generated index is the same. If <= 0, there is no limit.", 0, "Input/Output options");
+  argparser.AddArgument(&parameters->append_reference_path, VALUE_TYPE_STRING, "", "append-ref", "", "Path to new reference sequences which will be appended to the existing index (-i) as a new segment, without rebuilding the index. The new sequences are then mapped to together with the existing ones.", 0, "Input/Output options");
+  argparser.AddArgument(&parameters->index_max_segments, VALUE_TYPE_INT64, "", "max-segments", "8", "With --append-ref or --compact-index, if the index consists of more than INT segments, consecutive small segments are merged up to the length of the longest existing segment, after all reads are mapped (or right after --append-ref when only building the index), within the --build-mem and --max-memory limits. If <= 0, segments are never merged.", 0, "Input/Output options");
+  argparser.AddArgument(&parameters->compact_index, VALUE_TYPE_BOOL, "", "compact-index", "0", "Merge the index segments (see --max-segments) after all reads are mapped, also without --append-ref.", 0, "Input/Output options");
   argparser.AddArgument(&parameters->output_in_original_order, VALUE_TYPE_BOOL, "u", "ordered", "0", "SAM alignments will be output after the processing has finished, in the order of input reads.", 0, "Input/Output options");
   argparser.AddArgument(&parameters->batch_size_in_mb, VALUE_TYPE_INT64, "B", "batch-mb", "1024", "Reads will be loaded in batches of the size specified in megabytes. Value <= 0 loads the entire file.", 0, "Input/Output options");
   //    argparser.AddArgument(&parameters->reads_folder, VALUE_TYPE_STRING, "D", "readsfolder", "", "Path to a folder containing read files (in fastq or fasta format) to process. Cannot be used in combination with '-d' or '-o'.", 0, "Input/Output options");
@@ -426,13 +490,29 @@ int ProcessArgsDaemon(int argc, char **argv, ProgramParameters *parameters)
   argparser.AddArgument(&parameters->margin_for_ambiguity, VALUE_TYPE_FLOAT, "F", "ambiguity", "0.02", "All mapping positions within the given fraction of the top score will be counted for ambiguity (mapping quality). Value of 0.0 counts only identical mappings.", 0, "Algorithmic options");
   argparser.AddArgument(&parameters->output_multiple_alignments, VALUE_TYPE_BOOL, "Z", "secondary", "0", "If specified, all (secondary) alignments within (-F FLT) will be output to a file. Otherwise, only one alignment will be output.", 0, "Algorithmic options");
 //  argparser.AddArgument(&parameters->output_multiple_alignments, VALUE_TYPE_BOOL, "Z", "no-secondary", "1", "If specified, all (secondary) alignments within (-F FLT) will be output to a file. Otherwise, only one alignment will be output.", 0, "Algorithmic options");
-  argparser.AddArgument(&parameters->sensitive_mode, VALUE_TYPE_BOOL, "P", "sensitive", "0", "If false, only one gapped spaced index will be used in region selection. If true, two such indexes (with different shapes) will be used (2x memory-hungry but more powerful for very high error rates).", 0, "Algorithmic options");
+  argparser.AddArgument(&parameters->sensitive_mode, VALUE_TYPE_BOOL, "P", "sensitive", "0", "If false, only one gapped spaced index will be used in region selection. If true, two such indexes (with different shapes) will be used (more powerful for very high error rates). The secondary index shares the reference data with the primary one, so only the seed tables are added to memory.", 0, "Algorithmic options");
+  argparser.AddArgument(&parameters->lazy_secondary, VALUE_TYPE_BOOL, "", "lazy-sec", "0", "In sensitive mode, look up the secondary index only for reads where the primary index alone does not give a clear top region (see --lazy-sec-support and --lazy-sec-margin).", 0, "Algorithmic options");
+  argparser.AddArgument(&parameters->lazy_secondary_support, VALUE_TYPE_DOUBLE, "", "lazy-sec-support", "0.10", "With --lazy-sec, the primary index is conclusive only if the top bin is hit by at least FLT * num_seeds seeds of the read.", 0, "Algorithmic options");
+  argparser.AddArgument(&parameters->lazy_secondary_margin, VALUE_TYPE_DOUBLE, "", "lazy-sec-margin", "0.20", "With --lazy-sec, the primary index is conclusive only if the runner-up bin is lower than the top bin by at least FLT * top_bin.", 0, "Algorithmic options");
   argparser.AddArgument(&parameters->min_bin_percent, VALUE_TYPE_DOUBLE, "", "min-bin-perc", "0.75", "Consider only bins with counts above FLT * max_bin, where max_bin is the count of the top scoring bin.", 0, "Algorithmic options");
+  argparser.AddArgument(&parameters->adaptive_seeds, VALUE_TYPE_BOOL, "", "adaptive-seeds", "0", "In region selection, look up the seeds of a read in passes of decreasing stride, starting with --adaptive-stride, and skip the remaining seeds once the top bin is clearly ahead of the runner-up (see --adaptive-margin). Reduces the seed lookups for long, accurate reads. Uses the dense region selection.", 0, "Algorithmic options");
+  argparser.AddArgument(&parameters->adaptive_seed_stride, VALUE_TYPE_INT64, "", "adaptive-stride", "64", "With --adaptive-seeds, the stride of the first pass of seed lookups. Rounded down to a power of 2 multiple of the k-mer step.", 0, "Algorithmic options");
+  argparser.AddArgument(&parameters->adaptive_seed_margin, VALUE_TYPE_DOUBLE, "", "adaptive-margin", "3.0", "With --adaptive-seeds, the lookups stop once top - second >= FLT * sqrt(top + second), where top and second are the seed counts of the top bin and the runner-up.", 0, "Algorithmic options");
+  argparser.AddArgument(&parameters->region_engine, VALUE_TYPE_STRING, "", "region-engine", "dense", "Implementation of the region selection. All give the same regions. Options are:\n dense - counts the seed hits in bins covering the entire reference.\n sort  - sorts the seed hits, the cost does not depend on the reference length.\n auto  - sort for references up to 100 Mbp where the bins would vastly outnumber the hits (e.g. short reads, viral and bacterial panels), dense otherwise.", 0, "Algorithmic options");
 //  argparser.AddArgument(&parameters->bin_threshold_step, VALUE_TYPE_DOUBLE, "", "bin-step", "0.10", "After a chunk of bins with values above FLT * max_bin is processed, check if there is one extremely dominant region, and stop the search.", 0, "Algorithmic options");
   argparser.AddArgument(&parameters->bin_threshold_step, VALUE_TYPE_DOUBLE, "", "bin-step", "0.25", "After a chunk of bins with values above FLT * max_bin is processed, check if there is one extremely dominant region, and stop the search.", 0, "Algorithmic options");
   argparser.AddArgument(&parameters->min_read_len, VALUE_TYPE_INT64, "", "min-read-len", "80", "If a read is shorter than this, it will be marked as unmapped. This value can be lowered if the reads are known to be accurate.", 0, "Algorithmic options");
 
   argparser.AddArgument(&parameters->num_threads, VALUE_TYPE_INT64, "t", "threads", "-1", "Number of threads to use. If '-1', number of threads will be equal to min(24, num_cores/2).", 0, "Other options");
+  argparser.AddArgument(&parameters->numa_policy, VALUE_TYPE_STRING, "", "numa", "none", "Placement of the index in memory on multi-socket machines. Options are:\n none       - pages are placed on the node which first touches them.\n interleave - pages are interleaved across all NUMA nodes.\n replicate  - one copy of the index per node, mapping threads are bound to the node of their copy.", 0, "Other options");
+  argparser.AddArgument(&parameters->huge_pages, VALUE_TYPE_STRING, "", "huge-pages", "none", "Back the large index arrays with huge pages. Options are:\n none     - regular pages.\n thp      - transparent huge pages (madvise).\n explicit - pages from the reserved pool (vm.nr_hugepages), falls back to thp if the pool is too small.", 0, "Other options");
+  argparser.AddArgument(&parameters->stats_path, VALUE_TYPE_STRING, "", "stats", "", "Path to a JSON file for the statistics of the run: wall-clock latency percentiles of each pipeline stage per read (seed lookup, bin counting, graph, LCSk, filtering, alignment, formatting), and the throughput. The same summary is printed at the end of the run.", 0, "Other options");
+  argparser.AddArgument(&parameters->trace_path, VALUE_TYPE_STRING, "", "trace", "", "Path to a Chrome trace JSON file (chrome://tracing or ui.perfetto.dev) with the spans of every read and of its pipeline stages, per mapping thread. Tracing is off if not specified.", 0, "Other options");
+  argparser.AddArgument(&parameters->trace_buffer_size, VALUE_TYPE_INT64, "", "trace-buffer", "262144", "With --trace, the number of spans kept per thread. When the buffer is full, the oldest spans are overwritten.", 0, "Other options");
+  argparser.AddArgument(&parameters->slow_read_log_path, VALUE_TYPE_STRING, "", "slow-read-log", "", "Path to a FASTQ/FASTA file for the reads which took longer than --slow-read-ms to process. The header of each read holds its stage times, seed hit counts, number of regions and anchors. The file can be given as the reads (-d) to replay only those reads.", 0, "Other options");
+  argparser.AddArgument(&parameters->slow_read_threshold, VALUE_TYPE_DOUBLE, "", "slow-read-ms", "1000", "With --slow-read-log, the wall-clock time of a read (in milliseconds) above which it is logged.", 0, "Other options");
+  argparser.AddArgument(&parameters->perf_counters, VALUE_TYPE_BOOL, "", "perf-counters", "0", "Count the hardware events (cycles, instructions, LLC, L1D, dTLB and branch misses) of every pipeline stage with perf_event_open, and print the totals per stage at the end of the run. If the counters are not permitted (see /proc/sys/kernel/perf_event_paranoid), the mapping runs without them.", 0, "Other options");
+  argparser.AddArgument(&parameters->max_memory, VALUE_TYPE_INT64, "", "max-memory", "0", "Memory budget for mapping, in MB. The read batch size (up to --batch-mb) and the number of threads (up to --threads) are chosen for every batch from the size of the loaded index and the memory used by the reads mapped so far. The per-subsystem memory use is reported at the end. If <= 0, there is no budget.", 0, "Other options");
   argparser.AddArgument(&parameters->verbose_level, VALUE_TYPE_INT64, "v", "verbose", "5", "Verbose level. If equal to 0 nothing except strict output will be placed on stdout.", 0, "Other options");
   argparser.AddArgument(&parameters->start_read, VALUE_TYPE_INT64, "s", "start", "0", "Ordinal number of the read from which to start processing data.", 0, "Other options");
   argparser.AddArgument(&parameters->num_reads_to_process, VALUE_TYPE_INT64, "n", "numreads", "-1", "Number of reads to process per batch. Value of '-1' processes all reads.", 0, "Other options");
@@ -545,6 +625,41 @@ int ProcessArgsDaemon(int argc, char **argv, ProgramParameters *parameters)
     VerboseShortHelpAndExit(argc, argv);
   }
 
+  if (parameters->numa_policy != "none" && parameters->numa_policy != "interleave" && parameters->numa_policy != "replicate") {
+    fprintf (stderr, "Unknown NUMA policy '%s'!\n\n", parameters->numa_policy.c_str());
+    VerboseShortHelpAndExit(argc, argv);
+  }
+
+  if (parameters->huge_pages != "none" && parameters->huge_pages != "thp" && parameters->huge_pages != "explicit") {
+    fprintf (stderr, "Unknown huge page mode '%s'!\n\n", parameters->huge_pages.c_str());
+    VerboseShortHelpAndExit(argc, argv);
+  }
+
+  if (parameters->region_engine != "auto" && parameters->region_engine != "dense" && parameters->region_engine != "sort") {
+    fprintf (stderr, "Unknown region selection engine '%s'!\n\n", parameters->region_engine.c_str());
+    VerboseShortHelpAndExit(argc, argv);
+  }
+
+  if (parameters->adaptive_seeds == true && parameters->region_engine == "sort") {
+    fprintf (stderr, "Adaptive seeding (--adaptive-seeds) is not supported with the sort-based region selection (--region-engine sort)!\n\n");
+    VerboseShortHelpAndExit(argc, argv);
+  }
+
+  if (parameters->trace_path.size() > 0 && parameters->trace_buffer_size <= 0) {
+    fprintf (stderr, "The trace buffer size (--trace-buffer) needs to be larger than 0!\n\n");
+    VerboseShortHelpAndExit(argc, argv);
+  }
+
+  if (parameters->slow_read_threshold < 0.0) {
+    fprintf (stderr, "The slow read threshold (--slow-read-ms) cannot be negative!\n\n");
+    VerboseShortHelpAndExit(argc, argv);
+  }
+
+  if (parameters->max_memory > 0 && parameters->max_memory < MIN_MAX_MEMORY_MB) {
+    fprintf (stderr, "The memory budget (--max-memory) needs to be at least %d MB!\n\n", MIN_MAX_MEMORY_MB);
+    VerboseShortHelpAndExit(argc, argv);
+  }
+
 #ifndef RELEASE_VERSION
   if (parameters->debug_read >= 0 || parameters->debug_read_by_qname != "") {
     parameters->verbose_level = 9;
@@ -613,6 +728,7 @@ void VerboseProgramParameters(ProgramParameters *parameters) {
   fprintf (stderr, "%soutput_in_original_order = %s\n", line_prefix.c_str(), (parameters->output_in_original_order == true)?"true":"false");
   fprintf (stderr, "%sprocess_reads_from_folder = %s\n", line_prefix.c_str(), (parameters->process_reads_from_folder == true)?"true":"false");
   fprintf (stderr, "%sbatch_size_in_mb = %ld\n", line_prefix.c_str(), (parameters->batch_size_in_mb));
+  fprintf (stderr, "%smax_memory = %ld\n", line_prefix.c_str(), (parameters->max_memory));
 
   fprintf (stderr, "%sdebug_read = %ld\n", line_prefix.c_str(), parameters->debug_read);
   fprintf (stderr, "%sdebug_read_by_qname = %s\n", line_prefix.c_str(), parameters->debug_read_by_qname.c_str());
@@ -624,6 +740,9 @@ void VerboseProgramParameters(ProgramParameters *parameters) {
   fprintf (stderr, "%soutput_multiple_alignments = %s\n", line_prefix.c_str(), (parameters->output_multiple_alignments == true)?"true":"false");
 
   fprintf (stderr, "%ssensitive_mode = %s\n", line_prefix.c_str(), (parameters->sensitive_mode == true)?"true":"false");
+  fprintf (stderr, "%slazy_secondary = %s\n", line_prefix.c_str(), (parameters->lazy_secondary == true)?"true":"false");
+  fprintf (stderr, "%slazy_secondary_support = %f\n", line_prefix.c_str(), parameters->lazy_secondary_support);
+  fprintf (stderr, "%slazy_secondary_margin = %f\n", line_prefix.c_str(), parameters->lazy_secondary_margin);
 
   fprintf (stderr, "%sevalue_threshold = %f\n", line_prefix.c_str(), parameters->evalue_threshold);
   fprintf (stderr, "%smapq_threshold = %ld\n", line_prefix.c_str(), parameters->mapq_threshold);
@@ -35,6 +35,8 @@
   "  (2) University of Zagreb, Faculty of Electrical Engineering and Computing\n" \
   "  (3) Genome Institute of Singapore, A*STAR, Singapore\n"
 
+#define MIN_MAX_MEMORY_MB 256     // Smallest accepted --max-memory. Below this, the budget cannot hold even a small read batch.
+
 struct ProgramParameters {
   std::string subprogram = "";
 
@@ -63,6 +65,7 @@ struct ProgramParameters {
 
   bool output_in_original_order = false;    // 'u' If true, SAM alignments will be output after the processing has finished, in the order of input reads.
   int64_t kmer_step = 1;              // 'w' The number of bases to skip between beginnings of every adjecent kmer.
+  int64_t minimizer_window = 0;       // 'w' (Owler) If > 1, only (w,k)-minimizers of the spaced seeds are indexed and looked up, where w is this value. Otherwise all positions are used.
 
   std::string reads_folder = "";            // 'D', The path to a folder that contains reads, in FASTA or FASTQ format. Intended for batch processing.
   std::string output_folder = "";           // 'O', The path to the output folder for batch processing.
@@ -85,6 +88,9 @@ struct ProgramParameters {
   float margin_for_ambiguity = 0.05;  // All mapping positions within the given fraction of the top score will be counted for ambiguity (mapping quality). Value of 0.0f counts only identical mappings.
   bool output_multiple_alignments = false;  // If 0, only one best alignment will be output. Otherwise, all alignments within margin_for_ambiguity will be output to a file.
   bool sensitive_mode = false; // If false, only one index will be used, but the memory consumption will be reduced by half. If false, sensitive and memory-hungry mode will be used.
+  bool lazy_secondary = false;          // In sensitive mode, look up the secondary index only if the region selection with the primary index is inconclusive.
+  double lazy_secondary_support = 0.10; // Primary is conclusive if the top bin is hit by at least this fraction of the read's seeds...
+  double lazy_secondary_margin = 0.20;  // ...and the runner-up bin is lower than the top bin by at least this fraction of the top bin.
   int64_t min_num_anchor_bases = 12;
   double evalue_threshold = -1;
   int64_t mapq_threshold = 0;
@@ -98,6 +104,10 @@ struct ProgramParameters {
   int64_t min_read_len = 80;      // If a read is shorter than this, it will be marked as unmapped.
 
   double min_bin_percent = 0.75f;
+  bool adaptive_seeds = false;            // Look up the seeds of a read in region selection in passes of decreasing stride, and stop once the top bin is confident.
+  int64_t adaptive_seed_stride = 64;      // Stride of the first pass of adaptive seeding (rounded down to kmer_step * 2^n).
+  double adaptive_seed_margin = 3.0;      // Adaptive seeding stops when top - second >= margin * sqrt(top + second).
+  std::string region_engine = "dense";    // Region selection engine: "dense" (bins over the reference), "sort" (sorted seed hits) or "auto".
   double bin_threshold_step = 0.10f;
 
   bool use_spliced = false;
@@ -106,6 +116,21 @@ struct ProgramParameters {
   bool overlapper = false;
   bool no_self_hits = false;
   bool rebuild_index = false;
+  bool pack_reference = false;    // If true, the reference sequences are held 2-bit packed in memory (reverse strand derived on the fly) instead of one byte per base.
+  int64_t index_shard_size = 0;   // Max. reference length per index shard, in Mbp. If 0, shard only references which do not fit 32-bit positions. If < 0, never shard.
+  int64_t index_build_memory = 0; // Memory limit for building the index, in MB. If the in-memory build would need more, the index is built on disk. If <= 0, no limit.
+  std::string append_reference_path = "";  // Sequences to append to an existing index as a new segment, without rebuilding it.
+  int64_t index_max_segments = 8;           // With append_reference_path or compact_index, an index with more segments than this is compacted. If <= 0, never compact.
+  bool compact_index = false;               // If true, the index segments are compacted after mapping even without append_reference_path.
+  std::string numa_policy = "none";         // Placement of the index arrays on NUMA nodes: "none" (first touch), "interleave" or "replicate".
+  std::string huge_pages = "none";          // Huge page backing of the index arrays: "none", "thp" or "explicit".
+  std::string stats_path = "";             // If specified, the per-stage latency histograms and the throughput of the run are written here as JSON.
+  std::string trace_path = "";             // If specified, spans of every read and its pipeline stages are written here as Chrome trace JSON.
+  int64_t trace_buffer_size = 262144;       // Number of spans kept per thread for the trace (the oldest are overwritten).
+  std::string slow_read_log_path = "";     // If specified, reads which took longer than slow_read_threshold are written here, with their stage times.
+  double slow_read_threshold = 1000.0;      // In milliseconds of wall-clock time, for the whole read.
+  bool perf_counters = false;               // Count hardware events (cycles, cache/TLB/branch misses) per pipeline stage with perf_event_open.
+  int64_t max_memory = 0;                   // Memory budget of the mapping, in MB. The batch size and the number of threads are chosen to stay within it. If <= 0, no budget.
 
   double max_error_rate = 1.0f;
   double max_indel_error_rate = 1.0f;